@@ -22,6 +22,7 @@ output_init();
 
 static unsigned int flow_count = 10000;
 static unsigned int file_count = 2;
+static unsigned int load_flags = LOAD_DEFAULT;
 
 static int64_t
 flowsplit_packet(struct peak_tracks *track, void *buf,
@@ -50,21 +51,21 @@ static void
 usage(void)
 {
 	fprintf(stderr,
-	    "usage: flowsplit [-f flow_count] [-n file_count] file\n");
+	    "usage: flowsplit [-r] [-f flow_count] [-n file_count] file\n");
 	exit(EXIT_FAILURE);
 }
 
 int
 main(int argc, char **argv)
 {
+	struct peak_store **stores;
 	struct peak_tracks *track;
 	struct peak_load *trace;
 	unsigned int i;
 	char *dot_fn;
-	int *fds;
 	int c;
 
-	while ((c = getopt(argc, argv, "n:f:")) != -1) {
+	while ((c = getopt(argc, argv, "n:f:r")) != -1) {
 		switch (c) {
 		case 'f':
 			flow_count = atoi(optarg);
@@ -72,6 +73,9 @@ main(int argc, char **argv)
 		case 'n':
 			file_count = atoi(optarg);
 			break;
+		case 'r':
+			load_flags |= LOAD_THREAD;
+			break;
 		default:
 			usage();
 			/* NOTREACHED */
@@ -86,7 +90,7 @@ main(int argc, char **argv)
 		/* NOTREACHED */
 	}
 
-	trace = peak_load_init(argv[0]);
+	trace = peak_load_open(argv[0], load_flags);
 	if (!trace) {
 		panic("cannot init file loader\n");
 	}
@@ -96,9 +100,9 @@ main(int argc, char **argv)
 		panic("cannot init flow tracker\n");
 	}
 
-	fds = reallocarray(NULL, file_count, sizeof(*fds));
-	if (!fds) {
-		panic("cannot allocate file descriptor memory\n");
+	stores = reallocarray(NULL, file_count, sizeof(*stores));
+	if (!stores) {
+		panic("cannot allocate output file memory\n");
 	}
 
 	if (!file_count) {
@@ -119,8 +123,10 @@ main(int argc, char **argv)
 		snprintf(split_fn, sizeof(split_fn), "%s_%u.pcap",
 		    argv[0], i);
 
-		fds[i] = peak_store_init(split_fn);
-		if (fds[i] < 0) {
+		/* batch records, but keep many outputs affordable */
+		stores[i] = peak_store_open(split_fn, MAX(64 * 1024,
+		    MIN(1024 * 1024, 64 * 1024 * 1024 / file_count)));
+		if (!stores[i]) {
 			panic("cannot open an output file\n");
 		}
 	}
@@ -133,17 +139,21 @@ main(int argc, char **argv)
 				continue;
 			}
 
-			peak_store_packet(fds[ret % file_count],
+			if (!peak_store_write(stores[ret % file_count],
 			    trace->buf, trace->len, trace->ts.tv_sec,
-			    trace->ts.tv_usec);
+			    trace->ts.tv_usec)) {
+				panic("cannot write an output file\n");
+			}
 		} while (peak_load_packet(trace));
 	}
 
 	for (i = 0; i < file_count; ++i) {
-		peak_store_exit(fds[i]);
+		if (!peak_store_close(stores[i])) {
+			panic("cannot finish an output file\n");
+		}
 	}
 
-	free(fds);
+	free(stores);
 
 	peak_track_exit(track);
 	peak_load_exit(trace);
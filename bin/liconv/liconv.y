@@ -0,0 +1,563 @@
+%{
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/stat.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <peak.h>
+#include <limits.h>
+#include <unistd.h>
+
+#define YYERROR_VERBOSE	/* yacc(1) compliance */
+
+output_init();
+
+#define LICONV_STRLEN	256
+
+struct li_bytes {
+	uint8_t buf[LICONV_STRLEN];
+	size_t len;
+};
+
+void	yyerror(const char *) __dead;
+int	yyparse(void);
+int	yylex(void);
+
+static FILE *yyin;
+static const char *yyfile;
+static unsigned int yyline;
+
+void yyerror(const char *str)
+{
+	perr("%s:%u: %s\n", yyfile, yyline, str);
+	exit(1);
+}
+
+static struct peak_li_app *li_apps;
+static struct peak_li_sig *li_sigs;
+static unsigned int li_app_count;
+static unsigned int li_sig_count;
+
+static struct peak_li_sig li_sig;
+static unsigned int li_proto_count;
+static unsigned int li_port_count;
+static struct li_bytes li_value;
+static struct li_bytes li_mask;
+static unsigned int li_min;
+static unsigned int li_max;
+
+static void
+li_copy(char *dst, size_t size, const struct li_bytes *src, const char *what)
+{
+	if (src->len >= size || memchr(src->buf, '\0', src->len)) {
+		perr("%s:%u: bad %s `%.*s'\n", yyfile, yyline, what,
+		    (int)src->len, src->buf);
+		exit(1);
+	}
+
+	memcpy(dst, src->buf, src->len);
+	dst[src->len] = '\0';
+}
+
+static unsigned int
+li_app_number(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < li_app_count; ++i) {
+		if (!strcasecmp(name, li_apps[i].name)) {
+			return (li_apps[i].number);
+		}
+	}
+
+	return (peak_li_number(name));
+}
+
+static void
+li_app_add(const struct li_bytes *name, const struct li_bytes *pretty,
+    const struct li_bytes *cat, const struct li_bytes *desc)
+{
+	struct peak_li_app *app;
+
+	li_apps = reallocarray(li_apps, li_app_count + 1, sizeof(*app));
+	if (!li_apps) {
+		perr("could not allocate memory\n");
+		exit(1);
+	}
+
+	app = &li_apps[li_app_count];
+
+	memset(app, 0, sizeof(*app));
+
+	li_copy(app->name, sizeof(app->name), name, "name");
+	li_copy(app->pretty, sizeof(app->pretty), pretty, "pretty name");
+	li_copy(app->cat, sizeof(app->cat), cat, "category");
+	li_copy(app->desc, sizeof(app->desc), desc, "description");
+
+	if (li_app_number(app->name) != LI_UNKNOWN) {
+		perr("%s:%u: duplicated application `%s'\n", yyfile,
+		    yyline, app->name);
+		exit(1);
+	}
+
+	app->number = LI_MAX + li_app_count++;
+}
+
+static void
+li_sig_begin(const struct li_bytes *name)
+{
+	char buf[sizeof(li_apps->name)];
+
+	memset(&li_sig, 0, sizeof(li_sig));
+	memset(&li_value, 0, sizeof(li_value));
+	memset(&li_mask, 0, sizeof(li_mask));
+
+	li_sig.proto[0] = li_sig.proto[1] = LI_SIG_ANY;
+	li_proto_count = 0;
+	li_port_count = 0;
+	li_min = 0;
+	li_max = UINT16_MAX;
+
+	li_copy(buf, sizeof(buf), name, "name");
+
+	li_sig.number = li_app_number(buf);
+	if (li_sig.number <= LI_UNDEFINED) {
+		perr("%s:%u: unknown application `%s'\n", yyfile,
+		    yyline, buf);
+		exit(1);
+	}
+}
+
+static void
+li_sig_end(void)
+{
+	uint8_t value[LI_SIG_LEN], mask[LI_SIG_LEN];
+	unsigned int i;
+
+	if (li_value.len > LI_SIG_LEN || li_mask.len > li_value.len) {
+		yyerror("pattern or mask too long");
+	}
+
+	memset(value, 0, sizeof(value));
+	memset(mask, 0, sizeof(mask));
+
+	for (i = 0; i < li_value.len; ++i) {
+		/* default mask matches all bytes of the pattern */
+		mask[i] = i < li_mask.len ? li_mask.buf[i] : 0xFF;
+		value[i] = li_value.buf[i] & mask[i];
+	}
+
+	memcpy(li_sig.value, value, sizeof(value));
+	memcpy(li_sig.mask, mask, sizeof(mask));
+
+	/* pattern must be fully inside the payload */
+	li_min = MAX(li_min, li_sig.offset + li_value.len);
+	if (li_min > li_max || li_max > UINT16_MAX) {
+		yyerror("bad length constraint");
+	}
+
+	li_sig.min = li_min;
+	li_sig.max = li_max;
+
+	li_sigs = reallocarray(li_sigs, li_sig_count + 1, sizeof(li_sig));
+	if (!li_sigs) {
+		perr("could not allocate memory\n");
+		exit(1);
+	}
+
+	li_sigs[li_sig_count++] = li_sig;
+}
+
+static void
+li_sig_proto(unsigned int proto)
+{
+	if (li_proto_count >= lengthof(li_sig.proto)) {
+		yyerror("too many protocols");
+	}
+
+	if (proto > LI_SIG_ANY) {
+		yyerror("bad protocol");
+	}
+
+	li_sig.proto[li_proto_count++] = proto;
+	if (li_proto_count == 1) {
+		/* a single protocol occupies both slots */
+		li_sig.proto[1] = proto;
+	}
+}
+
+static void
+li_sig_port(unsigned int port)
+{
+	if (li_port_count >= lengthof(li_sig.port)) {
+		yyerror("too many ports");
+	}
+
+	if (!port || port > UINT16_MAX) {
+		yyerror("bad port");
+	}
+
+	li_sig.port[li_port_count++] = port;
+}
+%}
+%union {
+	struct li_bytes bytes;
+	unsigned int num;
+}
+%token <bytes> STRING BYTES WORD
+%token <num> NUMBER
+%token APP SIG PROTO PORT OFFSET MATCH MASK LENGTH
+%type <bytes> pattern
+%type <num> proto
+%start file
+%%
+file	: /* empty */
+	| file stmt
+	;
+
+stmt	: APP STRING STRING STRING STRING ';' {
+		li_app_add(&$2, &$3, &$4, &$5);
+	}
+	| SIG STRING {
+		li_sig_begin(&$2);
+	} opts ';' {
+		li_sig_end();
+	}
+	;
+
+opts	: /* empty */
+	| opts opt
+	;
+
+opt	: PROTO protos
+	| PORT ports
+	| OFFSET NUMBER {
+		if ($2 > UINT16_MAX - LI_SIG_LEN) {
+			yyerror("bad offset");
+		}
+		li_sig.offset = $2;
+	}
+	| MATCH pattern {
+		li_value = $2;
+	}
+	| MASK pattern {
+		li_mask = $2;
+	}
+	| LENGTH NUMBER {
+		li_min = li_max = $2;
+	}
+	| LENGTH NUMBER '-' {
+		li_min = $2;
+	}
+	| LENGTH NUMBER '-' NUMBER {
+		li_min = $2;
+		li_max = $4;
+	}
+	;
+
+protos	: proto {
+		li_sig_proto($1);
+	}
+	| protos ',' proto {
+		li_sig_proto($3);
+	}
+	;
+
+proto	: NUMBER {
+		$$ = $1;
+	}
+	| WORD {
+		struct protoent *ent;
+
+		$1.buf[$1.len] = '\0';
+
+		if (!strcmp((char *)$1.buf, "any")) {
+			$$ = LI_SIG_ANY;
+		} else if (!strcmp((char *)$1.buf, "tcp")) {
+			$$ = IPPROTO_TCP;
+		} else if (!strcmp((char *)$1.buf, "udp")) {
+			$$ = IPPROTO_UDP;
+		} else if ((ent = getprotobyname((char *)$1.buf))) {
+			$$ = ent->p_proto;
+		} else {
+			yyerror("unknown protocol");
+		}
+	}
+	;
+
+ports	: NUMBER {
+		li_sig_port($1);
+	}
+	| ports ',' NUMBER {
+		li_sig_port($3);
+	}
+	;
+
+pattern	: STRING {
+		$$ = $1;
+	}
+	| BYTES {
+		$$ = $1;
+	}
+	;
+%%
+static const struct {
+	const char *name;
+	int token;
+} keywords[] = {
+	{ "app", APP },
+	{ "length", LENGTH },
+	{ "mask", MASK },
+	{ "match", MATCH },
+	{ "offset", OFFSET },
+	{ "port", PORT },
+	{ "proto", PROTO },
+	{ "sig", SIG },
+};
+
+static void
+lex_append(struct li_bytes *bytes, int c)
+{
+	if (bytes->len >= sizeof(bytes->buf) - 1) {
+		yyerror("token too long");
+	}
+
+	bytes->buf[bytes->len++] = c;
+}
+
+static int
+lex_hex(int c)
+{
+	if (!isxdigit(c)) {
+		yyerror("bad hex digit");
+	}
+
+	return (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+}
+
+static int
+lex_string(struct li_bytes *bytes)
+{
+	int c, d;
+
+	while ((c = getc(yyin)) != '"') {
+		switch (c) {
+		case EOF:
+		case '\n':
+			yyerror("unterminated string");
+			/* NOTREACHED */
+		case '\\':
+			switch ((c = getc(yyin))) {
+			case 'n':
+				c = '\n';
+				break;
+			case 'r':
+				c = '\r';
+				break;
+			case 't':
+				c = '\t';
+				break;
+			case 'x':
+				d = lex_hex(getc(yyin)) << 4;
+				c = d | lex_hex(getc(yyin));
+				break;
+			case '\\':
+			case '"':
+				break;
+			default:
+				yyerror("bad escape sequence");
+				/* NOTREACHED */
+			}
+			/* FALLTHROUGH */
+		default:
+			lex_append(bytes, c);
+			break;
+		}
+	}
+
+	return (STRING);
+}
+
+static int
+lex_bytes(struct li_bytes *bytes)
+{
+	int c;
+
+	/* hex bytes enclosed in pipes, e.g. |16 03 01| */
+	while ((c = getc(yyin)) != '|') {
+		if (c == ' ' || c == '\t') {
+			continue;
+		}
+		lex_append(bytes, (lex_hex(c) << 4) | lex_hex(getc(yyin)));
+	}
+
+	return (BYTES);
+}
+
+int
+yylex(void)
+{
+	struct li_bytes *bytes = &yylval.bytes;
+	unsigned int i;
+	int c;
+
+	bytes->len = 0;
+
+	for (;;) {
+		c = getc(yyin);
+		if (c == '#') {
+			while ((c = getc(yyin)) != '\n' && c != EOF);
+		}
+		if (c == '\n') {
+			++yyline;
+			continue;
+		}
+		if (!isspace(c)) {
+			break;
+		}
+	}
+
+	if (c == EOF) {
+		return (0);
+	} else if (c == '"') {
+		return (lex_string(bytes));
+	} else if (c == '|') {
+		return (lex_bytes(bytes));
+	} else if (isdigit(c)) {
+		unsigned long num = 0;
+
+		do {
+			num = num * 10 + c - '0';
+			if (num > UINT_MAX) {
+				yyerror("number too large");
+			}
+		} while (isdigit(c = getc(yyin)));
+
+		ungetc(c, yyin);
+		yylval.num = num;
+
+		return (NUMBER);
+	} else if (isalpha(c)) {
+		do {
+			lex_append(bytes, tolower(c));
+		} while (isalnum(c = getc(yyin)) || c == '-' || c == '_');
+
+		ungetc(c, yyin);
+		bytes->buf[bytes->len] = '\0';
+
+		for (i = 0; i < lengthof(keywords); ++i) {
+			if (!strcmp((char *)bytes->buf, keywords[i].name)) {
+				return (keywords[i].token);
+			}
+		}
+
+		return (WORD);
+	}
+
+	return (c);
+}
+
+static void
+finalise(const char *plain_fn)
+{
+	struct peak_li_hdr hdr = {
+		.app_count = li_app_count,
+		.sig_count = li_sig_count,
+		.revision = LI_REVISION,
+		.magic = LI_MAGIC,
+		.base = LI_MAX,
+	};
+	char binary_fn[PATH_MAX];
+	size_t len;
+	int fd;
+
+	if (!li_sig_count) {
+		/* don't need output without input */
+		return;
+	}
+
+	/* automatically pick name from first plain config file */
+	snprintf(binary_fn, sizeof(binary_fn), "%s.bin", plain_fn);
+
+	fd = open(binary_fn, O_WRONLY|O_CREAT|O_TRUNC,
+	    S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	if (fd < 0) {
+		perr("output open failed\n");
+		exit(1);
+	}
+
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		perr("header write failed\n");
+		exit(1);
+	}
+
+	len = li_app_count * sizeof(*li_apps);
+	if (len && write(fd, li_apps, len) != (ssize_t)len) {
+		perr("application write failed\n");
+		exit(1);
+	}
+
+	len = li_sig_count * sizeof(*li_sigs);
+	if (write(fd, li_sigs, len) != (ssize_t)len) {
+		perr("signature write failed\n");
+		exit(1);
+	}
+
+	close(fd);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: liconv file ...\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *fn = NULL;
+	int i;
+
+	if (argc <= 1) {
+		usage();
+		/* NOTREACHED */
+	}
+
+	for (i = 1; i < argc; ++i) {
+		FILE *file = fopen(argv[i], "r");
+		if (!file) {
+			perr("could not open file %s\n", argv[i]);
+			return (1);
+		}
+		yyin = file;
+		yyfile = argv[i];
+		yyline = 1;
+		yyparse();
+		fclose(file);
+
+		fn = fn ? : argv[i];
+	}
+
+	finalise(fn);
+
+	free(li_apps);
+	free(li_sigs);
+
+	return (0);
+}
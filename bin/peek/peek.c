@@ -31,8 +31,24 @@ enum {
 	USE_MAX		/* last element */
 };
 
+struct peek_count {
+	uint64_t packets;
+	uint64_t bytes;
+};
+
+struct peek_stats {
+	struct peak_timeval first;
+	struct peak_timeval last;
+	struct peek_count total;
+	struct peek_count dropped;
+	struct peek_count type[UINT8_MAX + 1];
+	struct peek_count app[UINT16_MAX + 1];
+};
+
 static unsigned int use_print[USE_MAX];
 static unsigned int use_count = 0;
+static unsigned int load_flags = LOAD_DEFAULT;
+static unsigned int chunk_count = 0;
 
 static void
 peek_report(const struct peak_packet *packet, const struct peak_track *flow,
@@ -101,17 +117,16 @@ peek_report(const struct peak_packet *packet, const struct peak_track *flow,
 	pout("\n");
 }
 
-static void
-peek_packet(struct peak_tracks *peek, const timeslice_t *timer,
+static struct peak_track *
+peek_flow(struct peak_tracks *peek, struct peak_packet *packet,
     void *buf, unsigned int len, unsigned int type)
 {
-	struct peak_packet stackptr(packet);
 	struct peak_track *flow;
 	struct peak_track _flow;
 
 	if (peak_packet_parse(packet, buf, len, type) || !packet->net_len) {
 		/* here be dragons */
-		return;
+		return (NULL);
 	}
 
 	TRACK_KEY(&_flow, packet);
@@ -130,13 +145,166 @@ peek_packet(struct peak_tracks *peek, const timeslice_t *timer,
 		}
 	}
 
-	peek_report(packet, flow, timer);
+	return (flow);
+}
+
+static void
+peek_packet(struct peak_tracks *peek, const timeslice_t *timer,
+    void *buf, unsigned int len, unsigned int type)
+{
+	struct peak_packet stackptr(packet);
+	struct peak_track *flow;
+
+	flow = peek_flow(peek, packet, buf, len, type);
+	if (flow) {
+		peek_report(packet, flow, timer);
+	}
+}
+
+static void
+peek_count(struct peek_count *count, const unsigned int len)
+{
+	++count->packets;
+	count->bytes += len;
+}
+
+static void
+peek_chunk(struct peak_load *trace, void *arg)
+{
+	struct peak_packet stackptr(packet);
+	struct peek_stats *stats = arg;
+	struct peak_tracks *peek;
+	struct peak_track *flow;
+
+	/* flows are tracked per chunk */
+	peek = peak_track_init(10000, 1);
+	if (!peek) {
+		panic("cannot init flow tracker\n");
+	}
+
+	while (peak_load_packet(trace)) {
+		if (!stats->total.packets) {
+			stats->first = trace->ts;
+		}
+		stats->last = trace->ts;
+
+		peek_count(&stats->total, trace->len);
+
+		flow = peek_flow(peek, packet, trace->buf, trace->len,
+		    trace->ll);
+		if (!flow) {
+			peek_count(&stats->dropped, trace->len);
+			continue;
+		}
+
+		peek_count(&stats->type[packet->net_type], trace->len);
+		peek_count(&stats->app[peak_li_merge(flow->li)],
+		    trace->len);
+	}
+
+	peak_track_exit(peek);
+}
+
+static void
+peek_merge(void *arg, const void *chunk)
+{
+	const struct peek_stats *from = chunk;
+	struct peek_stats *into = arg;
+	unsigned int i;
+
+	if (!from->total.packets) {
+		return;
+	}
+
+	/* chunks arrive in file order */
+	if (!into->total.packets) {
+		into->first = from->first;
+	}
+	into->last = from->last;
+
+	into->total.packets += from->total.packets;
+	into->total.bytes += from->total.bytes;
+	into->dropped.packets += from->dropped.packets;
+	into->dropped.bytes += from->dropped.bytes;
+
+	for (i = 0; i < lengthof(into->type); ++i) {
+		into->type[i].packets += from->type[i].packets;
+		into->type[i].bytes += from->type[i].bytes;
+	}
+
+	for (i = 0; i < lengthof(into->app); ++i) {
+		into->app[i].packets += from->app[i].packets;
+		into->app[i].bytes += from->app[i].bytes;
+	}
+}
+
+static void
+peek_time(const char *name, const struct peak_timeval *tv)
+{
+	const time_t sec = tv->tv_sec;
+	char tsbuf[40];
+	struct tm gmt;
+
+	pout("%s: %s.%06ld\n", name, gmtime_r(&sec, &gmt) &&
+	    strftime(tsbuf, sizeof(tsbuf), OUTPUT_TIME, &gmt) ?
+	    tsbuf : "????", tv->tv_usec);
+}
+
+static void
+peek_summary(const char *file)
+{
+	struct peek_stats *stats;
+	unsigned int i;
+
+	stats = calloc(1, sizeof(*stats));
+	if (!stats) {
+		panic("cannot allocate statistics\n");
+	}
+
+	if (!peak_load_chunks(file, chunk_count, load_flags, peek_chunk,
+	    peek_merge, stats, sizeof(*stats))) {
+		panic("cannot process file in chunks\n");
+	}
+
+	if (stats->total.packets) {
+		peek_time("first", &stats->first);
+		peek_time("last", &stats->last);
+	}
+
+	pout("packets: %llu, bytes: %llu\n",
+	    (unsigned long long)stats->total.packets,
+	    (unsigned long long)stats->total.bytes);
+	pout("dropped: %llu, bytes: %llu\n",
+	    (unsigned long long)stats->dropped.packets,
+	    (unsigned long long)stats->dropped.bytes);
+
+	for (i = 0; i < lengthof(stats->type); ++i) {
+		if (stats->type[i].packets) {
+			pout("ip_type: %u, packets: %llu, bytes: %llu\n", i,
+			    (unsigned long long)stats->type[i].packets,
+			    (unsigned long long)stats->type[i].bytes);
+		}
+	}
+
+	for (i = 0; i < lengthof(stats->app); ++i) {
+		if (stats->app[i].packets) {
+			/* flows are cut at chunk borders, say so */
+			pout("%s: %s, packets: %llu, bytes: %llu\n",
+			    chunk_count > 1 ? "app_approx" : "app",
+			    peak_li_name(i),
+			    (unsigned long long)stats->app[i].packets,
+			    (unsigned long long)stats->app[i].bytes);
+		}
+	}
+
+	free(stats);
 }
 
 static void
 usage(void)
 {
-	fprintf(stderr, "usage: peek [-AadfNnst] file\n");
+	fprintf(stderr, "usage: peek [-AadfNnrst] [-j chunks] "
+	    "[-l signatures] file ...\n");
 	exit(EXIT_FAILURE);
 }
 
@@ -148,7 +316,7 @@ main(int argc, char **argv)
 	timeslice_t timer;
 	int c;
 
-	while ((c = getopt(argc, argv, "AadfNnst")) != -1) {
+	while ((c = getopt(argc, argv, "AadfNnrstj:l:")) != -1) {
 		switch (c) {
 		case 'A':
 			use_print[use_count++] = USE_APP_LEN;
@@ -162,12 +330,27 @@ main(int argc, char **argv)
 		case 'f':
 			use_print[use_count++] = USE_FLOW;
 			break;
+		case 'j':
+			chunk_count = atoi(optarg);
+			if (!chunk_count) {
+				usage();
+				/* NOTREACHED */
+			}
+			continue;
+		case 'l':
+			if (!peak_li_load(optarg)) {
+				panic("cannot load signatures\n");
+			}
+			continue;
 		case 'N':
 			use_print[use_count++] = USE_IP_LEN;
 			break;
 		case 'n':
 			use_print[use_count++] = USE_IP_TYPE;
 			break;
+		case 'r':
+			load_flags |= LOAD_THREAD;
+			continue;
 		case 's':
 			use_print[use_count++] = USE_SRC;
 			break;
@@ -193,6 +376,19 @@ main(int argc, char **argv)
 		/* NOTREACHED */
 	}
 
+	if (chunk_count) {
+		if (argc > 1 || load_flags & LOAD_THREAD) {
+			usage();
+			/* NOTREACHED */
+		}
+
+		/* aggregate statistics, one thread per chunk */
+		peek_summary(argv[0]);
+		peak_li_unload();
+
+		return (0);
+	}
+
 	if (!use_count) {
 		/* set the default output (as used by tests) */
 		use_print[use_count++] = USE_TIME;
@@ -204,7 +400,9 @@ main(int argc, char **argv)
 		use_print[use_count++] = USE_APP;
 	}
 
-	trace = peak_load_init(argv[0]);
+	/* several files are merged in time order */
+	trace = argc > 1 ? peak_load_merge(argv, argc, load_flags) :
+	    peak_load_open(argv[0], load_flags);
 	if (!trace) {
 		panic("cannot init file loader\n");
 	}
@@ -228,6 +426,7 @@ main(int argc, char **argv)
 
 	peak_track_exit(peek);
 	peak_load_exit(trace);
+	peak_li_unload();
 
 	return (0);
 }
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <peak.h>
+#include <limits.h>
+#include <unistd.h>
+
+output_init();
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: traceindex [-n interval] file ...\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int interval = 0;
+	char index[PATH_MAX];
+	struct peak_load *trace;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			interval = atoi(optarg);
+			break;
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		usage();
+		/* NOTREACHED */
+	}
+
+	for (i = 0; i < argc; ++i) {
+		if (snprintf(index, sizeof(index), "%s.idx", argv[i]) >=
+		    (int)sizeof(index)) {
+			panic("file name too long: %s\n", argv[i]);
+		}
+
+		trace = peak_load_init(argv[i]);
+		if (!trace) {
+			panic("cannot init file loader: %s\n", argv[i]);
+		}
+
+		/* an up-to-date index is left alone */
+		if (!peak_load_index(trace, index, interval)) {
+			panic("cannot index file: %s\n", argv[i]);
+		}
+
+		peak_load_exit(trace);
+	}
+
+	return (0);
+}
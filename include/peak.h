@@ -20,6 +20,7 @@
 
 #include <sys/cdefs.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 /* pull internal sys headers for portability */
 #include "sys/queue.h"
@@ -51,6 +52,10 @@
 #define __unused	__attribute__((__unused__))
 #endif /* !__unused */
 
+#ifndef __dead
+#define __dead		__attribute__((__noreturn__))
+#endif /* !__dead */
+
 #ifndef MIN
 #define MIN(a,b)	(((a)<(b))?(a):(b))
 #endif /* !MIN */
@@ -86,9 +91,14 @@
 #include "peak_jar.h"
 #include "peak_packet.h"
 #include "peak_li.h"
+#include "peak_meta.h"
+#include "peak_ja3.h"
 #include "peak_magic.h"
 #include "peak_regex.h"
 #include "peak_string.h"
 #include "peak_number.h"
 #include "peak_track.h"
+#include "peak_reasm.h"
+#include "peak_record.h"
+#include "peak_unpack.h"
 #include "peak_audit.h"
@@ -180,4 +180,52 @@ hash_joaat(const void *buf, const unsigned int len)
 
 #undef JOAAT_SALT
 
+/*
+ * Minimal perfect hashing for static string tables: the
+ * tables are built by scripts/lookup_update.py, which
+ * mirrors the two functions below, so keep them in sync.
+ */
+
+static inline uint32_t
+hash_lower(const char *str)
+{
+	uint32_t h = 2166136261u;
+	uint8_t c;
+
+	while ((c = *str++)) {
+		/* fold ASCII upper case without branching */
+		c |= ((uint8_t)(c - 'A') < 26) << 5;
+		h = 16777619u * (h ^ c);
+	}
+
+	return (h);
+}
+
+static inline uint32_t
+hash_mix(uint32_t h, const uint32_t seed)
+{
+	h ^= seed;
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+
+	return (h);
+}
+
+static inline unsigned int
+hash_perfect(const char *str, const uint16_t *disp,
+    const unsigned int disp_len, const uint16_t *slot,
+    const unsigned int slot_len)
+{
+	const uint32_t h = hash_lower(str);
+
+	return (slot[hash_mix(h, disp[hash_mix(h, 0) % disp_len]) %
+	    slot_len]);
+}
+
+#define HASH_PERFECT(str, disp, slot)					\
+	hash_perfect(str, disp, lengthof(disp), slot, lengthof(slot))
+
 #endif /* !PEAK_HASH_H */
@@ -17,6 +17,14 @@
 #include <peak.h>
 
 static __thread struct peak_audit audit_thread;
+static __thread unsigned char audit_touched[AUDIT_MAX];
+
+/* gauges hold a level instead of counting events */
+static const unsigned char audit_gauges[AUDIT_MAX] = {
+	[AUDIT_STREAM_USED] = 1,
+	[AUDIT_STREAM_FRAGMENTED] = 1,
+	[AUDIT_LOAD_RING] = 1,
+};
 
 static const char *audit_names[AUDIT_MAX] = {
 	[AUDIT_PACKET_DROP_LINK] = "packet.drop.link",
@@ -28,6 +36,29 @@ static const char *audit_names[AUDIT_MAX] = {
 	[AUDIT_TRACK_ADDED] = "track.added",
 	[AUDIT_TRACK_RECYCLED] = "track.recycled",
 	[AUDIT_TRACK_FAILED] = "track.failed",
+	[AUDIT_JA3_HIT] = "ja3.hit",
+	[AUDIT_JA3_MISS] = "ja3.miss",
+	[AUDIT_REASM_INORDER] = "reasm.inorder",
+	[AUDIT_REASM_BUFFERED] = "reasm.buffered",
+	[AUDIT_REASM_RETRANS] = "reasm.retrans",
+	[AUDIT_REASM_OVERLAP] = "reasm.overlap",
+	[AUDIT_REASM_EVICTED] = "reasm.evicted",
+	[AUDIT_REASM_DROPPED] = "reasm.dropped",
+	[AUDIT_STREAM_USED] = "stream.used",
+	[AUDIT_STREAM_FRAGMENTED] = "stream.fragmented",
+	[AUDIT_STREAM_PRESSURE] = "stream.pressure",
+	[AUDIT_STREAM_EVICTED] = "stream.evicted",
+	[AUDIT_STREAM_FAILED] = "stream.failed",
+	[AUDIT_STREAM_SPILLED] = "stream.spilled",
+	[AUDIT_STREAM_WRITES] = "stream.writes",
+	[AUDIT_RECORD_DUMPED] = "record.dumped",
+	[AUDIT_RECORD_FRAMES] = "record.frames",
+	[AUDIT_RECORD_BUSY] = "record.busy",
+	[AUDIT_RECORD_SKIPPED] = "record.skipped",
+	[AUDIT_LOAD_STALLS] = "load.stalls",
+	[AUDIT_LOAD_BLOCKED] = "load.blocked",
+	[AUDIT_LOAD_RING] = "load.ring",
+	[AUDIT_LOAD_TRUNCATED] = "load.truncated",
 };
 
 const char *
@@ -47,6 +78,7 @@ peak_audit_set(const unsigned int field, const uint64_t value)
 {
 	if (likely(field < AUDIT_MAX)) {
 		audit_thread.field[field] = value;
+		audit_touched[field] = 1;
 	}
 }
 
@@ -84,6 +116,15 @@ peak_audit_sync(struct peak_audit *export)
 	unsigned int i;
 
 	for (i = 0; i < AUDIT_MAX; ++i) {
+		if (audit_gauges[i]) {
+			/* pass on the latest level, if there is one */
+			if (audit_touched[i]) {
+				__sync_lock_test_and_set(&export->field[i],
+				    audit_thread.field[i]);
+				audit_touched[i] = 0;
+			}
+			continue;
+		}
 		/* merge all fields by doing atomic ops */
 		__sync_fetch_and_add(&export->field[i],
 		    audit_thread.field[i]);
@@ -27,6 +27,29 @@ enum {
 	AUDIT_TRACK_ADDED,
 	AUDIT_TRACK_RECYCLED,
 	AUDIT_TRACK_FAILED,
+	AUDIT_JA3_HIT,
+	AUDIT_JA3_MISS,
+	AUDIT_REASM_INORDER,
+	AUDIT_REASM_BUFFERED,
+	AUDIT_REASM_RETRANS,
+	AUDIT_REASM_OVERLAP,
+	AUDIT_REASM_EVICTED,
+	AUDIT_REASM_DROPPED,
+	AUDIT_STREAM_USED,
+	AUDIT_STREAM_FRAGMENTED,
+	AUDIT_STREAM_PRESSURE,
+	AUDIT_STREAM_EVICTED,
+	AUDIT_STREAM_FAILED,
+	AUDIT_STREAM_SPILLED,
+	AUDIT_STREAM_WRITES,
+	AUDIT_RECORD_DUMPED,
+	AUDIT_RECORD_FRAMES,
+	AUDIT_RECORD_BUSY,
+	AUDIT_RECORD_SKIPPED,
+	AUDIT_LOAD_STALLS,
+	AUDIT_LOAD_BLOCKED,
+	AUDIT_LOAD_RING,
+	AUDIT_LOAD_TRUNCATED,
 	AUDIT_MAX	/* last element */
 };
 
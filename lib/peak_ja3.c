@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <peak.h>
+#include <compat.h>
+
+#define JA3_FNV_OFFSET	0xCBF29CE484222325ull
+#define JA3_FNV_PRIME	0x100000001B3ull
+
+/* GREASE values are random and must be ignored */
+#define JA3_GREASE(x)							\
+	(((x) & 0x0F0F) == 0x0A0A && ((x) >> 8) == ((x) & 0xFF))
+
+struct peak_ja3_entry {
+	uint64_t key;
+	struct peak_ja3 data;
+};
+
+struct peak_ja3s {
+	struct peak_ja3_entry *table;
+	size_t mask;
+};
+
+int
+peak_ja3_parse(struct peak_meta_hello *self,
+    const struct peak_packet *packet)
+{
+	/* a partial hello can't produce a valid fingerprint */
+	return (peak_meta_hello(self, packet, 0));
+}
+
+static inline size_t
+peak_ja3_put(char *buf, unsigned int value)
+{
+	char tmp[5];
+	size_t i = 0, ret = 0;
+
+	do {
+		tmp[i++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	while (i) {
+		buf[ret++] = tmp[--i];
+	}
+
+	return (ret);
+}
+
+#define JA3_PUT(value) do {						\
+	if (unlikely(pos + 6 >= sizeof(self->str))) {			\
+		return (1);						\
+	}								\
+	pos += peak_ja3_put(&self->str[pos], (value));			\
+} while (0)
+
+#define JA3_SEP(chr) do {						\
+	if (unlikely(pos + 1 >= sizeof(self->str))) {			\
+		return (1);						\
+	}								\
+	self->str[pos++] = (chr);					\
+} while (0)
+
+int
+peak_ja3_build(struct peak_ja3 *self, const struct peak_meta_hello *hello,
+    const struct peak_packet *packet)
+{
+	static const char hex[] = "0123456789abcdef";
+	const uint8_t *raw = packet->app.raw;
+	unsigned int first, i, value;
+	size_t pos = 0;
+	MD5_CTX ctx;
+
+	JA3_PUT(hello->version);
+	JA3_SEP(',');
+
+	for (first = 1, i = 0; i < hello->ciphers.len; i += 2) {
+		value = be16dec(&raw[hello->ciphers.off + i]);
+		if (!JA3_GREASE(value)) {
+			if (!first) {
+				JA3_SEP('-');
+			}
+			JA3_PUT(value);
+			first = 0;
+		}
+	}
+
+	JA3_SEP(',');
+
+	for (first = 1, i = 0; i + 4 <= hello->extensions.len;
+	    i += 4 + be16dec(&raw[hello->extensions.off + i + 2])) {
+		value = be16dec(&raw[hello->extensions.off + i]);
+		if (!JA3_GREASE(value)) {
+			if (!first) {
+				JA3_SEP('-');
+			}
+			JA3_PUT(value);
+			first = 0;
+		}
+	}
+
+	JA3_SEP(',');
+
+	for (first = 1, i = 0; i < hello->curves.len; i += 2) {
+		value = be16dec(&raw[hello->curves.off + i]);
+		if (!JA3_GREASE(value)) {
+			if (!first) {
+				JA3_SEP('-');
+			}
+			JA3_PUT(value);
+			first = 0;
+		}
+	}
+
+	JA3_SEP(',');
+
+	for (i = 0; i < hello->formats.len; ++i) {
+		if (i) {
+			JA3_SEP('-');
+		}
+		JA3_PUT(raw[hello->formats.off + i]);
+	}
+
+	self->str[pos] = '\0';
+	self->len = pos;
+
+	MD5Init(&ctx);
+	MD5Update(&ctx, (const uint8_t *)self->str, pos);
+	MD5Final(self->digest, &ctx);
+
+	for (i = 0; i < JA3_DIGEST_LEN; ++i) {
+		self->hash[i * 2] = hex[self->digest[i] >> 4];
+		self->hash[i * 2 + 1] = hex[self->digest[i] & 0xF];
+	}
+
+	self->hash[JA3_HASH_LEN - 1] = '\0';
+
+	return (0);
+}
+
+static inline uint64_t
+peak_ja3_fold(uint64_t key, const unsigned int value)
+{
+	return ((key ^ value) * JA3_FNV_PRIME);
+}
+
+static uint64_t
+peak_ja3_key(const struct peak_meta_hello *hello,
+    const struct peak_packet *packet)
+{
+	const uint8_t *raw = packet->app.raw;
+	uint64_t key = JA3_FNV_OFFSET;
+	unsigned int i, value;
+
+	/*
+	 * Random, session id and extension payloads (SNI!)
+	 * differ from one hello to the next, so only hash what
+	 * goes into the fingerprint.  Section markers are out
+	 * of the 16 bit range to keep the lists apart.
+	 */
+	key = peak_ja3_fold(key, hello->version);
+	key = peak_ja3_fold(key, 0x10000);
+
+	for (i = 0; i < hello->ciphers.len; i += 2) {
+		value = be16dec(&raw[hello->ciphers.off + i]);
+		if (!JA3_GREASE(value)) {
+			key = peak_ja3_fold(key, value);
+		}
+	}
+
+	key = peak_ja3_fold(key, 0x20000);
+
+	for (i = 0; i + 4 <= hello->extensions.len;
+	    i += 4 + be16dec(&raw[hello->extensions.off + i + 2])) {
+		value = be16dec(&raw[hello->extensions.off + i]);
+		if (!JA3_GREASE(value)) {
+			key = peak_ja3_fold(key, value);
+		}
+	}
+
+	key = peak_ja3_fold(key, 0x30000);
+
+	for (i = 0; i < hello->curves.len; i += 2) {
+		value = be16dec(&raw[hello->curves.off + i]);
+		if (!JA3_GREASE(value)) {
+			key = peak_ja3_fold(key, value);
+		}
+	}
+
+	key = peak_ja3_fold(key, 0x40000);
+
+	for (i = 0; i < hello->formats.len; ++i) {
+		key = peak_ja3_fold(key, raw[hello->formats.off + i]);
+	}
+
+	/* zero marks an empty slot */
+	return (key ? : 1);
+}
+
+const struct peak_ja3 *
+peak_ja3_get(struct peak_ja3s *self, const struct peak_packet *packet)
+{
+	struct peak_ja3_entry *entry;
+	struct peak_meta_hello hello;
+	uint64_t key;
+
+	if (peak_ja3_parse(&hello, packet)) {
+		return (NULL);
+	}
+
+	key = peak_ja3_key(&hello, packet);
+	entry = &self->table[key & self->mask];
+
+	if (entry->key == key) {
+		peak_audit_inc(AUDIT_JA3_HIT);
+		return (&entry->data);
+	}
+
+	peak_audit_inc(AUDIT_JA3_MISS);
+
+	if (peak_ja3_build(&entry->data, &hello, packet)) {
+		entry->key = 0;
+		return (NULL);
+	}
+
+	entry->key = key;
+
+	return (&entry->data);
+}
+
+void
+peak_ja3_exit(struct peak_ja3s *self)
+{
+	if (self) {
+		free(self->table);
+		free(self);
+	}
+}
+
+struct peak_ja3s *
+peak_ja3_init(const size_t count)
+{
+	struct peak_ja3s *self;
+	size_t size = 1;
+
+	if (!count) {
+		return (NULL);
+	}
+
+	/* power of two for cheap slot selection */
+	while (size < count) {
+		size <<= 1;
+	}
+
+	self = malloc(sizeof(*self));
+	if (!self) {
+		return (NULL);
+	}
+
+	self->table = calloc(size, sizeof(*self->table));
+	if (!self->table) {
+		free(self);
+		return (NULL);
+	}
+
+	self->mask = size - 1;
+
+	return (self);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PEAK_JA3_H
+#define PEAK_JA3_H
+
+#define JA3_DIGEST_LEN	16
+#define JA3_HASH_LEN	(JA3_DIGEST_LEN * 2 + 1)
+#define JA3_STR_LEN	1024
+
+struct peak_ja3 {
+	uint8_t digest[JA3_DIGEST_LEN];
+	char hash[JA3_HASH_LEN];
+	char str[JA3_STR_LEN];
+	size_t len;
+};
+
+int			 peak_ja3_parse(struct peak_meta_hello *,
+			     const struct peak_packet *);
+int			 peak_ja3_build(struct peak_ja3 *,
+			     const struct peak_meta_hello *,
+			     const struct peak_packet *);
+struct peak_ja3s	*peak_ja3_init(const size_t);
+const struct peak_ja3	*peak_ja3_get(struct peak_ja3s *,
+			     const struct peak_packet *);
+void			 peak_ja3_exit(struct peak_ja3s *);
+
+#endif /* !PEAK_JA3_H */
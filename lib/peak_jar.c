@@ -15,6 +15,12 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
 #include <peak.h>
 
 struct peak_jar_head {
@@ -32,7 +38,73 @@ struct peak_jar_data {
 	unsigned char buf[];
 };
 
+/*
+ * Concurrent jars prefix each record with a post header.
+ * Producers append records and publish them in order, the
+ * consumer walks them later on and links them into their
+ * contexts as if they had been packed.  Space is given
+ * back by the consumer alone, so producers never touch
+ * data that may still be in use.
+ */
+struct peak_jar_post {
+	uint32_t size;
+	uint32_t skip;
+	struct peak_jar *context;
+	size_t begin;
+};
+
+struct peak_jar_ring {
+	unsigned int mode __aligned(ALLOC_CACHELINE);
+	/* producer side */
+	size_t reserve __aligned(ALLOC_CACHELINE);
+	size_t limit;
+	unsigned int pending;
+	/* published end of data */
+	size_t publish __aligned(ALLOC_CACHELINE);
+	/* consumer side */
+	size_t release __aligned(ALLOC_CACHELINE);
+	size_t scan;
+	prealloc_t heads;
+};
+
+/*
+ * File-backed jars keep their state in a small header in
+ * front of the buffer.  Two copies of the state take turns,
+ * so a crash never leaves a half-written one behind.  Heads
+ * and data are found again by retracing their allocations,
+ * which is why a wrap to the start leaves a marker.
+ */
+struct peak_jar_state {
+	uint64_t read;
+	uint64_t write;
+	uint32_t first_serial;
+	uint32_t last_serial;
+	uint32_t last_count;
+	uint32_t reserved;
+};
+
+struct peak_jar_map {
+	uint32_t magic;
+	uint32_t current;
+	uint64_t size;
+	struct peak_jar_state state[2];
+};
+
 #define JAR_HEAD_COUNT	1000
+#define JAR_ALIGN	16	/* smallest skip record */
+#define JAR_BATCH	32	/* publish interval for SPSC */
+#define JAR_SLICES	8	/* maximum head size is 1/8 */
+#define JAR_SPIN	16	/* spins before yielding */
+
+#define JAR_LOAD(x)	(*(volatile __typeof__(x) *)&(x))
+#define JAR_STORE(x, y)	(*(volatile __typeof__(x) *)&(x) = (y))
+
+#define JAR_MAGIC	0x6A617231	/* "jar1" */
+#define JAR_HEADER	4096		/* keeps the buffer page-aligned */
+#define JAR_WRAP	((uintptr_t)-1)	/* allocation moved to the start */
+
+/* a crash can't reorder stores that already happened */
+#define JAR_ORDER()	__asm__ __volatile__("" ::: "memory")
 
 static inline void *
 peak_jar_write(struct peak_jars *self, const size_t head_room)
@@ -54,6 +126,10 @@ peak_jar_write(struct peak_jars *self, const size_t head_room)
 	 * (head_room must be contiguous)
 	 */
 	if (unlikely(new_write >= size)) {
+		if (write < read) {
+			/* the start is still in use */
+			return (NULL);
+		}
 		new_write = head_room;
 		ret = self->buffer;
 		free = read;
@@ -64,6 +140,11 @@ peak_jar_write(struct peak_jars *self, const size_t head_room)
 		return (NULL);
 	}
 
+	if (ret == self->buffer && write) {
+		/* leave a trail for recovery */
+		*(uintptr_t *)(self->buffer + write) = JAR_WRAP;
+	}
+
 	/* sync new write value */
 	self->write = new_write;
 
@@ -71,10 +152,24 @@ peak_jar_write(struct peak_jars *self, const size_t head_room)
 	return (ret);
 }
 
+static inline void
+peak_jar_persist(struct peak_jar_map *map,
+    const struct peak_jar_state *state)
+{
+	const uint32_t next = !map->current;
+
+	map->state[next] = *state;
+	JAR_ORDER();
+	map->current = next;
+	JAR_ORDER();
+}
+
 static inline void
 peak_jar_read(struct peak_jars *self)
 {
 	struct peak_jar_head *head = TAILQ_FIRST(&self->heads);
+	struct peak_jar_state state;
+
 	if (head) {
 		/*
 		 * free old data sets and invalidate
@@ -83,9 +178,34 @@ peak_jar_read(struct peak_jars *self)
 		TAILQ_REMOVE(&self->heads, head, entry);
 		self->read = head->write;
 		++self->first_serial;
+
+		if (self->map) {
+			/* must be known before the space is reused */
+			state = self->map->state[self->map->current];
+			state.first_serial = self->first_serial;
+			state.read = self->read;
+			if (!(state.last_serial - state.first_serial) ||
+			    wrap32(state.last_serial - state.first_serial)) {
+				/* nothing committed is left */
+				state.last_serial = state.first_serial;
+				state.write = state.read;
+				state.last_count = 0;
+			}
+			peak_jar_persist(self->map, &state);
+		}
 	}
 }
 
+static inline void *
+peak_jar_find(struct peak_jars *self, const size_t pos)
+{
+	if (*(uintptr_t *)(self->buffer + pos) == JAR_WRAP) {
+		return (self->buffer);
+	}
+
+	return (self->buffer + pos);
+}
+
 static void
 peak_jar_repair(struct peak_jars *self, struct peak_jar *context)
 {
@@ -111,28 +231,172 @@ peak_jar_repair(struct peak_jars *self, struct peak_jar *context)
 
 	/* is the first serial valid? */
 	if (wrap32(context->first_serial - self->first_serial)) {
-		struct peak_jar_data *zap = data;
+		struct peak_jar_data *zap = data, *next;
+		unsigned int valid;
 
 		TAILQ_INIT(&context->datas);
 
-		while (TAILQ_NEXT(zap, entry) &&
-		    !wrap32(zap->prev_serial - self->first_serial)) {
-			zap = TAILQ_NEXT(zap, entry);
+		/* relink newest to oldest, read ahead before that */
+		for (;;) {
+			next = TAILQ_NEXT(zap, entry);
+			valid = next &&
+			    !wrap32(zap->prev_serial - self->first_serial);
 			TAILQ_INSERT_TAIL(&context->datas, zap, entry);
+			if (!valid) {
+				break;
+			}
+			zap = next;
 		}
 
 		context->first_serial = zap->serial;
 	}
 }
 
-void
-peak_jar_pack(struct peak_jars *self, struct peak_jar *context,
-    const void *buf, const size_t len)
+static inline void
+peak_jar_attach(struct peak_jars *self, struct peak_jar *context,
+    struct peak_jar_data *data)
+{
+	/* amend all invalid references in context */
+	peak_jar_repair(self, context);
+
+	data->prev_serial = 0;
+
+	/* put into context (literally)  */
+	if (TAILQ_EMPTY(&context->datas)) {
+		context->first_serial = data->serial;
+	}
+	TAILQ_INSERT_HEAD(&context->datas, data, entry);
+	context->last_serial = data->serial;
+
+	/* almost done: sync prev_serial for peek */
+	if (TAILQ_NEXT(data, entry)) {
+		data->prev_serial =
+		    TAILQ_NEXT(data, entry)->serial;
+	}
+}
+
+unsigned int
+peak_jar_share(struct peak_jars *self, const unsigned int mode)
+{
+	struct peak_jar_ring *ring;
+	size_t count;
+
+	if (mode == JAR_SERIAL) {
+		return (!self->ring);
+	}
+
+	if (self->ring || self->map || mode > JAR_MPSC ||
+	    self->size % JAR_ALIGN || !TAILQ_EMPTY(&self->heads)) {
+		return (0);
+	}
+
+	ring = malign(1, sizeof(*ring));
+	if (!ring) {
+		return (0);
+	}
+
+	memset(ring, 0, sizeof(*ring));
+
+	/*
+	 * Heads live outside of the buffer, because the
+	 * consumer can't write into it.  Running out of
+	 * them only means older data is dropped earlier.
+	 */
+	count = 2 * JAR_SLICES + self->size /
+	    (JAR_HEAD_COUNT * sizeof(struct peak_jar_data));
+	if (!prealloc_init(&ring->heads, count,
+	    sizeof(struct peak_jar_head))) {
+		free(ring);
+		return (0);
+	}
+
+	ring->mode = mode;
+	self->ring = ring;
+
+	return (1);
+}
+
+static inline void
+peak_jar_publish(struct peak_jar_ring *ring, const size_t end)
+{
+	/* data must be visible before its end is */
+	__sync_synchronize();
+	JAR_STORE(ring->publish, end);
+}
+
+static void *
+peak_jar_claim(struct peak_jars *self, struct peak_jar *context,
+    const size_t len)
+{
+	struct peak_jar_ring *ring = self->ring;
+	const size_t need = ALLOC_ALIGN(sizeof(struct peak_jar_post) +
+	    sizeof(struct peak_jar_data) + len, JAR_ALIGN);
+	struct peak_jar_data *data;
+	struct peak_jar_post *post;
+	size_t pos, end, pad;
+
+	/* leaves room for skipping to the start in any case */
+	if (unlikely(need > self->size / 2)) {
+		return (NULL);
+	}
+
+	for (;;) {
+		pos = JAR_LOAD(ring->reserve);
+
+		/* records must be contiguous */
+		pad = pos % self->size + need > self->size ?
+		    self->size - pos % self->size : 0;
+		end = pos + pad + need;
+
+		/* positions only grow, compare distances */
+		if (end - JAR_LOAD(ring->limit) > self->size) {
+			/* cached release is stale, look again */
+			JAR_STORE(ring->limit, JAR_LOAD(ring->release));
+			if (end - JAR_LOAD(ring->limit) > self->size) {
+				return (NULL);
+			}
+		}
+
+		if (ring->mode == JAR_SPSC) {
+			ring->reserve = end;
+			break;
+		}
+
+		if (__sync_bool_compare_and_swap(&ring->reserve, pos, end)) {
+			break;
+		}
+	}
+
+	if (pad) {
+		post = (void *)(self->buffer + pos % self->size);
+		post->size = pad;
+		post->skip = 1;
+	}
+
+	post = (void *)(self->buffer + (pos + pad) % self->size);
+	post->size = need;
+	post->skip = 0;
+	post->context = context;
+	post->begin = pos;
+
+	data = (void *)(post + 1);
+	data->len = len;
+
+	return (data->buf);
+}
+
+void *
+peak_jar_reserve(struct peak_jars *self, struct peak_jar *context,
+    const size_t len)
 {
 	struct peak_jar_head *head;
 	struct peak_jar_data *data;
 
-peak_jar_pack_again:
+	if (self->ring) {
+		return (peak_jar_claim(self, context, len));
+	}
+
+peak_jar_reserve_again:
 
 	/* do we need a new serial header? */
 	head = TAILQ_LAST(&self->heads, peak_jar_header);
@@ -140,7 +404,7 @@ peak_jar_pack_again:
 		head = peak_jar_write(self, sizeof(*head));
 		if (!head) {
 			peak_jar_read(self);
-			goto peak_jar_pack_again;
+			goto peak_jar_reserve_again;
 		}
 
 		/* initialise new serial header */
@@ -155,36 +419,210 @@ peak_jar_pack_again:
 	    ALLOC_ALIGN(len, sizeof(unsigned char *)));
 	if (!data) {
 		peak_jar_read(self);
-		goto peak_jar_pack_again;
+		goto peak_jar_reserve_again;
 	}
 
-	/* amend all invalid references in context */
-	peak_jar_repair(self, context);
-
-	/* initialise data header and copy data */
-	memset(data, 0, sizeof(*data));
-	memcpy(data->buf, buf, len);
+	/* initialise data header, the caller fills in the data */
 	data->serial = head->serial;
 	data->len = len;
 
-	/* put into context (literally)  */
-	if (TAILQ_EMPTY(&context->datas)) {
-		context->first_serial = data->serial;
+	peak_jar_attach(self, context, data);
+
+	/* sync serial header */
+	head->write = self->write;
+	head->count += 1;
+
+	return (data->buf);
+}
+
+static void
+peak_jar_save(struct peak_jars *self)
+{
+	struct peak_jar_state state = {
+		.last_count = TAILQ_LAST(&self->heads,
+		    peak_jar_header)->count,
+		.first_serial = self->first_serial,
+		.last_serial = self->last_serial,
+		.write = self->write,
+		.read = self->read,
+	};
+
+	/* plain stores into the mapping, no system calls */
+	peak_jar_persist(self->map, &state);
+}
+
+void
+peak_jar_commit(struct peak_jars *self, void *buf)
+{
+	struct peak_jar_ring *ring = self->ring;
+	struct peak_jar_post *post;
+	size_t end, pad, off;
+	unsigned int spin = 0;
+
+	if (!ring) {
+		/* serial data is linked right away */
+		if (self->map) {
+			peak_jar_save(self);
+		}
+		return;
 	}
-	TAILQ_INSERT_HEAD(&context->datas, data, entry);
-	context->last_serial = data->serial;
 
-	/* almost done: sync prev_serial for peek */
-	if (TAILQ_NEXT(data, entry)) {
-		data->prev_serial =
-		    TAILQ_NEXT(data, entry)->serial;
+	post = (struct peak_jar_post *)((uint8_t *)buf -
+	    __builtin_offsetof(struct peak_jar_data, buf)) - 1;
+
+	if (ring->mode == JAR_SPSC) {
+		if (++ring->pending >= JAR_BATCH) {
+			peak_jar_flush(self);
+		}
+		return;
 	}
 
-	/* sync serial header */
-	head->write = self->write;
+	/* the reservation may have skipped to the start */
+	off = (uint8_t *)post - self->buffer;
+	pad = (off + self->size - post->begin % self->size) % self->size;
+	end = post->begin + pad + post->size;
+
+	/* publish in order, wait for earlier producers */
+	while (JAR_LOAD(ring->publish) != post->begin) {
+		if (++spin % JAR_SPIN == 0) {
+			sched_yield();
+		}
+	}
+
+	peak_jar_publish(ring, end);
+}
+
+void
+peak_jar_pack(struct peak_jars *self, struct peak_jar *context,
+    const void *buf, const size_t len)
+{
+	void *ret;
+
+	if (unlikely(self->ring)) {
+		/* producers can't free, they have to be told */
+		panic("shared jars need peak_jar_post()\n");
+	}
+
+	ret = peak_jar_reserve(self, context, len);
+	if (unlikely(!ret)) {
+		return;
+	}
+
+	memcpy(ret, buf, len);
+	peak_jar_commit(self, ret);
+}
+
+unsigned int
+peak_jar_post(struct peak_jars *self, struct peak_jar *context,
+    const void *buf, const size_t len)
+{
+	void *ret = peak_jar_reserve(self, context, len);
+
+	if (!ret) {
+		return (0);
+	}
+
+	memcpy(ret, buf, len);
+	peak_jar_commit(self, ret);
+
+	return (1);
+}
+
+void
+peak_jar_flush(struct peak_jars *self)
+{
+	struct peak_jar_ring *ring = self->ring;
+
+	if (ring && ring->mode == JAR_SPSC && ring->pending) {
+		peak_jar_publish(ring, ring->reserve);
+		ring->pending = 0;
+	}
+}
+
+static void
+peak_jar_evict(struct peak_jars *self)
+{
+	struct peak_jar_ring *ring = self->ring;
+	struct peak_jar_head *head = TAILQ_FIRST(&self->heads);
+
+	TAILQ_REMOVE(&self->heads, head, entry);
+	JAR_STORE(ring->release, head->write);
+	++self->first_serial;
+	prealloc_put(&ring->heads, head);
+}
+
+static void
+peak_jar_link(struct peak_jars *self, struct peak_jar_post *post)
+{
+	struct peak_jar_ring *ring = self->ring;
+	struct peak_jar *context = post->context;
+	struct peak_jar_data *data = (void *)(post + 1);
+	struct peak_jar_head *head, *prev;
+	size_t begin = 0;
+
+	head = TAILQ_LAST(&self->heads, peak_jar_header);
+	if (head) {
+		/* where this head started */
+		prev = TAILQ_PREV(head, peak_jar_header, entry);
+		begin = prev ? prev->write : ring->release;
+	}
+
+	if (unlikely(!head || head->count > JAR_HEAD_COUNT ||
+	    ring->scan - begin > self->size / JAR_SLICES)) {
+		while (!(head = prealloc_get(&ring->heads))) {
+			peak_jar_evict(self);
+		}
+
+		TAILQ_INSERT_TAIL(&self->heads, head, entry);
+		head->serial = self->last_serial++;
+		head->count = 0;
+	}
+
+	/* same as peak_jar_pack() from here on */
+	data->serial = head->serial;
+	peak_jar_attach(self, context, data);
+
+	head->write = ring->scan + post->size;
 	head->count += 1;
 }
 
+unsigned int
+peak_jar_sync(struct peak_jars *self)
+{
+	struct peak_jar_ring *ring = self->ring;
+	struct peak_jar_post *post;
+	unsigned int count = 0;
+	size_t end;
+
+	/*
+	 * Make room before taking in new data, so that
+	 * data is only dropped after it could be seen.
+	 */
+	end = JAR_LOAD(ring->reserve);
+	if (end - ring->release > self->size - self->size / 4) {
+		/* done reading before giving it away */
+		__sync_synchronize();
+		while (!TAILQ_EMPTY(&self->heads) &&
+		    end - ring->release > self->size / 2) {
+			peak_jar_evict(self);
+		}
+	}
+
+	end = JAR_LOAD(ring->publish);
+	__sync_synchronize();
+
+	while (ring->scan != end) {
+		post = (void *)(self->buffer + ring->scan % self->size);
+		if (!post->skip) {
+			peak_jar_link(self, post);
+			++count;
+		}
+		ring->scan += post->size;
+	}
+
+	return (count);
+}
+
 unsigned int
 peak_jar_fifo(struct peak_jars *self, struct peak_jar *context,
     peak_jar_fun callback, void *userdata)
@@ -264,8 +702,166 @@ peak_jar_init(struct peak_jars *self, size_t size)
 	return (1);
 }
 
+static unsigned int
+peak_jar_recover(struct peak_jars *self)
+{
+	const struct peak_jar_state *state =
+	    &self->map->state[self->map->current & 1];
+	const unsigned int count = state->last_serial - state->first_serial;
+	struct peak_jar_head *head;
+	size_t pos = state->read;
+	unsigned int i;
+
+	if (state->read >= self->size || state->write >= self->size ||
+	    count > self->size / sizeof(*head)) {
+		return (0);
+	}
+
+	/* heads follow each other, no need to look at data */
+	for (i = 0; i < count; ++i) {
+		head = peak_jar_find(self, pos);
+		if (head->serial != state->first_serial + i ||
+		    head->write >= self->size) {
+			return (0);
+		}
+		if (i == count - 1) {
+			/* drop what wasn't committed */
+			head->write = state->write;
+			head->count = state->last_count;
+		}
+		TAILQ_INSERT_TAIL(&self->heads, head, entry);
+		pos = head->write;
+	}
+
+	self->first_serial = state->first_serial;
+	self->last_serial = state->last_serial;
+	self->write = state->write;
+	self->read = state->read;
+
+	return (1);
+}
+
+unsigned int
+peak_jar_open(struct peak_jars *self, const char *file, size_t size)
+{
+	struct stat st;
+	uint8_t *mem;
+	int fd, ret;
+
+	memset(self, 0, sizeof(*self));
+
+	if (size & 0x7 || size < 128) {
+		return (0);
+	}
+
+	fd = open(file, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		warning("could not open file `%s'\n", file);
+		return (0);
+	}
+
+	if (fstat(fd, &st)) {
+		goto peak_jar_open_fail;
+	}
+
+	if (st.st_size != (off_t)(JAR_HEADER + size)) {
+		/* different geometry, start from scratch */
+		if (ftruncate(fd, 0) || ftruncate(fd, JAR_HEADER + size)) {
+			goto peak_jar_open_fail;
+		}
+
+		/* the mapping must not run out of space later */
+		ret = posix_fallocate(fd, 0, JAR_HEADER + size);
+		if (ret && ret != EINVAL && ret != EOPNOTSUPP) {
+			goto peak_jar_open_fail;
+		}
+	}
+
+	mem = mmap(NULL, JAR_HEADER + size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) {
+		warning("could not map file `%s'\n", file);
+		goto peak_jar_open_fail;
+	}
+
+	close(fd);
+
+	TAILQ_INIT(&self->heads);
+	self->buffer = mem + JAR_HEADER;
+	self->map = (void *)mem;
+	self->size = size;
+
+	if (self->map->magic != JAR_MAGIC || self->map->size != size ||
+	    !peak_jar_recover(self)) {
+		TAILQ_INIT(&self->heads);
+		memset(self->map, 0, sizeof(*self->map));
+		self->map->size = size;
+		JAR_ORDER();
+		self->map->magic = JAR_MAGIC;
+	}
+
+	return (1);
+
+peak_jar_open_fail:
+
+	close(fd);
+
+	return (0);
+}
+
+unsigned int
+peak_jar_replay(struct peak_jars *self, peak_jar_key key, void *userdata)
+{
+	struct peak_jar_head *head;
+	struct peak_jar_data *data;
+	struct peak_jar *context;
+	unsigned int count = 0;
+	unsigned int i;
+	size_t pos;
+
+	if (!self->map) {
+		return (0);
+	}
+
+	TAILQ_FOREACH(head, &self->heads, entry) {
+		pos = (uint8_t *)(head + 1) - self->buffer;
+
+		for (i = 0; i < head->count; ++i) {
+			data = peak_jar_find(self, pos);
+			pos = data->buf - self->buffer +
+			    ALLOC_ALIGN(data->len, sizeof(unsigned char *));
+			if (data->serial != head->serial ||
+			    pos >= self->size) {
+				/* something went very wrong */
+				break;
+			}
+
+			context = key(userdata, data->buf, data->len);
+			if (context) {
+				peak_jar_attach(self, context, data);
+				++count;
+			}
+		}
+	}
+
+	return (count);
+}
+
 void
 peak_jar_exit(struct peak_jars *self)
 {
+	if (self->map) {
+		munmap(self->map, JAR_HEADER + self->size);
+		return;
+	}
+
+	if (self->ring) {
+		while (!TAILQ_EMPTY(&self->heads)) {
+			peak_jar_evict(self);
+		}
+		prealloc_exit(&self->ring->heads);
+		free(self->ring);
+	}
+
 	free(self->buffer);
 }
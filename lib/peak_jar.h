@@ -19,6 +19,8 @@
 
 struct peak_jars {
 	TAILQ_HEAD(peak_jar_header, peak_jar_head) heads;
+	struct peak_jar_ring *ring;
+	struct peak_jar_map *map;
 	unsigned int first_serial;
 	unsigned int last_serial;
 	unsigned char *buffer;
@@ -38,18 +40,33 @@ struct peak_jar {
 } while  (0)
 
 typedef unsigned int (*peak_jar_fun) (void *, void *, size_t len);
+typedef struct peak_jar *(*peak_jar_key) (void *, void *, size_t len);
 
 #define JAR_RETURN	0	/* keep, but return to caller */
 #define JAR_DROP	1	/* drop the current user data */
 #define JAR_KEEP	2	/* keep the current user data */
 
+#define JAR_SERIAL	0	/* one thread does everything */
+#define JAR_SPSC	1	/* one producer, one consumer */
+#define JAR_MPSC	2	/* many producers, one consumer */
+
 void		peak_jar_pack(struct peak_jars *, struct peak_jar *,
 		    const void *, const size_t);
+void		*peak_jar_reserve(struct peak_jars *, struct peak_jar *,
+		    const size_t);
+void		peak_jar_commit(struct peak_jars *, void *);
 unsigned int	peak_jar_fifo(struct peak_jars *, struct peak_jar *,
 		    peak_jar_fun, void *);
 unsigned int	peak_jar_lifo(struct peak_jars *, struct peak_jar *,
 		    peak_jar_fun, void *);
 unsigned int	peak_jar_init(struct peak_jars *, size_t);
+unsigned int	peak_jar_open(struct peak_jars *, const char *, size_t);
+unsigned int	peak_jar_replay(struct peak_jars *, peak_jar_key, void *);
+unsigned int	peak_jar_share(struct peak_jars *, const unsigned int);
+unsigned int	peak_jar_post(struct peak_jars *, struct peak_jar *,
+		    const void *, const size_t);
+void		peak_jar_flush(struct peak_jars *);
+unsigned int	peak_jar_sync(struct peak_jars *);
 void		peak_jar_exit(struct peak_jars *);
 
 #endif /* !PEAK_JAR_H */
@@ -17,9 +17,15 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <peak.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <unistd.h>
+
+#define LI_DEFAULT	"/usr/local/var/peak/li.bin"
 
 #define LI_ISDIGIT(x)		(((x) >= '0') && ((x) <= '9'))
 
@@ -80,6 +86,30 @@ struct peak_lis {
 	const char *cat;
 };
 
+enum {
+	LI_INDEX_TCP,
+	LI_INDEX_UDP,
+	LI_INDEX_OTHER,
+	LI_INDEX_MAX	/* last element */
+};
+
+#define LI_INDEX(type)							\
+	((type) == IPPROTO_TCP ? LI_INDEX_TCP :				\
+	    (type) == IPPROTO_UDP ? LI_INDEX_UDP : LI_INDEX_OTHER)
+
+struct peak_li_db {
+	struct peak_li_sig *index[LI_INDEX_MAX];
+	unsigned int count[LI_INDEX_MAX];
+	struct peak_lis *apps;
+	unsigned int app_count;
+	unsigned int *names;
+	unsigned int names_mask;
+	void *map;
+	size_t size;
+};
+
+static struct peak_li_db li_db;
+
 LI_DESCRIBE_APP(dns)
 {
 	/* TCP: padded with 2 bytes of length */
@@ -1844,6 +1874,379 @@ static const struct peak_lis apps[] = {
 	LI_LIST_IPTYPE(LI_UNDEFINED, undefined, IPPROTO_MAX, IPPROTO_MAX, "Undefined Protocols", "Traffic that does not match any known patterns.", "Networking"),
 };
 
+/*
+ * Begin of autogenerated lookup section.  DO NOT EDIT.
+ */
+
+static const uint16_t li_disp[] = {
+	7, 2, 1, 20, 11, 1, 1, 4,
+	2, 21, 22, 31, 1, 20, 2, 1,
+	47, 1, 4, 1,
+};
+
+static const uint16_t li_slot[] = {
+	LI_BITTORRENT,	/* bittorrent */
+	LI_RTSP,	/* rtsp */
+	LI_SSH,	/* ssh */
+	LI_GNUTELLA,	/* gnutella */
+	LI_DTLS,	/* dtls */
+	LI_DNS,	/* dns */
+	LI_L2TP,	/* l2tp */
+	LI_CVS,	/* cvs */
+	LI_POP3,	/* pop3 */
+	LI_LDAP,	/* ldap */
+	LI_XMPP,	/* xmpp */
+	LI_BGP,	/* bgp */
+	LI_RTP,	/* rtp */
+	LI_NETFLOW,	/* netflow */
+	LI_NETBIOS,	/* netbios */
+	LI_OSPF,	/* ospf */
+	LI_PPTP,	/* pptp */
+	LI_UNDEFINED,	/* undefined */
+	LI_RADIUS,	/* radius */
+	LI_TLS,	/* tls */
+	LI_TFTP,	/* tftp */
+	LI_STUN,	/* stun */
+	LI_FTP,	/* ftp */
+	LI_IMPP,	/* impp */
+	LI_SIP,	/* sip */
+	LI_NTP,	/* ntp */
+	LI_RTCP,	/* rtcp */
+	LI_SMTP,	/* smtp */
+	LI_OPENVPN,	/* openvpn */
+	LI_HTTP,	/* http */
+	LI_SYSLOG,	/* syslog */
+	LI_IMAP,	/* imap */
+	LI_SNMP,	/* snmp */
+	LI_IRC,	/* irc */
+	LI_TELNET,	/* telnet */
+	LI_IKE,	/* ike */
+	LI_RIP,	/* rip */
+	LI_IGMP,	/* igmp */
+	LI_DHCP,	/* dhcp */
+	LI_ICMP,	/* icmp */
+};
+
+static const struct peak_lis *const li_items[LI_MAX] = {
+	[LI_ICMP] = &apps[0],
+	[LI_IGMP] = &apps[1],
+	[LI_OSPF] = &apps[2],
+	[LI_L2TP] = &apps[3],
+	[LI_PPTP] = &apps[4],
+	[LI_HTTP] = &apps[5],
+	[LI_RTSP] = &apps[6],
+	[LI_POP3] = &apps[7],
+	[LI_IMAP] = &apps[8],
+	[LI_SMTP] = &apps[9],
+	[LI_FTP] = &apps[10],
+	[LI_CVS] = &apps[11],
+	[LI_SSH] = &apps[12],
+	[LI_IRC] = &apps[13],
+	[LI_STUN] = &apps[14],
+	[LI_SIP] = &apps[15],
+	[LI_RIP] = &apps[16],
+	[LI_RADIUS] = &apps[17],
+	[LI_BGP] = &apps[18],
+	[LI_IKE] = &apps[19],
+	[LI_NETFLOW] = &apps[20],
+	[LI_TFTP] = &apps[21],
+	[LI_DHCP] = &apps[22],
+	[LI_DTLS] = &apps[23],
+	[LI_TLS] = &apps[24],
+	[LI_LDAP] = &apps[25],
+	[LI_SNMP] = &apps[26],
+	[LI_BITTORRENT] = &apps[27],
+	[LI_GNUTELLA] = &apps[28],
+	[LI_IMPP] = &apps[29],
+	[LI_XMPP] = &apps[30],
+	[LI_SYSLOG] = &apps[31],
+	[LI_NTP] = &apps[33],
+	[LI_DNS] = &apps[34],
+	[LI_OPENVPN] = &apps[35],
+	[LI_RTCP] = &apps[36],
+	[LI_NETBIOS] = &apps[37],
+	[LI_TELNET] = &apps[38],
+	[LI_RTP] = &apps[39],
+	[LI_UNDEFINED] = &apps[40],
+};
+
+/*
+ * End of autogenerated lookup section.
+ */
+
+static inline unsigned int
+peak_li_sig_match(const struct peak_li_sig *sig,
+    const struct peak_packet *packet)
+{
+	uint64_t word[lengthof(sig->value)] = { 0 };
+	unsigned int hit, i;
+	size_t avail;
+
+	/*
+	 * Collect all the cheap verdicts without branching
+	 * and only look at the payload when they all agree.
+	 */
+	hit = (packet->app_len >= sig->min) &
+	    (packet->app_len <= sig->max) &
+	    ((sig->proto[0] == LI_SIG_ANY) |
+	    (sig->proto[0] == packet->net_type) |
+	    (sig->proto[1] == packet->net_type));
+
+	hit &= !sig->port[0] |
+	    (sig->port[0] == packet->flow_sport) |
+	    (sig->port[0] == packet->flow_dport) |
+	    (sig->port[1] && (sig->port[1] == packet->flow_sport ||
+	    sig->port[1] == packet->flow_dport)) |
+	    (sig->port[2] && (sig->port[2] == packet->flow_sport ||
+	    sig->port[2] == packet->flow_dport)) |
+	    (sig->port[3] && (sig->port[3] == packet->flow_sport ||
+	    sig->port[3] == packet->flow_dport));
+
+	if (!hit) {
+		return (0);
+	}
+
+	/* the loader made sure that `min' covers `offset' */
+	avail = packet->app_len - sig->offset;
+	if (likely(avail >= sizeof(word))) {
+		memcpy(word, &packet->app.raw[sig->offset], sizeof(word));
+	} else {
+		memcpy(word, &packet->app.raw[sig->offset], avail);
+	}
+
+	for (i = 0, hit = 0; i < lengthof(word); ++i) {
+		hit |= !!((word[i] ^ sig->value[i]) & sig->mask[i]);
+	}
+
+	return (!hit);
+}
+
+static unsigned int
+peak_li_sig_get(const struct peak_packet *packet, const unsigned int number)
+{
+	const unsigned int index = LI_INDEX(packet->net_type);
+	const struct peak_li_sig *sig = li_db.index[index];
+	unsigned int i;
+
+	for (i = 0; i < li_db.count[index]; ++i, ++sig) {
+		if ((number == LI_UNKNOWN || number == sig->number) &&
+		    peak_li_sig_match(sig, packet)) {
+			return (sig->number);
+		}
+	}
+
+	return (LI_UNKNOWN);
+}
+
+static int
+peak_li_sig_check(const struct peak_li_hdr *hdr,
+    const struct peak_li_app *app, const struct peak_li_sig *sig)
+{
+	unsigned int i;
+
+	for (i = 0; i < hdr->app_count; ++i, ++app) {
+		if (app->number != LI_MAX + i ||
+		    app->name[sizeof(app->name) - 1] != '\0' ||
+		    app->pretty[sizeof(app->pretty) - 1] != '\0' ||
+		    app->cat[sizeof(app->cat) - 1] != '\0' ||
+		    app->desc[sizeof(app->desc) - 1] != '\0') {
+			warning("malformed application %u\n", i);
+			return (1);
+		}
+	}
+
+	for (i = 0; i < hdr->sig_count; ++i, ++sig) {
+		if (sig->number <= LI_UNDEFINED ||
+		    sig->number >= LI_MAX + hdr->app_count ||
+		    sig->min < sig->offset || sig->min > sig->max) {
+			warning("malformed signature %u\n", i);
+			return (1);
+		}
+	}
+
+	return (0);
+}
+
+void
+peak_li_unload(void)
+{
+	unsigned int i;
+
+	if (!li_db.map) {
+		return;
+	}
+
+	for (i = 0; i < LI_INDEX_MAX; ++i) {
+		free(li_db.index[i]);
+	}
+
+	free(li_db.apps);
+	free(li_db.names);
+	munmap(li_db.map, li_db.size);
+
+	memset(&li_db, 0, sizeof(li_db));
+}
+
+unsigned int
+peak_li_load(const char *file)
+{
+	const struct peak_li_hdr *hdr;
+	const struct peak_li_app *app;
+	const struct peak_li_sig *sig;
+	struct stat st;
+	unsigned int i, j;
+	int fd;
+
+	peak_li_unload();
+
+	if (!file) {
+		file = LI_DEFAULT;
+	}
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		warning("could not open file `%s'\n", file);
+		return (0);
+	}
+
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*hdr)) {
+		warning("file header not available\n");
+		goto peak_li_load_out;
+	}
+
+	li_db.map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (li_db.map == MAP_FAILED) {
+		warning("could not map file `%s'\n", file);
+		li_db.map = NULL;
+		goto peak_li_load_out;
+	}
+
+	li_db.size = st.st_size;
+	hdr = li_db.map;
+
+	if (hdr->magic != LI_MAGIC) {
+		warning("file magic mismatch\n");
+		goto peak_li_load_fail;
+	}
+
+	if (hdr->revision != LI_REVISION) {
+		warning("file revision mismatch: got %u, want %u\n",
+		    hdr->revision, LI_REVISION);
+		goto peak_li_load_fail;
+	}
+
+	if (hdr->base != LI_MAX) {
+		/* numbering is baked into the file */
+		warning("file base mismatch: got %u, want %u\n",
+		    hdr->base, LI_MAX);
+		goto peak_li_load_fail;
+	}
+
+	if (li_db.size != sizeof(*hdr) + (size_t)hdr->app_count *
+	    sizeof(*app) + (size_t)hdr->sig_count * sizeof(*sig)) {
+		warning("file not complete\n");
+		goto peak_li_load_fail;
+	}
+
+	app = (const void *)(hdr + 1);
+	sig = (const void *)(app + hdr->app_count);
+
+	if (peak_li_sig_check(hdr, app, sig)) {
+		goto peak_li_load_fail;
+	}
+
+	if (hdr->app_count) {
+		li_db.apps = reallocarray(NULL, hdr->app_count,
+		    sizeof(*li_db.apps));
+		if (!li_db.apps) {
+			warning("memory allocation failed\n");
+			goto peak_li_load_fail;
+		}
+	}
+
+	for (i = 0; i < hdr->app_count; ++i) {
+		struct peak_lis *elm = &li_db.apps[i];
+
+		memset(elm, 0, sizeof(*elm));
+
+		elm->proto[0] = elm->proto[1] = IPPROTO_MAX;
+		elm->number = app[i].number;
+		elm->name = app[i].name;
+		elm->pretty = app[i].pretty;
+		elm->desc = app[i].desc;
+		elm->cat = app[i].cat;
+	}
+
+	li_db.app_count = hdr->app_count;
+
+	if (hdr->app_count) {
+		/* keep the name table at most half full */
+		j = 2;
+		while (j < hdr->app_count * 2) {
+			j <<= 1;
+		}
+
+		li_db.names = calloc(j, sizeof(*li_db.names));
+		if (!li_db.names) {
+			warning("memory allocation failed\n");
+			goto peak_li_load_fail;
+		}
+
+		li_db.names_mask = j - 1;
+
+		for (i = 0; i < hdr->app_count; ++i) {
+			j = hash_lower(li_db.apps[i].name) &
+			    li_db.names_mask;
+			while (li_db.names[j]) {
+				j = (j + 1) & li_db.names_mask;
+			}
+			li_db.names[j] = i + 1;
+		}
+	}
+
+	/*
+	 * Split the signatures into one table per IP type
+	 * so that the evaluation doesn't need to skip over
+	 * entries that can't match anyway.  Order is kept.
+	 */
+	for (i = 0; i < LI_INDEX_MAX; ++i) {
+		li_db.index[i] = reallocarray(NULL, hdr->sig_count + 1,
+		    sizeof(*sig));
+		if (!li_db.index[i]) {
+			warning("memory allocation failed\n");
+			goto peak_li_load_fail;
+		}
+	}
+
+	for (i = 0; i < hdr->sig_count; ++i) {
+		for (j = 0; j < LI_INDEX_MAX; ++j) {
+			if (sig[i].proto[0] != LI_SIG_ANY &&
+			    LI_INDEX(sig[i].proto[0]) != j &&
+			    LI_INDEX(sig[i].proto[1]) != j) {
+				continue;
+			}
+
+			li_db.index[j][li_db.count[j]++] = sig[i];
+		}
+	}
+
+	close(fd);
+
+	warning("successfully loaded %u signatures\n", hdr->sig_count);
+
+	return (hdr->sig_count);
+
+peak_li_load_fail:
+
+	peak_li_unload();
+
+peak_li_load_out:
+
+	close(fd);
+
+	return (0);
+}
+
 unsigned int
 peak_li_test(const struct peak_packet *packet, const unsigned int number)
 {
@@ -1857,11 +2260,16 @@ peak_li_test(const struct peak_packet *packet, const unsigned int number)
 		if (apps[i].number == number &&
 		    (apps[i].proto[0] == packet->net_type ||
 		     apps[i].proto[1] == packet->net_type)) {
-			return (apps[i].function(packet));
+			const unsigned int ret = apps[i].function(packet);
+			if (ret) {
+				return (ret);
+			}
+			break;
 		}
 	}
 
-	return (0);
+	return (number != LI_UNKNOWN &&
+	    peak_li_sig_get(packet, number) == number);
 }
 
 unsigned int
@@ -1881,6 +2289,14 @@ peak_li_get(const struct peak_packet *packet)
 		break;
 	}
 
+	if (li_db.map) {
+		/* loaded signatures may override built-ins */
+		i = peak_li_sig_get(packet, LI_UNKNOWN);
+		if (i) {
+			return (i);
+		}
+	}
+
 	for (i = 0; i < lengthof(apps); ++i) {
 		if ((apps[i].proto[0] == packet->net_type) ||
 		    (apps[i].proto[1] == packet->net_type)) {
@@ -1899,20 +2315,152 @@ peak_li_get(const struct peak_packet *packet)
 	return (packet->app_len ? LI_UNDEFINED : LI_UNKNOWN);
 }
 
+/* app indexes are stored as bytes */
+_Static_assert(lengthof(apps) <= UINT8_MAX + 1,
+    "too many applications for li_burst_apps");
+
+static uint8_t li_burst_apps[LI_INDEX_MAX][lengthof(apps)];
+static unsigned int li_burst_count[LI_INDEX_MAX];
+static pthread_once_t li_burst_once = PTHREAD_ONCE_INIT;
+
+static void
+peak_li_burst_init(void)
+{
+	unsigned int i, j;
+
+	/* candidate applications per IP type, order is kept */
+	for (i = 0; i < lengthof(apps); ++i) {
+		for (j = 0; j < LI_INDEX_MAX; ++j) {
+			if (j == LI_INDEX_OTHER ||
+			    LI_INDEX(apps[i].proto[0]) == j ||
+			    LI_INDEX(apps[i].proto[1]) == j) {
+				li_burst_apps[j][li_burst_count[j]++] = i;
+			}
+		}
+	}
+}
+
+uint64_t
+peak_li_get_burst(const struct peak_packet *const *packets,
+    unsigned int *result, const unsigned int count, uint64_t mask)
+{
+	uint64_t cand, pending, groups[LI_INDEX_MAX] = { 0 };
+	unsigned int i, j, k;
+
+	pthread_once(&li_burst_once, peak_li_burst_init);
+
+	if (count < LI_BURST_MAX) {
+		mask &= (1ull << count) - 1;
+	}
+
+	/*
+	 * Sort out the trivial cases first and group the rest
+	 * by IP type.  This way each application function runs
+	 * over all of its candidates in one go, keeping caches
+	 * and branch history warm instead of thrashing around
+	 * on mixed traffic.
+	 */
+	for (cand = mask; cand; cand &= cand - 1) {
+		const struct peak_packet *packet;
+
+		i = __builtin_ctzll(cand);
+		packet = packets[i];
+
+		switch (packet->net_type) {
+		case IPPROTO_TCP:
+		case IPPROTO_UDP:
+			/* payload needed for these */
+			if (!packet->app_len) {
+				result[i] = LI_UNKNOWN;
+				continue;
+			}
+			/* FALLTHROUGH */
+		default:
+			break;
+		}
+
+		if (li_db.map) {
+			result[i] = peak_li_sig_get(packet, LI_UNKNOWN);
+			if (result[i]) {
+				continue;
+			}
+		}
+
+		groups[LI_INDEX(packet->net_type)] |= 1ull << i;
+	}
+
+	for (i = 0; i < LI_INDEX_MAX; ++i) {
+		pending = groups[i];
+
+		/* application order is kept, so the first match wins */
+		for (j = 0; pending && j < li_burst_count[i]; ++j) {
+			const struct peak_lis *app =
+			    &apps[li_burst_apps[i][j]];
+
+			for (cand = pending; cand; cand &= cand - 1) {
+				k = __builtin_ctzll(cand);
+
+				if (i == LI_INDEX_OTHER &&
+				    app->proto[0] != packets[k]->net_type &&
+				    app->proto[1] != packets[k]->net_type) {
+					continue;
+				}
+
+				if (app->function(packets[k])) {
+					result[k] = app->number;
+					pending &= ~(1ull << k);
+				}
+			}
+		}
+
+		for (; pending; pending &= pending - 1) {
+			k = __builtin_ctzll(pending);
+			result[k] = packets[k]->app_len ?
+			    LI_UNDEFINED : LI_UNKNOWN;
+		}
+	}
+
+	/* let the caller know who is done */
+	for (cand = mask; cand; cand &= cand - 1) {
+		k = __builtin_ctzll(cand);
+		if (result[k] == LI_UNKNOWN) {
+			mask &= ~(1ull << k);
+		}
+	}
+
+	return (mask);
+}
+
 unsigned int
 peak_li_number(const char *name)
 {
-	unsigned int i;
+	unsigned int i, number;
 
 	/*
 	 * The reverse protocol lookup is mostly meant for use
 	 * in a parser so that we can externalise the intel for
-	 * all apps to the place where it comes from.  This is
-	 * even better than rolling out script-generated lists.
+	 * all apps to the place where it comes from.  It runs
+	 * often enough to warrant a generated perfect hash for
+	 * the built-in apps, see scripts/lookup_update.py.
 	 */
-	for (i = 0; i < lengthof(apps); ++i) {
-		if (!strcasecmp(name, apps[i].name)) {
-			return (apps[i].number);
+	number = HASH_PERFECT(name, li_disp, li_slot);
+	if (!strcasecmp(name, li_items[number]->name)) {
+		return (number);
+	}
+
+	if (li_db.names) {
+		i = hash_lower(name) & li_db.names_mask;
+
+		/* open addressing, zero marks the end of the chain */
+		while (li_db.names[i]) {
+			const struct peak_lis *app =
+			    &li_db.apps[li_db.names[i] - 1];
+
+			if (!strcasecmp(name, app->name)) {
+				return (app->number);
+			}
+
+			i = (i + 1) & li_db.names_mask;
 		}
 	}
 
@@ -1926,20 +2474,23 @@ peak_li_number(const char *name)
 static inline const char *
 peak_li_data(const unsigned int number, const unsigned int offset)
 {
-	unsigned int i;
+	const struct peak_lis *app = NULL;
 
 	switch (number) {
 	case LI_UNKNOWN:
 		return ("unknown");
 	default:
-		for (i = 0; i < lengthof(apps); ++i) {
-			if (number == apps[i].number) {
-				const register unsigned long *base =
-				    (const unsigned long *)
-				    (((const char *)&apps[i]) + offset);
+		if (number < LI_MAX) {
+			app = li_items[number];
+		} else if (number - LI_MAX < li_db.app_count) {
+			app = &li_db.apps[number - LI_MAX];
+		}
+		if (app) {
+			const register unsigned long *base =
+			    (const unsigned long *)
+			    (((const char *)app) + offset);
 
-				return ((const char *)*base);
-			}
+			return ((const char *)*base);
 		}
 		panic("application %u caused a failure\n", number);
 		/* NOTREACHED */
@@ -81,16 +81,65 @@ enum {
 	LI_OSPF,
 	LI_ICMP,
 	LI_IGMP,
+	/*
+	 * Applications loaded from a signature file are
+	 * numbered starting here, so don't put anything
+	 * else past this point.
+	 */
+	LI_MAX
+};
+
+#define LI_BURST_MAX	64	/* packets per burst */
+
+#define LI_MAGIC	0x11516A7E11516A7Eull
+#define LI_REVISION	1
+
+#define LI_SIG_ANY	0xFFFF	/* match all IP types */
+#define LI_SIG_LEN	16	/* maximum pattern length */
+#define LI_SIG_PORTS	4	/* maximum port hints */
+
+struct peak_li_hdr {
+	uint64_t magic;
+	uint32_t revision;
+	uint32_t base;
+	uint32_t app_count;
+	uint32_t sig_count;
+};
+
+struct peak_li_app {
+	uint32_t number;
+	uint32_t reserved;
+	char name[24];
+	char pretty[64];
+	char cat[32];
+	char desc[256];
+};
+
+struct peak_li_sig {
+	uint64_t value[LI_SIG_LEN / sizeof(uint64_t)];
+	uint64_t mask[LI_SIG_LEN / sizeof(uint64_t)];
+	uint16_t proto[2];
+	uint16_t port[LI_SIG_PORTS];
+	uint16_t offset;
+	uint16_t min;
+	uint16_t max;
+	uint16_t reserved;
+	uint32_t number;
+	uint32_t reserved2;
 };
 
 unsigned int	 peak_li_test(const struct peak_packet *,
 		     const unsigned int);
 unsigned int	 peak_li_get(const struct peak_packet *);
+uint64_t	 peak_li_get_burst(const struct peak_packet *const *,
+		     unsigned int *, const unsigned int, uint64_t);
 const char	*peak_li_name(const unsigned int);
 const char	*peak_li_pretty(const unsigned int);
 const char	*peak_li_desc(const unsigned int);
 const char	*peak_li_cat(const unsigned int);
 unsigned int	 peak_li_number(const char *);
+unsigned int	 peak_li_load(const char *);
+void		 peak_li_unload(void);
 
 static inline unsigned int
 peak_li_merge(const uint16_t array[2])
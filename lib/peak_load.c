@@ -15,23 +15,132 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <peak.h>
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 
 #define LOAD_FROM_USER(x)	(((struct _peak_load *)((x) + 1)) - 1)
 #define LOAD_TO_USER(x)		&(x)->data
 
+struct peak_load_slot {
+	struct peak_load_pkt pkt;
+	unsigned int len;
+	size_t bytes;
+};
+
+#define LOAD_RING	4096			/* read-ahead descriptors */
+#define LOAD_ARENA	(2 * LOAD_BUFFER)	/* read-ahead copies */
+#define LOAD_SPIN	64			/* yields before sleeping */
+#define LOAD_NAP	1000000			/* longest sleep in ns */
+
+struct peak_load_ring {
+	struct peak_load_slot slot[LOAD_RING];
+	struct _peak_load *ahead;
+	uint8_t *arena;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* written by the producer */
+	size_t head;
+	uint64_t made;
+	uint64_t blocked;
+	unsigned int done;
+	unsigned int asleep;
+	/* written by the consumer */
+	size_t tail;
+	size_t next;
+	uint64_t freed;
+	uint64_t reported;
+	unsigned int stop;
+	unsigned int waiting;
+};
+
+#define LOAD_LOAD(x)	(*(volatile __typeof__(x) *)&(x))
+#define LOAD_STORE(x, y) (*(volatile __typeof__(x) *)&(x) = (y))
+
+struct peak_load_mark {
+	/* latest time before this packet */
+	int64_t sec;
+	int64_t usec;
+	uint64_t offset;
+	uint64_t packet;
+	uint32_t ll;
+	uint32_t reserved;
+};
+
+struct peak_load_index {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;
+	uint64_t count;
+	uint32_t interval;
+	uint32_t reserved;
+};
+
+#define LOAD_INDEX_MAGIC	0x50494458	/* "PIDX" */
+#define LOAD_INDEX_VERSION	1
+
+struct peak_load_merge {
+	struct peak_load **sources;
+	unsigned int *heap;
+	unsigned int count;
+	unsigned int used;
+	unsigned int primed;
+	unsigned int advance;
+};
+
 struct _peak_load {
+	struct peak_load_merge *merge;
+	struct peak_load_ring *ring;
+	struct peak_unpack *unpack;
 	uint32_t *netmon_table;
 	uint32_t netmon_count;
 	uint32_t netmon_pos;
 	time_t netmon_time;
+	unsigned int caplen;
+	unsigned int wirelen;
+	unsigned int snaplen;
+	unsigned int truncate;
 	unsigned int fmt;
 	int fd;
+	/* burst state */
+	unsigned int burst;
+	unsigned int stall;
+	/* window into the file */
+	uint8_t *mem;
+	size_t size;
+	size_t pos;
+	size_t end;
+	size_t pending;
+	off_t base;
+	unsigned int mapped;
+	/* compressed file mapping */
+	uint8_t *zmem;
+	size_t zsize;
+	/* random access */
+	struct peak_load_mark start;
+	struct peak_load_mark *marks;
+	size_t mark_count;
+	uint64_t count;
+	/* end of chunk */
+	off_t limit;
 	struct peak_load data;
 };
 
+#define LOAD_BUFFER	(4 * 1024 * 1024)	/* for pipes and friends */
+#define LOAD_WINDOW	(256 * 1024)		/* smallest buffer */
+#define LOAD_RECORDS	64			/* per buffer at snaplen */
+#define LOAD_INTERVAL	1024			/* packets per index mark */
+#define LOAD_PIPE	(1024 * 1024)		/* pipe size hint */
+#define LOAD_SNAPLEN	(256 * 1024)		/* largest sane record */
+#define LOAD_SYNC	4			/* records to resync on */
+#define LOAD_SKEW	(24 * 60 * 60)		/* seconds between them */
+
 struct erf_packet_header {
 	uint64_t ts;
 	uint8_t type;
@@ -125,42 +234,349 @@ struct netmon_record_header {
 #define NETMON_SEC(x)	(((x) * 10ll) / (10ll * 1000ll * 1000ll))
 #define NETMON_MAGIC	0x55424D47
 
+static inline ssize_t
+_peak_load_input(struct _peak_load *self, void *buf, const size_t len)
+{
+	ssize_t ret;
+
+	if (self->unpack) {
+		return (peak_unpack_read(self->unpack, buf, len));
+	}
+
+	do {
+		ret = read(self->fd, buf, len);
+	} while (ret < 0 && errno == EINTR);
+
+	return (ret);
+}
+
+static unsigned int
+_peak_load_resize(struct _peak_load *self, const size_t size)
+{
+	const size_t have = self->end - self->pos;
+	uint8_t *mem;
+
+	if (self->mapped || size == self->size) {
+		return (1);
+	}
+
+	if (self->burst || have > size) {
+		return (0);
+	}
+
+	if (self->end > size) {
+		/* drop what was already consumed */
+		memmove(self->mem, self->mem + self->pos, have);
+		self->base += self->pos;
+		self->end = have;
+		self->pos = 0;
+	}
+
+	mem = realloc(self->mem, size);
+	if (!mem) {
+		return (0);
+	}
+
+	self->mem = mem;
+	self->size = size;
+
+	return (1);
+}
+
+static size_t
+_peak_load_window(struct _peak_load *self, unsigned int snaplen)
+{
+	if (self->truncate && (!snaplen || self->truncate < snaplen)) {
+		snaplen = self->truncate;
+	}
+
+	if (!snaplen) {
+		/* anything goes */
+		return (LOAD_BUFFER);
+	}
+
+	/* still plenty of records per read */
+	return (MIN(LOAD_BUFFER, MAX(LOAD_WINDOW,
+	    ((size_t)snaplen + 64) * LOAD_RECORDS)));
+}
+
+/*
+ * All formats look at the trace through a window: either
+ * the whole mapped file or a buffer that is filled with
+ * big reads.  Its size follows the snaplen of the trace.
+ * Records that straddle the end of the buffer are moved
+ * to the front before reading more.
+ */
+static unsigned int
+_peak_load_fill(struct _peak_load *self, const size_t len)
+{
+	ssize_t ret;
+
+	if (likely(self->end - self->pos >= len)) {
+		return (1);
+	}
+
+	if (self->mapped || len > LOAD_BUFFER) {
+		return (0);
+	}
+
+	if (self->burst) {
+		/* earlier packets of the burst must stay put */
+		self->stall = 1;
+		return (0);
+	}
+
+	if (len > self->size) {
+		/* the snaplen was a lie, make room */
+		if (!_peak_load_resize(self, MIN(LOAD_BUFFER,
+		    MAX(len, 2 * self->size)))) {
+			return (0);
+		}
+	}
+
+	memmove(self->mem, self->mem + self->pos, self->end - self->pos);
+	self->base += self->pos;
+	self->end -= self->pos;
+	self->pos = 0;
+
+	do {
+		ret = _peak_load_input(self, self->mem + self->end,
+		    self->size - self->end);
+		if (ret <= 0) {
+			return (0);
+		}
+		self->end += ret;
+	} while (self->end < len);
+
+	return (1);
+}
+
+static inline unsigned int
+_peak_load_fits(struct _peak_load *self, const size_t len)
+{
+	/* the mapping has no size limit, the file has */
+	return (self->mapped || len <= self->size);
+}
+
+static inline unsigned int
+_peak_load_peek(struct _peak_load *self, void *buf, const size_t len)
+{
+	if (!_peak_load_fill(self, len)) {
+		return (0);
+	}
+
+	memcpy(buf, self->mem + self->pos, len);
+
+	return (1);
+}
+
+static unsigned int
+_peak_load_direct(struct _peak_load *self, uint8_t *buf, size_t len)
+{
+	const size_t have = self->end - self->pos;
+	ssize_t ret;
+
+	if (self->burst) {
+		self->stall = 1;
+		return (0);
+	}
+
+	/* too big for the buffer, bypass it */
+	memcpy(buf, self->mem + self->pos, have);
+	self->base += self->end;
+	self->pos = self->end = 0;
+	buf += have;
+	len -= have;
+
+	while (len) {
+		ret = _peak_load_input(self, buf, len);
+		if (ret <= 0) {
+			return (0);
+		}
+		self->base += ret;
+		buf += ret;
+		len -= ret;
+	}
+
+	return (1);
+}
+
+static inline unsigned int
+_peak_load_read(struct _peak_load *self, void *buf, const size_t len)
+{
+	if (unlikely(!_peak_load_fits(self, len))) {
+		return (_peak_load_direct(self, buf, len));
+	}
+
+	if (!_peak_load_peek(self, buf, len)) {
+		return (0);
+	}
+
+	self->pos += len;
+
+	return (1);
+}
+
+static inline uint8_t *
+_peak_load_take(struct _peak_load *self, const size_t len)
+{
+	uint8_t *ret;
+
+	if (!_peak_load_fill(self, len)) {
+		return (NULL);
+	}
+
+	/* zero-copy: valid until the next call */
+	ret = self->mem + self->pos;
+	self->pos += len;
+
+	return (ret);
+}
+
+static unsigned int
+_peak_load_skip(struct _peak_load *self, size_t len)
+{
+	ssize_t ret;
+
+	if (self->end - self->pos >= len || self->mapped) {
+		self->pos += MIN(len, self->end - self->pos);
+		return (1);
+	}
+
+	if (self->burst) {
+		self->stall = 1;
+		return (0);
+	}
+
+	len -= self->end - self->pos;
+	self->base += self->end;
+	self->pos = self->end = 0;
+
+	if (!self->unpack && lseek(self->fd, len, SEEK_CUR) >= 0) {
+		self->base += len;
+		return (1);
+	}
+
+	/* pipes can't seek, read it all */
+	while (len) {
+		ret = _peak_load_input(self, self->mem,
+		    MIN(len, self->size));
+		if (ret <= 0) {
+			return (0);
+		}
+		self->base += ret;
+		len -= ret;
+	}
+
+	return (1);
+}
+
+static uint8_t *
+_peak_load_payload(struct _peak_load *self, const size_t len)
+{
+	size_t want = len;
+	uint8_t *ret;
+
+	if (self->truncate && want > self->truncate) {
+		want = self->truncate;
+	}
+
+	if (!self->mapped && want > LOAD_BUFFER) {
+		/* hand out what fits, but not silently */
+		want = LOAD_BUFFER;
+	}
+
+	ret = _peak_load_take(self, want);
+	if (!ret) {
+		return (NULL);
+	}
+
+	if (want < len && want == LOAD_BUFFER) {
+		peak_audit_inc(AUDIT_LOAD_TRUNCATED);
+	}
+
+	/* the rest is skipped before the next record */
+	self->pending = len - want;
+	self->caplen = want;
+
+	return (ret);
+}
+
+static unsigned int
+_peak_load_seek(struct _peak_load *self, const off_t off)
+{
+	self->pending = 0;
+
+	if (off >= self->base && off - self->base <= (off_t)self->end) {
+		self->pos = off - self->base;
+		return (1);
+	}
+
+	if (self->mapped) {
+		self->pos = self->end;
+		return (0);
+	}
+
+	if (self->burst) {
+		self->stall = 1;
+		return (0);
+	}
+
+	if (self->unpack) {
+		/* can't go back in a compressed stream */
+		self->pos = self->end;
+		return (0);
+	}
+
+	self->pos = self->end = 0;
+	self->base = lseek(self->fd, off, SEEK_SET) < 0 ? -1 : off;
+
+	return (self->base >= 0);
+}
+
+static inline unsigned int
+_peak_load_over(struct _peak_load *self)
+{
+	/* chunks end where the next one begins */
+	return (self->limit && self->base + (off_t)(self->pos +
+	    self->pending) >= self->limit);
+}
+
 static void
 _peak_load_erf(struct _peak_load *self)
 {
 	struct erf_packet_header hdr;
-	ssize_t ret;
+	uint8_t *buf;
 
-	ret = read(self->fd, &hdr, sizeof(hdr));
-	if (ret != sizeof(hdr)) {
+	if (!_peak_load_read(self, &hdr, sizeof(hdr))) {
 		return;
 	}
 
 	hdr.rlen = be16dec(&hdr.rlen) - sizeof(hdr);
 	hdr.wlen = be16dec(&hdr.wlen);
 
-	if (sizeof(self->data.buf) < hdr.rlen) {
+	buf = _peak_load_payload(self, hdr.rlen);
+	if (!buf) {
 		return;
 	}
 
-	ret = read(self->fd, self->data.buf, hdr.rlen);
-	if (ret != hdr.rlen) {
-		return;
-	}
+	self->data.buf = buf;
+	self->wirelen = hdr.wlen;
+	/* records are padded, don't hand that out */
+	self->caplen = MIN(self->caplen, hdr.wlen);
 
 	self->data.ts.tv_usec = ERF_USEC(hdr.ts);
 	self->data.ts.tv_sec = ERF_SEC(hdr.ts);
-	self->data.len = hdr.wlen;
+	self->data.len = self->caplen;
 }
 
 static void
 _peak_load_pcap(struct _peak_load *self)
 {
 	struct pcap_packet_header hdr;
-	ssize_t ret;
+	uint8_t *buf;
 
-	ret = read(self->fd, &hdr, sizeof(hdr));
-	if (ret != sizeof(hdr)) {
+	if (!_peak_load_read(self, &hdr, sizeof(hdr))) {
 		return;
 	}
 
@@ -171,18 +587,16 @@ _peak_load_pcap(struct _peak_load *self)
 		hdr.ts_sec = bswap32(hdr.ts_sec);
 	}
 
-	if (sizeof(self->data.buf) < hdr.incl_len) {
-		return;
-	}
-
-	ret = read(self->fd, self->data.buf, hdr.incl_len);
-	if (ret != hdr.incl_len) {
+	buf = _peak_load_payload(self, hdr.incl_len);
+	if (!buf) {
 		return;
 	}
 
 	self->data.ts.tv_usec = hdr.ts_usec;
 	self->data.ts.tv_sec = hdr.ts_sec;
-	self->data.len = hdr.incl_len;
+	self->data.len = self->caplen;
+	self->wirelen = hdr.orig_len;
+	self->data.buf = buf;
 }
 
 static void
@@ -191,32 +605,31 @@ _peak_load_pcapng(struct _peak_load *self)
 	struct pcapng_enhanced_pkt_header pkt;
 	struct pcapng_iface_desc_header iface;
 	struct pcapng_block_header hdr;
-	ssize_t ret;
+	uint8_t *buf;
 	int64_t ts;
 
 _peak_load_pcapng_again:
 
-	ret = read(self->fd, &hdr, sizeof(hdr));
-	if (ret != sizeof(hdr)) {
+	if (_peak_load_over(self) ||
+	    !_peak_load_read(self, &hdr, sizeof(hdr))) {
 		return;
 	}
 
-	if (sizeof(self->data.buf) < hdr.length) {
+	if (hdr.length < sizeof(hdr)) {
 		return;
 	}
 
 	switch (hdr.type) {
 	case 2: /* packet block (obsolete) */
 	case 6:	/* enhanced packet block */
-		ret = read(self->fd, &pkt, sizeof(pkt));
-		if (ret != sizeof(pkt)) {
+		if (hdr.length < sizeof(hdr) + sizeof(pkt) ||
+		    !_peak_load_read(self, &pkt, sizeof(pkt))) {
 			return;
 		}
 
-		ret = read(self->fd, self->data.buf, hdr.length -
+		buf = _peak_load_payload(self, hdr.length -
 		    sizeof(hdr) - sizeof(pkt));
-		if (ret != (ssize_t)(hdr.length -
-		    sizeof(hdr) - sizeof(pkt))) {
+		if (!buf) {
 			return;
 		}
 
@@ -224,19 +637,31 @@ _peak_load_pcapng_again:
 
 		self->data.ts.tv_usec = ts % (1000ll * 1000ll);
 		self->data.ts.tv_sec = ts / 1000ll / 1000ll;
-		self->data.len = pkt.packetlen;
+		self->caplen = MIN(pkt.capturelen, self->caplen);
+		self->wirelen = pkt.packetlen;
+		self->data.len = self->caplen;
+		self->data.buf = buf;
 
 		break;
 	case 1:	/* interface description block */
-		ret = read(self->fd, &iface, sizeof(iface));
-		if (ret != sizeof(iface)) {
+		if (hdr.length < sizeof(hdr) + sizeof(iface) ||
+		    !_peak_load_read(self, &iface, sizeof(iface))) {
 			return;
 		}
 
-		lseek(self->fd, hdr.length - sizeof(hdr) - sizeof(iface),
-		    SEEK_CUR);
+		if (!_peak_load_skip(self, hdr.length - sizeof(hdr) -
+		    sizeof(iface))) {
+			return;
+		}
 
 		self->data.ll = iface.linktype;
+		self->snaplen = iface.snaplen;
+
+		if (self->size < _peak_load_window(self, self->snaplen)) {
+			/* best effort, records still make room */
+			_peak_load_resize(self,
+			    _peak_load_window(self, self->snaplen));
+		}
 
 		goto _peak_load_pcapng_again;
 	default:
@@ -245,7 +670,9 @@ _peak_load_pcapng_again:
 		 * closely.  A new section may begin here as well,
 		 * but we mop up the link type change above anyway.
 		 */
-		lseek(self->fd, hdr.length - sizeof(hdr), SEEK_CUR);
+		if (!_peak_load_skip(self, hdr.length - sizeof(hdr))) {
+			return;
+		}
 		goto _peak_load_pcapng_again;
 	}
 }
@@ -254,42 +681,54 @@ static void
 _peak_load_netmon(struct _peak_load *self)
 {
 	struct netmon_record_header hdr;
-	ssize_t ret;
+	uint8_t *buf;
 
 	if (self->netmon_pos == self->netmon_count) {
 		/* all packets are read */
 		return;
 	}
 
-	lseek(self->fd, self->netmon_table[self->netmon_pos++], SEEK_SET);
-
-	ret = read(self->fd, &hdr, sizeof(hdr));
-	if (ret != sizeof(hdr)) {
+	if (!_peak_load_seek(self,
+	    self->netmon_table[self->netmon_pos++])) {
 		return;
 	}
 
-	if (sizeof(self->data.buf) < hdr.include_length) {
+	if (!_peak_load_read(self, &hdr, sizeof(hdr))) {
 		return;
 	}
 
-	ret = read(self->fd, self->data.buf, hdr.include_length);
-	if (ret != hdr.include_length) {
+	buf = _peak_load_payload(self, hdr.include_length);
+	if (!buf) {
 		return;
 	}
 
+	self->data.buf = buf;
+	self->wirelen = hdr.original_length;
+
 	self->data.ts.tv_usec = NETMON_USEC(hdr.time_stamp_data);
 	self->data.ts.tv_sec = NETMON_SEC(hdr.time_stamp_data) +
 	    self->netmon_time;
-	self->data.len = hdr.original_length;
+	self->data.len = self->caplen;
 }
 
-unsigned int
-peak_load_packet(struct peak_load *self_user)
+static unsigned int
+_peak_load_next(struct _peak_load *self)
 {
-	struct _peak_load *self = LOAD_FROM_USER(self_user);
-
 	self->data.len = 0;
 
+	if (self->pending) {
+		/* the rest of a cut record */
+		if (self->fmt != NETMON_MAGIC &&
+		    !_peak_load_skip(self, self->pending)) {
+			return (0);
+		}
+		self->pending = 0;
+	}
+
+	if (self->fmt != NETMON_MAGIC && _peak_load_over(self)) {
+		return (0);
+	}
+
 	switch (self->fmt) {
 	case ERF_MAGIC:
 		_peak_load_erf(self);
@@ -306,178 +745,1538 @@ peak_load_packet(struct peak_load *self_user)
 		break;
 	}
 
+	if (self->data.len) {
+		++self->count;
+	}
+
 	return (self->data.len);
 }
 
-struct peak_load *
-peak_load_init(const char *file)
+static void
+_peak_load_wake(struct peak_load_ring *ring, const unsigned int *sleeper)
 {
-	unsigned int ll = LINKTYPE_ETHERNET;
-	struct _peak_load *self = NULL;
-	uint32_t *netmon_table = NULL;
-	unsigned int fmt = ERF_MAGIC;
-	uint32_t netmon_length = 0;
-	time_t netmon_time = 0;
-	int fd = STDIN_FILENO;
+	if (unlikely(LOAD_LOAD(*sleeper))) {
+		pthread_mutex_lock(&ring->lock);
+		pthread_cond_broadcast(&ring->cond);
+		pthread_mutex_unlock(&ring->lock);
+	}
+}
 
-	if (file) {
-		uint32_t file_magic;
+static void
+_peak_load_nap(struct peak_load_ring *ring)
+{
+	struct timespec until;
+
+	/*
+	 * Wakers don't pay for a barrier on every packet, so
+	 * a wakeup may slip by.  The timeout puts a bound on
+	 * that, it's still a sleep rather than a busy wait.
+	 */
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_nsec += LOAD_NAP;
+	if (until.tv_nsec >= 1000000000) {
+		until.tv_nsec -= 1000000000;
+		++until.tv_sec;
+	}
 
-		fd = open(file, O_RDONLY);
-		if (fd < 0) {
-			goto peak_load_init_out;
-		}
+	pthread_cond_timedwait(&ring->cond, &ring->lock, &until);
+}
 
-		/* autodetect format if possible */
-		if (read(fd, &file_magic, sizeof(file_magic)) !=
-		    sizeof(file_magic)) {
-			goto peak_load_init_close;
-		}
+static inline int
+_peak_load_full(struct peak_load_ring *ring, const size_t need)
+{
+	return (ring->head - LOAD_LOAD(ring->tail) == LOAD_RING ||
+	    (ring->arena && ring->made + need - LOAD_LOAD(ring->freed) >
+	    LOAD_ARENA));
+}
 
-		/* rewind & pretend nothing happened */
-		lseek(fd, 0, SEEK_SET);
+static void *
+_peak_load_ahead(void *arg)
+{
+	struct peak_load_ring *ring = arg;
+	struct _peak_load *self = ring->ahead;
+	struct peak_load_slot *slot;
+	size_t len, pad, i;
+	volatile uint8_t touch;
+	unsigned int wait;
+
+	while (_peak_load_next(self)) {
+		len = self->caplen;
+		pad = 0;
+
+		if (ring->arena && ring->made % LOAD_ARENA + len > LOAD_ARENA) {
+			/* copies must be contiguous */
+			pad = LOAD_ARENA - ring->made % LOAD_ARENA;
+		}
 
-		switch (file_magic) {
-		case PCAP_SWAP_MAGIC:
-		case PCAP_MAGIC: {
-			struct pcap_file_header hdr;
+		for (wait = 0; _peak_load_full(ring, pad + len); ++wait) {
+			if (LOAD_LOAD(ring->stop)) {
+				goto _peak_load_ahead_out;
+			}
+			if (!wait) {
+				LOAD_STORE(ring->blocked, ring->blocked + 1);
+			}
+			if (wait < LOAD_SPIN) {
+				sched_yield();
+				continue;
+			}
 
-			if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
-				goto peak_load_init_close;
+			/* announce the nap, then look again */
+			pthread_mutex_lock(&ring->lock);
+			LOAD_STORE(ring->asleep, 1);
+			__sync_synchronize();
+			if (_peak_load_full(ring, pad + len) &&
+			    !LOAD_LOAD(ring->stop)) {
+				_peak_load_nap(ring);
 			}
+			LOAD_STORE(ring->asleep, 0);
+			pthread_mutex_unlock(&ring->lock);
+		}
 
-			fmt = PCAP_MAGIC;
-
-			if (file_magic == PCAP_SWAP_MAGIC) {
-				hdr.magic_number =
-				    bswap32(hdr.magic_number);
-				hdr.version_major =
-				    bswap16(hdr.version_major);
-				hdr.version_minor =
-				    bswap16(hdr.version_minor);
-				hdr.thiszone = bswap32(hdr.thiszone);
-				hdr.sigfigs = bswap32(hdr.sigfigs);
-				hdr.snaplen = bswap32(hdr.snaplen);
-				hdr.network = bswap32(hdr.network);
-				fmt = PCAP_SWAP_MAGIC;
+		/* the consumer must be done with the slot */
+		__sync_synchronize();
+
+		slot = &ring->slot[ring->head % LOAD_RING];
+		slot->pkt.buf = self->data.buf;
+		slot->pkt.ts = self->data.ts;
+		slot->pkt.len = len;
+		slot->pkt.wire = self->wirelen;
+		slot->pkt.ll = self->data.ll;
+		slot->len = self->data.len;
+		slot->bytes = 0;
+
+		if (ring->arena) {
+			/* buffered data moves, keep a copy */
+			slot->pkt.buf = ring->arena +
+			    (ring->made + pad) % LOAD_ARENA;
+			memcpy((uint8_t *)slot->pkt.buf, self->data.buf, len);
+			slot->bytes = pad + len;
+			ring->made += pad + len;
+		} else {
+			/* take the page faults here */
+			for (i = 0; i < len; i += 4096) {
+				touch = self->data.buf[i];
 			}
+		}
+
+		/* descriptor must be visible before the head is */
+		__sync_synchronize();
+		LOAD_STORE(ring->head, ring->head + 1);
+		_peak_load_wake(ring, &ring->waiting);
+	}
+
+  _peak_load_ahead_out:
+
+	__sync_synchronize();
+	LOAD_STORE(ring->done, 1);
+	_peak_load_wake(ring, &ring->waiting);
+
+	(void)touch;
+
+	return (NULL);
+}
+
+static unsigned int
+_peak_load_pop(struct peak_load_ring *ring, struct peak_load_slot **out,
+    const unsigned int count)
+{
+	uint64_t freed = ring->freed;
+	unsigned int i, wait;
+	size_t head;
 
-			ll = hdr.network;
+	/* hand back what was given out last time */
+	for (; ring->tail != ring->next; ++ring->tail) {
+		freed += ring->slot[ring->tail % LOAD_RING].bytes;
+	}
 
+	__sync_synchronize();
+	LOAD_STORE(ring->freed, freed);
+	LOAD_STORE(ring->tail, ring->next);
+	_peak_load_wake(ring, &ring->asleep);
+
+	for (wait = 0; (head = LOAD_LOAD(ring->head)) == ring->next;
+	    ++wait) {
+		if (LOAD_LOAD(ring->done)) {
+			/* the head may have moved before */
+			__sync_synchronize();
+			head = LOAD_LOAD(ring->head);
+			if (head == ring->next) {
+				return (0);
+			}
 			break;
 		}
-		case NETMON_MAGIC: {
-			struct netmon_file_header hdr;
-			struct tm base;
+		if (!wait) {
+			peak_audit_inc(AUDIT_LOAD_STALLS);
+		}
+		if (wait < LOAD_SPIN) {
+			sched_yield();
+			continue;
+		}
 
-			if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
-				goto peak_load_init_close;
-			}
+		/* slow pipe or cold disk, don't burn a core */
+		pthread_mutex_lock(&ring->lock);
+		LOAD_STORE(ring->waiting, 1);
+		__sync_synchronize();
+		if (LOAD_LOAD(ring->head) == ring->next &&
+		    !LOAD_LOAD(ring->done)) {
+			_peak_load_nap(ring);
+		}
+		LOAD_STORE(ring->waiting, 0);
+		pthread_mutex_unlock(&ring->lock);
+	}
 
-			if (hdr.version_minor != 0 ||
-			    hdr.version_major != 2) {
-				/* can only support version 2.0 for now */
-				goto peak_load_init_close;
-			}
+	__sync_synchronize();
 
-			if (hdr.network > 1) {
-				/*
-				 * Sorry for magic constant.  Both 0 and 1
-				 * are Ethernet packets.  The value is set
-				 * automatically.  Other link layers are
-				 * not supported.
-				 */
-				goto peak_load_init_close;
-			}
+	for (i = 0; i < count && ring->next != head; ++i) {
+		out[i] = &ring->slot[ring->next++ % LOAD_RING];
+	}
 
-			netmon_length = hdr.frame_table_length;
-			netmon_table = malloc(netmon_length);
-			if (!netmon_table) {
-				goto peak_load_init_close;
-			}
+	peak_audit_set(AUDIT_LOAD_RING, head - ring->next);
+	peak_audit_add(AUDIT_LOAD_BLOCKED,
+	    LOAD_LOAD(ring->blocked) - ring->reported);
+	ring->reported += LOAD_LOAD(ring->blocked) - ring->reported;
 
-			memset(&base, 0, sizeof(base));
+	return (i);
+}
+
+static inline int
+_peak_load_before(struct peak_load_merge *merge, const unsigned int a,
+    const unsigned int b)
+{
+	const struct peak_load *x = merge->sources[a];
+	const struct peak_load *y = merge->sources[b];
 
-			/* convert to time_t */
-			base.tm_year = hdr.start_year - 1900;
-			base.tm_mon = hdr.start_month - 1;
-			base.tm_mday = hdr.start_day;
-			base.tm_hour = hdr.start_hour;
-			base.tm_min = hdr.start_min;
-			base.tm_sec = hdr.start_sec;
+	if (x->ts.tv_sec != y->ts.tv_sec) {
+		return (x->ts.tv_sec < y->ts.tv_sec);
+	}
 
-			netmon_time = timegm(&base);
+	if (x->ts.tv_usec != y->ts.tv_usec) {
+		return (x->ts.tv_usec < y->ts.tv_usec);
+	}
 
-			lseek(fd, hdr.frame_table_offset, SEEK_SET);
+	/* keep ties stable */
+	return (a < b);
+}
 
-			if (read(fd, netmon_table, netmon_length) !=
-			    netmon_length) {
-				goto peak_load_init_close;
-			}
+static void
+_peak_load_sift(struct peak_load_merge *merge, unsigned int i)
+{
+	unsigned int *heap = merge->heap;
+	unsigned int child, tmp;
 
-			fmt = NETMON_MAGIC;
+	while ((child = 2 * i + 1) < merge->used) {
+		if (child + 1 < merge->used &&
+		    _peak_load_before(merge, heap[child + 1], heap[child])) {
+			++child;
+		}
 
+		if (!_peak_load_before(merge, heap[child], heap[i])) {
 			break;
 		}
-		case PCAPNG_MAGIC: {
-			struct pcapng_block_header hdr;
-
-			if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
-				goto peak_load_init_close;
-			}
 
-			/* skip over section header block */
-			lseek(fd, hdr.length - sizeof(hdr), SEEK_CUR);
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
 
-			/* change link type on the fly later */
-			fmt = PCAPNG_MAGIC;
-			ll = 0;
+static void
+_peak_load_advance(struct peak_load_merge *merge)
+{
+	unsigned int i;
 
-			break;
+	if (!merge->primed) {
+		/* every source brings its first packet */
+		for (i = 0; i < merge->count; ++i) {
+			if (peak_load_packet(merge->sources[i])) {
+				merge->heap[merge->used++] = i;
+			}
 		}
-		default:
-			/* unknown magic means erf format */
-			break;
+
+		for (i = merge->used / 2; i--; ) {
+			_peak_load_sift(merge, i);
 		}
+
+		merge->primed = 1;
+		return;
 	}
 
-	self = calloc(1, sizeof(*self));
-	if (!self) {
-		goto peak_load_init_close;
+	if (!merge->advance) {
+		return;
 	}
 
-	self->netmon_count = netmon_length / sizeof(*netmon_table);
-	self->netmon_table = netmon_table;
-	self->netmon_time = netmon_time;
-	self->fmt = fmt;
-	self->fd = fd;
+	merge->advance = 0;
 
-	self->data.ll = ll;
+	/* the packet on top was handed out, replace it */
+	if (!peak_load_packet(merge->sources[merge->heap[0]])) {
+		merge->heap[0] = merge->heap[--merge->used];
+	}
 
-	return (LOAD_TO_USER(self));
+	_peak_load_sift(merge, 0);
+}
 
-  peak_load_init_close:
+static unsigned int
+_peak_load_merged(struct _peak_load *self)
+{
+	struct peak_load_merge *merge = self->merge;
+	struct peak_load *top;
 
-	if (fd != STDIN_FILENO) {
-		close(fd);
+	self->data.len = 0;
+
+	_peak_load_advance(merge);
+
+	if (!merge->used) {
+		return (0);
 	}
 
-	free(netmon_table);
+	top = merge->sources[merge->heap[0]];
+	merge->advance = 1;
 
-  peak_load_init_out:
+	self->caplen = LOAD_FROM_USER(top)->caplen;
+	self->wirelen = LOAD_FROM_USER(top)->wirelen;
+	self->data = *top;
 
-	return (NULL);
+	return (self->data.len);
 }
 
-void
-peak_load_exit(struct peak_load *self_user)
-{
+unsigned int
+peak_load_packet(struct peak_load *self_user)
+{
+	struct _peak_load *self = LOAD_FROM_USER(self_user);
+	struct peak_load_slot *slot;
+
+	if (self->merge) {
+		return (_peak_load_merged(self));
+	}
+
+	if (!self->ring) {
+		return (_peak_load_next(self));
+	}
+
+	self->data.len = 0;
+
+	if (_peak_load_pop(self->ring, &slot, 1)) {
+		self->data.buf = (uint8_t *)slot->pkt.buf;
+		self->data.ts = slot->pkt.ts;
+		self->data.ll = slot->pkt.ll;
+		self->data.len = slot->len;
+		self->caplen = slot->pkt.len;
+		self->wirelen = slot->pkt.wire;
+	}
+
+	return (self->data.len);
+}
+
+unsigned int
+peak_load_burst(struct peak_load *self_user, struct peak_load_pkt *out,
+    const unsigned int count)
+{
+	struct _peak_load *self = LOAD_FROM_USER(self_user);
+	struct peak_load_slot *slots[64];
+	unsigned int i, j, ll, netmon_pos;
+	size_t pos, pending;
+
+	if (self->merge) {
+		for (i = 0; i < count && _peak_load_merged(self); ++i) {
+			out[i].buf = self->data.buf;
+			out[i].ts = self->data.ts;
+			out[i].len = self->caplen;
+			out[i].wire = self->wirelen;
+			out[i].ll = self->data.ll;
+
+			/*
+			 * Only mapped sources keep their data when
+			 * moving on, all others end the burst here.
+			 */
+			if (!LOAD_FROM_USER(self->merge->sources[
+			    self->merge->heap[0]])->mapped) {
+				++i;
+				break;
+			}
+		}
+		return (i);
+	}
+
+	if (self->ring) {
+		/* descriptors are ready, just copy them */
+		i = _peak_load_pop(self->ring, slots,
+		    MIN(count, lengthof(slots)));
+		for (j = 0; j < i; ++j) {
+			out[j] = slots[j]->pkt;
+		}
+		return (i);
+	}
+
+	for (i = 0; i < count; ++i) {
+		/*
+		 * Only the first packet may refill the buffer,
+		 * after that the window is frozen until the next
+		 * burst so that all descriptors stay valid.  A
+		 * packet that doesn't fit is rolled back and the
+		 * burst ends early.  Mappings never move.
+		 */
+		self->burst = i && !self->mapped;
+		netmon_pos = self->netmon_pos;
+		pending = self->pending;
+		ll = self->data.ll;
+		pos = self->pos;
+
+		if (!_peak_load_next(self)) {
+			if (self->stall) {
+				self->netmon_pos = netmon_pos;
+				self->pending = pending;
+				self->data.ll = ll;
+				self->pos = pos;
+			}
+			break;
+		}
+
+		out[i].buf = self->data.buf;
+		out[i].ts = self->data.ts;
+		out[i].len = self->caplen;
+		out[i].wire = self->wirelen;
+		out[i].ll = self->data.ll;
+	}
+
+	self->burst = self->stall = 0;
+
+	return (i);
+}
+
+static unsigned int
+_peak_load_map(struct _peak_load *self, const unsigned int flags)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(self->fd, &st)) {
+		return (0);
+	}
+
+	if (S_ISREG(st.st_mode) && st.st_size && !(flags & LOAD_READ)) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+		    self->fd, 0);
+		if (map != MAP_FAILED) {
+			self->end = self->size = st.st_size;
+			self->mapped = 1;
+			self->mem = map;
+			return (1);
+		}
+	}
+
+#ifdef F_SETPIPE_SZ
+	if (S_ISFIFO(st.st_mode)) {
+		/* fewer wakeups for the writing side */
+		fcntl(self->fd, F_SETPIPE_SZ, LOAD_PIPE);
+	}
+#endif /* F_SETPIPE_SZ */
+
+	/* grows once the snaplen is known */
+	self->mem = malloc(LOAD_WINDOW);
+	if (!self->mem) {
+		return (0);
+	}
+
+	self->base = lseek(self->fd, 0, SEEK_CUR);
+	self->size = LOAD_WINDOW;
+
+	return (1);
+}
+
+static unsigned int
+_peak_load_unpack(struct _peak_load *self, const unsigned int codec)
+{
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	uint8_t *mem;
+
+	if (!self->mapped) {
+		/* what was read already is compressed input */
+		self->unpack = peak_unpack_init(codec, self->fd,
+		    self->mem + self->pos, self->end - self->pos, 1);
+		if (!self->unpack) {
+			return (0);
+		}
+
+		self->pos = self->end = 0;
+		self->base = 0;
+
+		return (1);
+	}
+
+	mem = malloc(LOAD_BUFFER);
+	if (!mem) {
+		return (0);
+	}
+
+	/* decompress straight from the mapping, in parallel */
+	self->unpack = peak_unpack_init(codec, -1, self->mem, self->size,
+	    cpus > 1 ? cpus : 1);
+	if (!self->unpack) {
+		free(mem);
+		return (0);
+	}
+
+	posix_madvise(self->mem, self->size, POSIX_MADV_SEQUENTIAL);
+
+	self->zsize = self->size;
+	self->zmem = self->mem;
+	self->size = LOAD_BUFFER;
+	self->mem = mem;
+	self->mapped = 0;
+	self->pos = self->end = 0;
+	self->base = 0;
+
+	return (1);
+}
+
+unsigned int
+peak_load_truncate(struct peak_load *self_user, const unsigned int caplen)
+{
+	struct _peak_load *self = LOAD_FROM_USER(self_user);
+	unsigned int i, ret = 1;
+
+	if (self->ring) {
+		/* the loader belongs to the other thread */
+		return (0);
+	}
+
+	if (self->merge) {
+		for (i = 0; i < self->merge->count; ++i) {
+			ret &= peak_load_truncate(self->merge->sources[i],
+			    caplen);
+		}
+		return (ret);
+	}
+
+	self->truncate = caplen;
+
+	/* best effort, records still make room */
+	_peak_load_resize(self, _peak_load_window(self, self->snaplen));
+
+	return (1);
+}
+
+static void
+_peak_load_here(struct _peak_load *self, struct peak_load_mark *mark)
+{
+	mark->offset = self->fmt == NETMON_MAGIC ? self->netmon_pos :
+	    self->base + self->pos + self->pending;
+	mark->packet = self->count;
+	mark->ll = self->data.ll;
+}
+
+static unsigned int
+_peak_load_goto(struct _peak_load *self, const struct peak_load_mark *mark)
+{
+	if (self->fmt == NETMON_MAGIC) {
+		if (mark->offset > self->netmon_count) {
+			return (0);
+		}
+		self->netmon_pos = mark->offset;
+		self->pending = 0;
+	} else if (!_peak_load_seek(self, mark->offset)) {
+		return (0);
+	}
+
+	self->count = mark->packet;
+	self->data.ll = mark->ll;
+
+	return (1);
+}
+
+static inline unsigned int
+_peak_load_seekable(struct _peak_load *self)
+{
+	/* streams and composites can't go back */
+	return (!self->merge && !self->ring && !self->unpack &&
+	    !self->limit && (self->mapped || lseek(self->fd, 0, SEEK_CUR) >= 0));
+}
+
+static uint64_t
+_peak_load_size(struct _peak_load *self)
+{
+	struct stat st;
+
+	if (self->mapped) {
+		return (self->size);
+	}
+
+	return (fstat(self->fd, &st) ? 0 : st.st_size);
+}
+
+static unsigned int
+_peak_load_index_read(struct _peak_load *self, const char *file,
+    const unsigned int interval)
+{
+	struct peak_load_index hdr;
+	struct peak_load_mark *marks;
+	size_t len;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		return (0);
+	}
+
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    hdr.magic != LOAD_INDEX_MAGIC ||
+	    hdr.version != LOAD_INDEX_VERSION ||
+	    hdr.size != _peak_load_size(self) || !hdr.count ||
+	    (interval && interval != hdr.interval)) {
+		/* missing, foreign, stale or not as asked */
+		close(fd);
+		return (0);
+	}
+
+	len = hdr.count * sizeof(*marks);
+
+	marks = malloc(len);
+	if (!marks) {
+		close(fd);
+		return (0);
+	}
+
+	if (read(fd, marks, len) != (ssize_t)len) {
+		free(marks);
+		close(fd);
+		return (0);
+	}
+
+	close(fd);
+
+	free(self->marks);
+	self->mark_count = hdr.count;
+	self->marks = marks;
+
+	return (1);
+}
+
+static unsigned int
+_peak_load_index_write(struct _peak_load *self, const char *file,
+    const unsigned int interval)
+{
+	struct peak_load_index hdr;
+	const size_t len = self->mark_count * sizeof(*self->marks);
+	int fd;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = LOAD_INDEX_MAGIC;
+	hdr.version = LOAD_INDEX_VERSION;
+	hdr.size = _peak_load_size(self);
+	hdr.count = self->mark_count;
+	hdr.interval = interval;
+
+	fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return (0);
+	}
+
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    write(fd, self->marks, len) != (ssize_t)len) {
+		close(fd);
+		unlink(file);
+		return (0);
+	}
+
+	close(fd);
+
+	return (1);
+}
+
+static unsigned int
+_peak_load_index_build(struct _peak_load *self, unsigned int interval)
+{
+	struct peak_load_mark mark, *marks;
+	struct peak_timeval last;
+	size_t size = 0;
+
+	if (!interval) {
+		interval = LOAD_INTERVAL;
+	}
+
+	if (!_peak_load_goto(self, &self->start)) {
+		return (0);
+	}
+
+	free(self->marks);
+	self->marks = NULL;
+	self->mark_count = 0;
+
+	/* nothing came before the first packet */
+	last.tv_sec = INT64_MIN;
+	last.tv_usec = 0;
+
+	for (;;) {
+		_peak_load_here(self, &mark);
+
+		if (!_peak_load_next(self)) {
+			break;
+		}
+
+		if (mark.packet % interval) {
+			goto _peak_load_index_build_next;
+		}
+
+		if (self->mark_count == size) {
+			size = size ? 2 * size : 1024;
+			marks = reallocarray(self->marks, size,
+			    sizeof(*marks));
+			if (!marks) {
+				return (0);
+			}
+			self->marks = marks;
+		}
+
+		mark.sec = last.tv_sec;
+		mark.usec = last.tv_usec;
+		mark.reserved = 0;
+
+		self->marks[self->mark_count++] = mark;
+
+  _peak_load_index_build_next:
+
+		if (self->data.ts.tv_sec > last.tv_sec ||
+		    (self->data.ts.tv_sec == last.tv_sec &&
+		    self->data.ts.tv_usec > last.tv_usec)) {
+			last = self->data.ts;
+		}
+	}
+
+	if (!self->mark_count) {
+		/* empty traces need an entry, too */
+		self->marks = malloc(sizeof(*self->marks));
+		if (!self->marks) {
+			return (0);
+		}
+		self->marks[0] = self->start;
+		self->marks[0].sec = INT64_MIN;
+		self->marks[0].usec = 0;
+		self->mark_count = 1;
+	}
+
+	return (_peak_load_goto(self, &self->start));
+}
+
+unsigned int
+peak_load_index(struct peak_load *self_user, const char *file,
+    const unsigned int interval)
+{
+	struct _peak_load *self = LOAD_FROM_USER(self_user);
+	struct peak_load_mark here;
+
+	if (!_peak_load_seekable(self)) {
+		return (0);
+	}
+
+	_peak_load_here(self, &here);
+
+	if (file && _peak_load_index_read(self, file, interval)) {
+		return (1);
+	}
+
+	/* one pass over the whole trace */
+	if (!_peak_load_index_build(self, interval) ||
+	    !_peak_load_goto(self, &here)) {
+		return (0);
+	}
+
+	if (file && !_peak_load_index_write(self, file, interval ?
+	    interval : LOAD_INTERVAL)) {
+		return (0);
+	}
+
+	return (1);
+}
+
+unsigned int
+peak_load_seek_packet(struct peak_load *self_user, const uint64_t packet)
+{
+	struct _peak_load *self = LOAD_FROM_USER(self_user);
+	struct peak_load_mark here;
+	size_t lo = 0, hi, mid;
+
+	if (!self->marks) {
+		return (0);
+	}
+
+	/* last mark not past the packet */
+	hi = self->mark_count;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (self->marks[mid].packet <= packet) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (!_peak_load_goto(self, &self->marks[lo])) {
+		return (0);
+	}
+
+	for (;;) {
+		_peak_load_here(self, &here);
+
+		if (!_peak_load_next(self)) {
+			return (0);
+		}
+
+		if (self->count > packet) {
+			/* hand this one out next */
+			return (_peak_load_goto(self, &here));
+		}
+	}
+}
+
+unsigned int
+peak_load_seek_time(struct peak_load *self_user,
+    const struct peak_timeval *ts)
+{
+	struct _peak_load *self = LOAD_FROM_USER(self_user);
+	const struct peak_load_mark *mark;
+	struct peak_load_mark here;
+	size_t lo = 0, hi, mid;
+
+	if (!self->marks) {
+		return (0);
+	}
+
+	/*
+	 * Marks carry the latest time of all packets before them,
+	 * which never decreases even if the trace isn't sorted.
+	 * The last mark that is still earlier than the time has
+	 * no later packets in front of it.
+	 */
+	hi = self->mark_count;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		mark = &self->marks[mid];
+		if (mark->sec < ts->tv_sec || (mark->sec == ts->tv_sec &&
+		    mark->usec < ts->tv_usec)) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (!_peak_load_goto(self, &self->marks[lo])) {
+		return (0);
+	}
+
+	for (;;) {
+		_peak_load_here(self, &here);
+
+		if (!_peak_load_next(self)) {
+			return (0);
+		}
+
+		if (self->data.ts.tv_sec > ts->tv_sec ||
+		    (self->data.ts.tv_sec == ts->tv_sec &&
+		    self->data.ts.tv_usec >= ts->tv_usec)) {
+			/* hand this one out next */
+			return (_peak_load_goto(self, &here));
+		}
+	}
+}
+
+static unsigned int
+_peak_load_at(struct _peak_load *self, const uint64_t off, void *buf,
+    const size_t len)
+{
+	if (self->mapped) {
+		if (off + len > self->size) {
+			return (0);
+		}
+		memcpy(buf, self->mem + off, len);
+		return (1);
+	}
+
+	/* leaves the window alone */
+	return (pread(self->fd, buf, len, off) == (ssize_t)len);
+}
+
+/*
+ * Tell whether a plausible record starts at the offset and
+ * where the next one would start.  The verdict must only
+ * depend on the offset, so that neighbouring chunks agree
+ * on their common boundary.
+ */
+static unsigned int
+_peak_load_valid(struct _peak_load *self, const uint64_t off,
+    const uint64_t size, uint64_t *next, int64_t *sec)
+{
+	switch (self->fmt) {
+	case ERF_MAGIC: {
+		struct erf_packet_header hdr;
+		unsigned int type;
+
+		if (!_peak_load_at(self, off, &hdr, sizeof(hdr))) {
+			return (0);
+		}
+
+		hdr.rlen = be16dec(&hdr.rlen);
+		type = hdr.type & 0x7f;
+
+		if (!type || type > 48 || hdr.rlen < sizeof(hdr)) {
+			return (0);
+		}
+
+		*next = off + hdr.rlen;
+		*sec = ERF_SEC(hdr.ts);
+		break;
+	}
+	case PCAP_SWAP_MAGIC:
+	case PCAP_MAGIC: {
+		const unsigned int snaplen = self->snaplen ?
+		    self->snaplen : LOAD_SNAPLEN;
+		struct pcap_packet_header hdr;
+
+		if (!_peak_load_at(self, off, &hdr, sizeof(hdr))) {
+			return (0);
+		}
+
+		if (self->fmt == PCAP_SWAP_MAGIC) {
+			hdr.incl_len = bswap32(hdr.incl_len);
+			hdr.orig_len = bswap32(hdr.orig_len);
+			hdr.ts_usec = bswap32(hdr.ts_usec);
+			hdr.ts_sec = bswap32(hdr.ts_sec);
+		}
+
+		if (hdr.ts_usec >= 1000 * 1000 || !hdr.orig_len ||
+		    hdr.orig_len > LOAD_SNAPLEN ||
+		    hdr.incl_len > hdr.orig_len ||
+		    hdr.incl_len > snaplen) {
+			return (0);
+		}
+
+		*next = off + sizeof(hdr) + hdr.incl_len;
+		*sec = hdr.ts_sec;
+		break;
+	}
+	case PCAPNG_MAGIC: {
+		struct pcapng_block_header hdr;
+		uint32_t trailer;
+
+		if (off % sizeof(uint32_t) ||
+		    !_peak_load_at(self, off, &hdr, sizeof(hdr))) {
+			return (0);
+		}
+
+		switch (hdr.type) {
+		case 1:			/* interface description */
+		case 2:			/* packet (obsolete) */
+		case 3:			/* simple packet */
+		case 4:			/* name resolution */
+		case 5:			/* interface statistics */
+		case 6:			/* enhanced packet */
+		case 10:		/* decryption secrets */
+		case PCAPNG_MAGIC:	/* section header */
+			break;
+		default:
+			return (0);
+		}
+
+		/* blocks repeat their length at the end */
+		if (hdr.length < sizeof(hdr) + sizeof(trailer) ||
+		    hdr.length % sizeof(uint32_t) ||
+		    !_peak_load_at(self, off + hdr.length -
+		    sizeof(trailer), &trailer, sizeof(trailer)) ||
+		    trailer != hdr.length) {
+			return (0);
+		}
+
+		*next = off + hdr.length;
+		*sec = 0;
+		break;
+	}
+	default:
+		return (0);
+	}
+
+	return (*next <= size);
+}
+
+static uint64_t
+_peak_load_sync(struct _peak_load *self, uint64_t off, const uint64_t size)
+{
+	int64_t sec, last = 0;
+	uint64_t next, pos;
+	unsigned int i;
+
+	for (; off < size; ++off) {
+		pos = off;
+
+		/* a few records in a row must line up */
+		for (i = 0; i < LOAD_SYNC && pos < size; ++i) {
+			if (!_peak_load_valid(self, pos, size, &next, &sec) ||
+			    (i && (sec - last > LOAD_SKEW ||
+			    last - sec > LOAD_SKEW))) {
+				break;
+			}
+			last = sec;
+			pos = next;
+		}
+
+		if (i == LOAD_SYNC || pos == size) {
+			return (off);
+		}
+	}
+
+	return (size);
+}
+
+static unsigned int
+_peak_load_iface(struct _peak_load *self)
+{
+	const uint64_t size = _peak_load_size(self);
+	struct pcapng_iface_desc_header iface;
+	struct pcapng_block_header hdr;
+	uint64_t off = self->start.offset;
+
+	/* the link type of the first interface is taken */
+	while (_peak_load_at(self, off, &hdr, sizeof(hdr)) &&
+	    hdr.length >= sizeof(hdr) && off + hdr.length <= size) {
+		switch (hdr.type) {
+		case 1:
+			if (!_peak_load_at(self, off + sizeof(hdr), &iface,
+			    sizeof(iface))) {
+				return (0);
+			}
+			return (iface.linktype);
+		case 2:
+		case 3:
+		case 6:
+			return (0);
+		default:
+			break;
+		}
+		off += hdr.length;
+	}
+
+	return (0);
+}
+
+struct peak_load *
+peak_load_chunk(const char *file, const unsigned int index,
+    const unsigned int count, const unsigned int flags)
+{
+	struct _peak_load *self;
+	struct peak_load *trace;
+	struct peak_load_mark begin;
+	uint64_t size, from, to;
+
+	if (!file || index >= count || flags & LOAD_THREAD) {
+		return (NULL);
+	}
+
+	trace = peak_load_open(file, flags);
+	if (!trace) {
+		return (NULL);
+	}
+
+	self = LOAD_FROM_USER(trace);
+
+	if (!_peak_load_seekable(self)) {
+		goto peak_load_chunk_exit;
+	}
+
+	begin = self->start;
+
+	if (self->fmt == NETMON_MAGIC) {
+		/* the frame table is split instead */
+		size = self->netmon_count;
+		begin.offset = size * index / count;
+		self->netmon_count = size * (index + 1) / count;
+		return (_peak_load_goto(self, &begin) ? trace : NULL);
+	}
+
+	size = _peak_load_size(self);
+	from = MAX(size * index / count, self->start.offset);
+	to = MAX(size * (index + 1) / count, self->start.offset);
+
+	if (index) {
+		begin.offset = _peak_load_sync(self, from, size);
+		if (self->fmt == PCAPNG_MAGIC) {
+			begin.ll = _peak_load_iface(self);
+		}
+	}
+
+	self->limit = index + 1 < count ?
+	    (off_t)_peak_load_sync(self, to, size) : (off_t)size;
+
+	if (!_peak_load_goto(self, &begin)) {
+		goto peak_load_chunk_exit;
+	}
+
+	return (trace);
+
+  peak_load_chunk_exit:
+
+	peak_load_exit(trace);
+
+	return (NULL);
+}
+
+struct peak_load_job {
+	const char *file;
+	unsigned int index;
+	unsigned int count;
+	unsigned int flags;
+	unsigned int done;
+	void (*work)(struct peak_load *, void *);
+	void *result;
+	pthread_t thread;
+};
+
+static void *
+_peak_load_job(void *arg)
+{
+	struct peak_load_job *job = arg;
+	struct peak_load *trace;
+
+	trace = peak_load_chunk(job->file, job->index, job->count,
+	    job->flags);
+	if (trace) {
+		job->work(trace, job->result);
+		peak_load_exit(trace);
+		job->done = 1;
+	}
+
+	return (NULL);
+}
+
+unsigned int
+peak_load_chunks(const char *file, const unsigned int count,
+    const unsigned int flags, void (*work)(struct peak_load *, void *),
+    void (*merge)(void *, const void *), void *result, const size_t size)
+{
+	struct peak_load_job *jobs;
+	unsigned int i, started;
+	unsigned int ret = 0;
+	uint8_t *results;
+
+	if (!count) {
+		return (0);
+	}
+
+	jobs = calloc(count, sizeof(*jobs));
+	results = calloc(count, size);
+	if (!jobs || (!results && size)) {
+		goto peak_load_chunks_free;
+	}
+
+	for (started = 0; started < count; ++started) {
+		jobs[started].file = file;
+		jobs[started].index = started;
+		jobs[started].count = count;
+		jobs[started].flags = flags;
+		jobs[started].work = work;
+		jobs[started].result = results + started * size;
+
+		if (pthread_create(&jobs[started].thread, NULL,
+		    _peak_load_job, &jobs[started])) {
+			break;
+		}
+	}
+
+	ret = started == count;
+
+	for (i = 0; i < started; ++i) {
+		pthread_join(jobs[i].thread, NULL);
+		ret &= jobs[i].done;
+	}
+
+	/* fold in chunk order for stable results */
+	for (i = 0; ret && merge && i < count; ++i) {
+		merge(result, jobs[i].result);
+	}
+
+  peak_load_chunks_free:
+
+	free(results);
+	free(jobs);
+
+	return (ret);
+}
+
+struct peak_load *
+peak_load_merge(char *const *files, const unsigned int count,
+    const unsigned int flags)
+{
+	struct peak_load_merge *merge;
+	struct _peak_load *self;
+	unsigned int i;
+
+	if (!count) {
+		return (NULL);
+	}
+
+	self = calloc(1, sizeof(*self));
+	if (!self) {
+		return (NULL);
+	}
+
+	merge = calloc(1, sizeof(*merge));
+	if (!merge) {
+		goto peak_load_merge_free;
+	}
+
+	self->merge = merge;
+	self->fd = -1;
+
+	merge->sources = calloc(count, sizeof(*merge->sources));
+	merge->heap = calloc(count, sizeof(*merge->heap));
+	if (!merge->sources || !merge->heap) {
+		goto peak_load_merge_free;
+	}
+
+	for (merge->count = 0; merge->count < count; ++merge->count) {
+		/* every source has its own buffer and link type */
+		merge->sources[merge->count] =
+		    peak_load_open(files[merge->count], flags);
+		if (!merge->sources[merge->count]) {
+			goto peak_load_merge_free;
+		}
+	}
+
+	self->data = *merge->sources[0];
+
+	return (LOAD_TO_USER(self));
+
+  peak_load_merge_free:
+
+	if (merge) {
+		for (i = 0; i < merge->count; ++i) {
+			peak_load_exit(merge->sources[i]);
+		}
+		free(merge->sources);
+		free(merge->heap);
+		free(merge);
+	}
+
+	free(self);
+
+	return (NULL);
+}
+
+struct peak_load *
+peak_load_init(const char *file)
+{
+	return (peak_load_open(file, LOAD_DEFAULT));
+}
+
+static struct peak_load *
+_peak_load_thread(const char *file, const unsigned int flags)
+{
+	struct peak_load_ring *ring;
+	struct _peak_load *self;
+	struct peak_load *ahead;
+
+	ahead = peak_load_open(file, flags & ~LOAD_THREAD);
+	if (!ahead) {
+		goto _peak_load_thread_out;
+	}
+
+	self = calloc(1, sizeof(*self));
+	if (!self) {
+		goto _peak_load_thread_exit;
+	}
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring) {
+		goto _peak_load_thread_free;
+	}
+
+	ring->ahead = LOAD_FROM_USER(ahead);
+
+	if (!ring->ahead->mapped) {
+		ring->arena = malloc(LOAD_ARENA);
+		if (!ring->arena) {
+			goto _peak_load_thread_ring;
+		}
+	}
+
+	self->data = *ahead;
+	self->ring = ring;
+	self->fd = -1;
+
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->cond, NULL);
+
+	if (pthread_create(&ring->thread, NULL, _peak_load_ahead, ring)) {
+		goto _peak_load_thread_sync;
+	}
+
+	return (LOAD_TO_USER(self));
+
+  _peak_load_thread_sync:
+
+	pthread_cond_destroy(&ring->cond);
+	pthread_mutex_destroy(&ring->lock);
+
+  _peak_load_thread_ring:
+
+	free(ring->arena);
+	free(ring);
+
+  _peak_load_thread_free:
+
+	free(self);
+
+  _peak_load_thread_exit:
+
+	peak_load_exit(ahead);
+
+  _peak_load_thread_out:
+
+	return (NULL);
+}
+
+struct peak_load *
+peak_load_open(const char *file, const unsigned int flags)
+{
+	struct _peak_load *self;
+	uint32_t file_magic;
+	unsigned int codec;
+	int fd = STDIN_FILENO;
+
+	if (flags & LOAD_THREAD) {
+		return (_peak_load_thread(file, flags));
+	}
+
+	if (file) {
+		fd = open(file, O_RDONLY);
+		if (fd < 0) {
+			goto peak_load_init_out;
+		}
+	}
+
+	self = calloc(1, sizeof(*self));
+	if (!self) {
+		goto peak_load_init_close;
+	}
+
+	self->data.ll = LINKTYPE_ETHERNET;
+	self->fmt = ERF_MAGIC;
+	self->fd = fd;
+
+	if (!_peak_load_map(self, flags)) {
+		goto peak_load_init_free;
+	}
+
+	/* autodetect format if possible */
+	if (!_peak_load_peek(self, &file_magic, sizeof(file_magic))) {
+		if (file) {
+			goto peak_load_init_free;
+		}
+		/* empty input: nothing to detect */
+		file_magic = ERF_MAGIC;
+	}
+
+	codec = peak_unpack_detect(&file_magic, sizeof(file_magic));
+	if (codec != UNPACK_NONE) {
+		if (!_peak_load_unpack(self, codec)) {
+			goto peak_load_init_free;
+		}
+
+		/* now look at the actual contents */
+		if (!_peak_load_peek(self, &file_magic,
+		    sizeof(file_magic))) {
+			goto peak_load_init_free;
+		}
+	}
+
+	switch (file_magic) {
+	case PCAP_SWAP_MAGIC:
+	case PCAP_MAGIC: {
+		struct pcap_file_header hdr;
+
+		if (!_peak_load_read(self, &hdr, sizeof(hdr))) {
+			goto peak_load_init_free;
+		}
+
+		self->fmt = PCAP_MAGIC;
+
+		if (file_magic == PCAP_SWAP_MAGIC) {
+			hdr.magic_number = bswap32(hdr.magic_number);
+			hdr.version_major = bswap16(hdr.version_major);
+			hdr.version_minor = bswap16(hdr.version_minor);
+			hdr.thiszone = bswap32(hdr.thiszone);
+			hdr.sigfigs = bswap32(hdr.sigfigs);
+			hdr.snaplen = bswap32(hdr.snaplen);
+			hdr.network = bswap32(hdr.network);
+			self->fmt = PCAP_SWAP_MAGIC;
+		}
+
+		self->data.ll = hdr.network;
+		self->snaplen = hdr.snaplen;
+
+		break;
+	}
+	case NETMON_MAGIC: {
+		struct netmon_file_header hdr;
+		struct tm base;
+
+		if (!_peak_load_read(self, &hdr, sizeof(hdr))) {
+			goto peak_load_init_free;
+		}
+
+		if (hdr.version_minor != 0 || hdr.version_major != 2) {
+			/* can only support version 2.0 for now */
+			goto peak_load_init_free;
+		}
+
+		if (hdr.network > 1) {
+			/*
+			 * Sorry for magic constant.  Both 0 and 1
+			 * are Ethernet packets.  The value is set
+			 * automatically.  Other link layers are
+			 * not supported.
+			 */
+			goto peak_load_init_free;
+		}
+
+		self->netmon_table = malloc(hdr.frame_table_length);
+		if (!self->netmon_table) {
+			goto peak_load_init_free;
+		}
+
+		memset(&base, 0, sizeof(base));
+
+		/* convert to time_t */
+		base.tm_year = hdr.start_year - 1900;
+		base.tm_mon = hdr.start_month - 1;
+		base.tm_mday = hdr.start_day;
+		base.tm_hour = hdr.start_hour;
+		base.tm_min = hdr.start_min;
+		base.tm_sec = hdr.start_sec;
+
+		self->netmon_time = timegm(&base);
+
+		_peak_load_seek(self, hdr.frame_table_offset);
+
+		if (!_peak_load_read(self, self->netmon_table,
+		    hdr.frame_table_length)) {
+			goto peak_load_init_free;
+		}
+
+		self->netmon_count = hdr.frame_table_length /
+		    sizeof(*self->netmon_table);
+		self->fmt = NETMON_MAGIC;
+
+		break;
+	}
+	case PCAPNG_MAGIC: {
+		struct pcapng_block_header hdr;
+
+		if (!_peak_load_read(self, &hdr, sizeof(hdr))) {
+			goto peak_load_init_free;
+		}
+
+		/* skip over section header block */
+		_peak_load_skip(self, hdr.length - sizeof(hdr));
+
+		/* change link type on the fly later */
+		self->fmt = PCAPNG_MAGIC;
+		self->data.ll = 0;
+
+		break;
+	}
+	default:
+		/* unknown magic means erf format */
+		break;
+	}
+
+	if (self->fmt != PCAPNG_MAGIC &&
+	    !_peak_load_resize(self, _peak_load_window(self, self->snaplen))) {
+		goto peak_load_init_free;
+	}
+
+	/* where packets begin, for rewinding */
+	_peak_load_here(self, &self->start);
+
+	if (self->mapped) {
+		/* the kernel may read ahead aggressively */
+		posix_madvise(self->mem, self->size,
+		    self->fmt == NETMON_MAGIC ? POSIX_MADV_NORMAL :
+		    POSIX_MADV_SEQUENTIAL);
+	}
+
+	self->data.buf = self->mem;
+
+	return (LOAD_TO_USER(self));
+
+  peak_load_init_free:
+
+	if (self->mapped) {
+		munmap(self->mem, self->size);
+	} else {
+		free(self->mem);
+	}
+
+	peak_unpack_exit(self->unpack);
+
+	if (self->zmem) {
+		munmap(self->zmem, self->zsize);
+	}
+
+	free(self->netmon_table);
+	free(self);
+
+  peak_load_init_close:
+
+	if (fd != STDIN_FILENO) {
+		close(fd);
+	}
+
+  peak_load_init_out:
+
+	return (NULL);
+}
+
+void
+peak_load_exit(struct peak_load *self_user)
+{
 	if (self_user) {
 		struct _peak_load *self = LOAD_FROM_USER(self_user);
+		if (self->merge) {
+			unsigned int i;
+			for (i = 0; i < self->merge->count; ++i) {
+				peak_load_exit(self->merge->sources[i]);
+			}
+			free(self->merge->sources);
+			free(self->merge->heap);
+			free(self->merge);
+			free(self);
+			return;
+		}
+		if (self->ring) {
+			LOAD_STORE(self->ring->stop, 1);
+			_peak_load_wake(self->ring, &self->ring->asleep);
+			pthread_join(self->ring->thread, NULL);
+			pthread_cond_destroy(&self->ring->cond);
+			pthread_mutex_destroy(&self->ring->lock);
+			peak_load_exit(LOAD_TO_USER(self->ring->ahead));
+			free(self->ring->arena);
+			free(self->ring);
+			free(self);
+			return;
+		}
+		if (self->mapped) {
+			munmap(self->mem, self->size);
+		} else {
+			free(self->mem);
+		}
+		peak_unpack_exit(self->unpack);
+		if (self->zmem) {
+			munmap(self->zmem, self->zsize);
+		}
 		if (self->fd != STDIN_FILENO) {
 			close(self->fd);
 		}
 		free(self->netmon_table);
+		free(self->marks);
 		free(self);
 	}
 }
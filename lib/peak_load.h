@@ -21,11 +21,43 @@ struct peak_load {
 	struct peak_timeval ts;
 	unsigned int len;
 	unsigned int ll;
-	uint8_t buf[32 * 1024];
+	uint8_t *buf;
 };
 
+struct peak_load_pkt {
+	struct peak_timeval ts;
+	const uint8_t *buf;
+	unsigned int len;	/* captured length */
+	unsigned int wire;	/* length on the wire */
+	unsigned int ll;	/* link type */
+};
+
+#define LOAD_DEFAULT	0x0	/* map regular files */
+#define LOAD_READ	0x1	/* always use read(2) */
+#define LOAD_THREAD	0x2	/* read ahead in a thread */
+
 unsigned int		 peak_load_packet(struct peak_load *);
+unsigned int		 peak_load_burst(struct peak_load *,
+			     struct peak_load_pkt *, const unsigned int);
 void			 peak_load_exit(struct peak_load *);
 struct peak_load	*peak_load_init(const char *);
+struct peak_load	*peak_load_open(const char *, const unsigned int);
+struct peak_load	*peak_load_merge(char *const *, const unsigned int,
+			     const unsigned int);
+unsigned int		 peak_load_index(struct peak_load *, const char *,
+			     const unsigned int);
+unsigned int		 peak_load_seek_packet(struct peak_load *,
+			     const uint64_t);
+unsigned int		 peak_load_seek_time(struct peak_load *,
+			     const struct peak_timeval *);
+unsigned int		 peak_load_truncate(struct peak_load *,
+			     const unsigned int);
+struct peak_load	*peak_load_chunk(const char *, const unsigned int,
+			     const unsigned int, const unsigned int);
+unsigned int		 peak_load_chunks(const char *, const unsigned int,
+			     const unsigned int,
+			     void (*)(struct peak_load *, void *),
+			     void (*)(void *, const void *), void *,
+			     const size_t);
 
 #endif /* !PEAK_LOAD_H */
@@ -399,29 +399,300 @@ peak_locate_init_out:
 	return (ret);
 }
 
-static int
-kw_cmp(const void *x, const void *yy)
-{
-        const struct locate_item *y = yy;
+/*
+ * Begin of autogenerated lookup section.  DO NOT EDIT.
+ */
 
-        return (strcmp(x, y->name));
-}
+static const uint16_t locate_disp[] = {
+	7, 4, 7, 10, 1, 3, 14, 6,
+	2, 1, 2, 7, 4, 23, 1, 1,
+	1, 11, 1, 4, 21, 2, 5, 14,
+	1, 11, 1, 3, 8, 1, 14, 5,
+	1, 2, 1, 1, 1, 1, 8, 1,
+	1, 2, 14, 16, 7, 13, 1, 10,
+	1, 1, 15, 13, 1, 33, 1, 35,
+	11, 3, 2, 29, 8, 4, 13, 1,
+	1, 1, 1, 42, 8, 3, 14, 21,
+	2, 1, 9, 1, 14, 18, 1, 9,
+	6, 34, 1, 1, 20, 6, 31, 6,
+	20, 1, 1, 12, 8, 29, 43, 2,
+	3, 1, 26, 1, 1, 2, 7, 10,
+	41, 24, 14, 1, 131, 70, 1, 20,
+	5, 1, 44, 14, 2, 54, 15, 5,
+	3, 7, 124, 3, 141, 77,
+};
+
+static const uint16_t locate_slot[] = {
+	LOCATE_FR,	/* FR */
+	LOCATE_ST,	/* ST */
+	LOCATE_NG,	/* NG */
+	LOCATE_ES,	/* ES */
+	LOCATE_MM,	/* MM */
+	LOCATE_CO,	/* CO */
+	LOCATE_HT,	/* HT */
+	LOCATE_AZ,	/* AZ */
+	LOCATE_ZW,	/* ZW */
+	LOCATE_BR,	/* BR */
+	LOCATE_PM,	/* PM */
+	LOCATE_NL,	/* NL */
+	LOCATE_XX,	/* XX */
+	LOCATE_BS,	/* BS */
+	LOCATE_LU,	/* LU */
+	LOCATE_EE,	/* EE */
+	LOCATE_IQ,	/* IQ */
+	LOCATE_CA,	/* CA */
+	LOCATE_PH,	/* PH */
+	LOCATE_YT,	/* YT */
+	LOCATE_SJ,	/* SJ */
+	LOCATE_FK,	/* FK */
+	LOCATE_PW,	/* PW */
+	LOCATE_BL,	/* BL */
+	LOCATE_GA,	/* GA */
+	LOCATE_HK,	/* HK */
+	LOCATE_PY,	/* PY */
+	LOCATE_PE,	/* PE */
+	LOCATE_FJ,	/* FJ */
+	LOCATE_SE,	/* SE */
+	LOCATE_NR,	/* NR */
+	LOCATE_IE,	/* IE */
+	LOCATE_LK,	/* LK */
+	LOCATE_BT,	/* BT */
+	LOCATE_GR,	/* GR */
+	LOCATE_GM,	/* GM */
+	LOCATE_SG,	/* SG */
+	LOCATE_GU,	/* GU */
+	LOCATE_ET,	/* ET */
+	LOCATE_CD,	/* CD */
+	LOCATE_CW,	/* CW */
+	LOCATE_LR,	/* LR */
+	LOCATE_VI,	/* VI */
+	LOCATE_DK,	/* DK */
+	LOCATE_BJ,	/* BJ */
+	LOCATE_MR,	/* MR */
+	LOCATE_BM,	/* BM */
+	LOCATE_YE,	/* YE */
+	LOCATE_CZ,	/* CZ */
+	LOCATE_SX,	/* SX */
+	LOCATE_CC,	/* CC */
+	LOCATE_AE,	/* AE */
+	LOCATE_KE,	/* KE */
+	LOCATE_GQ,	/* GQ */
+	LOCATE_NO,	/* NO */
+	LOCATE_KH,	/* KH */
+	LOCATE_PN,	/* PN */
+	LOCATE_CG,	/* CG */
+	LOCATE_LB,	/* LB */
+	LOCATE_UM,	/* UM */
+	LOCATE_CY,	/* CY */
+	LOCATE_LS,	/* LS */
+	LOCATE_GD,	/* GD */
+	LOCATE_DE,	/* DE */
+	LOCATE_TM,	/* TM */
+	LOCATE_BN,	/* BN */
+	LOCATE_SL,	/* SL */
+	LOCATE_BD,	/* BD */
+	LOCATE_KP,	/* KP */
+	LOCATE_FO,	/* FO */
+	LOCATE_VC,	/* VC */
+	LOCATE_UA,	/* UA */
+	LOCATE_AF,	/* AF */
+	LOCATE_NU,	/* NU */
+	LOCATE_SM,	/* SM */
+	LOCATE_MP,	/* MP */
+	LOCATE_GE,	/* GE */
+	LOCATE_EG,	/* EG */
+	LOCATE_TC,	/* TC */
+	LOCATE_EH,	/* EH */
+	LOCATE_KM,	/* KM */
+	LOCATE_TJ,	/* TJ */
+	LOCATE_ER,	/* ER */
+	LOCATE_AS,	/* AS */
+	LOCATE_CM,	/* CM */
+	LOCATE_TF,	/* TF */
+	LOCATE_VE,	/* VE */
+	LOCATE_CK,	/* CK */
+	LOCATE_DJ,	/* DJ */
+	LOCATE_OM,	/* OM */
+	LOCATE_AD,	/* AD */
+	LOCATE_MY,	/* MY */
+	LOCATE_NP,	/* NP */
+	LOCATE_LA,	/* LA */
+	LOCATE_TG,	/* TG */
+	LOCATE_VA,	/* VA */
+	LOCATE_CU,	/* CU */
+	LOCATE_CV,	/* CV */
+	LOCATE_RU,	/* RU */
+	LOCATE_TN,	/* TN */
+	LOCATE_SD,	/* SD */
+	LOCATE_MZ,	/* MZ */
+	LOCATE_NZ,	/* NZ */
+	LOCATE_TH,	/* TH */
+	LOCATE_AT,	/* AT */
+	LOCATE_AW,	/* AW */
+	LOCATE_VU,	/* VU */
+	LOCATE_DM,	/* DM */
+	LOCATE_ID,	/* ID */
+	LOCATE_KN,	/* KN */
+	LOCATE_MN,	/* MN */
+	LOCATE_CH,	/* CH */
+	LOCATE_HM,	/* HM */
+	LOCATE_MF,	/* MF */
+	LOCATE_GP,	/* GP */
+	LOCATE_UY,	/* UY */
+	LOCATE_AG,	/* AG */
+	LOCATE_WF,	/* WF */
+	LOCATE_IR,	/* IR */
+	LOCATE_BG,	/* BG */
+	LOCATE_UNKNOWN,	/*  */
+	LOCATE_BA,	/* BA */
+	LOCATE_KG,	/* KG */
+	LOCATE_PT,	/* PT */
+	LOCATE_DO,	/* DO */
+	LOCATE_ML,	/* ML */
+	LOCATE_LT,	/* LT */
+	LOCATE_MU,	/* MU */
+	LOCATE_US,	/* US */
+	LOCATE_ZM,	/* ZM */
+	LOCATE_SC,	/* SC */
+	LOCATE_GG,	/* GG */
+	LOCATE_MA,	/* MA */
+	LOCATE_SH,	/* SH */
+	LOCATE_BW,	/* BW */
+	LOCATE_SR,	/* SR */
+	LOCATE_PK,	/* PK */
+	LOCATE_CR,	/* CR */
+	LOCATE_NC,	/* NC */
+	LOCATE_TO,	/* TO */
+	LOCATE_PF,	/* PF */
+	LOCATE_SO,	/* SO */
+	LOCATE_AO,	/* AO */
+	LOCATE_SB,	/* SB */
+	LOCATE_BO,	/* BO */
+	LOCATE_RE,	/* RE */
+	LOCATE_MX,	/* MX */
+	LOCATE_ME,	/* ME */
+	LOCATE_AR,	/* AR */
+	LOCATE_SY,	/* SY */
+	LOCATE_TD,	/* TD */
+	LOCATE_BH,	/* BH */
+	LOCATE_VG,	/* VG */
+	LOCATE_JM,	/* JM */
+	LOCATE_LC,	/* LC */
+	LOCATE_LV,	/* LV */
+	LOCATE_MC,	/* MC */
+	LOCATE_HN,	/* HN */
+	LOCATE_MT,	/* MT */
+	LOCATE_HR,	/* HR */
+	LOCATE_GT,	/* GT */
+	LOCATE_MQ,	/* MQ */
+	LOCATE_PR,	/* PR */
+	LOCATE_NI,	/* NI */
+	LOCATE_FI,	/* FI */
+	LOCATE_BY,	/* BY */
+	LOCATE_KR,	/* KR */
+	LOCATE_UZ,	/* UZ */
+	LOCATE_GF,	/* GF */
+	LOCATE_CL,	/* CL */
+	LOCATE_KI,	/* KI */
+	LOCATE_IT,	/* IT */
+	LOCATE_BB,	/* BB */
+	LOCATE_CX,	/* CX */
+	LOCATE_WS,	/* WS */
+	LOCATE_AQ,	/* AQ */
+	LOCATE_LY,	/* LY */
+	LOCATE_MS,	/* MS */
+	LOCATE_RS,	/* RS */
+	LOCATE_IO,	/* IO */
+	LOCATE_GH,	/* GH */
+	LOCATE_MW,	/* MW */
+	LOCATE_GW,	/* GW */
+	LOCATE_LI,	/* LI */
+	LOCATE_KW,	/* KW */
+	LOCATE_SS,	/* SS */
+	LOCATE_TV,	/* TV */
+	LOCATE_PG,	/* PG */
+	LOCATE_DZ,	/* DZ */
+	LOCATE_TT,	/* TT */
+	LOCATE_BZ,	/* BZ */
+	LOCATE_BV,	/* BV */
+	LOCATE_GN,	/* GN */
+	LOCATE_GI,	/* GI */
+	LOCATE_AU,	/* AU */
+	LOCATE_AL,	/* AL */
+	LOCATE_UG,	/* UG */
+	LOCATE_MV,	/* MV */
+	LOCATE_BE,	/* BE */
+	LOCATE_IL,	/* IL */
+	LOCATE_KZ,	/* KZ */
+	LOCATE_GY,	/* GY */
+	LOCATE_MO,	/* MO */
+	LOCATE_BQ,	/* BQ */
+	LOCATE_AI,	/* AI */
+	LOCATE_HU,	/* HU */
+	LOCATE_EC,	/* EC */
+	LOCATE_TZ,	/* TZ */
+	LOCATE_BF,	/* BF */
+	LOCATE_VN,	/* VN */
+	LOCATE_MH,	/* MH */
+	LOCATE_CN,	/* CN */
+	LOCATE_ZA,	/* ZA */
+	LOCATE_GS,	/* GS */
+	LOCATE_PA,	/* PA */
+	LOCATE_AM,	/* AM */
+	LOCATE_PS,	/* PS */
+	LOCATE_SZ,	/* SZ */
+	LOCATE_AX,	/* AX */
+	LOCATE_RW,	/* RW */
+	LOCATE_CI,	/* CI */
+	LOCATE_MG,	/* MG */
+	LOCATE_JO,	/* JO */
+	LOCATE_GL,	/* GL */
+	LOCATE_NE,	/* NE */
+	LOCATE_IM,	/* IM */
+	LOCATE_TK,	/* TK */
+	LOCATE_SA,	/* SA */
+	LOCATE_SN,	/* SN */
+	LOCATE_TR,	/* TR */
+	LOCATE_IN,	/* IN */
+	LOCATE_IS,	/* IS */
+	LOCATE_JE,	/* JE */
+	LOCATE_MD,	/* MD */
+	LOCATE_KY,	/* KY */
+	LOCATE_MK,	/* MK */
+	LOCATE_QA,	/* QA */
+	LOCATE_RO,	/* RO */
+	LOCATE_BI,	/* BI */
+	LOCATE_TL,	/* TL */
+	LOCATE_SV,	/* SV */
+	LOCATE_FM,	/* FM */
+	LOCATE_PL,	/* PL */
+	LOCATE_GB,	/* GB */
+	LOCATE_NF,	/* NF */
+	LOCATE_JP,	/* JP */
+	LOCATE_SK,	/* SK */
+	LOCATE_CF,	/* CF */
+	LOCATE_SI,	/* SI */
+	LOCATE_TW,	/* TW */
+	LOCATE_NA,	/* NA */
+};
+
+/*
+ * End of autogenerated lookup section.
+ */
 
 unsigned int
 peak_locate_number(const char *name)
 {
-	struct locate_item *location;
+	const unsigned int number = HASH_PERFECT(name, locate_disp,
+	    locate_slot);
 
-	location = bsearch(name, locate_items, lengthof(locate_items),
-	    sizeof(locate_items[0]), kw_cmp);
-	if (!location) {
+	if (strcmp(name, locate_items[number].name)) {
 		return (LOCATE_UNKNOWN);
 	}
 
-	return (location->guid);
+	return (number);
 }
 
-
 const char *
 peak_locate_name(const unsigned int number)
 {
@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <peak.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define META_AVAIL(off, need)						\
+	((size_t)(off) + (size_t)(need) <= packet->app_len)
+
+#define META_FIND(off, chr) ({						\
+	const size_t _off = (off);					\
+	size_t _ret = packet->app_len;					\
+	if (likely(_off < packet->app_len)) {				\
+		const uint8_t *_pos = memchr(&packet->app.raw[_off],	\
+		    (chr), packet->app_len - _off);			\
+		if (_pos) {						\
+			_ret = _pos - packet->app.raw;			\
+		}							\
+	}								\
+	_ret;								\
+})
+
+#define META_SET(name, begin, size) do {				\
+	self->field[name].off = (begin);				\
+	self->field[name].len = (size);					\
+	++self->count;							\
+} while (0)
+
+#define META_DESCRIBE_APP(name)						\
+static void								\
+peak_meta_##name(struct peak_meta *self,				\
+    const struct peak_packet *packet)
+
+static const char *meta_names[META_MAX] = {
+	[META_HTTP_METHOD] = "http.method",
+	[META_HTTP_URI] = "http.uri",
+	[META_HTTP_HOST] = "http.host",
+	[META_TLS_SNI] = "tls.sni",
+	[META_TLS_ALPN] = "tls.alpn",
+	[META_DNS_QNAME] = "dns.qname",
+	[META_DNS_QTYPE] = "dns.qtype",
+};
+
+#define HELLO_AVAIL(off, need)						\
+	((size_t)(off) + (size_t)(need) <= end)
+
+#define HELLO_SET(field, begin, size) do {				\
+	(field).off = (begin);						\
+	(field).len = (size);						\
+} while (0)
+
+int
+peak_meta_hello(struct peak_meta_hello *self,
+    const struct peak_packet *packet, const unsigned int partial)
+{
+	const uint8_t *raw = packet->app.raw;
+	size_t end, off, len;
+	int ret = 0;
+
+	memset(self, 0, sizeof(*self));
+
+	/* handshake record carrying a ClientHello */
+	if (!META_AVAIL(0, 11) || raw[0] != 0x16 || raw[5] != 0x01) {
+		return (1);
+	}
+
+	end = 9 + ((size_t)raw[6] << 16) + be16dec(&raw[7]);
+	if (end > packet->app_len) {
+		if (!partial) {
+			return (1);
+		}
+
+		/* walk as far as the payload goes */
+		end = packet->app_len;
+		ret = 1;
+	}
+
+	self->version = be16dec(&raw[9]);
+
+	/* record header, handshake header, version, random */
+	off = 5 + 4 + 2 + 32;
+
+	if (!HELLO_AVAIL(off, 1)) {
+		return (1);
+	}
+
+	off += 1 + raw[off];	/* session id */
+
+	if (!HELLO_AVAIL(off, 2)) {
+		return (1);
+	}
+
+	len = be16dec(&raw[off]);
+	off += 2;
+
+	if (!HELLO_AVAIL(off, len) || len & 1) {
+		return (1);
+	}
+
+	HELLO_SET(self->ciphers, off, len);
+	off += len;
+
+	if (!HELLO_AVAIL(off, 1)) {
+		return (1);
+	}
+
+	off += 1 + raw[off];	/* compression methods */
+
+	if (off == end) {
+		/* extensions are optional */
+		return (ret);
+	}
+
+	if (!HELLO_AVAIL(off, 2)) {
+		return (1);
+	}
+
+	len = be16dec(&raw[off]);
+	off += 2;
+
+	if (!HELLO_AVAIL(off, len)) {
+		if (!ret) {
+			return (1);
+		}
+
+		/* cut short by the end of the payload */
+		len = end - off;
+	}
+
+	HELLO_SET(self->extensions, off, len);
+	end = off + len;
+
+	while (off < end) {
+		unsigned int type;
+
+		if (!HELLO_AVAIL(off, 4)) {
+			return (1);
+		}
+
+		type = be16dec(&raw[off]);
+		len = be16dec(&raw[off + 2]);
+		off += 4;
+
+		if (!HELLO_AVAIL(off, len)) {
+			return (1);
+		}
+
+		switch (type) {
+		case 0:	/* server_name */
+			if (len >= 5 && !raw[off + 2] &&
+			    5 + (size_t)be16dec(&raw[off + 3]) <= len) {
+				HELLO_SET(self->sni, off + 5,
+				    be16dec(&raw[off + 3]));
+			}
+			break;
+		case 10: /* supported_groups */
+			if (len >= 2 && !(be16dec(&raw[off]) & 1) &&
+			    2 + (size_t)be16dec(&raw[off]) <= len) {
+				HELLO_SET(self->curves, off + 2,
+				    be16dec(&raw[off]));
+			}
+			break;
+		case 11: /* ec_point_formats */
+			if (len >= 1 && 1 + (size_t)raw[off] <= len) {
+				HELLO_SET(self->formats, off + 1, raw[off]);
+			}
+			break;
+		case 16: /* application_layer_protocol_negotiation */
+			if (len >= 3 && 3 + (size_t)raw[off + 2] <= len) {
+				HELLO_SET(self->alpn, off + 3, raw[off + 2]);
+			}
+			break;
+		default:
+			break;
+		}
+
+		off += len;
+	}
+
+	return (ret);
+}
+
+META_DESCRIBE_APP(http)
+{
+	const uint8_t *raw = packet->app.raw;
+	size_t i, line, next;
+
+	/* request line only, responses don't carry anything */
+	for (i = 0; i < packet->app_len; ++i) {
+		if (raw[i] < 'A' || raw[i] > 'Z') {
+			break;
+		}
+	}
+
+	if (!i || !META_AVAIL(i, 1) || raw[i] != ' ') {
+		return;
+	}
+
+	META_SET(META_HTTP_METHOD, 0, i);
+
+	line = META_FIND(i, '\n');
+	next = META_FIND(i + 1, ' ');
+	if (next > line) {
+		/* HTTP/0.9 doesn't send a version */
+		next = line;
+		if (next > i + 1 && raw[next - 1] == '\r') {
+			--next;
+		}
+	}
+
+	if (next > i + 1 && line < packet->app_len) {
+		META_SET(META_HTTP_URI, i + 1, next - i - 1);
+	}
+
+	/* walk complete header lines until the empty one */
+	while (line < packet->app_len) {
+		i = line + 1;
+		line = META_FIND(i, '\n');
+		if (line >= packet->app_len) {
+			break;
+		}
+
+		next = line;
+		if (next > i && raw[next - 1] == '\r') {
+			--next;
+		}
+
+		if (next == i) {
+			break;
+		}
+
+		if (next - i < 5 || strncasecmp((const char *)&raw[i],
+		    "host:", 5)) {
+			continue;
+		}
+
+		for (i += 5; i < next && (raw[i] == ' ' ||
+		    raw[i] == '\t'); ++i);
+		while (next > i && (raw[next - 1] == ' ' ||
+		    raw[next - 1] == '\t')) {
+			--next;
+		}
+
+		if (next > i) {
+			META_SET(META_HTTP_HOST, i, next - i);
+		}
+
+		break;
+	}
+}
+
+META_DESCRIBE_APP(tls)
+{
+	struct peak_meta_hello hello;
+
+	/* take what's there, the rest may be in the next segment */
+	peak_meta_hello(&hello, packet, 1);
+
+	if (hello.sni.len) {
+		META_SET(META_TLS_SNI, hello.sni.off, hello.sni.len);
+	}
+
+	if (hello.alpn.len) {
+		META_SET(META_TLS_ALPN, hello.alpn.off, hello.alpn.len);
+	}
+}
+
+META_DESCRIBE_APP(dns)
+{
+	/* TCP: padded with 2 bytes of length */
+	const size_t padding =
+	    (packet->net_type == IPPROTO_TCP) * sizeof(uint16_t);
+	const uint8_t *raw = packet->app.raw;
+	size_t off, begin;
+
+	if (!META_AVAIL(padding, 12) || !be16dec(&raw[padding + 4])) {
+		/* no question section */
+		return;
+	}
+
+	begin = off = padding + 12;
+
+	for (;;) {
+		if (!META_AVAIL(off, 1) || off - begin > 255) {
+			return;
+		}
+
+		if (!raw[off]) {
+			break;
+		}
+
+		if (raw[off] & 0xC0) {
+			/* no compression in the question, please */
+			return;
+		}
+
+		off += 1 + raw[off];
+	}
+
+	if (off > begin) {
+		META_SET(META_DNS_QNAME, begin, off - begin);
+	}
+
+	if (META_AVAIL(off + 1, 2)) {
+		META_SET(META_DNS_QTYPE, off + 1, 2);
+	}
+}
+
+unsigned int
+peak_meta_get(struct peak_meta *self, const struct peak_packet *packet,
+    const unsigned int app)
+{
+	memset(self, 0, sizeof(*self));
+
+	switch (app) {
+	case LI_HTTP:
+		peak_meta_http(self, packet);
+		break;
+	case LI_TLS:
+		peak_meta_tls(self, packet);
+		break;
+	case LI_DNS:
+		peak_meta_dns(self, packet);
+		break;
+	default:
+		break;
+	}
+
+	if (self->count) {
+		/* a packet without fields must not end the search */
+		self->app = app;
+	}
+
+	return (self->count);
+}
+
+const uint8_t *
+peak_meta_ptr(const struct peak_meta *self,
+    const struct peak_packet *packet, const unsigned int field,
+    size_t *len)
+{
+	const struct peak_meta_field *elm;
+
+	if (unlikely(field >= META_MAX)) {
+		return (NULL);
+	}
+
+	elm = &self->field[field];
+
+	if (!elm->len || !META_AVAIL(elm->off, elm->len)) {
+		return (NULL);
+	}
+
+	*len = elm->len;
+
+	return (&packet->app.raw[elm->off]);
+}
+
+const char *
+peak_meta_name(const unsigned int field)
+{
+	const char *ret = NULL;
+
+	if (likely(field < META_MAX)) {
+		ret = meta_names[field];
+	}
+
+	return (ret);
+}
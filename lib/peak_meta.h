@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PEAK_META_H
+#define PEAK_META_H
+
+enum {
+	META_HTTP_METHOD,
+	META_HTTP_URI,
+	META_HTTP_HOST,
+	META_TLS_SNI,
+	META_TLS_ALPN,
+	META_DNS_QNAME,
+	META_DNS_QTYPE,
+	META_MAX	/* last element */
+};
+
+struct peak_meta_field {
+	uint16_t off;
+	uint16_t len;
+};
+
+struct peak_meta_hello {
+	uint16_t version;
+	struct peak_meta_field ciphers;
+	struct peak_meta_field extensions;
+	struct peak_meta_field sni;
+	struct peak_meta_field alpn;
+	struct peak_meta_field curves;
+	struct peak_meta_field formats;
+};
+
+struct peak_meta {
+	struct peak_meta_field field[META_MAX];
+	uint16_t app;
+	uint16_t count;
+};
+
+unsigned int	 peak_meta_get(struct peak_meta *,
+		     const struct peak_packet *, const unsigned int);
+const uint8_t	*peak_meta_ptr(const struct peak_meta *,
+		     const struct peak_packet *, const unsigned int,
+		     size_t *);
+const char	*peak_meta_name(const unsigned int);
+int		 peak_meta_hello(struct peak_meta_hello *,
+		     const struct peak_packet *, const unsigned int);
+
+#endif /* !PEAK_META_H */
@@ -0,0 +1,627 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <peak.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/* anything further ahead is garbage, not a hole */
+#define REASM_WINDOW	(1u << 30)
+
+#define SEQ_DIFF(x, y)	((int32_t)((uint32_t)(x) - (uint32_t)(y)))
+#define SEQ_LT(x, y)	(SEQ_DIFF(x, y) < 0)
+#define SEQ_LEQ(x, y)	(SEQ_DIFF(x, y) <= 0)
+
+#define REASM_END(x)	((uint32_t)((x)->seq + (x)->len))
+
+enum {
+	REASM_NONE,
+	REASM_OPEN,
+	REASM_CLOSING,
+	REASM_CLOSED,
+};
+
+struct peak_reasm_seg {
+	TAILQ_ENTRY(peak_reasm_seg) entry;
+	struct peak_stream *mem;
+	uint64_t id;
+	uint32_t seq;
+	uint32_t len;
+	uint8_t dir;
+	uint8_t gap;
+};
+
+TAILQ_HEAD(peak_reasm_segs, peak_reasm_seg);
+
+struct peak_reasm_dir {
+	struct peak_reasm_segs segs;
+	uint32_t next;
+	uint32_t fin;
+	uint8_t state;
+	uint8_t gap;
+};
+
+struct peak_reasm_flow {
+	struct peak_reasm_dir dir[2];
+	unsigned int held;
+	uint64_t id;
+	RB_ENTRY(peak_reasm_flow) rb_flow;
+	TAILQ_ENTRY(peak_reasm_flow) tq_lru;
+	TAILQ_ENTRY(peak_reasm_flow) tq_held;
+};
+
+RB_HEAD(peak_reasm_tree, peak_reasm_flow);
+
+struct peak_reasms {
+	struct peak_reasm_tree flows;
+	TAILQ_HEAD(, peak_reasm_flow) lru;
+	TAILQ_HEAD(, peak_reasm_flow) held;
+	struct peak_reasm_segs ready;
+	struct peak_reasm_seg *last;
+	struct peak_reasm_data direct;
+	unsigned int has_direct;
+	unsigned int policy;
+	struct peak_streams *streams;
+	prealloc_t flow_mem;
+	prealloc_t seg_mem;
+};
+
+static inline int
+peak_reasm_cmp(const struct peak_reasm_flow *x,
+    const struct peak_reasm_flow *y)
+{
+	return (x->id < y->id ? -1 : x->id > y->id);
+}
+
+RB_GENERATE_STATIC(peak_reasm_tree, peak_reasm_flow, rb_flow,
+    peak_reasm_cmp);
+
+static inline unsigned int
+peak_reasm_side(const struct peak_track *track,
+    const struct peak_packet *packet)
+{
+	struct netaddr addr = track->addr[0];
+
+	/* TRACK_KEY() puts the sender into slot 0 or 1 */
+	if (netcmp(&addr, &packet->net_saddr)) {
+		return (1);
+	}
+
+	return (track->port[0] != packet->flow_sport);
+}
+
+static void
+peak_reasm_put(struct peak_reasms *self, struct peak_reasm_seg *seg)
+{
+	peak_stream_release(self->streams, &seg->mem, seg->len);
+	prealloc_put(&self->seg_mem, seg);
+}
+
+static void
+peak_reasm_unhold(struct peak_reasms *self, struct peak_reasm_flow *flow)
+{
+	if (!--flow->held) {
+		TAILQ_REMOVE(&self->held, flow, tq_held);
+	}
+}
+
+static unsigned int
+peak_reasm_clear(struct peak_reasms *self, struct peak_reasm_flow *flow)
+{
+	struct peak_reasm_seg *seg;
+	unsigned int count = 0;
+	unsigned int i;
+
+	for (i = 0; i < lengthof(flow->dir); ++i) {
+		struct peak_reasm_dir *dir = &flow->dir[i];
+
+		while ((seg = TAILQ_FIRST(&dir->segs))) {
+			/* skip what's lost and carry on */
+			dir->next = REASM_END(seg);
+			dir->gap = 1;
+
+			TAILQ_REMOVE(&dir->segs, seg, entry);
+			peak_reasm_unhold(self, flow);
+			peak_reasm_put(self, seg);
+			++count;
+		}
+	}
+
+	peak_audit_add(AUDIT_REASM_EVICTED, count);
+
+	return (count);
+}
+
+static void
+peak_reasm_drop(struct peak_reasms *self, struct peak_reasm_flow *flow)
+{
+	peak_reasm_clear(self, flow);
+
+	RB_REMOVE(peak_reasm_tree, &self->flows, flow);
+	TAILQ_REMOVE(&self->lru, flow, tq_lru);
+	prealloc_put(&self->flow_mem, flow);
+}
+
+static void
+peak_reasm_close(struct peak_reasms *self, struct peak_reasm_flow *flow)
+{
+	unsigned int i;
+
+	for (i = 0; i < lengthof(flow->dir); ++i) {
+		struct peak_reasm_dir *dir = &flow->dir[i];
+
+		if (dir->state == REASM_CLOSING &&
+		    SEQ_LEQ(dir->fin, dir->next)) {
+			dir->state = REASM_CLOSED;
+		}
+	}
+
+	if (flow->dir[0].state == REASM_CLOSED &&
+	    flow->dir[1].state == REASM_CLOSED) {
+		/* both sides are done */
+		peak_reasm_drop(self, flow);
+	}
+}
+
+static unsigned int
+peak_reasm_evict(struct peak_reasms *self, struct peak_reasm_flow *keep)
+{
+	struct peak_reasm_flow *flow;
+
+	/* least recently touched flow with buffered data first */
+	TAILQ_FOREACH(flow, &self->held, tq_held) {
+		if (flow != keep) {
+			break;
+		}
+	}
+
+	if (!flow) {
+		return (0);
+	}
+
+	peak_reasm_clear(self, flow);
+	peak_reasm_close(self, flow);
+
+	return (1);
+}
+
+static unsigned int
+peak_reasm_store(struct peak_reasms *self, struct peak_reasm_flow *flow,
+    const unsigned int side, struct peak_reasm_seg *next,
+    const uint32_t seq, const uint32_t len, const uint8_t *buf)
+{
+	struct peak_reasm_dir *dir = &flow->dir[side];
+	struct peak_stream *mem = NULL;
+	struct peak_reasm_seg *seg;
+
+	while (!peak_stream_claim(self->streams, &mem, len)) {
+		if (!peak_reasm_evict(self, flow)) {
+			return (0);
+		}
+	}
+
+	seg = prealloc_get(&self->seg_mem);
+	if (unlikely(!seg)) {
+		/*
+		 * There are as many segments as pages, and
+		 * each segment holds at least one page.
+		 */
+		panic("no more reassembly segments available\n");
+	}
+
+	memcpy(mem->buf, buf, len);
+
+	seg->mem = mem;
+	seg->id = flow->id;
+	seg->seq = seq;
+	seg->len = len;
+	seg->dir = side;
+	seg->gap = 0;
+
+	if (next) {
+		TAILQ_INSERT_BEFORE(next, seg, entry);
+	} else {
+		TAILQ_INSERT_TAIL(&dir->segs, seg, entry);
+	}
+
+	if (!flow->held++) {
+		TAILQ_INSERT_TAIL(&self->held, flow, tq_held);
+	}
+
+	peak_audit_inc(AUDIT_REASM_BUFFERED);
+
+	return (1);
+}
+
+static void
+peak_reasm_insert(struct peak_reasms *self, struct peak_reasm_flow *flow,
+    const unsigned int side, uint32_t seq, const uint32_t end,
+    const uint8_t *buf)
+{
+	struct peak_reasm_dir *dir = &flow->dir[side];
+	struct peak_reasm_seg *seg = TAILQ_FIRST(&dir->segs);
+	uint32_t stop;
+
+	/*
+	 * Walk the sorted segment list and split the new data
+	 * into pieces that are either already buffered or not.
+	 * Buffered pieces are overwritten depending on policy,
+	 * the others become segments of their own.
+	 */
+	while (seq != end) {
+		while (seg && SEQ_LEQ(REASM_END(seg), seq)) {
+			seg = TAILQ_NEXT(seg, entry);
+		}
+
+		if (seg && SEQ_LEQ(seg->seq, seq)) {
+			stop = SEQ_LT(end, REASM_END(seg)) ?
+			    end : REASM_END(seg);
+			if (self->policy == REASM_POLICY_LAST) {
+				memcpy((uint8_t *)seg->mem->buf +
+				    (seq - seg->seq), buf, stop - seq);
+			}
+			peak_audit_inc(AUDIT_REASM_OVERLAP);
+		} else {
+			stop = seg && SEQ_LT(seg->seq, end) ? seg->seq : end;
+			if (!peak_reasm_store(self, flow, side, seg, seq,
+			    stop - seq, buf)) {
+				peak_audit_inc(AUDIT_REASM_DROPPED);
+				return;
+			}
+		}
+
+		buf += stop - seq;
+		seq = stop;
+	}
+}
+
+static void
+peak_reasm_drain(struct peak_reasms *self, struct peak_reasm_flow *flow,
+    const unsigned int side)
+{
+	struct peak_reasm_dir *dir = &flow->dir[side];
+	struct peak_reasm_seg *seg;
+
+	/* segments never overlap, so they fit seamlessly */
+	while ((seg = TAILQ_FIRST(&dir->segs)) && seg->seq == dir->next) {
+		TAILQ_REMOVE(&dir->segs, seg, entry);
+		peak_reasm_unhold(self, flow);
+
+		seg->gap = dir->gap;
+		dir->gap = 0;
+		dir->next = REASM_END(seg);
+
+		TAILQ_INSERT_TAIL(&self->ready, seg, entry);
+	}
+}
+
+static void
+peak_reasm_data(struct peak_reasms *self, struct peak_reasm_flow *flow,
+    const unsigned int side, uint32_t seq, const uint8_t *buf,
+    const uint32_t len)
+{
+	struct peak_reasm_dir *dir = &flow->dir[side];
+	const uint32_t end = seq + len;
+	struct peak_reasm_seg *first;
+	uint32_t lim;
+
+	if (SEQ_LEQ(end, dir->next)) {
+		peak_audit_inc(AUDIT_REASM_RETRANS);
+		return;
+	}
+
+	if (SEQ_LT(seq, dir->next)) {
+		/* only deliver what's new */
+		buf += dir->next - seq;
+		seq = dir->next;
+		peak_audit_inc(AUDIT_REASM_OVERLAP);
+	}
+
+	if (seq - dir->next > REASM_WINDOW) {
+		peak_audit_inc(AUDIT_REASM_DROPPED);
+		return;
+	}
+
+	if (seq != dir->next) {
+		peak_reasm_insert(self, flow, side, seq, end, buf);
+		return;
+	}
+
+	/*
+	 * In order: hand out the payload without copying up
+	 * to the first buffered segment.  Anything beyond is
+	 * merged into the buffer before draining it.
+	 */
+	first = TAILQ_FIRST(&dir->segs);
+	lim = first && SEQ_LT(first->seq, end) ? first->seq : end;
+
+	self->direct.buf = buf;
+	self->direct.id = flow->id;
+	self->direct.seq = seq;
+	self->direct.len = lim - seq;
+	self->direct.dir = side;
+	self->direct.gap = dir->gap;
+	self->has_direct = 1;
+
+	dir->next = lim;
+	dir->gap = 0;
+
+	peak_audit_inc(AUDIT_REASM_INORDER);
+
+	if (lim != end) {
+		peak_reasm_insert(self, flow, side, lim, end,
+		    buf + (lim - seq));
+	}
+
+	peak_reasm_drain(self, flow, side);
+}
+
+static struct peak_reasm_flow *
+peak_reasm_find(struct peak_reasms *self, const struct peak_track *track)
+{
+	struct peak_reasm_flow key;
+
+	key.id = track->id;
+
+	return (RB_FIND(peak_reasm_tree, &self->flows, &key));
+}
+
+static struct peak_reasm_flow *
+peak_reasm_acquire(struct peak_reasms *self, const struct peak_track *track)
+{
+	struct peak_reasm_flow *flow;
+
+	flow = peak_reasm_find(self, track);
+	if (likely(flow)) {
+		TAILQ_REMOVE(&self->lru, flow, tq_lru);
+		TAILQ_INSERT_TAIL(&self->lru, flow, tq_lru);
+		if (flow->held) {
+			TAILQ_REMOVE(&self->held, flow, tq_held);
+			TAILQ_INSERT_TAIL(&self->held, flow, tq_held);
+		}
+
+		return (flow);
+	}
+
+	if (prealloc_empty(&self->flow_mem)) {
+		/* recycle the least recently used flow */
+		peak_reasm_drop(self, TAILQ_FIRST(&self->lru));
+	}
+
+	flow = prealloc_get(&self->flow_mem);
+	if (unlikely(!flow)) {
+		panic("reassembly pool empty\n");
+	}
+
+	memset(flow, 0, sizeof(*flow));
+	TAILQ_INIT(&flow->dir[0].segs);
+	TAILQ_INIT(&flow->dir[1].segs);
+	flow->id = track->id;
+
+	if (unlikely(RB_INSERT(peak_reasm_tree, &self->flows, flow))) {
+		panic("can't insert reassembly flow\n");
+	}
+
+	TAILQ_INSERT_TAIL(&self->lru, flow, tq_lru);
+
+	return (flow);
+}
+
+void
+peak_reasm_add(struct peak_reasms *self, const struct peak_track *track,
+    const struct peak_packet *packet)
+{
+	const struct tcphdr *th = packet->flow.th;
+	struct peak_reasm_flow *flow;
+	struct peak_reasm_dir *dir;
+	unsigned int side;
+	uint32_t seq;
+
+	if (unlikely(!track || packet->net_type != IPPROTO_TCP || !th)) {
+		return;
+	}
+
+	if (unlikely(self->has_direct || TAILQ_FIRST(&self->ready))) {
+		/* delivery order would break */
+		panic("reassembled data was not drained\n");
+	}
+
+	flow = peak_reasm_acquire(self, track);
+
+	if (th->th_flags & TH_RST) {
+		/* whatever is buffered can't be completed */
+		peak_reasm_drop(self, flow);
+		return;
+	}
+
+	side = peak_reasm_side(track, packet);
+	dir = &flow->dir[side];
+	seq = be32dec(&th->th_seq);
+
+	if (th->th_flags & TH_SYN) {
+		if (dir->state == REASM_NONE) {
+			dir->state = REASM_OPEN;
+			dir->next = seq + 1;
+		}
+		/* payload follows the SYN */
+		++seq;
+	} else if (dir->state == REASM_NONE) {
+		/* picked up in the middle of a connection */
+		dir->state = REASM_OPEN;
+		dir->next = seq;
+	}
+
+	if (th->th_flags & TH_FIN && dir->state == REASM_OPEN) {
+		dir->state = REASM_CLOSING;
+		dir->fin = seq + packet->app_len;
+	}
+
+	if (packet->app_len) {
+		peak_reasm_data(self, flow, side, seq, packet->app.raw,
+		    packet->app_len);
+	}
+
+	peak_reasm_close(self, flow);
+}
+
+unsigned int
+peak_reasm_next(struct peak_reasms *self, struct peak_reasm_data *data)
+{
+	struct peak_reasm_seg *seg;
+
+	if (self->last) {
+		/* caller is done with it */
+		peak_reasm_put(self, self->last);
+		self->last = NULL;
+	}
+
+	if (self->has_direct) {
+		*data = self->direct;
+		self->has_direct = 0;
+		return (1);
+	}
+
+	seg = TAILQ_FIRST(&self->ready);
+	if (!seg) {
+		return (0);
+	}
+
+	TAILQ_REMOVE(&self->ready, seg, entry);
+
+	memset(data, 0, sizeof(*data));
+	data->buf = seg->mem->buf;
+	data->id = seg->id;
+	data->seq = seg->seq;
+	data->len = seg->len;
+	data->dir = seg->dir;
+	data->gap = seg->gap;
+
+	self->last = seg;
+
+	return (1);
+}
+
+void
+peak_reasm_flush(struct peak_reasms *self, const struct peak_track *track)
+{
+	struct peak_reasm_flow *flow;
+	struct peak_reasm_seg *seg;
+	unsigned int i;
+
+	if (unlikely(!track)) {
+		return;
+	}
+
+	flow = peak_reasm_find(self, track);
+	if (!flow) {
+		return;
+	}
+
+	/* hand out everything, holes or not */
+	for (i = 0; i < lengthof(flow->dir); ++i) {
+		struct peak_reasm_dir *dir = &flow->dir[i];
+
+		while ((seg = TAILQ_FIRST(&dir->segs))) {
+			TAILQ_REMOVE(&dir->segs, seg, entry);
+			peak_reasm_unhold(self, flow);
+
+			seg->gap = dir->gap || seg->seq != dir->next;
+			dir->next = REASM_END(seg);
+			dir->gap = 0;
+
+			TAILQ_INSERT_TAIL(&self->ready, seg, entry);
+		}
+	}
+
+	peak_reasm_drop(self, flow);
+}
+
+void
+peak_reasm_exit(struct peak_reasms *self)
+{
+	struct peak_reasm_flow *flow;
+	struct peak_reasm_seg *seg;
+
+	if (!self) {
+		return;
+	}
+
+	while ((flow = RB_ROOT(&self->flows))) {
+		peak_reasm_drop(self, flow);
+	}
+
+	while ((seg = TAILQ_FIRST(&self->ready))) {
+		TAILQ_REMOVE(&self->ready, seg, entry);
+		peak_reasm_put(self, seg);
+	}
+
+	if (self->last) {
+		peak_reasm_put(self, self->last);
+	}
+
+	prealloc_exit(&self->seg_mem);
+	prealloc_exit(&self->flow_mem);
+	peak_stream_exit(self->streams);
+	free(self);
+}
+
+struct peak_reasms *
+peak_reasm_init(const size_t flow_count, const size_t page_count,
+    const size_t page_size, const unsigned int policy)
+{
+	struct peak_reasms *self;
+
+	if (!flow_count || policy >= REASM_POLICY_MAX) {
+		return (NULL);
+	}
+
+	self = calloc(1, sizeof(*self));
+	if (!self) {
+		return (NULL);
+	}
+
+	self->streams = peak_stream_init(page_count, page_size);
+	if (!self->streams) {
+		goto peak_reasm_init_streams;
+	}
+
+	if (!prealloc_init(&self->flow_mem, flow_count,
+	    sizeof(struct peak_reasm_flow))) {
+		goto peak_reasm_init_flows;
+	}
+
+	if (!prealloc_init(&self->seg_mem, page_count,
+	    sizeof(struct peak_reasm_seg))) {
+		goto peak_reasm_init_segs;
+	}
+
+	RB_INIT(&self->flows);
+	TAILQ_INIT(&self->lru);
+	TAILQ_INIT(&self->held);
+	TAILQ_INIT(&self->ready);
+	self->policy = policy;
+
+	return (self);
+
+peak_reasm_init_segs:
+	prealloc_exit(&self->flow_mem);
+peak_reasm_init_flows:
+	peak_stream_exit(self->streams);
+peak_reasm_init_streams:
+	free(self);
+
+	return (NULL);
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PEAK_REASM_H
+#define PEAK_REASM_H
+
+enum {
+	REASM_POLICY_FIRST,	/* buffered data wins overlaps */
+	REASM_POLICY_LAST,	/* new data wins overlaps */
+	REASM_POLICY_MAX	/* last element */
+};
+
+struct peak_reasm_data {
+	const void *buf;
+	uint64_t id;
+	uint32_t seq;
+	uint32_t len;
+	uint8_t dir;
+	uint8_t gap;
+	uint8_t pad[6];
+};
+
+struct peak_reasms	*peak_reasm_init(const size_t, const size_t,
+			     const size_t, const unsigned int);
+void			 peak_reasm_add(struct peak_reasms *,
+			     const struct peak_track *,
+			     const struct peak_packet *);
+unsigned int		 peak_reasm_next(struct peak_reasms *,
+			     struct peak_reasm_data *);
+void			 peak_reasm_flush(struct peak_reasms *,
+			     const struct peak_track *);
+void			 peak_reasm_exit(struct peak_reasms *);
+
+#endif /* !PEAK_REASM_H */
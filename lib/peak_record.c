@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <peak.h>
+#include <pthread.h>
+
+struct peak_record_frame {
+	int64_t sec;
+	int64_t usec;
+	uint32_t len;
+	uint8_t pad[4];
+	uint8_t buf[];
+};
+
+#define RECORD_FRAME(len)						\
+    (sizeof(struct peak_record_frame) + ALLOC_ALIGN(len, sizeof(int64_t)))
+
+struct peak_record_flow {
+	struct peak_jar context;
+	int64_t last;
+	uint64_t id;
+	RB_ENTRY(peak_record_flow) rb_flow;
+	TAILQ_ENTRY(peak_record_flow) tq_lru;
+};
+
+RB_HEAD(peak_record_tree, peak_record_flow);
+
+struct peak_record_job {
+	TAILQ_ENTRY(peak_record_job) entry;
+	const char *file;
+	size_t size;
+	uint8_t buf[];
+};
+
+struct peak_record_walk {
+	struct peak_record_job *job;
+	unsigned int count;
+	int64_t since;
+	size_t size;
+};
+
+struct peak_records {
+	struct peak_record_tree flows;
+	TAILQ_HEAD(, peak_record_flow) lru;
+	struct peak_jars jar;
+	prealloc_t flow_mem;
+	unsigned int window;
+	/* everything below is shared with the writer */
+	TAILQ_HEAD(, peak_record_job) jobs;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+	pthread_t writer;
+	unsigned int failed;
+	unsigned int quit;
+	size_t pending;
+};
+
+static inline int
+peak_record_cmp(const struct peak_record_flow *x,
+    const struct peak_record_flow *y)
+{
+	return (x->id < y->id ? -1 : x->id > y->id);
+}
+
+RB_GENERATE_STATIC(peak_record_tree, peak_record_flow, rb_flow,
+    peak_record_cmp);
+
+static unsigned int
+peak_record_unlink(void *userdata, void *buf, size_t len)
+{
+	(void)userdata;
+	(void)buf;
+	(void)len;
+
+	return (JAR_DROP);
+}
+
+static void
+peak_record_drop(struct peak_records *self, struct peak_record_flow *flow)
+{
+	/* the jar must not hand out stale frames to the next owner */
+	peak_jar_fifo(&self->jar, &flow->context, peak_record_unlink, NULL);
+
+	RB_REMOVE(peak_record_tree, &self->flows, flow);
+	TAILQ_REMOVE(&self->lru, flow, tq_lru);
+	prealloc_put(&self->flow_mem, flow);
+}
+
+static struct peak_record_flow *
+peak_record_find(struct peak_records *self, const struct peak_track *track)
+{
+	struct peak_record_flow key;
+
+	key.id = track->id;
+
+	return (RB_FIND(peak_record_tree, &self->flows, &key));
+}
+
+static struct peak_record_flow *
+peak_record_acquire(struct peak_records *self,
+    const struct peak_track *track)
+{
+	struct peak_record_flow *flow;
+
+	flow = peak_record_find(self, track);
+	if (likely(flow)) {
+		TAILQ_REMOVE(&self->lru, flow, tq_lru);
+		TAILQ_INSERT_TAIL(&self->lru, flow, tq_lru);
+
+		return (flow);
+	}
+
+	if (prealloc_empty(&self->flow_mem)) {
+		/* recycle the least recently used flow */
+		peak_record_drop(self, TAILQ_FIRST(&self->lru));
+	}
+
+	flow = prealloc_get(&self->flow_mem);
+	if (unlikely(!flow)) {
+		panic("recorder pool empty\n");
+	}
+
+	memset(flow, 0, sizeof(*flow));
+	JAR_INIT(&flow->context);
+	flow->id = track->id;
+
+	if (unlikely(RB_INSERT(peak_record_tree, &self->flows, flow))) {
+		panic("can't insert recorder flow\n");
+	}
+
+	TAILQ_INSERT_TAIL(&self->lru, flow, tq_lru);
+
+	return (flow);
+}
+
+void
+peak_record_add(struct peak_records *self, const struct peak_track *track,
+    const void *buf, const unsigned int len, const struct peak_timeval *ts)
+{
+	struct peak_record_flow *flow;
+	struct peak_record_frame *frame;
+
+	if (unlikely(RECORD_FRAME(len) > self->jar.size / 4)) {
+		/* would wipe out the history of everyone else */
+		peak_audit_inc(AUDIT_RECORD_SKIPPED);
+		return;
+	}
+
+	flow = peak_record_acquire(self, track);
+
+	/* serialise straight into the jar */
+	frame = peak_jar_reserve(&self->jar, &flow->context,
+	    RECORD_FRAME(len));
+	frame->sec = ts->tv_sec;
+	frame->usec = ts->tv_usec;
+	frame->len = len;
+	memcpy(frame->buf, buf, len);
+	peak_jar_commit(&self->jar, frame);
+
+	flow->last = ts->tv_sec;
+}
+
+static unsigned int
+peak_record_size(void *userdata, void *buf, size_t len)
+{
+	struct peak_record_walk *walk = userdata;
+	struct peak_record_frame *frame = buf;
+
+	if (frame->sec >= walk->since) {
+		walk->size += len;
+		walk->count += 1;
+	}
+
+	return (JAR_KEEP);
+}
+
+static unsigned int
+peak_record_copy(void *userdata, void *buf, size_t len)
+{
+	struct peak_record_walk *walk = userdata;
+	struct peak_record_frame *frame = buf;
+
+	if (frame->sec >= walk->since) {
+		memcpy(walk->job->buf + walk->size, frame, len);
+		walk->size += len;
+	}
+
+	return (JAR_KEEP);
+}
+
+unsigned int
+peak_record_dump(struct peak_records *self, const struct peak_track *track,
+    const char *file)
+{
+	const size_t file_len = strlen(file) + 1;
+	struct peak_record_flow *flow;
+	struct peak_record_walk walk;
+	struct peak_record_job *job;
+
+	flow = peak_record_find(self, track);
+	if (!flow) {
+		return (0);
+	}
+
+	memset(&walk, 0, sizeof(walk));
+	walk.since = self->window ? flow->last - self->window : INT64_MIN;
+
+	/* first pass sizes the job, second pass copies */
+	peak_jar_fifo(&self->jar, &flow->context, peak_record_size, &walk);
+	if (!walk.count) {
+		return (0);
+	}
+
+	pthread_mutex_lock(&self->lock);
+	if (self->pending + walk.size > self->jar.size) {
+		/* the writer can't keep up, don't pile up memory */
+		pthread_mutex_unlock(&self->lock);
+		peak_audit_inc(AUDIT_RECORD_BUSY);
+		return (0);
+	}
+	self->pending += walk.size;
+	pthread_mutex_unlock(&self->lock);
+
+	job = malloc(sizeof(*job) + walk.size + file_len);
+	if (!job) {
+		pthread_mutex_lock(&self->lock);
+		self->pending -= walk.size;
+		pthread_mutex_unlock(&self->lock);
+		peak_audit_inc(AUDIT_RECORD_BUSY);
+		return (0);
+	}
+
+	job->size = walk.size;
+	job->file = (char *)job->buf + walk.size;
+	memcpy((char *)job->file, file, file_len);
+
+	walk.job = job;
+	walk.size = 0;
+	peak_jar_fifo(&self->jar, &flow->context, peak_record_copy, &walk);
+
+	pthread_mutex_lock(&self->lock);
+	TAILQ_INSERT_TAIL(&self->jobs, job, entry);
+	pthread_cond_signal(&self->wake);
+	pthread_mutex_unlock(&self->lock);
+
+	peak_audit_inc(AUDIT_RECORD_DUMPED);
+	peak_audit_add(AUDIT_RECORD_FRAMES, walk.count);
+
+	return (walk.count);
+}
+
+static unsigned int
+peak_record_write(const struct peak_record_job *job)
+{
+	const struct peak_record_frame *frame;
+	unsigned int ret = 1;
+	size_t i;
+	int fd;
+
+	fd = peak_store_init(job->file);
+	if (fd < 0) {
+		warning("could not open file `%s'\n", job->file);
+		return (0);
+	}
+
+	for (i = 0; i < job->size; i += RECORD_FRAME(frame->len)) {
+		frame = (const void *)(job->buf + i);
+		if (!peak_store_packet(fd, frame->buf, frame->len,
+		    frame->sec, frame->usec)) {
+			ret = 0;
+			break;
+		}
+	}
+
+	peak_store_exit(fd);
+
+	return (ret);
+}
+
+static void *
+peak_record_writer(void *arg)
+{
+	struct peak_records *self = arg;
+	struct peak_record_job *job;
+	unsigned int ret;
+
+	pthread_mutex_lock(&self->lock);
+
+	for (;;) {
+		job = TAILQ_FIRST(&self->jobs);
+		if (!job) {
+			if (self->quit) {
+				break;
+			}
+			pthread_cond_wait(&self->wake, &self->lock);
+			continue;
+		}
+
+		TAILQ_REMOVE(&self->jobs, job, entry);
+
+		/* disk I/O happens without the lock held */
+		pthread_mutex_unlock(&self->lock);
+		ret = peak_record_write(job);
+		pthread_mutex_lock(&self->lock);
+
+		self->pending -= job->size;
+		self->failed += !ret;
+		free(job);
+
+		if (!self->pending) {
+			pthread_cond_broadcast(&self->idle);
+		}
+	}
+
+	pthread_mutex_unlock(&self->lock);
+
+	return (NULL);
+}
+
+unsigned int
+peak_record_wait(struct peak_records *self)
+{
+	unsigned int ret;
+
+	pthread_mutex_lock(&self->lock);
+	while (self->pending) {
+		pthread_cond_wait(&self->idle, &self->lock);
+	}
+	ret = self->failed;
+	self->failed = 0;
+	pthread_mutex_unlock(&self->lock);
+
+	return (ret);
+}
+
+void
+peak_record_forget(struct peak_records *self, const struct peak_track *track)
+{
+	struct peak_record_flow *flow;
+
+	flow = peak_record_find(self, track);
+	if (flow) {
+		peak_record_drop(self, flow);
+	}
+}
+
+void
+peak_record_exit(struct peak_records *self)
+{
+	struct peak_record_flow *flow;
+
+	if (!self) {
+		return;
+	}
+
+	/* queued dumps are still written */
+	pthread_mutex_lock(&self->lock);
+	self->quit = 1;
+	pthread_cond_signal(&self->wake);
+	pthread_mutex_unlock(&self->lock);
+	pthread_join(self->writer, NULL);
+
+	while ((flow = RB_ROOT(&self->flows))) {
+		peak_record_drop(self, flow);
+	}
+
+	pthread_cond_destroy(&self->idle);
+	pthread_cond_destroy(&self->wake);
+	pthread_mutex_destroy(&self->lock);
+	prealloc_exit(&self->flow_mem);
+	peak_jar_exit(&self->jar);
+	free(self);
+}
+
+struct peak_records *
+peak_record_init(const size_t flow_count, const size_t size,
+    const unsigned int window)
+{
+	struct peak_records *self;
+
+	if (!flow_count) {
+		return (NULL);
+	}
+
+	self = calloc(1, sizeof(*self));
+	if (!self) {
+		return (NULL);
+	}
+
+	if (!peak_jar_init(&self->jar, size)) {
+		goto peak_record_init_jar;
+	}
+
+	if (!prealloc_init(&self->flow_mem, flow_count,
+	    sizeof(struct peak_record_flow))) {
+		goto peak_record_init_flows;
+	}
+
+	RB_INIT(&self->flows);
+	TAILQ_INIT(&self->lru);
+	TAILQ_INIT(&self->jobs);
+	self->window = window;
+
+	pthread_mutex_init(&self->lock, NULL);
+	pthread_cond_init(&self->wake, NULL);
+	pthread_cond_init(&self->idle, NULL);
+
+	if (pthread_create(&self->writer, NULL, peak_record_writer, self)) {
+		goto peak_record_init_writer;
+	}
+
+	return (self);
+
+peak_record_init_writer:
+	pthread_cond_destroy(&self->idle);
+	pthread_cond_destroy(&self->wake);
+	pthread_mutex_destroy(&self->lock);
+	prealloc_exit(&self->flow_mem);
+peak_record_init_flows:
+	peak_jar_exit(&self->jar);
+peak_record_init_jar:
+	free(self);
+
+	return (NULL);
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PEAK_RECORD_H
+#define PEAK_RECORD_H
+
+struct peak_records	*peak_record_init(const size_t, const size_t,
+			     const unsigned int);
+void			 peak_record_add(struct peak_records *,
+			     const struct peak_track *, const void *,
+			     const unsigned int, const struct peak_timeval *);
+unsigned int		 peak_record_dump(struct peak_records *,
+			     const struct peak_track *, const char *);
+unsigned int		 peak_record_wait(struct peak_records *);
+void			 peak_record_forget(struct peak_records *,
+			     const struct peak_track *);
+void			 peak_record_exit(struct peak_records *);
+
+#endif /* !PEAK_RECORD_H */
@@ -64,6 +64,88 @@ peak_regex_find(struct peak_regexes *root, const char *buf,
 	}
 }
 
+static int
+peak_regex_findv_one(struct peak_regex *node, const struct iovec *iov,
+    const unsigned int count)
+{
+	unsigned int i, j;
+	int options, ret;
+	size_t len;
+	char *buf;
+
+	for (i = 0; i < count; ++i) {
+		/* the last buffer decides, no more partials there */
+		options = i + 1 < count ? PCRE_PARTIAL_SOFT : 0;
+		if (i) {
+			options |= PCRE_NOTBOL;
+		}
+
+		ret = pcre_exec(node->regex, node->pextra, iov[i].iov_base,
+		    iov[i].iov_len, 0, options, NULL, 0);
+		if (ret >= 0) {
+			return (1);
+		}
+
+		if (ret == PCRE_ERROR_PARTIAL) {
+			break;
+		}
+	}
+
+	if (i >= count) {
+		return (0);
+	}
+
+	/*
+	 * A match may continue into the next buffer.  There
+	 * can be any number of those pending at once and any
+	 * of them may fail later on, so copy the rest of the
+	 * chain into one piece and let PCRE sort it out.
+	 * The buffers before this one are done with.
+	 */
+	for (len = 0, j = i; j < count; ++j) {
+		len += iov[j].iov_len;
+	}
+
+	buf = malloc(len);
+	if (!buf) {
+		return (0);
+	}
+
+	for (len = 0, j = i; j < count; ++j) {
+		memcpy(buf + len, iov[j].iov_base, iov[j].iov_len);
+		len += iov[j].iov_len;
+	}
+
+	ret = pcre_exec(node->regex, node->pextra, buf, len, 0,
+	    i ? PCRE_NOTBOL : 0, NULL, 0);
+
+	free(buf);
+
+	return (ret >= 0);
+}
+
+void
+peak_regex_findv(struct peak_regexes *root, const struct iovec *iov,
+    const unsigned int count, stash_t stash)
+{
+	struct peak_regex *node = root->head;
+	STASH_REBUILD(temp, int, stash);
+
+	if (count == 1) {
+		/* keep the faster path for contiguous buffers */
+		peak_regex_find(root, iov->iov_base, iov->iov_len, stash);
+		return;
+	}
+
+	while (node) {
+		if (peak_regex_findv_one(node, iov, count)) {
+			STASH_PUSH(&node->result, temp);
+		}
+
+		node = node->next;
+	}
+}
+
 int
 peak_regex_add(struct peak_regexes *root, const unsigned int result,
     const char *_buf, const size_t len, const unsigned int flags)
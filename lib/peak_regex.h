@@ -29,6 +29,9 @@ int			 peak_regex_add(struct peak_regexes *,
 			     const size_t, const unsigned int);
 void			 peak_regex_find(struct peak_regexes *,
 			     const char *, const size_t, stash_t);
+void			 peak_regex_findv(struct peak_regexes *,
+			     const struct iovec *, const unsigned int,
+			     stash_t);
 void			 peak_regex_exit(struct peak_regexes *);
 
 #endif /* !PEAK_REGEX_H */
@@ -14,9 +14,11 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <peak.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 struct pcap_file_header {
@@ -36,9 +38,49 @@ struct pcap_packet_header {
 	uint32_t orig_len;
 };
 
+struct peak_store {
+	uint8_t *buf;
+	size_t size;
+	size_t used;
+	unsigned int error;
+	int fd;
+};
+
+#define STORE_BUFFER	(1024 * 1024)	/* default batch size */
+
+static unsigned int
+_peak_store_writev(const int fd, struct iovec *iov, unsigned int count)
+{
+	ssize_t ret;
+
+	while (count) {
+		ret = writev(fd, iov, count);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (0);
+		}
+
+		/* short writes resume where they stopped */
+		while (count && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			++iov;
+			--count;
+		}
+
+		if (count) {
+			iov->iov_base = (uint8_t *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return (1);
+}
+
 unsigned int
-peak_store_packet(int fd, const void *buf, const unsigned int len,
-    const int64_t ts_sec, const int64_t ts_usec)
+peak_store_write(struct peak_store *self, const void *buf,
+    const unsigned int len, const int64_t ts_sec, const int64_t ts_usec)
 {
 	struct pcap_packet_header hdr = {
 		.ts_usec = ts_usec,
@@ -46,18 +88,71 @@ peak_store_packet(int fd, const void *buf, const unsigned int len,
 		.incl_len = len,
 		.orig_len = len,
 	};
+	struct iovec iov[3];
 
-	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+	if (unlikely(self->error)) {
 		return (0);
 	}
 
-	if (write(fd, buf, len) != len) {
+	if (likely(self->size - self->used >= sizeof(hdr) + len)) {
+		memcpy(self->buf + self->used, &hdr, sizeof(hdr));
+		memcpy(self->buf + self->used + sizeof(hdr), buf, len);
+		self->used += sizeof(hdr) + len;
+		return (1);
+	}
+
+	/* batch and record go out together, big ones uncopied */
+	iov[0].iov_base = self->buf;
+	iov[0].iov_len = self->used;
+	iov[1].iov_base = &hdr;
+	iov[1].iov_len = sizeof(hdr);
+	iov[2].iov_base = (void *)buf;
+	iov[2].iov_len = len;
+
+	self->used = 0;
+
+	if (!_peak_store_writev(self->fd, iov, lengthof(iov))) {
+		self->error = 1;
 		return (0);
 	}
 
 	return (1);
 }
 
+unsigned int
+peak_store_flush(struct peak_store *self)
+{
+	struct iovec iov;
+
+	if (unlikely(self->error)) {
+		return (0);
+	}
+
+	iov.iov_base = self->buf;
+	iov.iov_len = self->used;
+
+	self->used = 0;
+
+	if (!_peak_store_writev(self->fd, &iov, 1)) {
+		self->error = 1;
+		return (0);
+	}
+
+	return (1);
+}
+
+unsigned int
+peak_store_packet(int fd, const void *buf, const unsigned int len,
+    const int64_t ts_sec, const int64_t ts_usec)
+{
+	struct peak_store self = {
+		.fd = fd,
+	};
+
+	/* without a buffer every record is one system call */
+	return (peak_store_write(&self, buf, len, ts_sec, ts_usec));
+}
+
 int
 peak_store_init(const char *file)
 {
@@ -102,3 +197,58 @@ peak_store_exit(int fd)
 
 	close(fd);
 }
+
+struct peak_store *
+peak_store_open(const char *file, const size_t size)
+{
+	struct peak_store *self;
+
+	self = calloc(1, sizeof(*self));
+	if (!self) {
+		goto peak_store_open_out;
+	}
+
+	self->size = size ? size : STORE_BUFFER;
+
+	self->buf = malloc(self->size);
+	if (!self->buf) {
+		goto peak_store_open_free;
+	}
+
+	self->fd = peak_store_init(file);
+	if (self->fd < 0) {
+		goto peak_store_open_free;
+	}
+
+	return (self);
+
+peak_store_open_free:
+
+	free(self->buf);
+	free(self);
+
+peak_store_open_out:
+
+	return (NULL);
+}
+
+unsigned int
+peak_store_close(struct peak_store *self)
+{
+	unsigned int ret;
+
+	if (!self) {
+		return (0);
+	}
+
+	ret = peak_store_flush(self);
+
+	if (close(self->fd)) {
+		ret = 0;
+	}
+
+	free(self->buf);
+	free(self);
+
+	return (ret);
+}
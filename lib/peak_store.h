@@ -21,5 +21,10 @@ unsigned int	peak_store_packet(int, const void *, const unsigned int,
 		    const int64_t, const int64_t);
 int		peak_store_init(const char *);
 void		peak_store_exit(int);
+struct peak_store *peak_store_open(const char *, const size_t);
+unsigned int	peak_store_write(struct peak_store *, const void *,
+		    const unsigned int, const int64_t, const int64_t);
+unsigned int	peak_store_flush(struct peak_store *);
+unsigned int	peak_store_close(struct peak_store *);
 
 #endif /* !PEAK_STORE_H */
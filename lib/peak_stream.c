@@ -14,16 +14,29 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <peak.h>
 
 #define STREAM_PAGE(x, y)						\
     (void *)((x)->page_mem + ((y) * (x)->page_size))
 #define STREAM_TAIL(x, y)						\
     (void *)((uint8_t *)(y) + (x)->page_size - sizeof((y)->magic2))
-#define STREAM_CMP(x, y)	((x)->index - (y)->index)
 #define STREAM_MAGIC		0xEF05BA06CD07FA08ull
 #define STREAM_ERROR		-1
 
+#define STREAM_MAGAZINE		64
+#define STREAM_BATCH		64
+#define STREAM_SPLIT		4
+#define STREAM_CLASSES		32
+
+#define STREAM_BITS		64
+#define STREAM_WORD(x)		((x) / STREAM_BITS)
+#define STREAM_BIT(x)		(1ull << ((x) % STREAM_BITS))
+#define STREAM_FULL		~0ull
+
 #define STREAM_SETUP(x, y, z) do {					\
 	le64enc(STREAM_TAIL(x, y), STREAM_MAGIC);			\
 	(y)->magic = STREAM_MAGIC;					\
@@ -37,102 +50,341 @@
 	}								\
 } while (0)
 
+#define STREAM_BLOCK(x, y, z)						\
+    (void *)((x)->mem + ((z) * (y)->page_size))
+
 #define STREAM_FROM_USER(x)	(((struct _peak_stream *)((x) + 1)) - 1)
 #define STREAM_TO_USER(x)	&(x)->data
 
+#define CHAIN_FROM_USER(x)						\
+    (((struct _peak_stream_chain *)((x) + 1)) - 1)
+#define CHAIN_TO_USER(x)	&(x)->data
+
 struct _peak_stream {
+	struct _peak_stream *next;
+	TAILQ_ENTRY(_peak_stream) tq_lru;
+	TAILQ_ENTRY(_peak_stream) tq_class;
+	struct peak_stream **owner;
+	unsigned int class;
+	unsigned int spilled;
+	unsigned int evicting;
 	ssize_t page_count;
 	ssize_t page_no;
 	struct peak_stream data;
 };
 
-RB_HEAD(peak_stream_tree, peak_stream_page);
+struct _peak_stream_chain {
+	struct _peak_stream *head;
+	struct _peak_stream *tail;
+	struct _peak_stream **hot;
+	size_t cold;
+	struct peak_stream_chain data;
+};
 
 struct peak_stream_page {
 	uint64_t magic;
 	ssize_t index;
-	RB_ENTRY(peak_stream_page) rb_stream;
 	/* size placeholder, sits at the end of the actual page: */
 	uint64_t magic2;
 };
 
+/*
+ * Free pages are tracked in a bitmap, one bit per page.
+ * On top of the bitmap sits a complete binary tree with
+ * one leaf per bitmap word.  Each node knows the longest
+ * run of free pages below it and how many free pages
+ * touch its left and right edges, so the first run of
+ * any length can be found in O(log n) while updates only
+ * need to walk from the touched leaf up to the root.
+ */
+struct peak_stream_run {
+	uint32_t head;
+	uint32_t tail;
+	uint32_t max;
+};
+
+struct peak_stream_map {
+	struct peak_stream_run *runs;
+	uint64_t *bits;
+	size_t leaves;
+	size_t count;
+};
+
+/*
+ * Per-thread caches hold single free pages that are taken
+ * out of the bitmap, so the common case of claiming and
+ * releasing small streams doesn't touch shared state at all.
+ * Each cached page may come with a cached reference, but
+ * never more references than pages are cached: references
+ * in use never outnumber pages in use, so the reference pool
+ * can't run dry while there are still pages to be had.
+ */
+struct peak_stream_cache {
+	struct peak_streams *pool;
+	unsigned int page_count;
+	unsigned int ref_count;
+	size_t pages[STREAM_MAGAZINE];
+	struct _peak_stream *refs[STREAM_MAGAZINE];
+};
+
+/*
+ * The spill tier moves older segments of large chains out
+ * to a preallocated file.  Its blocks are tracked exactly
+ * like pages, and since the file is mapped, the kernel pages
+ * the data back in once it is actually accessed.
+ */
+struct peak_stream_spill {
+	struct peak_stream_map blocks;
+	prealloc_t references;
+	size_t threshold;
+	size_t size;
+	uint8_t *mem;
+	int fd;
+};
+
+TAILQ_HEAD(peak_stream_list, _peak_stream);
+
 struct peak_streams {
-	struct peak_stream_tree page_tree;
+	spinlock_t lock;
+	struct peak_stream_list lru;
+	struct peak_stream_list classes[STREAM_CLASSES];
+	peak_stream_fun evict_fun;
+	void *evict_arg;
+	unsigned int evict_policy;
+	size_t evict_low;
+	size_t evict_high;
+	size_t page_used;
+	struct peak_stream_map pages;
+	struct peak_stream_spill *spill;
 	prealloc_t references;
+	prealloc_t chains;
 	size_t page_count;
 	size_t page_size;
 	uint8_t *page_mem;
 };
 
-RB_GENERATE_STATIC(peak_stream_tree, peak_stream_page, rb_stream,
-    STREAM_CMP);
+static inline void
+peak_stream_leaf(struct peak_stream_run *run, uint64_t word)
+{
+	unsigned int len;
+
+	run->head = word == STREAM_FULL ? STREAM_BITS :
+	    __builtin_ctzll(~word);
+	run->tail = word == STREAM_FULL ? STREAM_BITS :
+	    __builtin_clzll(~word);
+	run->max = 0;
+
+	while (word) {
+		word >>= __builtin_ctzll(word);
+		if (word == STREAM_FULL) {
+			len = STREAM_BITS;
+		} else {
+			len = __builtin_ctzll(~word);
+		}
+		run->max = MAX(run->max, len);
+		if (len == STREAM_BITS) {
+			break;
+		}
+		word >>= len;
+	}
+}
+
+static inline void
+peak_stream_update(struct peak_stream_map *map, const size_t word)
+{
+	struct peak_stream_run *runs = map->runs, next;
+	size_t i = map->leaves + word;
+	uint32_t len = STREAM_BITS;
+
+	peak_stream_leaf(&runs[i], map->bits[word]);
+
+	for (i /= 2; i; i /= 2, len *= 2) {
+		const struct peak_stream_run *l = &runs[2 * i];
+		const struct peak_stream_run *r = &runs[2 * i + 1];
+
+		next.head = l->head == len ? len + r->head : l->head;
+		next.tail = r->tail == len ? len + l->tail : r->tail;
+		next.max = MAX(MAX(l->max, r->max), l->tail + r->head);
+
+		if (!memcmp(&runs[i], &next, sizeof(next))) {
+			/* nothing changes further up */
+			break;
+		}
+
+		runs[i] = next;
+	}
+}
+
+static inline void
+peak_stream_mark(struct peak_stream_map *map, const size_t page_no)
+{
+	uint64_t *word = &map->bits[STREAM_WORD(page_no)];
+
+	if (unlikely(*word & STREAM_BIT(page_no))) {
+		panic("duplicated page found: %zu\n", page_no);
+	}
+
+	*word |= STREAM_BIT(page_no);
+	peak_stream_update(map, STREAM_WORD(page_no));
+}
 
 static inline ssize_t
-peak_stream_probe(struct peak_stream_page *base, const ssize_t stop)
+peak_stream_find(struct peak_stream_map *map, const ssize_t page_count)
 {
-	struct peak_stream_page *next = base;
-	ssize_t count = 0;
+	const struct peak_stream_run *runs = map->runs;
+	size_t i = 1, base = 0, len;
+	uint64_t word;
+	ssize_t pos;
+
+	if (page_count > runs[1].max) {
+		return (STREAM_ERROR);
+	}
+
+	len = map->leaves * STREAM_BITS;
 
 	/*
-	 * Count the number of consecutive pages in the
-	 * free list.  To make the implementation more
-	 * useful, the caller is in charge of defining the
-	 * the start and stop position inside the free list.
-	 * With the returned count the caller can jump to
-	 * the next likely candidate and try again.
+	 * Descend to the leftmost fit: runs in the left
+	 * half come first, then the one crossing the
+	 * middle, then runs in the right half.
 	 */
+	while (i < map->leaves) {
+		const struct peak_stream_run *l = &runs[2 * i];
+		const struct peak_stream_run *r = &runs[2 * i + 1];
+
+		len /= 2;
+
+		if (l->max >= page_count) {
+			i = 2 * i;
+		} else if (l->tail + r->head >= page_count) {
+			return (base + len - l->tail);
+		} else {
+			i = 2 * i + 1;
+			base += len;
+		}
+	}
+
+	/* the run is inside this word, walk its runs */
+	word = map->bits[i - map->leaves];
+	pos = 0;
 
 	for (;;) {
-		if (!next) {
-			/* no more elements */
+		ssize_t skip = __builtin_ctzll(word);
+
+		word >>= skip;
+		pos += skip;
+		skip = word == STREAM_FULL ? STREAM_BITS :
+		    __builtin_ctzll(~word);
+		if (skip >= page_count) {
 			break;
 		}
+		word >>= skip;
+		pos += skip;
+	}
+
+	return (base + pos);
+}
+
+static inline ssize_t
+peak_stream_probe(struct peak_stream_map *map, const size_t page_no,
+    const ssize_t stop)
+{
+	size_t bit = page_no;
+	ssize_t count = 0;
+	uint64_t word;
 
-		if (count == stop) {
-			/* request limit reached */
+	/*
+	 * Count the number of consecutive free pages
+	 * starting at the given position, but no more
+	 * than needed.  Works a word at a time.
+	 */
+	while (count < stop && bit < map->count) {
+		word = ~map->bits[STREAM_WORD(bit)] >>
+		    (bit % STREAM_BITS);
+		if (word) {
+			count += __builtin_ctzll(word);
 			break;
 		}
 
-		if (next->index != base->index + count) {
-			/* scattered pages detected */
-			break;
+		count += STREAM_BITS - bit % STREAM_BITS;
+		bit += STREAM_BITS - bit % STREAM_BITS;
+	}
+
+	/* bits past the end are never set, so this is safe */
+	return (MIN(count, stop));
+}
+
+static inline void
+peak_stream_take(struct peak_stream_map *map, const size_t page_no,
+    ssize_t page_count)
+{
+	size_t i;
+
+	for (i = page_no; i < page_no + page_count; ++i) {
+		map->bits[STREAM_WORD(i)] &= ~STREAM_BIT(i);
+		if (i % STREAM_BITS == STREAM_BITS - 1) {
+			peak_stream_update(map, STREAM_WORD(i));
 		}
+	}
+
+	if (i % STREAM_BITS) {
+		/* last word was only partially done */
+		peak_stream_update(map, STREAM_WORD(i));
+	}
+}
+
+static void
+peak_stream_map_exit(struct peak_stream_map *map)
+{
+	free(map->runs);
+	free(map->bits);
+	map->runs = NULL;
+	map->bits = NULL;
+}
+
+static unsigned int
+peak_stream_map_init(struct peak_stream_map *map, const size_t count)
+{
+	/* everything starts out taken */
+	map->leaves = 1;
+	while (map->leaves * STREAM_BITS < count) {
+		map->leaves <<= 1;
+	}
 
-		next = RB_NEXT(peak_stream_tree, next);
-		++count;
+	map->bits = calloc(map->leaves, sizeof(*map->bits));
+	map->runs = calloc(map->leaves * 2, sizeof(*map->runs));
+	if (!map->bits || !map->runs) {
+		peak_stream_map_exit(map);
+		return (0);
 	}
 
-	return (count);
+	map->count = count;
+
+	return (1);
 }
 
 static inline void
-peak_stream_unhook(struct peak_streams *self, struct peak_stream_page *page,
+peak_stream_unhook(struct peak_streams *self, const size_t page_no,
     ssize_t page_count)
 {
-	struct peak_stream_page *next;
-	ssize_t i;
+	size_t i;
 
-	for (i = 0; i < page_count; ++i) {
-		STREAM_CHECK(self, page);
-		next = RB_NEXT(peak_stream_tree, page);
-		RB_REMOVE(peak_stream_tree, &self->page_tree, page);
-		page = next;
+	for (i = page_no; i < page_no + page_count; ++i) {
+		STREAM_CHECK(self, (struct peak_stream_page *)
+		    STREAM_PAGE(self, i));
 	}
+
+	peak_stream_take(&self->pages, page_no, page_count);
+	self->page_used += page_count;
 }
 
 static ssize_t
 __peak_stream_reclaim(struct peak_streams *self,
     struct _peak_stream *stream, ssize_t page_count)
 {
-	struct peak_stream_page *page;
-	struct peak_stream_page ref;
+	/* the index of the needed page(s) */
+	const size_t page_no = stream->page_no + stream->page_count;
 
-	/* calculate the index of the needed page(s) */
-	ref.index = stream->page_no + stream->page_count;
-
-	/* see if we can find the next consecutive page */
-	page = RB_FIND(peak_stream_tree, &self->page_tree, &ref);
-	if (page_count > peak_stream_probe(page, page_count)) {
+	if (page_count > peak_stream_probe(&self->pages, page_no, page_count)) {
 		/*
 		 * At least one of the needed pages is blocked.
 		 * In this case return with an error.  The caller
@@ -142,7 +394,7 @@ __peak_stream_reclaim(struct peak_streams *self,
 		return (STREAM_ERROR);
 	}
 
-	peak_stream_unhook(self, page, page_count);
+	peak_stream_unhook(self, page_no, page_count);
 
 	return (stream->page_no);
 }
@@ -150,33 +402,17 @@ __peak_stream_reclaim(struct peak_streams *self,
 static ssize_t
 __peak_stream_claim(struct peak_streams *self, ssize_t page_count)
 {
-	struct peak_stream_page *page;
-	ssize_t i, j;
-
-	/* since the stream is new, pick any page */
-	page = RB_MIN(peak_stream_tree, &self->page_tree);
-
-	for (;;) {
-		i = peak_stream_probe(page, page_count);
-		if (page_count <= i) {
-			/* found a matching spot */
-			break;
-		}
-
-		/* move past the scattered pages */
-		for (j = 0; j < i; ++j) {
-			page = RB_NEXT(peak_stream_tree, page);
-		}
+	ssize_t page_no;
 
-		if (!page) {
-			/* hit the end of the list! */
-			return (STREAM_ERROR);
-		}
+	/* since the stream is new, pick the first fit */
+	page_no = peak_stream_find(&self->pages, page_count);
+	if (page_no == STREAM_ERROR) {
+		return (STREAM_ERROR);
 	}
 
-	peak_stream_unhook(self, page, page_count);
+	peak_stream_unhook(self, page_no, page_count);
 
-	return (page->index);
+	return (page_no);
 }
 
 static inline struct _peak_stream *
@@ -216,7 +452,7 @@ _peak_stream_claim(struct peak_streams *self, struct peak_stream **ref,
 		stream = STREAM_FROM_USER(*ref);
 	}
 
-	if (unlikely(!stream && RB_EMPTY(&self->page_tree))) {
+	if (unlikely(!stream && !self->pages.runs[1].max)) {
 		/* no pages left, there's no use */
 		return (0);
 	}
@@ -273,8 +509,105 @@ _peak_stream_claim(struct peak_streams *self, struct peak_stream **ref,
 	return (1);
 }
 
-unsigned int
-peak_stream_claim(struct peak_streams *self, struct peak_stream **ref,
+static inline void
+peak_stream_gauge(struct peak_streams *self)
+{
+	const size_t free = self->page_count - self->page_used;
+
+	peak_audit_set(AUDIT_STREAM_USED, self->page_used);
+	peak_audit_set(AUDIT_STREAM_FRAGMENTED,
+	    free - self->pages.runs[1].max);
+}
+
+static inline unsigned int
+peak_stream_class(const struct _peak_stream *stream)
+{
+	/* log2 of the page count */
+	return (MIN(63 - __builtin_clzll(stream->page_count),
+	    STREAM_CLASSES - 1));
+}
+
+static inline void
+peak_stream_untrack(struct peak_streams *self, struct _peak_stream *stream)
+{
+	if (stream->owner) {
+		TAILQ_REMOVE(&self->lru, stream, tq_lru);
+		TAILQ_REMOVE(&self->classes[stream->class], stream,
+		    tq_class);
+		stream->owner = NULL;
+	}
+}
+
+static inline void
+peak_stream_track(struct peak_streams *self, struct _peak_stream *stream,
+    struct peak_stream **owner)
+{
+	peak_stream_untrack(self, stream);
+
+	stream->owner = owner;
+	stream->class = peak_stream_class(stream);
+	TAILQ_INSERT_TAIL(&self->lru, stream, tq_lru);
+	TAILQ_INSERT_TAIL(&self->classes[stream->class], stream, tq_class);
+}
+
+static unsigned int
+peak_stream_shed(struct peak_streams *self, const struct peak_stream *keep)
+{
+	struct _peak_stream *victim = NULL;
+	struct peak_stream **owner;
+	unsigned int i;
+
+	if (self->evict_policy == STREAM_EVICT_LRU) {
+		victim = TAILQ_FIRST(&self->lru);
+		if (victim && STREAM_TO_USER(victim) == keep) {
+			victim = TAILQ_NEXT(victim, tq_lru);
+		}
+	} else {
+		/* oldest of the largest size class */
+		for (i = STREAM_CLASSES; i-- && !victim; ) {
+			victim = TAILQ_FIRST(&self->classes[i]);
+			if (victim && STREAM_TO_USER(victim) == keep) {
+				victim = TAILQ_NEXT(victim, tq_class);
+			}
+		}
+	}
+
+	if (!victim) {
+		return (0);
+	}
+
+	owner = victim->owner;
+
+	if (self->evict_fun) {
+		/*
+		 * Let the owner flush or drop the data.  The
+		 * callback may free whatever holds the reference,
+		 * so only the victim itself tells us what is left:
+		 * a full release untracks it and a reuse through
+		 * peak_stream_get() wipes the mark.
+		 */
+		victim->evicting = 1;
+		self->evict_fun(self->evict_arg, owner);
+		if (!victim->evicting || !victim->owner) {
+			owner = NULL;
+		} else {
+			victim->evicting = 0;
+			owner = victim->owner;
+		}
+	}
+
+	if (owner) {
+		/* still there, drop it */
+		peak_stream_release(self, owner, victim->data.len);
+	}
+
+	peak_audit_inc(AUDIT_STREAM_EVICTED);
+
+	return (1);
+}
+
+static unsigned int
+__peak_stream_grow(struct peak_streams *self, struct peak_stream **ref,
     size_t size)
 {
 	struct peak_stream *retry = NULL;
@@ -308,28 +641,164 @@ peak_stream_claim(struct peak_streams *self, struct peak_stream **ref,
 	return (ret);
 }
 
+unsigned int
+peak_stream_claim(struct peak_streams *self, struct peak_stream **ref,
+    size_t size)
+{
+	unsigned int ret;
+
+	if (self->evict_high && self->page_used >= self->evict_high) {
+		/* shed down to the low watermark in one go */
+		peak_audit_inc(AUDIT_STREAM_PRESSURE);
+		while (self->page_used > self->evict_low &&
+		    peak_stream_shed(self, *ref)) {
+			/* nothing */
+		}
+	}
+
+	while (!(ret = __peak_stream_grow(self, ref, size))) {
+		if (!self->evict_high || !peak_stream_shed(self, *ref)) {
+			peak_audit_inc(AUDIT_STREAM_FAILED);
+			break;
+		}
+	}
+
+	if (ret && size) {
+		peak_stream_track(self, STREAM_FROM_USER(*ref), ref);
+	}
+
+	peak_stream_gauge(self);
+
+	return (ret);
+}
+
+void
+peak_stream_touch(struct peak_streams *self, struct peak_stream **ref)
+{
+	struct _peak_stream *stream;
+
+	if (*ref) {
+		stream = STREAM_FROM_USER(*ref);
+		if (stream->owner) {
+			TAILQ_REMOVE(&self->lru, stream, tq_lru);
+			TAILQ_INSERT_TAIL(&self->lru, stream, tq_lru);
+			stream->owner = ref;
+		}
+	}
+}
+
+unsigned int
+peak_stream_watermark(struct peak_streams *self, const size_t low,
+    const size_t high, const unsigned int policy, peak_stream_fun fun,
+    void *arg)
+{
+	if (low > high || high > self->page_count ||
+	    policy >= STREAM_EVICT_MAX) {
+		return (0);
+	}
+
+	self->evict_low = low;
+	self->evict_high = high;
+	self->evict_policy = policy;
+	self->evict_fun = fun;
+	self->evict_arg = arg;
+
+	return (1);
+}
+
 static void
 _peak_stream_release(struct peak_streams *self, ssize_t page_no)
 {
 	struct peak_stream_page *page = STREAM_PAGE(self, page_no);
 
 	STREAM_SETUP(self, page, page_no);
+	peak_stream_mark(&self->pages, page_no);
+	--self->page_used;
+}
+
+static void
+peak_stream_cache_drop(struct peak_stream_cache *cache, unsigned int keep)
+{
+	struct peak_streams *self = cache->pool;
+
+	/* pool lock must be held */
+	while (cache->page_count > keep) {
+		_peak_stream_release(self, cache->pages[--cache->page_count]);
+	}
+
+	while (cache->ref_count > cache->page_count) {
+		prealloc_put(&self->references, cache->refs[--cache->ref_count]);
+	}
+}
+
+static void
+peak_stream_cache_flush(struct peak_stream_cache *cache, unsigned int keep)
+{
+	spin_lock(&cache->pool->lock);
+	peak_stream_cache_drop(cache, keep);
+	spin_unlock(&cache->pool->lock);
+}
+
+static void
+peak_stream_cache_refill(struct peak_stream_cache *cache)
+{
+	struct peak_streams *self = cache->pool;
+	ssize_t page_no;
 
-	if (unlikely(RB_INSERT(peak_stream_tree,
-	    &self->page_tree, page))) {
-		panic("duplicated page found: %zd\n", page_no);
+	spin_lock(&self->lock);
+
+	while (cache->page_count < STREAM_MAGAZINE / 2) {
+		page_no = __peak_stream_claim(self, 1);
+		if (page_no == STREAM_ERROR) {
+			break;
+		}
+		cache->pages[cache->page_count++] = page_no;
+	}
+
+	while (cache->ref_count < cache->page_count &&
+	    !prealloc_empty(&self->references)) {
+		cache->refs[cache->ref_count++] =
+		    prealloc_get(&self->references);
 	}
+
+	spin_unlock(&self->lock);
 }
 
 static inline void
-peak_stream_put(struct peak_streams *self, struct _peak_stream *stream)
+peak_stream_free(struct peak_streams *self, struct peak_stream_cache *cache,
+    const size_t page_no)
 {
-	prealloc_put(&self->references, stream);
+	if (!cache) {
+		_peak_stream_release(self, page_no);
+		return;
+	}
+
+	if (unlikely(cache->page_count == STREAM_MAGAZINE)) {
+		/* give back half in one go */
+		peak_stream_cache_flush(cache, STREAM_MAGAZINE / 2);
+	}
+
+	cache->pages[cache->page_count++] = page_no;
 }
 
-void
-peak_stream_release(struct peak_streams *self, struct peak_stream **ref,
-    size_t size)
+static inline void
+peak_stream_put(struct peak_streams *self, struct peak_stream_cache *cache,
+    struct _peak_stream *stream)
+{
+	if (!cache) {
+		prealloc_put(&self->references, stream);
+	} else if (likely(cache->ref_count < cache->page_count)) {
+		cache->refs[cache->ref_count++] = stream;
+	} else {
+		spin_lock(&self->lock);
+		prealloc_put(&self->references, stream);
+		spin_unlock(&self->lock);
+	}
+}
+
+static void
+__peak_stream_release(struct peak_streams *self,
+    struct peak_stream_cache *cache, struct peak_stream **ref, size_t size)
 {
 	struct _peak_stream *stream;
 	size_t size_adj;
@@ -346,7 +815,7 @@ peak_stream_release(struct peak_streams *self, struct peak_stream **ref,
 	size_adj -= (size_t)STREAM_PAGE(self, stream->page_no);
 
 	while (stream->page_count && size_adj + size >= self->page_size) {
-		_peak_stream_release(self, stream->page_no);
+		peak_stream_free(self, cache, stream->page_no);
 
 		/* update accounting */
 		stream->data.buf =
@@ -363,17 +832,517 @@ peak_stream_release(struct peak_streams *self, struct peak_stream **ref,
 	stream->data.buf = (uint8_t *)stream->data.buf + size;
 	stream->data.len -= size;
 
+	if (stream->owner) {
+		if (unlikely(cache)) {
+			spin_lock(&self->lock);
+		}
+		if (!stream->data.len) {
+			peak_stream_untrack(self, stream);
+		} else if (stream->class != peak_stream_class(stream)) {
+			/* shrunk into a smaller size class */
+			peak_stream_track(self, stream, stream->owner);
+		}
+		if (unlikely(cache)) {
+			spin_unlock(&self->lock);
+		}
+	}
+
 	if (!stream->data.len) {
+		/* no data left: free partial page, delete reference */
+		while (stream->page_count) {
+			peak_stream_free(self, cache, stream->page_no);
+			--stream->page_count;
+			++stream->page_no;
+		}
+		peak_stream_put(self, cache, stream);
+		*ref = NULL;
+	}
+}
+
+void
+peak_stream_release(struct peak_streams *self, struct peak_stream **ref,
+    size_t size)
+{
+	__peak_stream_release(self, NULL, ref, size);
+	peak_stream_gauge(self);
+}
+
+unsigned int
+peak_stream_cache_claim(struct peak_stream_cache *cache,
+    struct peak_stream **ref, size_t size)
+{
+	struct peak_streams *self = cache->pool;
+	struct peak_stream *retry = NULL;
+	struct _peak_stream *stream;
+	unsigned int ret;
+
+	if (unlikely(!size)) {
+		return (1);
+	}
+
+	if (!*ref && size <= self->page_size) {
+		/* fast path: one page, straight from the cache */
+		if (!cache->page_count) {
+			peak_stream_cache_refill(cache);
+			if (!cache->page_count) {
+				return (0);
+			}
+		}
+
+		if (likely(cache->ref_count)) {
+			stream = cache->refs[--cache->ref_count];
+		} else {
+			spin_lock(&self->lock);
+			stream = peak_stream_get(self);
+			spin_unlock(&self->lock);
+		}
+
+		memset(stream, 0, sizeof(*stream));
+		stream->page_no = cache->pages[--cache->page_count];
+		stream->page_count = 1;
+		stream->data.buf = STREAM_PAGE(self, stream->page_no);
+		stream->data.len = size;
+
+		*ref = STREAM_TO_USER(stream);
+
+		return (1);
+	}
+
+	if (*ref) {
+		stream = STREAM_FROM_USER(*ref);
+		if (ALLOC_ALIGN(size + stream->data.len, self->page_size) /
+		    self->page_size == (size_t)stream->page_count) {
+			/* fits into the last page, no locking needed */
+			stream->data.len += size;
+			return (1);
+		}
+	}
+
+	spin_lock(&self->lock);
+
+	ret = _peak_stream_claim(self, ref, size);
+	if (!ret && cache->page_count) {
+		/* our own cached pages may be what's missing */
+		peak_stream_cache_drop(cache, 0);
+		ret = _peak_stream_claim(self, ref, size);
+	}
+	if (!ret && *ref) {
+		ret = _peak_stream_claim(self, &retry, (*ref)->len + size);
+	}
+
+	spin_unlock(&self->lock);
+
+	if (retry) {
+		/* relocate, see peak_stream_claim() */
+		memcpy(retry->buf, (*ref)->buf, (*ref)->len);
+		__peak_stream_release(self, cache, ref, (*ref)->len);
+		*ref = retry;
+	}
+
+	return (ret);
+}
+
+void
+peak_stream_cache_release(struct peak_stream_cache *cache,
+    struct peak_stream **ref, size_t size)
+{
+	__peak_stream_release(cache->pool, cache, ref, size);
+}
+
+struct peak_stream_cache *
+peak_stream_cache_init(struct peak_streams *self)
+{
+	struct peak_stream_cache *cache;
+
+	if (!self) {
+		return (NULL);
+	}
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache) {
+		return (NULL);
+	}
+
+	cache->pool = self;
+
+	return (cache);
+}
+
+void
+peak_stream_cache_exit(struct peak_stream_cache *cache)
+{
+	if (cache) {
+		peak_stream_cache_flush(cache, 0);
+		free(cache);
+	}
+}
+
+static void
+peak_stream_spill_exit(struct peak_stream_spill *spill)
+{
+	if (spill) {
+		if (spill->mem) {
+			munmap(spill->mem, spill->size);
+		}
+		if (spill->fd >= 0) {
+			close(spill->fd);
+		}
+		peak_stream_map_exit(&spill->blocks);
+		prealloc_exit(&spill->references);
+		free(spill);
+	}
+}
+
+unsigned int
+peak_stream_spill(struct peak_streams *self, const char *file,
+    const size_t size, const size_t threshold)
+{
+	const size_t block_count = size / self->page_size;
+	struct peak_stream_spill *spill;
+	size_t i;
+	int ret;
+
+	if (self->spill || !block_count || block_count > UINT32_MAX) {
+		return (0);
+	}
+
+	spill = calloc(1, sizeof(*spill));
+	if (!spill) {
+		return (0);
+	}
+
+	spill->fd = -1;
+	spill->size = block_count * self->page_size;
+	spill->threshold = threshold;
+
+	/* worst case: each spilled segment holds one block */
+	if (!prealloc_init(&spill->references, block_count,
+	    sizeof(struct _peak_stream))) {
+		goto peak_stream_spill_fail;
+	}
+
+	if (!peak_stream_map_init(&spill->blocks, block_count)) {
+		goto peak_stream_spill_fail;
+	}
+
+	spill->fd = open(file, O_RDWR | O_CREAT, 0600);
+	if (spill->fd < 0) {
+		warning("could not open file `%s'\n", file);
+		goto peak_stream_spill_fail;
+	}
+
+	if (ftruncate(spill->fd, spill->size)) {
+		goto peak_stream_spill_fail;
+	}
+
+	/*
+	 * Reserve the blocks now so that writing them later
+	 * can't run out of space.  Not every file system can
+	 * do that, in which case the file stays sparse.
+	 */
+	ret = posix_fallocate(spill->fd, 0, spill->size);
+	if (ret && ret != EINVAL && ret != EOPNOTSUPP) {
+		goto peak_stream_spill_fail;
+	}
+
+	spill->mem = mmap(NULL, spill->size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, spill->fd, 0);
+	if (spill->mem == MAP_FAILED) {
+		warning("could not map file `%s'\n", file);
+		spill->mem = NULL;
+		goto peak_stream_spill_fail;
+	}
+
+	/* spilled data is mostly read front to back */
+	posix_madvise(spill->mem, spill->size, POSIX_MADV_SEQUENTIAL);
+
+	for (i = 0; i < block_count; ++i) {
+		peak_stream_mark(&spill->blocks, i);
+	}
+
+	self->spill = spill;
+
+	return (1);
+
+peak_stream_spill_fail:
+
+	peak_stream_spill_exit(spill);
+	return (0);
+}
+
+static unsigned int
+peak_stream_spill_out(struct peak_streams *self,
+    struct _peak_stream_chain *chain)
+{
+	struct peak_stream_spill *spill = self->spill;
+	struct _peak_stream *batch[STREAM_BATCH];
+	struct _peak_stream *stream, *cold;
+	struct iovec iov[STREAM_BATCH];
+	ssize_t block_count = 0, block_no;
+	unsigned int count = 0, i;
+
+	/* gather the oldest segments in memory, but never the tail */
+	for (stream = *chain->hot; stream != chain->tail &&
+	    count < STREAM_BATCH; stream = stream->next) {
+		iov[count].iov_base = STREAM_PAGE(self, stream->page_no);
+		iov[count].iov_len = stream->page_count * self->page_size;
+		block_count += stream->page_count;
+		batch[count++] = stream;
+	}
+
+	/* the batch goes out in one write, so it needs one run */
+	while (count && (block_no = peak_stream_find(&spill->blocks,
+	    block_count)) == STREAM_ERROR) {
+		block_count -= batch[--count]->page_count;
+	}
+
+	if (!count) {
+		return (0);
+	}
+
+	if (pwritev(spill->fd, iov, count, block_no * self->page_size) !=
+	    block_count * (ssize_t)self->page_size) {
+		/* the data stays where it is */
+		return (0);
+	}
+
+	peak_stream_take(&spill->blocks, block_no, block_count);
+
+	peak_audit_add(AUDIT_STREAM_SPILLED, block_count);
+	peak_audit_inc(AUDIT_STREAM_WRITES);
+
+	for (i = 0; i < count; ++i) {
+		stream = batch[i];
+
+		/* cannot run dry, see peak_stream_spill() */
+		cold = prealloc_get(&spill->references);
+
+		*cold = *stream;
+		cold->spilled = 1;
+		cold->page_no = block_no;
+		cold->data.buf = (uint8_t *)STREAM_BLOCK(spill, self,
+		    block_no) + ((uint8_t *)stream->data.buf -
+		    (uint8_t *)STREAM_PAGE(self, stream->page_no));
+
+		*chain->hot = cold;
+		chain->hot = &cold->next;
+		chain->cold += cold->data.len;
+		block_no += cold->page_count;
+
+		while (stream->page_count) {
+			_peak_stream_release(self, stream->page_no);
+			--stream->page_count;
+			++stream->page_no;
+		}
+
+		prealloc_put(&self->references, stream);
+	}
+
+	return (1);
+}
+
+static void
+peak_stream_spill_release(struct peak_streams *self,
+    struct peak_stream **ref, size_t size)
+{
+	struct peak_stream_spill *spill = self->spill;
+	struct _peak_stream *stream = STREAM_FROM_USER(*ref);
+	size_t size_adj;
+
+	/* take current buffer offset into account */
+	size_adj = (size_t)stream->data.buf;
+	size_adj -= (size_t)STREAM_BLOCK(spill, self, stream->page_no);
+	size_adj += size;
+
+	stream->data.buf = (uint8_t *)stream->data.buf + size;
+	stream->data.len -= size;
+
+	while (stream->page_count && (size_adj >= self->page_size ||
+	    !stream->data.len)) {
+		peak_stream_mark(&spill->blocks, stream->page_no);
+		size_adj -= MIN(size_adj, self->page_size);
+		--stream->page_count;
+		++stream->page_no;
+	}
+
+	if (!stream->data.len) {
+		prealloc_put(&spill->references, stream);
+		*ref = NULL;
+	}
+}
+
+static inline void
+peak_stream_chain_cool(struct peak_streams *self,
+    struct _peak_stream_chain *chain)
+{
+	/*
+	 * Once over the threshold, everything but the tail
+	 * goes out.  That's a few segments in one write and
+	 * leaves room until the threshold is crossed again.
+	 */
+	if (chain->data.len - chain->cold > self->spill->threshold) {
+		while (peak_stream_spill_out(self, chain)) {
+			/* nothing */
+		}
+	}
+}
+
+static inline size_t
+peak_stream_chain_cut(const struct peak_streams *self)
+{
+	/* segments must be small enough to batch them */
+	return (MAX(self->spill->threshold / STREAM_SPLIT,
+	    self->page_size));
+}
+
+unsigned int
+peak_stream_chain_claim(struct peak_streams *self,
+    struct peak_stream_chain **ref, size_t size)
+{
+	struct _peak_stream_chain *chain = NULL;
+	struct peak_stream *segment = NULL;
+	struct _peak_stream *stream;
+
+	if (unlikely(!size)) {
+		return (1);
+	}
+
+	if (*ref) {
+		chain = CHAIN_FROM_USER(*ref);
+		segment = STREAM_TO_USER(chain->tail);
+
+		/*
+		 * Grow the last segment in place if possible, but
+		 * cut it when spilling so it can move out later...
+		 */
+		if ((!self->spill || segment->len + size <=
+		    peak_stream_chain_cut(self)) &&
+		    _peak_stream_claim(self, &segment, size)) {
+			chain->data.len += size;
+			return (1);
+		}
+
+		segment = NULL;
+	}
+
+	/* ...or start a new one instead of moving the data */
+	while (!_peak_stream_claim(self, &segment, size)) {
+		if (!chain || !self->spill ||
+		    !peak_stream_spill_out(self, chain)) {
+			return (0);
+		}
+	}
+
+	stream = STREAM_FROM_USER(segment);
+
+	if (!chain) {
+		chain = prealloc_get(&self->chains);
+		if (unlikely(!chain)) {
+			/* see peak_stream_get() */
+			panic("no more stream chains available\n");
+		}
+
+		memset(chain, 0, sizeof(*chain));
+		chain->hot = &chain->head;
+		chain->head = stream;
+	} else {
+		chain->tail->next = stream;
+	}
+
+	chain->tail = stream;
+	chain->data.len += size;
+	++chain->data.count;
+
+	if (self->spill) {
+		peak_stream_chain_cool(self, chain);
+	}
+
+	*ref = CHAIN_TO_USER(chain);
+
+	return (1);
+}
+
+void
+peak_stream_chain_release(struct peak_streams *self,
+    struct peak_stream_chain **ref, size_t size)
+{
+	struct _peak_stream_chain *chain;
+	struct _peak_stream **after;
+	struct peak_stream *segment;
+	struct _peak_stream *next;
+	size_t step;
+
+	if (unlikely(!size || !*ref)) {
+		/* nothing to do */
+		return;
+	}
+
+	chain = CHAIN_FROM_USER(*ref);
+
+	while (size && chain->head) {
+		segment = STREAM_TO_USER(chain->head);
+		next = chain->head->next;
+		after = &chain->head->next;
+		step = MIN(size, segment->len);
+
+		if (chain->head->spilled) {
+			peak_stream_spill_release(self, &segment, step);
+			chain->cold -= step;
+		} else {
+			peak_stream_release(self, &segment, step);
+		}
+
+		chain->data.len -= step;
+		size -= step;
+
+		if (!segment) {
+			/* segment is gone, move on to the next */
+			if (chain->hot == after) {
+				chain->hot = &chain->head;
+			}
+			chain->head = next;
+			--chain->data.count;
+		}
+	}
+
+	if (!chain->head) {
 		/* no data left: delete reference */
-		peak_stream_put(self, stream);
+		prealloc_put(&self->chains, chain);
 		*ref = NULL;
 	}
 }
 
+unsigned int
+peak_stream_chain_iov(const struct peak_stream_chain *ref,
+    struct iovec *iov, const unsigned int count)
+{
+	const struct _peak_stream_chain *chain;
+	const struct _peak_stream *stream;
+	unsigned int i = 0;
+
+	if (!ref) {
+		return (0);
+	}
+
+	chain = CHAIN_FROM_USER((struct peak_stream_chain *)ref);
+
+	for (stream = chain->head; stream && i < count;
+	    stream = stream->next, ++i) {
+		iov[i].iov_base = stream->data.buf;
+		iov[i].iov_len = stream->data.len;
+	}
+
+	return (i);
+}
+
 void
 peak_stream_exit(struct peak_streams *self)
 {
 	if (self) {
+		spin_exit(&self->lock);
+		peak_stream_spill_exit(self->spill);
+		peak_stream_map_exit(&self->pages);
+		prealloc_exit(&self->chains);
 		prealloc_exit(&self->references);
 		free(self->page_mem);
 		free(self);
@@ -387,7 +1356,8 @@ peak_stream_init(size_t page_count, size_t page_size)
 	unsigned int ret;
 	size_t i;
 
-	if (!page_count) {
+	if (!page_count || page_count > UINT32_MAX) {
+		/* run lengths are kept in 32 bits */
 		goto peak_stream_init_fail;
 	}
 
@@ -398,9 +1368,9 @@ peak_stream_init(size_t page_count, size_t page_size)
 
 	if (page_size < sizeof(struct peak_stream_page)) {
 		/*
-		 * Free pages are embedded into a tree
-		 * structure, so the initial page size
-		 * must hold the tree structure.  D'oh!
+		 * Free pages carry markers to detect
+		 * trashing, so the initial page size
+		 * must hold them.  D'oh!
 		 */
 		goto peak_stream_init_fail;
 	}
@@ -410,6 +1380,12 @@ peak_stream_init(size_t page_count, size_t page_size)
 		goto peak_stream_init_fail;
 	}
 
+	spin_init(&self->lock);
+	TAILQ_INIT(&self->lru);
+	for (i = 0; i < STREAM_CLASSES; ++i) {
+		TAILQ_INIT(&self->classes[i]);
+	}
+
 	self->page_mem = malign(page_count, page_size);
 	if (!self->page_mem) {
 		goto peak_stream_init_fail;
@@ -421,9 +1397,20 @@ peak_stream_init(size_t page_count, size_t page_size)
 		goto peak_stream_init_fail;
 	}
 
+	/* same worst case: each chain holds one page */
+	ret = prealloc_init(&self->chains, page_count,
+	    sizeof(struct _peak_stream_chain));
+	if (!ret) {
+		goto peak_stream_init_fail;
+	}
+
+	if (!peak_stream_map_init(&self->pages, page_count)) {
+		goto peak_stream_init_fail;
+	}
+
 	self->page_count = page_count;
 	self->page_size = page_size;
-	RB_INIT(&self->page_tree);
+	self->page_used = page_count;
 
 	for (i = 0; i < page_count; ++i) {
 		_peak_stream_release(self, i);
@@ -22,11 +22,44 @@ struct peak_stream {
 	void *buf;
 };
 
+enum {
+	STREAM_EVICT_LRU,	/* least recently touched first */
+	STREAM_EVICT_LARGEST,	/* largest first */
+	STREAM_EVICT_MAX	/* last element */
+};
+
+typedef void (*peak_stream_fun) (void *, struct peak_stream **);
+
+struct peak_stream_chain {
+	size_t len;
+	unsigned int count;
+};
+
 struct peak_streams	*peak_stream_init(size_t, size_t);
 unsigned int		 peak_stream_claim(struct peak_streams *,
 			     struct peak_stream **, size_t);
 void			 peak_stream_release(struct peak_streams *,
 			     struct peak_stream **, size_t);
+void			 peak_stream_touch(struct peak_streams *,
+			     struct peak_stream **);
+unsigned int		 peak_stream_watermark(struct peak_streams *,
+			     const size_t, const size_t, const unsigned int,
+			     peak_stream_fun, void *);
+unsigned int		 peak_stream_spill(struct peak_streams *,
+			     const char *, const size_t, const size_t);
+unsigned int		 peak_stream_chain_claim(struct peak_streams *,
+			     struct peak_stream_chain **, size_t);
+void			 peak_stream_chain_release(struct peak_streams *,
+			     struct peak_stream_chain **, size_t);
+unsigned int		 peak_stream_chain_iov(const struct peak_stream_chain *,
+			     struct iovec *, const unsigned int);
 void			 peak_stream_exit(struct peak_streams *);
 
+struct peak_stream_cache	*peak_stream_cache_init(struct peak_streams *);
+unsigned int		 peak_stream_cache_claim(struct peak_stream_cache *,
+			     struct peak_stream **, size_t);
+void			 peak_stream_cache_release(struct peak_stream_cache *,
+			     struct peak_stream **, size_t);
+void			 peak_stream_cache_exit(struct peak_stream_cache *);
+
 #endif /* !PEAK_STREAM_H */
@@ -170,6 +170,107 @@ peak_string_find(struct peak_strings *root, const char *buf,
 	}
 }
 
+/*
+ * Input position that may span several buffers, passed by
+ * value so each recursion level keeps its own position.
+ */
+struct peak_string_pos {
+	const struct iovec *iov;
+	size_t off;
+};
+
+static inline int
+peak_string_char(struct peak_string_pos *pos)
+{
+	/* skip to the next buffer, the caller knows there is one */
+	while (pos->off >= pos->iov->iov_len) {
+		pos->off = 0;
+		++pos->iov;
+	}
+
+	return ((unsigned char)((const char *)pos->iov->iov_base)
+	    [pos->off++]);
+}
+
+static void
+_peak_string_findv(struct peak_strings *node, struct peak_string_pos pos,
+    const size_t len, const unsigned int start, stash_t stash)
+{
+	struct peak_strings stackptr(ref);
+	struct peak_strings *found;
+	const int character = peak_string_char(&pos);
+
+	/*
+	 * search for literal character inside input buffer
+	 */
+	ref->character = character;
+
+	found = PAGE_FIND(node->next, ref, STRING_CMP);
+	if (found) {
+		if (peak_string_match(found, len - 1, start, stash)) {
+			return;
+		}
+		_peak_string_findv(found, pos, len - 1, start, stash);
+	}
+
+	/*
+	 * search for wildcard character by ignoring the input
+	 */
+	ref->character = STRING_WILDCARD;
+
+	found = PAGE_FIND(node->next, ref, STRING_CMP);
+	if (found) {
+		if (peak_string_match(found, len - 1, start, stash)) {
+			return;
+		}
+		_peak_string_findv(found, pos, len - 1, start, stash);
+	}
+
+	/*
+	 * search for case insensitive character inside input buffer
+	 */
+	ref->character = string_nocase[character];
+
+	if (ref->character) {
+		found = PAGE_FIND(node->next, ref, STRING_CMP);
+		if (found) {
+			if (peak_string_match(found, len - 1,
+			    start, stash)) {
+				return;
+			}
+			_peak_string_findv(found, pos, len - 1,
+			    start, stash);
+		}
+	}
+}
+
+void
+peak_string_findv(struct peak_strings *root, const struct iovec *iov,
+    const unsigned int count, stash_t stash)
+{
+	struct peak_string_pos pos = { .iov = iov, .off = 0 };
+	size_t i, len = 0;
+
+	if (count == 1) {
+		/* keep the faster path for contiguous buffers */
+		peak_string_find(root, iov->iov_base, iov->iov_len, stash);
+		return;
+	}
+
+	for (i = 0; i < count; ++i) {
+		len += iov[i].iov_len;
+	}
+
+	if (peak_string_match(root, len, 1, stash)) {
+		return;
+	}
+
+	for (i = 0; i < len; ++i) {
+		_peak_string_findv(root, pos, len - i, !i, stash);
+		peak_string_char(&pos);
+	}
+}
+
 int
 peak_string_add(struct peak_strings *root, const unsigned int result,
     const char *buf, const size_t len, const unsigned int flags)
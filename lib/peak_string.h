@@ -26,6 +26,9 @@
 struct peak_strings	*peak_string_init(void);
 void			 peak_string_find(struct peak_strings *,
 			     const char *, const size_t, stash_t);
+void			 peak_string_findv(struct peak_strings *,
+			     const struct iovec *, const unsigned int,
+			     stash_t);
 int			 peak_string_add(struct peak_strings *,
 			     const unsigned int, const char *,
 			     const size_t, const unsigned int);
@@ -0,0 +1,702 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <peak.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif /* WITH_ZSTD */
+#ifdef WITH_LZ4
+#include <lz4frame.h>
+#endif /* WITH_LZ4 */
+
+#define UNPACK_INPUT	(1024 * 1024)		/* compressed read size */
+#define UNPACK_BLOCK	(64 * 1024 * 1024)	/* largest parallel block */
+#define UNPACK_THREADS	8			/* upper bound for workers */
+#define UNPACK_SLOTS	2			/* blocks per worker */
+
+#define ZSTD_MAGIC	0xFD2FB528
+#define LZ4_MAGIC	0x184D2204
+
+enum {
+	UNPACK_SLOT_FREE,
+	UNPACK_SLOT_BUSY,
+	UNPACK_SLOT_READY,
+	UNPACK_SLOT_FAILED,
+};
+
+struct peak_unpack_slot {
+	const uint8_t *in;
+	size_t in_len;
+	uint8_t *out;
+	size_t out_len;
+	size_t out_pos;
+	size_t out_size;
+	unsigned int state;
+};
+
+struct peak_unpack_worker {
+	struct peak_unpack *self;
+	pthread_t thread;
+	z_stream gzip;
+#ifdef WITH_ZSTD
+	ZSTD_DCtx *zstd;
+#endif /* WITH_ZSTD */
+};
+
+struct peak_unpack {
+	unsigned int codec;
+	unsigned int failed;
+	unsigned int partial;
+	unsigned int eof;
+	int fd;
+	/* compressed input */
+	const uint8_t *in;
+	size_t in_pos;
+	size_t in_len;
+	uint8_t *buffer;
+	size_t buffer_size;
+	/* streaming decoders */
+	z_stream gzip;
+	unsigned int gzip_ready;
+#ifdef WITH_ZSTD
+	ZSTD_DStream *zstd;
+#endif /* WITH_ZSTD */
+#ifdef WITH_LZ4
+	LZ4F_dctx *lz4;
+#endif /* WITH_LZ4 */
+	/* block-parallel decoding */
+	struct peak_unpack_worker *workers;
+	struct peak_unpack_slot *slots;
+	unsigned int worker_count;
+	unsigned int slot_count;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pthread_cond_t wake;
+	size_t issued;
+	size_t current;
+	unsigned int split_done;
+	unsigned int streamed;
+	unsigned int stop;
+};
+
+unsigned int
+peak_unpack_detect(const void *buf, const size_t len)
+{
+	const uint8_t *in = buf;
+
+	if (len < sizeof(uint32_t)) {
+		return (UNPACK_NONE);
+	}
+
+	if (in[0] == 0x1F && in[1] == 0x8B && in[2] == 0x08) {
+		/* deflate is the only gzip method */
+		return (UNPACK_GZIP);
+	}
+
+	switch (le32dec(in)) {
+	case ZSTD_MAGIC:
+		return (UNPACK_ZSTD);
+	case LZ4_MAGIC:
+		return (UNPACK_LZ4);
+	default:
+		break;
+	}
+
+	return (UNPACK_NONE);
+}
+
+/*
+ * Blocks can only be handed out to workers when their size
+ * is known without decoding them.  That is the case for zstd
+ * frames and for gzip members that carry their size in a
+ * "BC" extra field as written by bgzip(1).  The first block
+ * that doesn't qualify ends the parallel part and the rest
+ * of the input is streamed.
+ */
+static unsigned int
+_peak_unpack_split(struct peak_unpack *self, size_t *in_len,
+    size_t *out_len)
+{
+	const uint8_t *in = self->in + self->in_pos;
+	const size_t left = self->in_len - self->in_pos;
+
+	switch (self->codec) {
+	case UNPACK_GZIP: {
+		size_t i, len, xlen;
+
+		if (left < 18 || peak_unpack_detect(in, left) !=
+		    UNPACK_GZIP || !(in[3] & 0x04)) {
+			return (0);
+		}
+
+		xlen = le16dec(in + 10);
+		if (12 + xlen > left) {
+			return (0);
+		}
+
+		for (i = 12; i + 4 <= 12 + xlen;
+		    i += 4 + le16dec(in + i + 2)) {
+			if (in[i] != 'B' || in[i + 1] != 'C' ||
+			    le16dec(in + i + 2) != 2 || i + 6 > 12 + xlen) {
+				continue;
+			}
+
+			len = le16dec(in + i + 4) + 1;
+			if (len > left || len < 12 + xlen + 8) {
+				return (0);
+			}
+
+			*out_len = le32dec(in + len - 4);
+			*in_len = len;
+
+			return (*out_len <= UNPACK_BLOCK);
+		}
+
+		break;
+	}
+#ifdef WITH_ZSTD
+	case UNPACK_ZSTD: {
+		unsigned long long size;
+		size_t len;
+
+		len = ZSTD_findFrameCompressedSize(in, left);
+		if (ZSTD_isError(len)) {
+			return (0);
+		}
+
+		size = ZSTD_getFrameContentSize(in, len);
+		if (size == ZSTD_CONTENTSIZE_UNKNOWN ||
+		    size == ZSTD_CONTENTSIZE_ERROR || size > UNPACK_BLOCK) {
+			return (0);
+		}
+
+		*out_len = size;
+		*in_len = len;
+
+		return (1);
+	}
+#endif /* WITH_ZSTD */
+	default:
+		break;
+	}
+
+	return (0);
+}
+
+static unsigned int
+_peak_unpack_block(struct peak_unpack_worker *worker,
+    struct peak_unpack_slot *slot)
+{
+	const size_t size = MAX(slot->out_len, 1);
+
+	if (slot->out_size < size) {
+		uint8_t *out = realloc(slot->out, size);
+		if (!out) {
+			return (0);
+		}
+		slot->out_size = size;
+		slot->out = out;
+	}
+
+	switch (worker->self->codec) {
+	case UNPACK_GZIP:
+		if (inflateReset(&worker->gzip) != Z_OK) {
+			return (0);
+		}
+
+		worker->gzip.next_in = (Bytef *)slot->in;
+		worker->gzip.avail_in = slot->in_len;
+		worker->gzip.next_out = slot->out;
+		worker->gzip.avail_out = slot->out_len;
+
+		/* the size in the trailer must be right, too */
+		return (inflate(&worker->gzip, Z_FINISH) == Z_STREAM_END &&
+		    !worker->gzip.avail_out && !worker->gzip.avail_in);
+#ifdef WITH_ZSTD
+	case UNPACK_ZSTD:
+		return (ZSTD_decompressDCtx(worker->zstd, slot->out,
+		    slot->out_len, slot->in, slot->in_len) == slot->out_len);
+#endif /* WITH_ZSTD */
+	default:
+		break;
+	}
+
+	return (0);
+}
+
+static void *
+_peak_unpack_worker(void *arg)
+{
+	struct peak_unpack_worker *worker = arg;
+	struct peak_unpack *self = worker->self;
+	struct peak_unpack_slot *slot;
+	size_t in_len, out_len;
+	unsigned int ok;
+
+	pthread_mutex_lock(&self->lock);
+
+	for (;;) {
+		while (!self->stop && (self->split_done ||
+		    self->issued - self->current >= self->slot_count)) {
+			pthread_cond_wait(&self->wake, &self->lock);
+		}
+
+		if (self->stop) {
+			break;
+		}
+
+		if (!_peak_unpack_split(self, &in_len, &out_len)) {
+			/* the rest is streamed */
+			self->split_done = 1;
+			pthread_cond_broadcast(&self->ready);
+			continue;
+		}
+
+		slot = &self->slots[self->issued++ % self->slot_count];
+		slot->in = self->in + self->in_pos;
+		slot->state = UNPACK_SLOT_BUSY;
+		slot->out_len = out_len;
+		slot->in_len = in_len;
+		slot->out_pos = 0;
+
+		self->in_pos += in_len;
+
+		pthread_mutex_unlock(&self->lock);
+
+		ok = _peak_unpack_block(worker, slot);
+
+		pthread_mutex_lock(&self->lock);
+
+		slot->state = ok ? UNPACK_SLOT_READY : UNPACK_SLOT_FAILED;
+		pthread_cond_broadcast(&self->ready);
+	}
+
+	pthread_mutex_unlock(&self->lock);
+
+	return (NULL);
+}
+
+static unsigned int
+_peak_unpack_prepare(struct peak_unpack_worker *worker)
+{
+	switch (worker->self->codec) {
+	case UNPACK_GZIP:
+		return (inflateInit2(&worker->gzip, 15 + 16) == Z_OK);
+#ifdef WITH_ZSTD
+	case UNPACK_ZSTD:
+		worker->zstd = ZSTD_createDCtx();
+		return (worker->zstd != NULL);
+#endif /* WITH_ZSTD */
+	default:
+		break;
+	}
+
+	return (0);
+}
+
+static void
+_peak_unpack_release(struct peak_unpack_worker *worker)
+{
+	switch (worker->self->codec) {
+	case UNPACK_GZIP:
+		inflateEnd(&worker->gzip);
+		break;
+#ifdef WITH_ZSTD
+	case UNPACK_ZSTD:
+		ZSTD_freeDCtx(worker->zstd);
+		break;
+#endif /* WITH_ZSTD */
+	default:
+		break;
+	}
+}
+
+static void
+_peak_unpack_pool(struct peak_unpack *self, const unsigned int count)
+{
+	struct peak_unpack_worker *worker;
+	unsigned int i;
+
+	self->workers = calloc(count, sizeof(*self->workers));
+	self->slots = calloc(count * UNPACK_SLOTS, sizeof(*self->slots));
+	if (!self->workers || !self->slots) {
+		goto _peak_unpack_pool_free;
+	}
+
+	self->slot_count = count * UNPACK_SLOTS;
+
+	pthread_mutex_init(&self->lock, NULL);
+	pthread_cond_init(&self->ready, NULL);
+	pthread_cond_init(&self->wake, NULL);
+
+	for (i = 0; i < count; ++i) {
+		worker = &self->workers[i];
+		worker->self = self;
+
+		if (!_peak_unpack_prepare(worker)) {
+			break;
+		}
+
+		if (pthread_create(&worker->thread, NULL,
+		    _peak_unpack_worker, worker)) {
+			_peak_unpack_release(worker);
+			break;
+		}
+
+		++self->worker_count;
+	}
+
+	if (self->worker_count) {
+		return;
+	}
+
+	/* streaming still works */
+	pthread_cond_destroy(&self->wake);
+	pthread_cond_destroy(&self->ready);
+	pthread_mutex_destroy(&self->lock);
+
+  _peak_unpack_pool_free:
+
+	free(self->workers);
+	free(self->slots);
+	self->workers = NULL;
+	self->slots = NULL;
+}
+
+static ssize_t
+_peak_unpack_parallel(struct peak_unpack *self, uint8_t *buf,
+    const size_t len)
+{
+	struct peak_unpack_slot *slot;
+	size_t ret;
+
+	pthread_mutex_lock(&self->lock);
+
+	for (;;) {
+		slot = &self->slots[self->current % self->slot_count];
+		if (self->current != self->issued &&
+		    slot->state != UNPACK_SLOT_BUSY) {
+			break;
+		}
+		if (self->current == self->issued && self->split_done) {
+			/* workers are done, stream from here on */
+			pthread_mutex_unlock(&self->lock);
+			self->streamed = 1;
+			return (0);
+		}
+		pthread_cond_wait(&self->ready, &self->lock);
+	}
+
+	pthread_mutex_unlock(&self->lock);
+
+	if (slot->state == UNPACK_SLOT_FAILED) {
+		return (-1);
+	}
+
+	ret = MIN(len, slot->out_len - slot->out_pos);
+	memcpy(buf, slot->out + slot->out_pos, ret);
+	slot->out_pos += ret;
+
+	if (slot->out_pos == slot->out_len) {
+		pthread_mutex_lock(&self->lock);
+		slot->state = UNPACK_SLOT_FREE;
+		++self->current;
+		pthread_cond_broadcast(&self->wake);
+		pthread_mutex_unlock(&self->lock);
+	}
+
+	return (ret);
+}
+
+static ssize_t
+_peak_unpack_input(struct peak_unpack *self)
+{
+	ssize_t ret;
+
+	if (self->fd < 0) {
+		self->eof = 1;
+		return (0);
+	}
+
+	do {
+		ret = read(self->fd, self->buffer, self->buffer_size);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0) {
+		self->eof = 1;
+		return (ret);
+	}
+
+	self->in_len = ret;
+	self->in_pos = 0;
+
+	return (ret);
+}
+
+static ssize_t
+_peak_unpack_stream(struct peak_unpack *self, uint8_t *buf,
+    const size_t len)
+{
+	size_t in_len, out_len;
+	const uint8_t *in;
+
+	for (;;) {
+		if (self->in_pos == self->in_len && !self->eof &&
+		    _peak_unpack_input(self) < 0) {
+			return (-1);
+		}
+
+		if (self->in_pos == self->in_len) {
+			/* input ended in the middle of a frame? */
+			return (self->partial ? -1 : 0);
+		}
+
+		in = self->in + self->in_pos;
+		in_len = self->in_len - self->in_pos;
+		out_len = len;
+
+		switch (self->codec) {
+		case UNPACK_GZIP: {
+			int ret;
+
+			if (!self->partial && in[0] != 0x1F) {
+				/* trailing garbage or padding */
+				self->in_pos = self->in_len;
+				self->eof = 1;
+				return (0);
+			}
+
+			self->gzip.next_in = (Bytef *)in;
+			self->gzip.avail_in = in_len;
+			self->gzip.next_out = buf;
+			self->gzip.avail_out = out_len;
+
+			ret = inflate(&self->gzip, Z_NO_FLUSH);
+			if (ret == Z_STREAM_END) {
+				/* more members may follow */
+				inflateReset(&self->gzip);
+				self->partial = 0;
+			} else if (ret == Z_OK || ret == Z_BUF_ERROR) {
+				self->partial = 1;
+			} else {
+				return (-1);
+			}
+
+			in_len -= self->gzip.avail_in;
+			out_len -= self->gzip.avail_out;
+			break;
+		}
+#ifdef WITH_ZSTD
+		case UNPACK_ZSTD: {
+			ZSTD_outBuffer output = { buf, out_len, 0 };
+			ZSTD_inBuffer input = { in, in_len, 0 };
+			size_t ret;
+
+			ret = ZSTD_decompressStream(self->zstd, &output,
+			    &input);
+			if (ZSTD_isError(ret)) {
+				return (-1);
+			}
+
+			self->partial = ret != 0;
+			out_len = output.pos;
+			in_len = input.pos;
+			break;
+		}
+#endif /* WITH_ZSTD */
+#ifdef WITH_LZ4
+		case UNPACK_LZ4: {
+			size_t ret;
+
+			/* frames end with a reset context */
+			ret = LZ4F_decompress(self->lz4, buf, &out_len,
+			    in, &in_len, NULL);
+			if (LZ4F_isError(ret)) {
+				return (-1);
+			}
+
+			self->partial = ret != 0;
+			break;
+		}
+#endif /* WITH_LZ4 */
+		default:
+			return (-1);
+		}
+
+		self->in_pos += in_len;
+
+		if (out_len) {
+			return (out_len);
+		}
+
+		if (!in_len && self->in_pos != self->in_len) {
+			/* no progress at all */
+			return (-1);
+		}
+	}
+}
+
+ssize_t
+peak_unpack_read(struct peak_unpack *self, void *buf, const size_t len)
+{
+	ssize_t ret;
+
+	if (unlikely(self->failed)) {
+		return (-1);
+	}
+
+	while (self->worker_count && !self->streamed) {
+		ret = _peak_unpack_parallel(self, buf, len);
+		if (ret) {
+			goto peak_unpack_read_out;
+		}
+	}
+
+	ret = _peak_unpack_stream(self, buf, len);
+
+  peak_unpack_read_out:
+
+	if (ret < 0) {
+		/* errors are sticky */
+		self->failed = 1;
+	}
+
+	return (ret);
+}
+
+struct peak_unpack *
+peak_unpack_init(const unsigned int codec, const int fd, const void *buf,
+    const size_t len, const unsigned int threads)
+{
+	struct peak_unpack *self;
+	size_t in_len, out_len;
+
+	self = calloc(1, sizeof(*self));
+	if (!self) {
+		return (NULL);
+	}
+
+	self->codec = codec;
+	self->fd = fd;
+
+	if (fd < 0) {
+		/* all input is at hand, e.g. mapped */
+		self->in_len = len;
+		self->eof = 1;
+		self->in = buf;
+	} else {
+		/* bytes already taken from the descriptor go first */
+		self->buffer_size = MAX(len, UNPACK_INPUT);
+		self->buffer = malloc(self->buffer_size);
+		if (!self->buffer) {
+			goto peak_unpack_init_free;
+		}
+		memcpy(self->buffer, buf, len);
+		self->in = self->buffer;
+		self->in_len = len;
+	}
+
+	switch (codec) {
+	case UNPACK_GZIP:
+		if (inflateInit2(&self->gzip, 15 + 16) != Z_OK) {
+			goto peak_unpack_init_free;
+		}
+		self->gzip_ready = 1;
+		break;
+#ifdef WITH_ZSTD
+	case UNPACK_ZSTD:
+		self->zstd = ZSTD_createDStream();
+		if (!self->zstd) {
+			goto peak_unpack_init_free;
+		}
+		break;
+#endif /* WITH_ZSTD */
+#ifdef WITH_LZ4
+	case UNPACK_LZ4:
+		if (LZ4F_isError(LZ4F_createDecompressionContext(&self->lz4,
+		    LZ4F_VERSION))) {
+			goto peak_unpack_init_free;
+		}
+		break;
+#endif /* WITH_LZ4 */
+	default:
+		/* not compiled in */
+		goto peak_unpack_init_free;
+	}
+
+	if (fd < 0 && threads > 1 &&
+	    _peak_unpack_split(self, &in_len, &out_len)) {
+		_peak_unpack_pool(self, MIN(threads, UNPACK_THREADS));
+	}
+
+	return (self);
+
+  peak_unpack_init_free:
+
+	peak_unpack_exit(self);
+
+	return (NULL);
+}
+
+void
+peak_unpack_exit(struct peak_unpack *self)
+{
+	unsigned int i;
+
+	if (!self) {
+		return;
+	}
+
+	if (self->worker_count) {
+		pthread_mutex_lock(&self->lock);
+		self->stop = 1;
+		pthread_cond_broadcast(&self->wake);
+		pthread_mutex_unlock(&self->lock);
+
+		for (i = 0; i < self->worker_count; ++i) {
+			pthread_join(self->workers[i].thread, NULL);
+			_peak_unpack_release(&self->workers[i]);
+		}
+
+		pthread_cond_destroy(&self->wake);
+		pthread_cond_destroy(&self->ready);
+		pthread_mutex_destroy(&self->lock);
+	}
+
+	for (i = 0; i < self->slot_count; ++i) {
+		free(self->slots[i].out);
+	}
+
+	if (self->gzip_ready) {
+		inflateEnd(&self->gzip);
+	}
+#ifdef WITH_ZSTD
+	ZSTD_freeDStream(self->zstd);
+#endif /* WITH_ZSTD */
+#ifdef WITH_LZ4
+	LZ4F_freeDecompressionContext(self->lz4);
+#endif /* WITH_LZ4 */
+
+	free(self->workers);
+	free(self->buffer);
+	free(self->slots);
+	free(self);
+}
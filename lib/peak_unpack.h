@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef PEAK_UNPACK_H
+#define PEAK_UNPACK_H
+
+enum {
+	UNPACK_NONE,	/* not compressed */
+	UNPACK_GZIP,
+	UNPACK_ZSTD,
+	UNPACK_LZ4,
+	UNPACK_MAX	/* last element */
+};
+
+unsigned int		 peak_unpack_detect(const void *, const size_t);
+struct peak_unpack	*peak_unpack_init(const unsigned int, const int,
+			     const void *, const size_t, const unsigned int);
+ssize_t			 peak_unpack_read(struct peak_unpack *, void *,
+			     const size_t);
+void			 peak_unpack_exit(struct peak_unpack *);
+
+#endif /* !PEAK_UNPACK_H */
@@ -125,3 +125,6 @@ insertIntoFile('lib/peak_locate.h', "#define PEAK_LOCATE_H\n", \
 	"#define LOCATE_MAGIC\t0x10CA7E10CA7E7412ull\n", header_string)
 insertIntoFile('lib/peak_locate.c', "#define LOCATE_DEFAULT\t\"/usr/local/var/peak/locate.bin\"\n", \
 	"struct peak_locates {\n", source_string)
+
+# the name lookup tables depend on the list above
+execfile('scripts/lookup_update.py')
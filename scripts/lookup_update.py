@@ -0,0 +1,151 @@
+#!/usr/bin/env python2.7
+
+# Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+# Generates the minimal perfect hash tables used for name to number
+# lookups in lib/peak_li.c and lib/peak_locate.c.  The tables are
+# derived from the static lists in those files, so this needs to run
+# whenever one of the lists changes.  The hash functions mirror
+# hash_lower() and hash_mix() in include/peak_hash.h.  The long mime
+# types in lib/peak_magic.c hash slower than its sorted list can be
+# searched, so it keeps its bsearch().
+
+import re
+import sys
+
+BEGIN = "/*\n * Begin of autogenerated lookup section.  DO NOT EDIT.\n */\n"
+END = "/*\n * End of autogenerated lookup section.\n */\n"
+
+MASK = 0xFFFFFFFF
+
+def hashLower(key):
+	h = 2166136261
+	for c in bytearray(key.encode('utf-8')):
+		if c >= ord('A') and c <= ord('Z'):
+			c += ord('a') - ord('A')
+		h = (16777619 * (h ^ c)) & MASK
+	return h
+
+def hashMix(h, seed):
+	h ^= seed
+	h ^= h >> 16
+	h = (h * 0x85EBCA6B) & MASK
+	h ^= h >> 13
+	h = (h * 0xC2B2AE35) & MASK
+	h ^= h >> 16
+	return h
+
+def unescape(string):
+	return re.sub(r'\\(.)', r'\1', string)
+
+def perfectHash(keys):
+	# hash and displace: group keys into buckets, then find
+	# a displacement per bucket that moves all of its keys
+	# into free slots, largest buckets first
+	count = len(keys)
+	hashes = [hashLower(key) for key in keys]
+	buckets = [[] for i in range(max(1, (count + 1) // 2))]
+
+	for i in range(count):
+		buckets[hashMix(hashes[i], 0) % len(buckets)].append(i)
+
+	disp = [1] * len(buckets)
+	slot = [None] * count
+
+	order = sorted(range(len(buckets)), key=lambda b: -len(buckets[b]))
+	for b in order:
+		if not buckets[b]:
+			break
+		for d in range(1, 0x10000):
+			taken = [hashMix(hashes[i], d) % count \
+			    for i in buckets[b]]
+			if len(set(taken)) != len(taken):
+				continue
+			if [t for t in taken if slot[t] is not None]:
+				continue
+			for i, t in zip(buckets[b], taken):
+				slot[t] = i
+			disp[b] = d
+			break
+		else:
+			sys.exit("no displacement found, giving up")
+
+	return disp, slot
+
+def formatTables(prefix, keys, symbols, extra=""):
+	disp, slot = perfectHash(keys)
+
+	ret = "\n"
+	ret += "static const uint16_t " + prefix + "_disp[] = {\n"
+	for i in range(0, len(disp), 8):
+		ret += "\t" + ", ".join([str(d) for d in disp[i:i + 8]]) + ",\n"
+	ret += "};\n\n"
+	ret += "static const uint16_t " + prefix + "_slot[] = {\n"
+	for i in slot:
+		ret += "\t" + symbols[i] + ",\t/* " + keys[i] + " */\n"
+	ret += "};\n\n"
+	ret += extra
+
+	return ret
+
+def insertIntoFile(fileName, insertString):
+	with open(fileName, 'r') as source_file:
+		content = source_file.read()
+
+	begin = content.find(BEGIN)
+	end = content.find(END)
+	if begin < 0 or end < begin:
+		sys.exit("no lookup section in " + fileName)
+
+	content = content[:begin + len(BEGIN)] + insertString + \
+	    content[end:]
+
+	with open(fileName, 'w') as source_file:
+		source_file.write(content)
+
+def collect(entries):
+	# first occurrence of a name wins, as in a linear search
+	keys = []
+	symbols = []
+	for symbol, key in entries:
+		if key.lower() in [k.lower() for k in keys]:
+			continue
+		keys.append(key)
+		symbols.append(symbol)
+	return keys, symbols
+
+item = r'\t\{ (\w+), "((?:[^"\\]|\\.)*)", "((?:[^"\\]|\\.)*)" \},'
+
+with open('lib/peak_locate.c', 'r') as source_file:
+	entries = re.findall(item, source_file.read())
+
+keys, symbols = collect([(e[0], unescape(e[1])) for e in entries])
+insertIntoFile('lib/peak_locate.c', formatTables('locate', keys, symbols))
+
+with open('lib/peak_li.c', 'r') as source_file:
+	entries = re.findall(r'\tLI_LIST_(?:APP|IPTYPE)\((LI_\w+), (\w+),', \
+	    source_file.read())
+
+items = "static const struct peak_lis *const li_items[LI_MAX] = {\n"
+seen = []
+for i in range(len(entries)):
+	if entries[i][0] in seen:
+		continue
+	seen.append(entries[i][0])
+	items += "\t[" + entries[i][0] + "] = &apps[" + str(i) + "],\n"
+items += "};\n\n"
+
+keys, symbols = collect([(e[0], e[1]) for e in entries])
+insertIntoFile('lib/peak_li.c', formatTables('li', keys, symbols, items))
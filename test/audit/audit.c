@@ -58,6 +58,24 @@ test_audit(void)
 	peak_audit_sync(&data);
 	assert(data.field[0] == 49);
 
+	/* gauges are passed on, not added up */
+	peak_audit_set(AUDIT_STREAM_USED, 5);
+	peak_audit_sync(&data);
+	assert(data.field[AUDIT_STREAM_USED] == 5);
+	assert(peak_audit_get(AUDIT_STREAM_USED) == 5);
+	peak_audit_sync(&data);
+	assert(data.field[AUDIT_STREAM_USED] == 5);
+	peak_audit_set(AUDIT_STREAM_USED, 3);
+	peak_audit_sync(&data);
+	assert(data.field[AUDIT_STREAM_USED] == 3);
+
+	/* an untouched gauge doesn't overwrite the export */
+	data.field[AUDIT_STREAM_USED] = 9;
+	peak_audit_sync(&data);
+	assert(data.field[AUDIT_STREAM_USED] == 9);
+	peak_audit_set(AUDIT_STREAM_USED, 0);
+	peak_audit_sync(&data);
+
 	/* clear aggregate and resync, causing eternal winter to unfold */
 	memset(&data, 0, sizeof(data));
 	peak_audit_sync(&data);
@@ -606,6 +606,13 @@ test_hash(void)
 	assert(backup == ROLL_HASH(&head));
 
 	assert(backup != hash_roll("tesT", 4));
+
+	assert(hash_lower("test") == 0xAFD071E5u);
+	assert(hash_lower("TeST") == hash_lower("test"));
+	assert(hash_lower("") == 0x811C9DC5u);
+	assert(hash_lower("[") != hash_lower("{"));
+	assert(hash_mix(0, 0) == 0);
+	assert(hash_mix(1, 0) != hash_mix(1, 1));
 }
 
 static void
@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <peak.h>
+#include <assert.h>
+
+#define TEST_STR	"771,4865-4866-49195,0-10-11-16,29-23,0"
+#define TEST_HASH	"46bdf94c81b6051631c094dcdd4cfc23"
+
+output_init();
+
+#define PUT8(x)		do { buf[len++] = (x); } while (0)
+#define PUT16(x)	do { PUT8((x) >> 8); PUT8((x) & 0xFF); } while (0)
+#define PUT24(x)	do { PUT8((x) >> 16); PUT16((x) & 0xFFFF); } while (0)
+
+static size_t
+test_hello(uint8_t *buf, const uint8_t seed, const uint16_t grease,
+    const char *sni)
+{
+	const size_t sni_len = strlen(sni);
+	size_t len = 0, ext, i;
+
+	PUT8(0x16);		/* handshake */
+	PUT16(0x0301);
+	PUT16(0);		/* record length, see below */
+	PUT8(0x01);		/* ClientHello */
+	PUT24(0);		/* handshake length, see below */
+	PUT16(0x0303);
+
+	for (i = 0; i < 32; ++i) {
+		PUT8(seed + i);	/* random */
+	}
+
+	PUT8(32);
+	for (i = 0; i < 32; ++i) {
+		PUT8(seed ^ i);	/* session id */
+	}
+
+	PUT16(8);
+	PUT16(grease);
+	PUT16(0x1301);
+	PUT16(0x1302);
+	PUT16(0xc02b);
+
+	PUT8(1);
+	PUT8(0);
+
+	PUT16(0);		/* extensions length, see below */
+	ext = len;
+
+	PUT16(grease ^ 0x1010);
+	PUT16(0);
+
+	PUT16(0);		/* server_name */
+	PUT16(sni_len + 5);
+	PUT16(sni_len + 3);
+	PUT8(0);
+	PUT16(sni_len);
+	memcpy(&buf[len], sni, sni_len);
+	len += sni_len;
+
+	PUT16(10);		/* supported_groups */
+	PUT16(8);
+	PUT16(6);
+	PUT16(grease ^ 0x2020);
+	PUT16(0x001d);
+	PUT16(0x0017);
+
+	PUT16(11);		/* ec_point_formats */
+	PUT16(2);
+	PUT8(1);
+	PUT8(0);
+
+	PUT16(16);		/* application_layer_protocol_negotiation */
+	PUT16(5);
+	PUT16(3);
+	PUT8(2);
+	PUT8('h');
+	PUT8('2');
+
+	be16enc(&buf[3], len - 5);
+	be16enc(&buf[7], len - 9);
+	be16enc(&buf[ext - 2], len - ext);
+
+	return (len);
+}
+
+static void
+test_packet(struct peak_packet *packet, const void *buf, const size_t len)
+{
+	memset(packet, 0, sizeof(*packet));
+
+	packet->net_type = IPPROTO_TCP;
+	packet->app.raw = (void *)buf;
+	packet->app_len = len;
+}
+
+static void
+test_build(void)
+{
+	struct peak_packet stackptr(packet);
+	struct peak_meta_hello hello;
+	struct peak_ja3 ja3;
+	uint8_t buf[512];
+	size_t len;
+
+	len = test_hello(buf, 0, 0x0a0a, "example.com");
+	test_packet(packet, buf, len);
+
+	assert(!peak_ja3_parse(&hello, packet));
+	assert(hello.version == 0x0303);
+	assert(hello.ciphers.len == 8);
+	assert(hello.curves.len == 6);
+	assert(hello.formats.len == 1);
+
+	assert(!peak_ja3_build(&ja3, &hello, packet));
+	assert(ja3.len == strlen(TEST_STR));
+	assert(!strcmp(ja3.str, TEST_STR));
+	assert(!strcmp(ja3.hash, TEST_HASH));
+
+	/* partial hello is rejected */
+	test_packet(packet, buf, len - 1);
+	assert(peak_ja3_parse(&hello, packet));
+
+	/* not a handshake */
+	buf[0] = 0x17;
+	test_packet(packet, buf, len);
+	assert(peak_ja3_parse(&hello, packet));
+
+	test_packet(packet, buf, 0);
+	assert(peak_ja3_parse(&hello, packet));
+}
+
+static void
+test_cache(void)
+{
+	struct peak_packet stackptr(packet);
+	const struct peak_ja3 *ja3;
+	struct peak_ja3s *cache;
+	uint64_t hit, miss;
+	uint8_t buf[512];
+	size_t len;
+
+	assert(!peak_ja3_init(0));
+
+	cache = peak_ja3_init(100);
+	assert(cache);
+
+	hit = peak_audit_get(AUDIT_JA3_HIT);
+	miss = peak_audit_get(AUDIT_JA3_MISS);
+
+	len = test_hello(buf, 0, 0x0a0a, "example.com");
+	test_packet(packet, buf, len);
+	ja3 = peak_ja3_get(cache, packet);
+	assert(ja3);
+	assert(!strcmp(ja3->hash, TEST_HASH));
+	assert(peak_audit_get(AUDIT_JA3_MISS) == miss + 1);
+
+	/* random, session id, SNI and GREASE don't matter */
+	len = test_hello(buf, 42, 0xbaba, "www.example.org");
+	test_packet(packet, buf, len);
+	ja3 = peak_ja3_get(cache, packet);
+	assert(ja3);
+	assert(!strcmp(ja3->hash, TEST_HASH));
+	assert(!strcmp(ja3->str, TEST_STR));
+	assert(peak_audit_get(AUDIT_JA3_HIT) == hit + 1);
+	assert(peak_audit_get(AUDIT_JA3_MISS) == miss + 1);
+
+	/* a different cipher list is a different client */
+	be16enc(&buf[5 + 4 + 2 + 32 + 1 + 32 + 2 + 4], 0x1303);
+	ja3 = peak_ja3_get(cache, packet);
+	assert(ja3);
+	assert(strcmp(ja3->hash, TEST_HASH));
+	assert(!strncmp(ja3->str, "771,4865-4867-49195,", 20));
+	assert(peak_audit_get(AUDIT_JA3_MISS) == miss + 2);
+
+	test_packet(packet, buf, len - 1);
+	assert(!peak_ja3_get(cache, packet));
+
+	peak_ja3_exit(cache);
+}
+
+int
+main(void)
+{
+	pout("peak ja3 test suite... ");
+
+	test_build();
+	test_cache();
+
+	pout("ok\n");
+
+	return (0);
+}
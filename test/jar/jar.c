@@ -16,6 +16,8 @@
 
 #include <peak.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
 
 output_init();
 
@@ -98,12 +100,550 @@ test_jar(void)
 	peak_jar_exit(&bucket);
 }
 
+static unsigned int
+test_repair_callback(void *userdata, void *buf, size_t len)
+{
+	unsigned int *seen = userdata;
+	unsigned int seq;
+
+	assert(len == sizeof(seq));
+	memcpy(&seq, buf, sizeof(seq));
+	assert(!seen[1] || seq == seen[0] + 1);
+	seen[0] = seq;
+	seen[1] += 1;
+
+	return (JAR_KEEP);
+}
+
+static void
+test_jar_repair(void)
+{
+	struct peak_jars bucket;
+	struct peak_jar context;
+	unsigned int seen[2];
+	unsigned int i;
+
+	JAR_INIT(&context);
+
+	assert(peak_jar_init(&bucket, 64 * 1024));
+
+	/* the oldest header has to go at some point */
+	for (i = 0; i < 2000; ++i) {
+		peak_jar_pack(&bucket, &context, &i, sizeof(i));
+	}
+
+	/* what is left must still be complete */
+	memset(seen, 0, sizeof(seen));
+	assert(peak_jar_fifo(&bucket, &context, test_repair_callback,
+	    seen));
+	assert(seen[0] == 1999 && seen[1] > 1 && seen[1] < 2000);
+
+	peak_jar_exit(&bucket);
+}
+
+static void
+test_jar_reserve(void)
+{
+	struct peak_jars bucket;
+	struct peak_jar context;
+	unsigned int action, i, j, mode;
+	char *buf;
+
+	JAR_INIT(&context);
+
+	for (mode = JAR_SERIAL; mode <= JAR_MPSC; ++mode) {
+		/* the serial jar would overwrite the round in progress */
+		assert(peak_jar_init(&bucket, mode == JAR_SERIAL ?
+		    64 * 1024 : 33 * 16));
+		assert(peak_jar_share(&bucket, mode));
+
+		for (i = 0; i < 100; ++i) {
+			for (j = 0; j < lengthof(stuff); ++j) {
+				/* build the data in place */
+				buf = peak_jar_reserve(&bucket, &context,
+				    strsize(stuff[j]));
+				assert(buf);
+				memcpy(buf, stuff[j], strsize(stuff[j]));
+				peak_jar_commit(&bucket, buf);
+			}
+			peak_jar_flush(&bucket);
+			assert(mode == JAR_SERIAL ||
+			    peak_jar_sync(&bucket) == lengthof(stuff));
+			action = JAR_DROP;
+			count = 0;
+			assert(!fifo(&bucket, &context, &action));
+			assert(count == lengthof(stuff));
+		}
+
+		if (mode != JAR_SERIAL) {
+			/* too big to ever fit */
+			assert(!peak_jar_reserve(&bucket, &context, 512));
+		}
+
+		peak_jar_exit(&bucket);
+	}
+}
+
+struct test_file {
+	unsigned int id;
+	unsigned int seq;
+};
+
+static struct peak_jar *
+test_file_key(void *userdata, void *buf, size_t len)
+{
+	struct peak_jar *contexts = userdata;
+	struct test_file *rec = buf;
+
+	assert(len == sizeof(*rec) + rec->seq % 7);
+
+	return (&contexts[rec->id]);
+}
+
+static unsigned int
+test_file_callback(void *userdata, void *buf, size_t len)
+{
+	unsigned int *seen = userdata;
+	struct test_file *rec = buf;
+
+	assert(len == sizeof(*rec) + rec->seq % 7);
+	assert(!seen[1] || rec->seq == seen[0] + 2);
+	seen[0] = rec->seq;
+	seen[1] += 1;
+
+	return (JAR_KEEP);
+}
+
+static void
+test_jar_file(void)
+{
+	char file[] = "/tmp/jar.XXXXXX";
+	struct peak_jar contexts[2];
+	struct peak_jars bucket;
+	struct test_file *rec;
+	unsigned int seen[2];
+	unsigned int i;
+
+	mktemp(file);
+
+	for (i = 0; i < 2; ++i) {
+		JAR_INIT(&contexts[i]);
+	}
+
+	assert(!peak_jar_open(&bucket, file, 100));
+	assert(peak_jar_open(&bucket, file, 4096));
+	assert(!peak_jar_share(&bucket, JAR_SPSC));
+
+	/* a fresh file has nothing to offer */
+	assert(!peak_jar_replay(&bucket, test_file_key, contexts));
+
+	/* wrap around a couple of times */
+	for (i = 0; i < 1000; ++i) {
+		rec = peak_jar_reserve(&bucket, &contexts[i % 2],
+		    sizeof(*rec) + i % 7);
+		rec->id = i % 2;
+		rec->seq = i;
+		peak_jar_commit(&bucket, rec);
+	}
+
+	/* this one never makes it */
+	rec = peak_jar_reserve(&bucket, &contexts[0],
+	    sizeof(*rec) + 1000 % 7);
+	rec->id = 0;
+	rec->seq = 1000;
+
+	peak_jar_exit(&bucket);
+
+	for (i = 0; i < 2; ++i) {
+		JAR_INIT(&contexts[i]);
+	}
+
+	assert(peak_jar_open(&bucket, file, 4096));
+	assert(peak_jar_replay(&bucket, test_file_key, contexts));
+
+	/* same history as before the restart */
+	for (i = 0; i < 2; ++i) {
+		memset(seen, 0, sizeof(seen));
+		assert(peak_jar_fifo(&bucket, &contexts[i],
+		    test_file_callback, seen));
+		assert(seen[0] == 998 + i && seen[1] > 1);
+	}
+
+	/* carries on where it left off */
+	for (i = 1000; i < 1010; ++i) {
+		rec = peak_jar_reserve(&bucket, &contexts[i % 2],
+		    sizeof(*rec) + i % 7);
+		rec->id = i % 2;
+		rec->seq = i;
+		peak_jar_commit(&bucket, rec);
+	}
+
+	peak_jar_exit(&bucket);
+
+	for (i = 0; i < 2; ++i) {
+		JAR_INIT(&contexts[i]);
+	}
+
+	assert(peak_jar_open(&bucket, file, 4096));
+	assert(peak_jar_replay(&bucket, test_file_key, contexts));
+
+	for (i = 0; i < 2; ++i) {
+		memset(seen, 0, sizeof(seen));
+		assert(peak_jar_fifo(&bucket, &contexts[i],
+		    test_file_callback, seen));
+		assert(seen[0] == 1008 + i && seen[1] > 5);
+	}
+
+	peak_jar_exit(&bucket);
+
+	/* other geometry, other jar */
+	assert(peak_jar_open(&bucket, file, 8192));
+	assert(!peak_jar_replay(&bucket, test_file_key, contexts));
+	peak_jar_exit(&bucket);
+
+	unlink(file);
+}
+
+#define post(x, y, z)	peak_jar_post(x, y, z, strsize(z))
+
+static void
+test_jar_share(void)
+{
+	struct peak_jars bucket;
+	struct peak_jar context;
+	unsigned int action, i, j;
+	char buf[512];
+
+	JAR_INIT(&context);
+
+	/* needs 16 byte alignment */
+	assert(peak_jar_init(&bucket, 200));
+	assert(peak_jar_share(&bucket, JAR_SERIAL));
+	assert(!peak_jar_share(&bucket, JAR_SPSC));
+	peak_jar_exit(&bucket);
+
+	assert(peak_jar_init(&bucket, 256));
+	assert(!peak_jar_share(&bucket, JAR_MPSC + 1));
+	assert(peak_jar_share(&bucket, JAR_SPSC));
+	assert(!peak_jar_share(&bucket, JAR_SPSC));
+	assert(!peak_jar_share(&bucket, JAR_SERIAL));
+
+	/* too big to ever fit */
+	assert(!peak_jar_post(&bucket, &context, buf, sizeof(buf)));
+
+	for (i = 0; i < lengthof(stuff); ++i) {
+		assert(post(&bucket, &context, stuff[i]));
+	}
+
+	/* nothing is published until the batch is flushed */
+	assert(!peak_jar_sync(&bucket));
+	action = JAR_KEEP;
+	count = 0;
+	assert(!fifo(&bucket, &context, &action));
+	assert(!count);
+
+	peak_jar_flush(&bucket);
+	assert(peak_jar_sync(&bucket) == lengthof(stuff));
+
+	action = JAR_KEEP;
+	count = 0;
+	assert(fifo(&bucket, &context, &action));
+	assert(count == lengthof(stuff));
+
+	/* the buffer is full, so the older half is dropped */
+	assert(!peak_jar_sync(&bucket));
+
+	action = JAR_DROP;
+	count = lengthof(stuff) / 2;
+	assert(!fifo(&bucket, &context, &action));
+	assert(count == lengthof(stuff));
+
+	peak_jar_exit(&bucket);
+
+	/* odd size, so records wrap at different offsets */
+	assert(peak_jar_init(&bucket, 33 * 16));
+	assert(peak_jar_share(&bucket, JAR_MPSC));
+
+	for (i = 0; i < 1000; ++i) {
+		for (j = 0; j < lengthof(stuff); ++j) {
+			assert(post(&bucket, &context, stuff[j]));
+		}
+		assert(peak_jar_sync(&bucket) == lengthof(stuff));
+		action = JAR_DROP;
+		count = 0;
+		assert(!fifo(&bucket, &context, &action));
+		assert(count == lengthof(stuff));
+	}
+
+	/* the consumer is too slow, the producer doesn't wait */
+	for (j = 0; post(&bucket, &context, stuff[0]); ++j) {
+		assert(j < 33 * 16 / 64);
+	}
+	assert(j && peak_jar_sync(&bucket) == j);
+	action = JAR_RETURN;
+	count = 0;
+	assert(fifo(&bucket, &context, &action));
+	assert(count == 1);
+
+	peak_jar_exit(&bucket);
+}
+
+#define SHARE_RECORDS	(200 * 1000)
+#define SHARE_THREADS	4
+
+struct test_share {
+	struct peak_jars *bucket;
+	struct peak_jar context;
+	pthread_mutex_t *lock;
+	unsigned int finished;
+	unsigned int seen;
+	unsigned int id;
+	pthread_t thread;
+};
+
+struct test_record {
+	unsigned int id;
+	unsigned int seq;
+	uint8_t pad[56];
+};
+
+static void *
+test_share_thread(void *arg)
+{
+	struct test_share *self = arg;
+	struct test_record rec, *slot;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.id = self->id;
+
+	for (rec.seq = 0; rec.seq < SHARE_RECORDS; ++rec.seq) {
+		if (!self->lock && !(self->id % 2)) {
+			/* even producers write in place */
+			while (!(slot = peak_jar_reserve(self->bucket,
+			    &self->context, sizeof(*slot)))) {
+				sched_yield();
+			}
+			slot->id = rec.id;
+			slot->seq = rec.seq;
+			peak_jar_commit(self->bucket, slot);
+			continue;
+		}
+
+		if (self->lock) {
+			pthread_mutex_lock(self->lock);
+			peak_jar_pack(self->bucket, &self->context,
+			    &rec, sizeof(rec));
+			pthread_mutex_unlock(self->lock);
+			continue;
+		}
+
+		/* wait for the consumer to make room */
+		while (!peak_jar_post(self->bucket, &self->context,
+		    &rec, sizeof(rec))) {
+			sched_yield();
+		}
+	}
+
+	peak_jar_flush(self->bucket);
+	__sync_fetch_and_add(&self->finished, 1);
+
+	return (NULL);
+}
+
+static unsigned int
+test_share_callback(void *userdata, void *buf, size_t len)
+{
+	struct test_share *self = userdata;
+	struct test_record *rec = buf;
+
+	assert(len == sizeof(*rec));
+	assert(rec->id == self->id);
+
+	if (self->lock) {
+		/* the serial jar overwrites what wasn't read in time */
+		assert(rec->seq >= self->seen);
+	} else {
+		assert(rec->seq == self->seen);
+	}
+
+	self->seen = rec->seq + 1;
+
+	return (JAR_DROP);
+}
+
+static double
+test_share_run(const unsigned int threads, const unsigned int mode,
+    unsigned int *lost)
+{
+	struct test_share share[SHARE_THREADS * 2];
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	struct timespec start, stop;
+	struct peak_jars bucket;
+	unsigned int i, done, seen;
+
+	assert(threads <= lengthof(share));
+
+	assert(peak_jar_init(&bucket, 256 * 1024));
+	assert(peak_jar_share(&bucket, mode));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < threads; ++i) {
+		memset(&share[i], 0, sizeof(share[i]));
+		JAR_INIT(&share[i].context);
+		share[i].bucket = &bucket;
+		share[i].lock = mode == JAR_SERIAL ? &lock : NULL;
+		share[i].id = i;
+		assert(!pthread_create(&share[i].thread, NULL,
+		    test_share_thread, &share[i]));
+	}
+
+	do {
+		/* one last round after everybody finished */
+		for (i = done = 0; i < threads; ++i) {
+			done += __sync_fetch_and_add(&share[i].finished, 0);
+		}
+
+		if (mode == JAR_SERIAL) {
+			pthread_mutex_lock(&lock);
+		} else {
+			peak_jar_sync(&bucket);
+		}
+
+		for (i = seen = 0; i < threads; ++i) {
+			seen -= share[i].seen;
+			peak_jar_fifo(&bucket, &share[i].context,
+			    test_share_callback, &share[i]);
+			seen += share[i].seen;
+		}
+
+		if (mode == JAR_SERIAL) {
+			pthread_mutex_unlock(&lock);
+		}
+
+		if (!seen) {
+			/* don't hog the CPU for nothing */
+			sched_yield();
+		}
+	} while (done < threads);
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	*lost = 0;
+
+	for (i = 0; i < threads; ++i) {
+		pthread_join(share[i].thread, NULL);
+		*lost += SHARE_RECORDS - share[i].seen;
+	}
+
+	peak_jar_exit(&bucket);
+
+	return ((stop.tv_sec - start.tv_sec) +
+	    (stop.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+static void
+test_jar_threads(void)
+{
+	unsigned int lost;
+
+	test_share_run(1, JAR_SPSC, &lost);
+	assert(!lost);
+	test_share_run(SHARE_THREADS, JAR_MPSC, &lost);
+	assert(!lost);
+}
+
+static void
+bench_share(void)
+{
+	static const char *modes[] = {
+		[JAR_SERIAL] = "mutex",
+		[JAR_SPSC] = "spsc",
+		[JAR_MPSC] = "mpsc",
+	};
+	unsigned int i, lost, mode;
+	double elapsed;
+
+	for (i = 1; i <= SHARE_THREADS * 2; i *= 2) {
+		for (mode = JAR_SERIAL; mode <= JAR_MPSC; ++mode) {
+			if (mode == JAR_SPSC && i > 1) {
+				continue;
+			}
+			elapsed = test_share_run(i, mode, &lost);
+			pout("%u producers, %s: %.2f Mrecords/s", i,
+			    modes[mode], i * SHARE_RECORDS / elapsed / 1e6);
+			if (lost) {
+				/* the mutex version can't wait */
+				pout(", %u lost", lost);
+			}
+			pout("\n");
+		}
+	}
+}
+
+static void
+bench_file(void)
+{
+	static struct peak_jar contexts[1024];
+	char file[] = "/tmp/jar.XXXXXX";
+	struct timespec start, stop;
+	struct peak_jars bucket;
+	struct test_record rec;
+	unsigned int i, mapped;
+	double elapsed;
+
+	mktemp(file);
+	memset(&rec, 0, sizeof(rec));
+
+	for (mapped = 0; mapped < 2; ++mapped) {
+		for (i = 0; i < lengthof(contexts); ++i) {
+			JAR_INIT(&contexts[i]);
+		}
+		assert(mapped ? peak_jar_open(&bucket, file, 256 << 10) :
+		    peak_jar_init(&bucket, 256 << 10));
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (rec.seq = 0; rec.seq < 10 * SHARE_RECORDS; ++rec.seq) {
+			peak_jar_pack(&bucket, &contexts[rec.seq %
+			    lengthof(contexts)], &rec, sizeof(rec));
+		}
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+
+		elapsed = (stop.tv_sec - start.tv_sec) +
+		    (stop.tv_nsec - start.tv_nsec) / 1e9;
+		pout("pack, %s: %.2f Mrecords/s\n", mapped ? "file" :
+		    "memory", 10 * SHARE_RECORDS / elapsed / 1e6);
+
+		peak_jar_exit(&bucket);
+	}
+
+	unlink(file);
+}
+
 int
-main(void)
+main(int argc, char **argv)
 {
+	int c;
+
+	while ((c = getopt(argc, argv, "b")) != -1) {
+		switch (c) {
+		case 'b':
+			bench_file();
+			bench_share();
+			return (0);
+		default:
+			return (1);
+		}
+	}
+
 	pout("peak jar test suite... ");
 
 	test_jar();
+	test_jar_repair();
+	test_jar_reserve();
+	test_jar_file();
+	test_jar_share();
+	test_jar_threads();
 
 	pout("ok\n");
 
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <peak.h>
+#include <assert.h>
+#include <unistd.h>
+
+#define TRACE_MAX	100000
+
+output_init();
+
+struct test_trace {
+	struct peak_packet *packets;
+	const struct peak_packet **refs;
+	unsigned int *result;
+	uint8_t *mem;
+	size_t count;
+};
+
+static void
+test_trace_init(struct test_trace *trace, const char *file)
+{
+	struct peak_load *load;
+	size_t size = 0;
+	size_t i;
+
+	memset(trace, 0, sizeof(*trace));
+
+	load = peak_load_init(file);
+	assert(load);
+
+	trace->packets = calloc(TRACE_MAX, sizeof(*trace->packets));
+	trace->refs = calloc(TRACE_MAX, sizeof(*trace->refs));
+	trace->result = calloc(TRACE_MAX, sizeof(*trace->result));
+	assert(trace->packets && trace->refs && trace->result);
+
+	while (trace->count < TRACE_MAX && peak_load_packet(load)) {
+		struct peak_packet *packet = &trace->packets[trace->count];
+
+		trace->mem = realloc(trace->mem, size + load->len);
+		assert(trace->mem);
+		memcpy(trace->mem + size, load->buf, load->len);
+
+		/* stash offset for now, memory may still move */
+		packet->mac.raw = (void *)size;
+		packet->mac_len = load->len;
+		packet->link_type = load->ll;
+
+		size += load->len;
+		++trace->count;
+	}
+
+	peak_load_exit(load);
+
+	for (i = 0; i < trace->count; ++i) {
+		struct peak_packet *packet = &trace->packets[i];
+		const size_t off = (size_t)packet->mac.raw;
+		const unsigned int len = packet->mac_len;
+
+		if (peak_packet_parse(packet, trace->mem + off, len,
+		    packet->link_type)) {
+			memset(packet, 0, sizeof(*packet));
+		}
+
+		trace->refs[i] = packet;
+	}
+}
+
+static void
+test_trace_exit(struct test_trace *trace)
+{
+	free(trace->packets);
+	free(trace->refs);
+	free(trace->result);
+	free(trace->mem);
+}
+
+static void
+test_trace_burst(struct test_trace *trace)
+{
+	size_t i;
+
+	for (i = 0; i < trace->count; i += LI_BURST_MAX) {
+		peak_li_get_burst(&trace->refs[i], &trace->result[i],
+		    MIN(trace->count - i, LI_BURST_MAX), ~0ull);
+	}
+}
+
+static void
+test_packet(struct peak_packet *packet, const uint8_t type,
+    const uint16_t sport, const uint16_t dport, const void *buf,
+    const size_t len)
+{
+	memset(packet, 0, sizeof(*packet));
+
+	packet->net_type = type;
+	packet->flow_sport = sport;
+	packet->flow_dport = dport;
+	packet->app.raw = (void *)buf;
+	packet->app_len = len;
+}
+
+static void
+test_mapping(void)
+{
+	unsigned int i, number;
+	const char *name;
+
+	for (i = LI_UNKNOWN + 1; i < LI_MAX; ++i) {
+		/* all protocols have names... */
+		name = peak_li_name(i);
+		assert(name);
+		/* ...and a unique number */
+		number = peak_li_number(name);
+		assert(i == number);
+	}
+
+	assert(!strcmp(peak_li_name(LI_UNKNOWN), "unknown"));
+	assert(peak_li_number("HTTP") == LI_HTTP);
+	assert(peak_li_number("htt") == LI_UNKNOWN);
+	assert(peak_li_number("") == LI_UNKNOWN);
+}
+
+static void
+test_load(void)
+{
+	static const uint8_t mysql[40] = {
+		0x24, 0x00, 0x00, 0x00, 0x0a, '5', '.', '5',
+	};
+	struct peak_packet stackptr(packet);
+	unsigned int memcached, redis;
+
+	assert(!peak_li_load("../../config/does.not.exist"));
+	assert(!peak_li_number("redis"));
+
+	assert(peak_li_load("../../config/li.conf.bin") == 4);
+
+	memcached = peak_li_number("memcached");
+	redis = peak_li_number("Redis");
+	assert(memcached >= LI_MAX && redis >= LI_MAX);
+	assert(!strcmp(peak_li_name(redis), "redis"));
+	assert(!strcmp(peak_li_pretty(memcached), "Memcached"));
+	assert(!strcmp(peak_li_cat(memcached), "Database"));
+
+	/* port hint and length constraint */
+	test_packet(packet, IPPROTO_UDP, 4711, 11211, "stats\r\n", 7);
+	assert(peak_li_get(packet) == memcached);
+	test_packet(packet, IPPROTO_UDP, 4711, 11212, "stats\r\n", 7);
+	assert(peak_li_get(packet) != memcached);
+	test_packet(packet, IPPROTO_UDP, 4711, 11211, "stat", 4);
+	assert(peak_li_get(packet) != memcached);
+
+	/* pattern at an offset, protocol sets */
+	test_packet(packet, IPPROTO_TCP, 3306, 4711, mysql, sizeof(mysql));
+	assert(peak_li_get(packet) == peak_li_number("mysql"));
+	test_packet(packet, IPPROTO_UDP, 3306, 4711, mysql, sizeof(mysql));
+	assert(peak_li_get(packet) != peak_li_number("mysql"));
+
+	/* masked compare */
+	test_packet(packet, IPPROTO_TCP, 6379, 4711, "+PONG\r\n", 7);
+	assert(peak_li_get(packet) == redis);
+	assert(peak_li_test(packet, redis));
+	test_packet(packet, IPPROTO_TCP, 6379, 4711, "+pong\r\n", 7);
+	assert(peak_li_get(packet) == redis);
+	test_packet(packet, IPPROTO_TCP, 6379, 4711, "-pong\r\n", 7);
+	assert(peak_li_get(packet) != redis);
+	assert(!peak_li_test(packet, redis));
+
+	/* built-in applications still work */
+	test_packet(packet, IPPROTO_TCP, 4711, 80, "GET / HTTP/1.1\r\n", 16);
+	assert(peak_li_get(packet) == LI_HTTP);
+
+	peak_li_unload();
+
+	test_packet(packet, IPPROTO_TCP, 6379, 4711, "+PONG\r\n", 7);
+	assert(peak_li_get(packet) == LI_UNDEFINED);
+	assert(!peak_li_number("redis"));
+}
+
+static void
+test_burst(const char *file)
+{
+	struct test_trace trace;
+	uint64_t done;
+	size_t i;
+
+	test_trace_init(&trace, file);
+	test_trace_burst(&trace);
+
+	/* burst output must be identical to the scalar one */
+	for (i = 0; i < trace.count; ++i) {
+		assert(trace.result[i] == peak_li_get(trace.refs[i]));
+	}
+
+	/* masked packets are not touched */
+	memset(trace.result, 0xff, LI_BURST_MAX * sizeof(*trace.result));
+	done = peak_li_get_burst(trace.refs, trace.result,
+	    MIN(trace.count, LI_BURST_MAX), 0x5ull);
+	for (i = 0; i < MIN(trace.count, LI_BURST_MAX); ++i) {
+		if (i == 0 || i == 2) {
+			assert(trace.result[i] == peak_li_get(trace.refs[i]));
+			assert(!!(done & (1ull << i)) ==
+			    (trace.result[i] != LI_UNKNOWN));
+		} else {
+			assert(trace.result[i] == ~0U);
+		}
+	}
+	assert(!(done & ~0x5ull));
+
+	test_trace_exit(&trace);
+}
+
+static void
+bench_burst(const char *file, const unsigned int rounds)
+{
+	struct timespec start, stop;
+	struct test_trace trace;
+	double scalar, burst;
+	unsigned int r;
+	size_t i;
+
+	test_trace_init(&trace, file);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (r = 0; r < rounds; ++r) {
+		for (i = 0; i < trace.count; ++i) {
+			trace.result[i] = peak_li_get(trace.refs[i]);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	scalar = (stop.tv_sec - start.tv_sec) +
+	    (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (r = 0; r < rounds; ++r) {
+		test_trace_burst(&trace);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	burst = (stop.tv_sec - start.tv_sec) +
+	    (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+	pout("%s: %zu packets, scalar %.2f Mpps, burst %.2f Mpps\n",
+	    file, trace.count, trace.count * rounds / scalar / 1e6,
+	    trace.count * rounds / burst / 1e6);
+
+	test_trace_exit(&trace);
+}
+
+static void
+bench(int argc, char **argv)
+{
+	int i;
+
+	for (i = 0; i < argc; ++i) {
+		bench_burst(argv[i], 20000);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "b")) != -1) {
+		switch (c) {
+		case 'b':
+			bench(argc - optind, argv + optind);
+			return (0);
+		default:
+			return (1);
+		}
+	}
+
+	pout("peak li test suite... ");
+
+	test_mapping();
+	test_load();
+	test_burst("../../sample/test.pcap");
+	test_burst("../../sample/tcp.pcap");
+	test_burst("../../sample/udp6.pcap");
+
+	pout("ok\n");
+
+	return (0);
+}
@@ -24,7 +24,12 @@
 #else /* !__OpenBSD__ && !__NetBSD__ */
 #include <net/ethernet.h>
 #endif /* __OpenBSD__ || __NetBSD__ */
+#include <sys/stat.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <zlib.h>
 
 output_init();
 
@@ -52,36 +57,1155 @@ static const unsigned int erf_len[] = {
 
 static const char *erf_file = "../../sample/test.erf";
 
+static const unsigned int pcap_swap_len[] = {
+	98, 98,
+};
+
+static const char *pcap_swap_file = "../../sample/test_be.pcap";
+
 static void
 test_load(const char *file, const unsigned int *len, const size_t count)
 {
-	struct peak_load *trace = peak_load_init(file);
+	unsigned int flags[] = { LOAD_DEFAULT, LOAD_READ };
+	struct peak_load *trace, *other;
 	struct ether_header *eth;
+	size_t i, j;
+
+	for (j = 0; j < lengthof(flags); ++j) {
+		trace = peak_load_open(file, flags[j]);
+		assert(trace);
+
+		for (i = 0; i < count; ++i) {
+			assert(peak_load_packet(trace) == len[i]);
+			eth = (struct ether_header *)trace->buf;
+			assert(be16dec(&eth->ether_type) == ETHERTYPE_IP);
+		}
+
+		assert(!peak_load_packet(trace));
+		assert(!peak_load_packet(trace));
+
+		peak_load_exit(trace);
+	}
+
+	/* mapped and read packets must be the same */
+	trace = peak_load_open(file, LOAD_DEFAULT);
+	other = peak_load_open(file, LOAD_READ);
+	assert(trace && other);
+
+	while (peak_load_packet(trace)) {
+		assert(peak_load_packet(other) == trace->len);
+		assert(trace->ts.tv_sec == other->ts.tv_sec);
+		assert(trace->ts.tv_usec == other->ts.tv_usec);
+		assert(trace->ll == other->ll);
+		assert(trace->buf != other->buf);
+		assert(!memcmp(trace->buf, other->buf,
+		    MIN(trace->len, 64)));
+	}
+
+	assert(!peak_load_packet(other));
+
+	peak_load_exit(other);
+	peak_load_exit(trace);
+}
+
+static void
+test_blowup(const char *file, char *template, const size_t packets)
+{
+	struct peak_load *trace;
+	size_t count;
+	int fd;
+
+	fd = mkstemp(template);
+	assert(fd >= 0);
+	close(fd);
+
+	fd = peak_store_init(template);
+	assert(fd >= 0);
+
+	for (count = 0; count < packets; ) {
+		trace = peak_load_init(file);
+		assert(trace);
+		while (count < packets && peak_load_packet(trace)) {
+			assert(peak_store_packet(fd, trace->buf, trace->len,
+			    trace->ts.tv_sec, trace->ts.tv_usec));
+			++count;
+		}
+		peak_load_exit(trace);
+	}
+
+	peak_store_exit(fd);
+}
+
+struct test_pipe {
+	const char *file;
+	const char *fifo;
+	size_t chunk;
+	pthread_t thread;
+};
+
+static void *
+test_pipe_writer(void *arg)
+{
+	struct test_pipe *self = arg;
+	char buf[64 * 1024];
+	ssize_t len;
+	int in, out;
+
+	in = open(self->file, O_RDONLY);
+	out = open(self->fifo, O_WRONLY);
+	assert(in >= 0 && out >= 0);
+
+	/* small writes make records straddle reads */
+	while ((len = read(in, buf, self->chunk)) > 0) {
+		assert(write(out, buf, len) == len);
+	}
+
+	close(out);
+	close(in);
+
+	return (NULL);
+}
+
+static struct peak_load *
+test_pipe_open(struct test_pipe *self, const char *file, const size_t chunk,
+    const unsigned int flags)
+{
+	static char fifo[] = "/tmp/load.fifo";
+
+	unlink(fifo);
+	assert(!mkfifo(fifo, 0600));
+
+	self->chunk = chunk;
+	self->file = file;
+	self->fifo = fifo;
+
+	assert(!pthread_create(&self->thread, NULL, test_pipe_writer, self));
+
+	return (peak_load_open(fifo, flags));
+}
+
+static void
+test_pipe_close(struct test_pipe *self, struct peak_load *trace)
+{
+	peak_load_exit(trace);
+	pthread_join(self->thread, NULL);
+	unlink(self->fifo);
+}
+
+static void
+test_pipe(const char *file, const size_t chunk)
+{
+	struct peak_load *trace, *other;
+	struct test_pipe pipe;
+	size_t count = 0;
+
+	trace = peak_load_open(file, LOAD_DEFAULT);
+	other = test_pipe_open(&pipe, file, chunk, LOAD_DEFAULT);
+	assert(trace && other);
+
+	/* a pipe must look exactly like the file */
+	while (peak_load_packet(trace)) {
+		assert(peak_load_packet(other) == trace->len);
+		assert(trace->ts.tv_sec == other->ts.tv_sec);
+		assert(trace->ts.tv_usec == other->ts.tv_usec);
+		assert(trace->ll == other->ll);
+		assert(!memcmp(trace->buf, other->buf,
+		    MIN(trace->len, 64)));
+		++count;
+	}
+
+	assert(count && !peak_load_packet(other));
+
+	test_pipe_close(&pipe, other);
+	peak_load_exit(trace);
+}
+
+static void
+test_burst_compare(const char *file, struct peak_load *other)
+{
+	struct peak_load_pkt pkts[16];
+	struct peak_load *trace;
+	unsigned int count, i;
+	size_t total = 0;
+
+	trace = peak_load_open(file, LOAD_DEFAULT);
+	assert(trace);
+
+	while ((count = peak_load_burst(other, pkts, lengthof(pkts)))) {
+		assert(count <= lengthof(pkts));
+		/* all of the burst must still be intact */
+		for (i = 0; i < count; ++i) {
+			assert(peak_load_packet(trace));
+			assert(pkts[i].ts.tv_sec == trace->ts.tv_sec);
+			assert(pkts[i].ts.tv_usec == trace->ts.tv_usec);
+			assert(pkts[i].ll == trace->ll);
+			assert(!memcmp(pkts[i].buf, trace->buf,
+			    MIN(pkts[i].len, 64)));
+		}
+		total += count;
+	}
+
+	assert(total && !peak_load_packet(trace));
+
+	peak_load_exit(trace);
+}
+
+static void
+test_burst(const char *file)
+{
+	struct peak_load *trace;
+	struct test_pipe pipe;
+
+	trace = peak_load_open(file, LOAD_DEFAULT);
+	assert(trace);
+	test_burst_compare(file, trace);
+	peak_load_exit(trace);
+
+	trace = peak_load_open(file, LOAD_READ);
+	assert(trace);
+	test_burst_compare(file, trace);
+	peak_load_exit(trace);
+
+	trace = test_pipe_open(&pipe, file, 1000, LOAD_DEFAULT);
+	assert(trace);
+	test_burst_compare(file, trace);
+	test_pipe_close(&pipe, trace);
+}
+
+static void
+test_compare(const char *file, struct peak_load *other)
+{
+	struct peak_load *trace;
+	size_t count = 0;
+
+	trace = peak_load_open(file, LOAD_DEFAULT);
+	assert(trace);
+
+	while (peak_load_packet(trace)) {
+		assert(peak_load_packet(other) == trace->len);
+		assert(trace->ts.tv_sec == other->ts.tv_sec);
+		assert(trace->ts.tv_usec == other->ts.tv_usec);
+		assert(trace->ll == other->ll);
+		assert(!memcmp(trace->buf, other->buf,
+		    MIN(trace->len, 64)));
+		++count;
+	}
+
+	assert(count && !peak_load_packet(other));
+	assert(!peak_load_packet(other));
+
+	peak_load_exit(trace);
+}
+
+static void
+test_thread(const char *file)
+{
+	unsigned int flags[] = { LOAD_DEFAULT, LOAD_READ };
+	struct peak_audit stats;
+	struct peak_load *trace;
+	struct test_pipe pipe;
 	size_t i;
 
+	for (i = 0; i < lengthof(flags); ++i) {
+		trace = peak_load_open(file, flags[i] | LOAD_THREAD);
+		assert(trace);
+		test_compare(file, trace);
+		peak_load_exit(trace);
+
+		trace = peak_load_open(file, flags[i] | LOAD_THREAD);
+		assert(trace);
+		test_burst_compare(file, trace);
+		peak_load_exit(trace);
+
+		/* leave while the producer is still busy */
+		trace = peak_load_open(file, flags[i] | LOAD_THREAD);
+		assert(trace);
+		assert(peak_load_packet(trace));
+		peak_load_exit(trace);
+	}
+
+	assert(peak_audit_get(AUDIT_LOAD_RING) < 4096);
+	memset(&stats, 0, sizeof(stats));
+	peak_audit_sync(&stats);
+	assert(stats.field[AUDIT_LOAD_RING] ==
+	    peak_audit_get(AUDIT_LOAD_RING));
+
+	trace = test_pipe_open(&pipe, file, 1000, LOAD_THREAD);
+	assert(trace);
+	test_compare(file, trace);
+	test_pipe_close(&pipe, trace);
+}
+
+static void
+test_gzip(const char *file)
+{
+	char template[] = "/tmp/load.XXXXXX";
+	struct peak_load *trace;
+	struct test_pipe pipe;
+	char buf[4096];
+	ssize_t len;
+	gzFile out;
+	int fd;
+
+	fd = mkstemp(template);
+	assert(fd >= 0);
+
+	out = gzdopen(fd, "wb");
+	assert(out);
+
+	fd = open(file, O_RDONLY);
+	assert(fd >= 0);
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		assert(gzwrite(out, buf, len) == len);
+	}
+
+	close(fd);
+	gzclose(out);
+
+	/* autodetected behind the compression */
+	trace = peak_load_init(template);
+	assert(trace);
+	test_compare(file, trace);
+	peak_load_exit(trace);
+
+	trace = peak_load_open(template, LOAD_READ);
+	assert(trace);
+	test_compare(file, trace);
+	peak_load_exit(trace);
+
+	trace = test_pipe_open(&pipe, template, 1000, LOAD_DEFAULT);
 	assert(trace);
+	test_compare(file, trace);
+	test_pipe_close(&pipe, trace);
 
-	eth = (struct ether_header *)trace->buf;
+	unlink(template);
+}
+
+static void
+test_merge_order(struct peak_load *trace, const size_t expected,
+    uint64_t *sum)
+{
+	struct peak_timeval last = { 0, 0 };
+	size_t count = 0, i;
+
+	*sum = 0;
+
+	while (peak_load_packet(trace)) {
+		/* time never goes backwards */
+		assert(trace->ts.tv_sec > last.tv_sec ||
+		    (trace->ts.tv_sec == last.tv_sec &&
+		    trace->ts.tv_usec >= last.tv_usec));
+		last = trace->ts;
+
+		for (i = 0; i < MIN(trace->len, 64); ++i) {
+			*sum += trace->buf[i] * (i + 1);
+		}
+		*sum += trace->ll;
+		++count;
+	}
+
+	assert(count == expected);
+}
 
-	for (i = 0; i < count; ++i) {
+static void
+test_merge(const char *file)
+{
+	char templates[3][sizeof("/tmp/load.XXXXXX")];
+	char *files[lengthof(templates)];
+	struct peak_load_pkt pkts[16];
+	struct peak_load *trace;
+	uint64_t sum, total = 0;
+	unsigned int flags[] = { LOAD_DEFAULT, LOAD_READ, LOAD_THREAD };
+	size_t count = 0, i, j;
+	unsigned int k, n;
+	int fds[lengthof(templates)];
+
+	for (i = 0; i < lengthof(templates); ++i) {
+		memcpy(templates[i], "/tmp/load.XXXXXX",
+		    sizeof(templates[i]));
+		fds[i] = mkstemp(templates[i]);
+		assert(fds[i] >= 0);
+		close(fds[i]);
+		fds[i] = peak_store_init(templates[i]);
+		assert(fds[i] >= 0);
+		files[i] = templates[i];
+	}
+
+	trace = peak_load_init(file);
+	assert(trace);
+
+	/* deal the packets out, but shuffle their times */
+	while (peak_load_packet(trace)) {
+		i = count++ % lengthof(fds);
+		assert(peak_store_packet(fds[i], trace->buf, trace->len,
+		    trace->ts.tv_sec + i, trace->ts.tv_usec));
+		for (j = 0; j < MIN(trace->len, 64); ++j) {
+			total += trace->buf[j] * (j + 1);
+		}
+		total += trace->ll;
+	}
+
+	peak_load_exit(trace);
+
+	for (i = 0; i < lengthof(fds); ++i) {
+		peak_store_exit(fds[i]);
+	}
+
+	for (i = 0; i < lengthof(flags); ++i) {
+		trace = peak_load_merge(files, lengthof(files), flags[i]);
+		assert(trace);
+		test_merge_order(trace, count, &sum);
+		assert(sum == total);
+		assert(!peak_load_packet(trace));
+		peak_load_exit(trace);
+
+		/* bursts see the same sequence */
+		trace = peak_load_merge(files, lengthof(files), flags[i]);
+		assert(trace);
+		for (j = 0; (n = peak_load_burst(trace, pkts,
+		    lengthof(pkts))); j += n) {
+			assert(n <= lengthof(pkts));
+			for (k = 0; k < n; ++k) {
+				/* lengths come along, read ahead or not */
+				assert(pkts[k].len);
+				assert(pkts[k].len == pkts[k].wire);
+			}
+			for (k = 1; k < n; ++k) {
+				assert(pkts[k - 1].ts.tv_sec <
+				    pkts[k].ts.tv_sec ||
+				    (pkts[k - 1].ts.tv_sec ==
+				    pkts[k].ts.tv_sec &&
+				    pkts[k - 1].ts.tv_usec <=
+				    pkts[k].ts.tv_usec));
+			}
+		}
+		assert(j == count);
+		peak_load_exit(trace);
+	}
+
+	/* any mix of formats and link types */
+	files[0] = (char *)pcap_file;
+	files[1] = (char *)pcapng_file;
+	files[2] = (char *)erf_file;
+
+	trace = peak_load_merge(files, 3, LOAD_DEFAULT);
+	assert(trace);
+	test_merge_order(trace, lengthof(pcap_len) + lengthof(pcapng_len) +
+	    lengthof(erf_len), &sum);
+	peak_load_exit(trace);
+
+	for (i = 0; i < lengthof(flags); ++i) {
+		trace = peak_load_merge(files, 3, flags[i]);
+		assert(trace);
+		for (sum = 0, j = 0; (n = peak_load_burst(trace, pkts,
+		    lengthof(pkts))); j += n) {
+			for (k = 0; k < n; ++k) {
+				assert(pkts[k].len);
+				assert(pkts[k].len <= pkts[k].wire);
+				sum += pkts[k].len;
+			}
+		}
+		assert(j == lengthof(pcap_len) + lengthof(pcapng_len) +
+		    lengthof(erf_len));
+		if (!i) {
+			total = sum;
+		}
+		assert(sum == total);
+		peak_load_exit(trace);
+	}
+
+	files[1] = "/nonexistent";
+	assert(!peak_load_merge(files, 3, LOAD_DEFAULT));
+	assert(!peak_load_merge(files, 0, LOAD_DEFAULT));
+
+	for (i = 0; i < lengthof(templates); ++i) {
+		unlink(templates[i]);
+	}
+}
+
+static void
+test_index_check(struct peak_load *trace, const struct peak_timeval *ts,
+    const unsigned int *len, const size_t count, const size_t step)
+{
+	size_t i, j;
+
+	for (i = 0; i < count; i += step) {
+		assert(peak_load_seek_packet(trace, i));
 		assert(peak_load_packet(trace) == len[i]);
-		assert(be16dec(&eth->ether_type) == ETHERTYPE_IP);
+		assert(trace->ts.tv_sec == ts[i].tv_sec);
+		assert(trace->ts.tv_usec == ts[i].tv_usec);
+
+		/* first packet that is not earlier */
+		for (j = 0; j < count; ++j) {
+			if (ts[j].tv_sec > ts[i].tv_sec ||
+			    (ts[j].tv_sec == ts[i].tv_sec &&
+			    ts[j].tv_usec >= ts[i].tv_usec)) {
+				break;
+			}
+		}
+
+		assert(peak_load_seek_time(trace, &ts[i]));
+		assert(peak_load_packet(trace) == len[j]);
+		assert(trace->ts.tv_sec == ts[j].tv_sec);
+		assert(trace->ts.tv_usec == ts[j].tv_usec);
 	}
 
+	/* backwards works just the same */
+	assert(peak_load_seek_packet(trace, 0));
+	assert(peak_load_packet(trace) == len[0]);
+
+	assert(!peak_load_seek_packet(trace, count));
 	assert(!peak_load_packet(trace));
-	assert(!peak_load_packet(trace));
+	assert(!peak_load_seek_time(trace, &ts[count]));
+}
+
+static void
+test_index(const char *file, const unsigned int interval, const size_t step)
+{
+	char index[] = "/tmp/load.idx.XXXXXX";
+	struct peak_timeval *ts = NULL;
+	unsigned int *len = NULL;
+	struct peak_load *trace;
+	size_t count = 0;
+	int fd;
+
+	trace = peak_load_init(file);
+	assert(trace);
+
+	while (peak_load_packet(trace)) {
+		ts = realloc(ts, (count + 2) * sizeof(*ts));
+		len = realloc(len, (count + 1) * sizeof(*len));
+		assert(ts && len);
+		ts[count] = trace->ts;
+		len[count] = trace->len;
+		++count;
+	}
 
 	peak_load_exit(trace);
+
+	assert(count);
+
+	/* later than everything */
+	ts[count] = ts[0];
+	ts[count].tv_sec = INT32_MAX;
+
+	fd = mkstemp(index);
+	assert(fd >= 0);
+	close(fd);
+
+	/* no index, no seeking */
+	trace = peak_load_init(file);
+	assert(trace);
+	assert(!peak_load_seek_packet(trace, 0));
+	assert(!peak_load_seek_time(trace, &ts[0]));
+
+	/* in the middle of reading */
+	assert(peak_load_packet(trace) == len[0]);
+	assert(peak_load_index(trace, NULL, interval));
+	if (count > 1) {
+		assert(peak_load_packet(trace) == len[1]);
+	}
+	test_index_check(trace, ts, len, count, step);
+	peak_load_exit(trace);
+
+	/* written out and picked up again */
+	trace = peak_load_init(file);
+	assert(trace);
+	assert(peak_load_index(trace, index, interval));
+	peak_load_exit(trace);
+
+	trace = peak_load_init(file);
+	assert(trace);
+	assert(peak_load_index(trace, index, interval));
+	test_index_check(trace, ts, len, count, step);
+	peak_load_exit(trace);
+
+	/* stale index of another trace is rebuilt */
+	trace = peak_load_init(file == pcap_file ? erf_file : pcap_file);
+	assert(trace);
+	assert(peak_load_index(trace, index, 0));
+	peak_load_exit(trace);
+
+	trace = peak_load_init(file);
+	assert(trace);
+	assert(peak_load_index(trace, index, interval));
+	test_index_check(trace, ts, len, count, step);
+	peak_load_exit(trace);
+
+	/* streams can't seek */
+	trace = peak_load_open(file, LOAD_THREAD);
+	assert(trace);
+	assert(!peak_load_index(trace, NULL, interval));
+	peak_load_exit(trace);
+
+	unlink(index);
+	free(len);
+	free(ts);
+}
+
+struct test_chunk_sum {
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t sum;
+};
+
+static void
+test_chunk_work(struct peak_load *trace, void *arg)
+{
+	struct test_chunk_sum *result = arg;
+
+	while (peak_load_packet(trace)) {
+		++result->packets;
+		result->bytes += trace->len;
+		/* order matters inside of a chunk */
+		result->sum = result->sum * 31 + trace->ts.tv_usec;
+	}
+}
+
+static void
+test_chunk_merge(void *arg, const void *chunk)
+{
+	const struct test_chunk_sum *from = chunk;
+	struct test_chunk_sum *into = arg;
+
+	into->packets += from->packets;
+	into->bytes += from->bytes;
+	into->sum = into->sum * 17 + from->sum;
+}
+
+static void
+test_chunk(const char *file, const unsigned int max)
+{
+	static const unsigned int flags[] = { LOAD_DEFAULT, LOAD_READ };
+	struct test_chunk_sum want, have, part;
+	struct peak_load *trace, *chunk;
+	unsigned int count, i, j;
+
+	for (j = 0; j < lengthof(flags); ++j) {
+		for (count = 1; count <= max; ++count) {
+			trace = peak_load_open(file, flags[j]);
+			assert(trace);
+
+			memset(&want, 0, sizeof(want));
+
+			/* chunks hand out every packet exactly once */
+			for (i = 0; i < count; ++i) {
+				chunk = peak_load_chunk(file, i, count,
+				    flags[j]);
+				assert(chunk);
+
+				memset(&part, 0, sizeof(part));
+
+				while (peak_load_packet(chunk)) {
+					assert(peak_load_packet(trace) ==
+					    chunk->len);
+					assert(trace->ts.tv_sec ==
+					    chunk->ts.tv_sec);
+					assert(trace->ts.tv_usec ==
+					    chunk->ts.tv_usec);
+					assert(trace->ll == chunk->ll);
+					assert(!memcmp(trace->buf, chunk->buf,
+					    MIN(trace->len, 64)));
+					++part.packets;
+					part.bytes += chunk->len;
+					part.sum = part.sum * 31 +
+					    chunk->ts.tv_usec;
+				}
+
+				assert(!peak_load_packet(chunk));
+				peak_load_exit(chunk);
+
+				test_chunk_merge(&want, &part);
+			}
+
+			assert(!peak_load_packet(trace));
+			peak_load_exit(trace);
+
+			memset(&have, 0, sizeof(have));
+
+			assert(peak_load_chunks(file, count, flags[j],
+			    test_chunk_work, test_chunk_merge, &have,
+			    sizeof(have)));
+			assert(!memcmp(&have, &want, sizeof(have)));
+		}
+	}
+
+	assert(!peak_load_chunk(file, 1, 1, LOAD_DEFAULT));
+	assert(!peak_load_chunk(file, 0, 1, LOAD_THREAD));
+	assert(!peak_load_chunks(file, 0, LOAD_DEFAULT, test_chunk_work,
+	    test_chunk_merge, &have, sizeof(have)));
+}
+
+static void
+test_truncate(const char *file, const unsigned int caplen)
+{
+	static const unsigned int flags[] = { LOAD_DEFAULT, LOAD_READ };
+	struct peak_load_pkt full, pkt;
+	struct peak_load *trace, *other;
+	unsigned int i;
+
+	for (i = 0; i < lengthof(flags); ++i) {
+		trace = peak_load_open(file, flags[i]);
+		assert(trace);
+		other = peak_load_open(file, flags[i]);
+		assert(other);
+		assert(peak_load_truncate(other, caplen));
+
+		while (peak_load_burst(trace, &full, 1)) {
+			assert(peak_load_burst(other, &pkt, 1));
+			assert(pkt.len == MIN(full.len, caplen));
+			assert(pkt.wire == full.wire);
+			assert(pkt.ts.tv_sec == full.ts.tv_sec);
+			assert(pkt.ts.tv_usec == full.ts.tv_usec);
+			assert(!memcmp(pkt.buf, full.buf, pkt.len));
+		}
+
+		assert(!peak_load_burst(other, &pkt, 1));
+
+		peak_load_exit(other);
+		peak_load_exit(trace);
+	}
+
+	trace = peak_load_init(file);
+	assert(trace);
+	other = peak_load_init(file);
+	assert(other);
+	assert(peak_load_truncate(other, caplen));
+
+	while (peak_load_packet(trace)) {
+		assert(peak_load_packet(other));
+		assert(other->len <= trace->len);
+		assert(other->len == trace->len || other->len <= caplen);
+	}
+
+	assert(!peak_load_packet(other));
+
+	peak_load_exit(other);
+	peak_load_exit(trace);
+
+	/* the other thread owns the loader */
+	trace = peak_load_open(file, LOAD_THREAD);
+	assert(trace);
+	assert(!peak_load_truncate(trace, caplen));
+	peak_load_exit(trace);
+}
+
+static void
+test_short_check(const char *file, const unsigned int caplen,
+    const unsigned int wire)
+{
+	static const unsigned int flags[] = { LOAD_DEFAULT, LOAD_READ };
+	struct peak_load_pkt pkt;
+	struct peak_load *trace;
+	unsigned int i, j;
+
+	for (j = 0; j < lengthof(flags); ++j) {
+		trace = peak_load_open(file, flags[j]);
+		assert(trace);
+
+		/* only what was captured, the mapping ends right here */
+		assert(peak_load_packet(trace) == caplen);
+		for (i = 0; i < trace->len; ++i) {
+			assert(trace->buf[i] == 0xAA);
+		}
+		assert(!peak_load_packet(trace));
+
+		peak_load_exit(trace);
+
+		trace = peak_load_open(file, flags[j]);
+		assert(trace);
+		assert(peak_load_burst(trace, &pkt, 1) == 1);
+		assert(pkt.len == caplen);
+		assert(pkt.wire == wire);
+		assert(!peak_load_burst(trace, &pkt, 1));
+		peak_load_exit(trace);
+	}
+}
+
+static void
+test_short(void)
+{
+	uint32_t shb[7] = { 0x0A0D0D0A, 28, 0x1A2B3C4D, 1, 0xFFFFFFFF,
+	    0xFFFFFFFF, 28 };
+	uint32_t idb[5] = { 1, 20, 1, 96, 20 };
+	uint32_t epb[7] = { 6, 32 + 96, 0, 0, 1000, 96, 65535 };
+	uint32_t trailer = 32 + 96;
+	uint8_t erf[16] = { 0 };
+	char file[] = "/tmp/load.XXXXXX";
+	uint8_t buf[96];
+	int fd;
+
+	memset(buf, 0xAA, sizeof(buf));
+
+	/* snaplen-truncated packet at the end of a PCAPNG */
+	fd = mkstemp(file);
+	assert(fd >= 0);
+	assert(write(fd, shb, sizeof(shb)) == sizeof(shb));
+	assert(write(fd, idb, sizeof(idb)) == sizeof(idb));
+	assert(write(fd, epb, sizeof(epb)) == sizeof(epb));
+	assert(write(fd, buf, sizeof(buf)) == sizeof(buf));
+	assert(write(fd, &trailer, sizeof(trailer)) == sizeof(trailer));
+	close(fd);
+
+	test_short_check(file, sizeof(buf), 65535);
+	unlink(file);
+
+	/* the same for ERF, where the wire length is larger */
+	erf[8] = 2;			/* Ethernet */
+	be16enc(&erf[10], sizeof(erf) + sizeof(buf));
+	be16enc(&erf[14], 1514);
+
+	memcpy(file, "/tmp/load.XXXXXX", sizeof(file));
+	fd = mkstemp(file);
+	assert(fd >= 0);
+	assert(write(fd, erf, sizeof(erf)) == sizeof(erf));
+	assert(write(fd, buf, sizeof(buf)) == sizeof(buf));
+	close(fd);
+
+	/* Ethernet records start with two bytes of padding */
+	test_short_check(file, sizeof(buf) - 2, 1514);
+	unlink(file);
+}
+
+static void
+test_jumbo_record(int fd, const uint32_t len, const uint8_t fill)
+{
+	uint32_t hdr[4] = { 1388534400, len % 1000, len, len };
+	static uint8_t buf[64 * 1024];
+	uint32_t left = len;
+
+	assert(write(fd, hdr, sizeof(hdr)) == sizeof(hdr));
+
+	memset(buf, fill, sizeof(buf));
+
+	while (left) {
+		const uint32_t chunk = MIN(left, sizeof(buf));
+		assert(write(fd, buf, chunk) == (ssize_t)chunk);
+		left -= chunk;
+	}
+}
+
+static void
+test_jumbo(void)
+{
+	static const uint32_t len[] = {
+		60, 64 * 1024, 60, 300 * 1000, 5 * 1024 * 1024, 60,
+	};
+	static const unsigned int flags[] = {
+		LOAD_DEFAULT, LOAD_READ, LOAD_READ | LOAD_THREAD,
+	};
+	uint32_t hdr[6] = { 0xA1B2C3D4, 0x00040002, 0, 0, 128, 1 };
+	char file[] = "/tmp/load.XXXXXX";
+	struct test_pipe pipe;
+	struct peak_load *trace;
+	unsigned int i, j, want;
+	uint64_t truncated;
+	int fd;
+
+	fd = mkstemp(file);
+	assert(fd >= 0);
+
+	/* the snaplen claims much less than what follows */
+	assert(write(fd, hdr, sizeof(hdr)) == sizeof(hdr));
+	for (i = 0; i < lengthof(len); ++i) {
+		test_jumbo_record(fd, len[i], i);
+	}
+
+	close(fd);
+
+	for (j = 0; j <= lengthof(flags); ++j) {
+		if (j < lengthof(flags)) {
+			trace = peak_load_open(file, flags[j]);
+		} else {
+			trace = test_pipe_open(&pipe, file, 64 * 1024,
+			    LOAD_DEFAULT);
+		}
+		assert(trace);
+
+		truncated = peak_audit_get(AUDIT_LOAD_TRUNCATED);
+
+		for (i = 0; i < lengthof(len); ++i) {
+			/* nothing is dropped, too big is cut */
+			want = len[i];
+			if (j && want > 4 * 1024 * 1024) {
+				want = 4 * 1024 * 1024;
+			}
+			assert(peak_load_packet(trace) == want);
+			assert(trace->ts.tv_usec == (long)(len[i] % 1000));
+			assert(trace->buf[0] == i);
+			assert(trace->buf[want - 1] == i);
+		}
+
+		assert(!peak_load_packet(trace));
+
+		if (j == 1 || j == 3) {
+			/* counted where the loading happened */
+			assert(peak_audit_get(AUDIT_LOAD_TRUNCATED) ==
+			    truncated + 1);
+		}
+
+		if (j < lengthof(flags)) {
+			peak_load_exit(trace);
+		} else {
+			test_pipe_close(&pipe, trace);
+		}
+	}
+
+	unlink(file);
+}
+
+static void
+test_pipe_big(const char *file)
+{
+	char template[] = "/tmp/load.XXXXXX";
+
+	/* more than fits into the buffer at once */
+	test_blowup(file, template, 20 * 1000);
+	test_pipe(template, 64 * 1024);
+	test_burst(template);
+	test_thread(template);
+	test_index(template, 0, 997);
+	test_chunk(template, 16);
+	unlink(template);
+}
+
+struct test_netmon_header {
+	uint32_t magic;
+	uint8_t version_minor;
+	uint8_t version_major;
+	uint16_t network;
+	uint16_t start[8];
+	uint32_t frame_table_offset;
+	uint32_t frame_table_length;
+	uint32_t unused[8];
+};
+
+struct test_netmon_record {
+	uint64_t time_stamp_data;
+	uint32_t original_length;
+	uint32_t include_length;
+};
+
+static void
+test_netmon(void)
+{
+	static const unsigned int len[] = { 60, 1514, 98 };
+	unsigned int flags[] = { LOAD_DEFAULT, LOAD_READ };
+	char file[] = "/tmp/load.XXXXXX";
+	struct peak_load_pkt pkts[lengthof(len) + 1];
+	struct test_netmon_header hdr;
+	struct test_netmon_record rec;
+	struct peak_load *trace;
+	uint32_t table[lengthof(len)];
+	uint8_t buf[1514];
+	size_t i, j;
+	int fd;
+
+	fd = mkstemp(file);
+	assert(fd >= 0);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = 0x55424D47;
+	hdr.version_major = 2;
+	hdr.start[0] = 2014;	/* year */
+	hdr.start[1] = 1;	/* month */
+	hdr.start[3] = 1;	/* day */
+	hdr.frame_table_length = sizeof(table);
+	assert(write(fd, &hdr, sizeof(hdr)) == sizeof(hdr));
+
+	/* frames go in backwards to make the table count */
+	for (i = lengthof(len); i--; ) {
+		table[i] = lseek(fd, 0, SEEK_CUR);
+		rec.time_stamp_data = i * 1000 * 1000 + i;
+		rec.original_length = len[i];
+		rec.include_length = len[i];
+		memset(buf, i, len[i]);
+		assert(write(fd, &rec, sizeof(rec)) == sizeof(rec));
+		assert(write(fd, buf, len[i]) == len[i]);
+	}
+
+	hdr.frame_table_offset = lseek(fd, 0, SEEK_CUR);
+	assert(write(fd, table, sizeof(table)) == sizeof(table));
+	lseek(fd, 0, SEEK_SET);
+	assert(write(fd, &hdr, sizeof(hdr)) == sizeof(hdr));
+	close(fd);
+
+	for (j = 0; j < lengthof(flags); ++j) {
+		trace = peak_load_open(file, flags[j]);
+		assert(trace);
+
+		for (i = 0; i < lengthof(len); ++i) {
+			assert(peak_load_packet(trace) == len[i]);
+			assert(trace->buf[0] == i);
+			assert(trace->buf[len[i] - 1] == i);
+			assert(trace->ts.tv_usec == (long)i);
+			assert(trace->ts.tv_sec == 1388534400 + (long long)i);
+		}
+
+		assert(!peak_load_packet(trace));
+
+		peak_load_exit(trace);
+
+		trace = peak_load_open(file, flags[j]);
+		assert(trace);
+
+		/* frames are scattered, the burst follows the table */
+		assert(peak_load_burst(trace, pkts, lengthof(pkts)) ==
+		    lengthof(len));
+
+		for (i = 0; i < lengthof(len); ++i) {
+			assert(pkts[i].len == len[i]);
+			assert(pkts[i].wire == len[i]);
+			assert(pkts[i].buf[0] == i);
+			assert(pkts[i].ts.tv_usec == (long)i);
+		}
+
+		assert(!peak_load_burst(trace, pkts, lengthof(pkts)));
+
+		peak_load_exit(trace);
+	}
+
+	/* marks point into the frame table */
+	test_index(file, 2, 1);
+	test_chunk(file, 4);
+
+	unlink(file);
+}
+
+#define BENCH_PACKETS	(1000 * 1000)
+
+static void
+bench_load(const char *file)
+{
+	unsigned int flags[] = { LOAD_DEFAULT, LOAD_READ,
+	    LOAD_DEFAULT | LOAD_THREAD, LOAD_READ | LOAD_THREAD };
+	const char *names[] = { "mmap", "read", "mmap thread",
+	    "read thread", "pipe" };
+	char bench_file[] = "/tmp/load.XXXXXX";
+	struct peak_load_pkt pkts[32];
+	struct timespec start, stop;
+	struct peak_load *trace;
+	struct test_pipe pipe;
+	volatile uint8_t byte;
+	size_t count, i, j;
+	unsigned int k, n;
+	double elapsed;
+
+	/* blow the sample up to something sizeable */
+	test_blowup(file, bench_file, BENCH_PACKETS);
+
+	for (i = 0; i < 3; ++i) {
+		for (j = 0; j < lengthof(names); ++j) {
+			trace = j < lengthof(flags) ?
+			    peak_load_open(bench_file, flags[j]) :
+			    test_pipe_open(&pipe, bench_file, 64 * 1024,
+			    LOAD_DEFAULT);
+			assert(trace);
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (count = 0; peak_load_packet(trace); ++count) {
+				/* touch the packet like a consumer would */
+				byte = trace->buf[12];
+			}
+			clock_gettime(CLOCK_MONOTONIC, &stop);
+
+			assert(count == BENCH_PACKETS);
+
+			elapsed = (stop.tv_sec - start.tv_sec) +
+			    (stop.tv_nsec - start.tv_nsec) / 1e9;
+			pout("%s: %.2f Mpps\n", names[j],
+			    count / elapsed / 1e6);
+
+			if (j < lengthof(flags)) {
+				peak_load_exit(trace);
+			} else {
+				test_pipe_close(&pipe, trace);
+			}
+		}
+
+		for (j = 0; j < lengthof(flags); ++j) {
+			trace = peak_load_open(bench_file, flags[j]);
+			assert(trace);
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			count = 0;
+			while ((n = peak_load_burst(trace, pkts,
+			    lengthof(pkts)))) {
+				for (k = 0; k < n; ++k) {
+					byte = pkts[k].buf[12];
+				}
+				count += n;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &stop);
+
+			assert(count == BENCH_PACKETS);
+
+			elapsed = (stop.tv_sec - start.tv_sec) +
+			    (stop.tv_nsec - start.tv_nsec) / 1e9;
+			pout("%s burst: %.2f Mpps\n", names[j],
+			    count / elapsed / 1e6);
+
+			peak_load_exit(trace);
+		}
+	}
+
+	unlink(bench_file);
+	(void)byte;
 }
 
 int
-main(void)
+main(int argc, char **argv)
 {
+	int c;
+
+	while ((c = getopt(argc, argv, "b")) != -1) {
+		switch (c) {
+		case 'b':
+			bench_load(pcap_file);
+			return (0);
+		default:
+			return (1);
+		}
+	}
+
 	pout("peak load test suite... ");
 
 	test_load(pcap_file, pcap_len, lengthof(pcap_len));
 	test_load(pcapng_file, pcapng_len, lengthof(pcapng_len));
 	test_load(erf_file, erf_len, lengthof(erf_len));
+	test_load(pcap_swap_file, pcap_swap_len, lengthof(pcap_swap_len));
+	test_netmon();
+	test_pipe(pcap_file, 1000);
+	test_pipe(pcap_swap_file, 7);
+	test_pipe(pcapng_file, 13);
+	test_pipe(erf_file, 100);
+	test_burst(pcap_file);
+	test_burst(pcap_swap_file);
+	test_burst(pcapng_file);
+	test_burst(erf_file);
+	test_thread(pcap_file);
+	test_thread(pcapng_file);
+	test_thread(erf_file);
+	test_gzip(pcap_file);
+	test_gzip(pcapng_file);
+	test_gzip(erf_file);
+	test_merge(pcap_file);
+	test_index(pcap_file, 7, 1);
+	test_index(pcap_swap_file, 1, 1);
+	test_index(pcapng_file, 3, 1);
+	test_index(erf_file, 4, 1);
+	test_chunk(pcap_file, 9);
+	test_chunk(pcap_swap_file, 3);
+	test_chunk(pcapng_file, 3);
+	test_chunk(erf_file, 9);
+	test_truncate(pcap_file, 64);
+	test_truncate(pcap_swap_file, 14);
+	test_truncate(pcapng_file, 20);
+	test_truncate(erf_file, 100);
+	test_jumbo();
+	test_short();
+	test_pipe_big(pcap_file);
 
 	pout("ok\n");
 
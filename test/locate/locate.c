@@ -36,6 +36,11 @@ test_mapping(void)
 		number = peak_locate_number(name);
 		assert(i == number);
 	}
+
+	/* the lookup is case sensitive and rejects garbage */
+	assert(peak_locate_number("de") == LOCATE_UNKNOWN);
+	assert(peak_locate_number("DEU") == LOCATE_UNKNOWN);
+	assert(peak_locate_number("D") == LOCATE_UNKNOWN);
 }
 
 static void
@@ -36,6 +36,9 @@ test_mapping(void)
 		number = peak_magic_number(name);
 		assert(i == number);
 	}
+
+	assert(peak_magic_number("APPLICATION/PDF") == MAGIC_PDF_DOCUMENT);
+	assert(peak_magic_number("application/x-peak") == MAGIC_PACKED_DATA);
 }
 
 static void
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <peak.h>
+#include <assert.h>
+
+output_init();
+
+static void
+test_packet(struct peak_packet *packet, const uint8_t type,
+    const void *buf, const size_t len)
+{
+	memset(packet, 0, sizeof(*packet));
+
+	packet->net_type = type;
+	packet->app.raw = (void *)buf;
+	packet->app_len = len;
+}
+
+static void
+test_field(const struct peak_meta *meta, const struct peak_packet *packet,
+    const unsigned int field, const void *want, const size_t want_len)
+{
+	const uint8_t *ptr;
+	size_t len;
+
+	ptr = peak_meta_ptr(meta, packet, field, &len);
+	if (!want) {
+		assert(!ptr);
+		return;
+	}
+
+	assert(ptr);
+	assert(len == want_len);
+	assert(!memcmp(ptr, want, len));
+
+	/* zero-copy: slices point into the payload */
+	assert(ptr >= packet->app.raw &&
+	    ptr + len <= packet->app.raw + packet->app_len);
+}
+
+static void
+test_http(void)
+{
+	static const char request[] = "GET /index.html HTTP/1.1\r\n"
+	    "User-Agent: test\r\nHOST:  www.example.com \r\n\r\n";
+	static const char simple[] = "GET /\r\n";
+	static const char response[] = "HTTP/1.1 200 OK\r\n\r\n";
+	struct peak_packet stackptr(packet);
+	struct peak_meta meta;
+
+	test_packet(packet, IPPROTO_TCP, request, strlen(request));
+	assert(peak_meta_get(&meta, packet, LI_HTTP) == 3);
+	assert(meta.app == LI_HTTP);
+	test_field(&meta, packet, META_HTTP_METHOD, "GET", 3);
+	test_field(&meta, packet, META_HTTP_URI, "/index.html", 11);
+	test_field(&meta, packet, META_HTTP_HOST, "www.example.com", 15);
+	test_field(&meta, packet, META_TLS_SNI, NULL, 0);
+
+	/* truncated header line must not produce a host */
+	test_packet(packet, IPPROTO_TCP, request, strlen(request) - 8);
+	assert(peak_meta_get(&meta, packet, LI_HTTP) == 2);
+	test_field(&meta, packet, META_HTTP_HOST, NULL, 0);
+
+	test_packet(packet, IPPROTO_TCP, simple, strlen(simple));
+	assert(peak_meta_get(&meta, packet, LI_HTTP) == 2);
+	test_field(&meta, packet, META_HTTP_URI, "/", 1);
+
+	test_packet(packet, IPPROTO_TCP, response, strlen(response));
+	assert(!peak_meta_get(&meta, packet, LI_HTTP));
+	assert(!meta.app);
+}
+
+static void
+test_tls(void)
+{
+	static const uint8_t hello[] = {
+		0x16, 0x03, 0x01, 0x00, 0x4c,
+		0x01, 0x00, 0x00, 0x48, 0x03, 0x03,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0x00,			/* session id */
+		0x00, 0x02, 0x13, 0x01,	/* cipher suites */
+		0x01, 0x00,		/* compression methods */
+		0x00, 0x1d,		/* extensions */
+		0x00, 0x00, 0x00, 0x10, 0x00, 0x0e, 0x00, 0x00, 0x0b,
+		'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm',
+		0x00, 0x10, 0x00, 0x05, 0x00, 0x03, 0x02, 'h', '2',
+	};
+	struct peak_packet stackptr(packet);
+	struct peak_meta_hello walk;
+	struct peak_meta meta;
+	size_t i;
+
+	test_packet(packet, IPPROTO_TCP, hello, sizeof(hello));
+	assert(peak_meta_get(&meta, packet, LI_TLS) == 2);
+	test_field(&meta, packet, META_TLS_SNI, "example.com", 11);
+	test_field(&meta, packet, META_TLS_ALPN, "h2", 2);
+
+	/* no truncation may yield a partial field */
+	for (i = 0; i < sizeof(hello) - 9; ++i) {
+		test_packet(packet, IPPROTO_TCP, hello, i);
+		assert(peak_meta_get(&meta, packet, LI_TLS) <= 1);
+		test_field(&meta, packet, META_TLS_ALPN, NULL, 0);
+	}
+
+	test_packet(packet, IPPROTO_TCP, hello, sizeof(hello));
+	assert(!peak_meta_hello(&walk, packet, 0));
+	assert(walk.version == 0x0303 && walk.ciphers.len == 2);
+	assert(walk.sni.len == 11 && walk.alpn.len == 2);
+
+	/* a partial hello only goes through when asked to */
+	test_packet(packet, IPPROTO_TCP, hello, sizeof(hello) - 4);
+	assert(peak_meta_hello(&walk, packet, 0));
+	assert(!walk.sni.len);
+	assert(peak_meta_hello(&walk, packet, 1));
+	assert(walk.sni.len == 11 && !walk.alpn.len);
+}
+
+static void
+test_dns(void)
+{
+	static const uint8_t query[] = {
+		0x00, 0x1d,		/* TCP length */
+		0x12, 0x34, 0x01, 0x00, 0x00, 0x01,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x03, 'w', 'w', 'w', 0x07, 'e', 'x', 'a', 'm', 'p', 'l',
+		'e', 0x00, 0x00, 0x1c, 0x00, 0x01,
+	};
+	static const char qname[] = "\003www\007example";
+	struct peak_packet stackptr(packet);
+	struct peak_meta meta;
+	const uint8_t *ptr;
+	size_t len;
+
+	test_packet(packet, IPPROTO_UDP, query + 2, sizeof(query) - 2);
+	assert(peak_meta_get(&meta, packet, LI_DNS) == 2);
+	test_field(&meta, packet, META_DNS_QNAME, qname, strlen(qname));
+	ptr = peak_meta_ptr(&meta, packet, META_DNS_QTYPE, &len);
+	assert(ptr && len == 2 && be16dec(ptr) == 28);
+
+	test_packet(packet, IPPROTO_TCP, query, sizeof(query));
+	assert(peak_meta_get(&meta, packet, LI_DNS) == 2);
+	test_field(&meta, packet, META_DNS_QNAME, qname, strlen(qname));
+
+	test_packet(packet, IPPROTO_UDP, query + 2, 20);
+	assert(!peak_meta_get(&meta, packet, LI_DNS));
+
+	/* not an app with meta data */
+	assert(!peak_meta_get(&meta, packet, LI_SSH));
+	assert(!meta.app);
+}
+
+static void
+test_name(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < META_MAX; ++i) {
+		assert(peak_meta_name(i));
+	}
+
+	assert(!peak_meta_name(META_MAX));
+}
+
+int
+main(void)
+{
+	pout("peak meta test suite... ");
+
+	test_http();
+	test_tls();
+	test_dns();
+	test_name();
+
+	pout("ok\n");
+
+	return (0);
+}
@@ -0,0 +1,604 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <peak.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <assert.h>
+#include <unistd.h>
+
+#define FLOW_MAX	4096
+#define SEG_SIZE	1460
+
+output_init();
+
+struct test_conn {
+	struct peak_tracks *tracker;
+	struct peak_reasms *reasm;
+	struct peak_packet packet;
+	struct tcphdr th;
+	uint16_t port;
+};
+
+static void
+test_conn_init(struct test_conn *conn, struct peak_tracks *tracker,
+    struct peak_reasms *reasm, const uint16_t port)
+{
+	memset(conn, 0, sizeof(*conn));
+
+	conn->tracker = tracker;
+	conn->reasm = reasm;
+	conn->port = port;
+}
+
+static void
+test_conn_send(struct test_conn *conn, const unsigned int side,
+    const uint32_t seq, const uint8_t flags, const void *buf,
+    const size_t len)
+{
+	struct peak_packet *packet = &conn->packet;
+	struct peak_track *flow, key;
+
+	memset(packet, 0, sizeof(*packet));
+	memset(&conn->th, 0, sizeof(conn->th));
+
+	netaddr4(&packet->net_saddr, side ? 2 : 1);
+	netaddr4(&packet->net_daddr, side ? 1 : 2);
+	packet->flow_sport = side ? 80 : conn->port;
+	packet->flow_dport = side ? conn->port : 80;
+	packet->net_type = IPPROTO_TCP;
+
+	conn->th.th_seq = htonl(seq);
+	conn->th.th_flags = flags;
+	packet->flow.th = &conn->th;
+	packet->app.raw = (void *)buf;
+	packet->app_len = len;
+
+	TRACK_KEY(&key, packet);
+	flow = peak_track_acquire(conn->tracker, &key);
+	assert(flow);
+
+	peak_reasm_add(conn->reasm, flow, packet);
+}
+
+static size_t
+test_drain(struct peak_reasms *reasm, char *out, unsigned int *gaps)
+{
+	struct peak_reasm_data data;
+	size_t len = 0;
+
+	while (peak_reasm_next(reasm, &data)) {
+		memcpy(out + len, data.buf, data.len);
+		len += data.len;
+		if (gaps) {
+			*gaps += data.gap;
+		}
+	}
+
+	out[len] = '\0';
+
+	return (len);
+}
+
+static void
+test_inorder(void)
+{
+	static const char hello[] = "hello ";
+	static const char world[] = "world";
+	struct peak_tracks *tracker;
+	struct peak_reasm_data data;
+	struct peak_reasms *reasm;
+	struct test_conn conn;
+	char out[64];
+
+	tracker = peak_track_init(16, 0);
+	reasm = peak_reasm_init(16, 16, 64, REASM_POLICY_FIRST);
+	assert(tracker && reasm);
+
+	test_conn_init(&conn, tracker, reasm, 51000);
+
+	test_conn_send(&conn, 0, 999, TH_SYN, NULL, 0);
+	assert(!peak_reasm_next(reasm, &data));
+	test_conn_send(&conn, 1, 4999, TH_SYN|TH_ACK, NULL, 0);
+	assert(!peak_reasm_next(reasm, &data));
+
+	/* in order data is not copied */
+	test_conn_send(&conn, 0, 1000, TH_ACK, hello, strlen(hello));
+	assert(peak_reasm_next(reasm, &data));
+	assert(data.buf == hello && data.len == strlen(hello));
+	assert(data.seq == 1000 && data.dir == 0 && !data.gap);
+	assert(!peak_reasm_next(reasm, &data));
+
+	test_conn_send(&conn, 0, 1006, TH_ACK, world, strlen(world));
+	assert(test_drain(reasm, out, NULL) == strlen(world));
+	assert(!strcmp(out, world));
+
+	/* the other direction */
+	test_conn_send(&conn, 1, 5000, TH_ACK, world, strlen(world));
+	assert(peak_reasm_next(reasm, &data));
+	assert(data.buf == world && data.dir == 1);
+	assert(!peak_reasm_next(reasm, &data));
+
+	peak_reasm_exit(reasm);
+	peak_track_exit(tracker);
+}
+
+static void
+test_reorder(void)
+{
+	struct peak_tracks *tracker;
+	struct peak_reasm_data data;
+	struct peak_reasms *reasm;
+	struct test_conn conn;
+	struct peak_audit stats;
+	char out[64];
+
+	memset(&stats, 0, sizeof(stats));
+	peak_audit_sync(&stats);
+	memset(&stats, 0, sizeof(stats));
+
+	tracker = peak_track_init(16, 0);
+	reasm = peak_reasm_init(16, 16, 64, REASM_POLICY_FIRST);
+	assert(tracker && reasm);
+
+	test_conn_init(&conn, tracker, reasm, 51000);
+
+	/* no SYN: synced on the first segment */
+	test_conn_send(&conn, 0, 1000, TH_ACK, "abc", 3);
+	assert(test_drain(reasm, out, NULL) == 3);
+
+	/* hole until the missing segment shows up */
+	test_conn_send(&conn, 0, 1009, TH_ACK, "jkl", 3);
+	test_conn_send(&conn, 0, 1006, TH_ACK, "ghi", 3);
+	assert(!peak_reasm_next(reasm, &data));
+	test_conn_send(&conn, 0, 1003, TH_ACK, "def", 3);
+	assert(test_drain(reasm, out, NULL) == 9);
+	assert(!strcmp(out, "defghijkl"));
+
+	/* retransmissions are ignored */
+	test_conn_send(&conn, 0, 1000, TH_ACK, "abc", 3);
+	assert(!peak_reasm_next(reasm, &data));
+
+	/* partial retransmission only yields new data */
+	test_conn_send(&conn, 0, 1010, TH_ACK, "klmno", 5);
+	assert(test_drain(reasm, out, NULL) == 3);
+	assert(!strcmp(out, "mno"));
+
+	peak_audit_sync(&stats);
+	assert(stats.field[AUDIT_REASM_INORDER] == 3);
+	assert(stats.field[AUDIT_REASM_BUFFERED] == 2);
+	assert(stats.field[AUDIT_REASM_RETRANS] == 1);
+	assert(stats.field[AUDIT_REASM_OVERLAP] == 1);
+
+	peak_reasm_exit(reasm);
+	peak_track_exit(tracker);
+}
+
+static void
+test_policy(const unsigned int policy, const char *expect)
+{
+	struct peak_tracks *tracker;
+	struct peak_reasms *reasm;
+	struct test_conn conn;
+	char out[64];
+
+	tracker = peak_track_init(16, 0);
+	reasm = peak_reasm_init(16, 16, 64, policy);
+	assert(tracker && reasm);
+
+	test_conn_init(&conn, tracker, reasm, 51000);
+
+	test_conn_send(&conn, 0, 999, TH_SYN, NULL, 0);
+	test_conn_send(&conn, 0, 1010, TH_ACK, "XXXX", 4);
+	test_conn_send(&conn, 0, 1016, TH_ACK, "YY", 2);
+	test_conn_send(&conn, 0, 1000, TH_ACK, "0123456789ABCDEFGHIJ", 20);
+	assert(test_drain(reasm, out, NULL) == 20);
+	assert(!strcmp(out, expect));
+
+	peak_reasm_exit(reasm);
+	peak_track_exit(tracker);
+}
+
+static void
+test_evict(void)
+{
+	struct test_conn conn1, conn2;
+	struct peak_tracks *tracker;
+	struct peak_reasm_data data;
+	struct peak_reasms *reasm;
+	struct peak_audit stats;
+	unsigned int gaps = 0;
+	char buf[512];
+	char out[512];
+
+	memset(&stats, 0, sizeof(stats));
+	peak_audit_sync(&stats);
+	memset(&stats, 0, sizeof(stats));
+	memset(buf, 'a', sizeof(buf));
+
+	tracker = peak_track_init(16, 0);
+	reasm = peak_reasm_init(16, 4, 64, REASM_POLICY_FIRST);
+	assert(tracker && reasm);
+
+	test_conn_init(&conn1, tracker, reasm, 51000);
+	test_conn_init(&conn2, tracker, reasm, 51001);
+
+	test_conn_send(&conn1, 0, 999, TH_SYN, NULL, 0);
+	test_conn_send(&conn2, 0, 1999, TH_SYN, NULL, 0);
+
+	/* two pages held by the first flow */
+	test_conn_send(&conn1, 0, 1100, TH_ACK, buf, 128);
+	assert(!peak_reasm_next(reasm, &data));
+
+	/* three pages needed by the second flow */
+	test_conn_send(&conn2, 0, 2100, TH_ACK, buf, 192);
+	assert(!peak_reasm_next(reasm, &data));
+
+	peak_audit_sync(&stats);
+	assert(stats.field[AUDIT_REASM_EVICTED] == 1);
+
+	/* evicted flow skips the hole and resumes */
+	test_conn_send(&conn1, 0, 1000, TH_ACK, buf, 100);
+	assert(!peak_reasm_next(reasm, &data));
+	test_conn_send(&conn1, 0, 1228, TH_ACK, "b", 1);
+	assert(peak_reasm_next(reasm, &data));
+	assert(data.seq == 1228 && data.gap);
+	assert(!peak_reasm_next(reasm, &data));
+
+	/* the second flow is intact */
+	test_conn_send(&conn2, 0, 2000, TH_ACK, buf, 100);
+	assert(test_drain(reasm, out, &gaps) == 292);
+	assert(!gaps);
+
+	/* more than the pool can ever hold */
+	test_conn_send(&conn2, 0, 2400, TH_ACK, buf, 512);
+	assert(!peak_reasm_next(reasm, &data));
+
+	peak_audit_sync(&stats);
+	assert(stats.field[AUDIT_REASM_DROPPED] == 1);
+
+	peak_reasm_exit(reasm);
+	peak_track_exit(tracker);
+}
+
+static void
+test_flush(void)
+{
+	struct peak_tracks *tracker;
+	struct peak_reasm_data data;
+	struct peak_track *flow, key;
+	struct peak_reasms *reasm;
+	unsigned int gaps = 0;
+	struct test_conn conn;
+	char out[64];
+
+	tracker = peak_track_init(16, 0);
+	reasm = peak_reasm_init(16, 16, 64, REASM_POLICY_FIRST);
+	assert(tracker && reasm);
+
+	test_conn_init(&conn, tracker, reasm, 51000);
+
+	test_conn_send(&conn, 0, 999, TH_SYN, NULL, 0);
+	test_conn_send(&conn, 0, 1005, TH_ACK, "world", 5);
+	test_conn_send(&conn, 1, 5005, TH_ACK, "hello", 5);
+	assert(test_drain(reasm, out, NULL) == 5);
+
+	TRACK_KEY(&key, &conn.packet);
+	flow = peak_track_acquire(tracker, &key);
+	peak_reasm_flush(reasm, flow);
+	assert(test_drain(reasm, out, &gaps) == 5);
+	assert(!strcmp(out, "world") && gaps == 1);
+
+	/* state is gone, flow starts over */
+	test_conn_send(&conn, 0, 1005, TH_ACK, "again", 5);
+	assert(peak_reasm_next(reasm, &data));
+	assert(!data.gap && data.seq == 1005);
+	assert(!peak_reasm_next(reasm, &data));
+
+	peak_reasm_exit(reasm);
+	peak_track_exit(tracker);
+}
+
+static size_t
+test_trace_run(const char *file, struct peak_tracks *tracker,
+    struct peak_reasms *reasm, const unsigned int check, size_t *count)
+{
+	static uint32_t next[FLOW_MAX][2];
+	static uint8_t seen[FLOW_MAX][2];
+	struct peak_packet stackptr(packet);
+	struct peak_reasm_data data;
+	struct peak_track *flow, key;
+	struct peak_load *load;
+	uint64_t base = 0;
+	size_t ret = 0;
+
+	if (check) {
+		memset(seen, 0, sizeof(seen));
+	}
+
+	load = peak_load_init(file);
+	assert(load);
+
+	while (peak_load_packet(load)) {
+		++*count;
+
+		if (peak_packet_parse(packet, load->buf, load->len,
+		    load->ll) || packet->net_type != IPPROTO_TCP) {
+			continue;
+		}
+
+		TRACK_KEY(&key, packet);
+		flow = peak_track_acquire(tracker, &key);
+		if (check && !base) {
+			/* flow ids are global, make them relative */
+			base = flow->id + 1;
+		}
+
+		peak_reasm_add(reasm, flow, packet);
+
+		while (peak_reasm_next(reasm, &data)) {
+			ret += data.len;
+
+			if (check) {
+				const uint64_t id = data.id + 1 - base;
+
+				assert(id < FLOW_MAX);
+				/* no overlaps, holes only when told */
+				assert(!seen[id][data.dir] || data.gap ||
+				    next[id][data.dir] == data.seq);
+				next[id][data.dir] = data.seq + data.len;
+				seen[id][data.dir] = 1;
+			}
+		}
+	}
+
+	peak_load_exit(load);
+
+	return (ret);
+}
+
+static void
+test_trace(const char *file)
+{
+	struct peak_tracks *tracker;
+	struct peak_reasms *reasm;
+	size_t count = 0;
+
+	tracker = peak_track_init(FLOW_MAX, 0);
+	reasm = peak_reasm_init(FLOW_MAX, 4096, 256, REASM_POLICY_FIRST);
+	assert(tracker && reasm);
+
+	assert(test_trace_run(file, tracker, reasm, 1, &count));
+	assert(count);
+
+	peak_reasm_exit(reasm);
+	peak_track_exit(tracker);
+}
+
+static double
+bench_elapsed(const struct timespec *start)
+{
+	struct timespec stop;
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	return ((stop.tv_sec - start->tv_sec) +
+	    (stop.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+static void
+bench_trace(const char *file, const unsigned int rounds)
+{
+	struct peak_packet *packets;
+	struct peak_reasm_data data;
+	struct peak_tracks *tracker;
+	struct peak_track **refs, key;
+	struct peak_reasms *reasm;
+	struct peak_load *load;
+	struct timespec start;
+	double elapsed = 0.0;
+	size_t count = 0, size = 0;
+	size_t bytes = 0;
+	uint8_t *mem;
+	unsigned int r;
+	size_t i;
+
+	/* size the trace first so packets never move once parsed */
+	load = peak_load_init(file);
+	assert(load);
+	while (peak_load_packet(load)) {
+		size += load->len;
+		++count;
+	}
+	peak_load_exit(load);
+
+	packets = calloc(count ? count : 1, sizeof(*packets));
+	refs = calloc(count ? count : 1, sizeof(*refs));
+	mem = malloc(size ? size : 1);
+	assert(packets && refs && mem);
+
+	load = peak_load_init(file);
+	assert(load);
+	for (i = 0, size = 0; i < count && peak_load_packet(load); ++i) {
+		memcpy(mem + size, load->buf, load->len);
+		if (peak_packet_parse(&packets[i], mem + size, load->len,
+		    load->ll)) {
+			memset(&packets[i], 0, sizeof(packets[i]));
+		}
+		size += load->len;
+	}
+	peak_load_exit(load);
+
+	for (r = 0; r < rounds; ++r) {
+		/* fresh state each round, but don't time setup */
+		tracker = peak_track_init(FLOW_MAX, 0);
+		reasm = peak_reasm_init(FLOW_MAX, 4096, 256,
+		    REASM_POLICY_FIRST);
+		assert(tracker && reasm);
+
+		for (i = 0; i < count; ++i) {
+			refs[i] = NULL;
+			if (packets[i].net_type != IPPROTO_TCP) {
+				continue;
+			}
+			TRACK_KEY(&key, &packets[i]);
+			refs[i] = peak_track_acquire(tracker, &key);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < count; ++i) {
+			if (!refs[i]) {
+				continue;
+			}
+			peak_reasm_add(reasm, refs[i], &packets[i]);
+			while (peak_reasm_next(reasm, &data)) {
+				bytes += data.len;
+			}
+		}
+		elapsed += bench_elapsed(&start);
+
+		peak_reasm_exit(reasm);
+		peak_track_exit(tracker);
+	}
+
+	pout("%s: %zu packets, %.2f Mpps, %.1f MB/s\n", file,
+	    count, count * rounds / elapsed / 1e6, bytes / elapsed / 1e6);
+
+	free(packets);
+	free(refs);
+	free(mem);
+}
+
+static void
+bench_synthetic(const unsigned int flows, const unsigned int segments,
+    const unsigned int reorder)
+{
+	struct peak_packet *packets;
+	struct peak_tracks *tracker;
+	struct peak_track **refs, key;
+	struct peak_reasm_data data;
+	struct peak_reasms *reasm;
+	struct timespec start;
+	struct tcphdr *ths;
+	const unsigned int count = flows * segments;
+	size_t bytes = 0;
+	uint8_t *payload;
+	unsigned int i;
+	double elapsed;
+
+	packets = calloc(count, sizeof(*packets));
+	ths = calloc(count, sizeof(*ths));
+	refs = calloc(count, sizeof(*refs));
+	payload = calloc(1, SEG_SIZE);
+	tracker = peak_track_init(flows, 0);
+	reasm = peak_reasm_init(flows, flows * 64, 512, REASM_POLICY_FIRST);
+	assert(packets && ths && refs && payload && tracker && reasm);
+
+	/*
+	 * Flows are interleaved round robin.  When reordering,
+	 * every other pair of segments of a flow is swapped.
+	 */
+	for (i = 0; i < count; ++i) {
+		const unsigned int flow = i % flows;
+		unsigned int seg = i / flows;
+		struct peak_packet *packet = &packets[i];
+
+		if (reorder && (seg / 2) % 2) {
+			seg ^= 1;
+		}
+
+		netaddr4(&packet->net_saddr, 1);
+		netaddr4(&packet->net_daddr, 2);
+		packet->flow_sport = 1024 + flow;
+		packet->flow_dport = 80;
+		packet->net_type = IPPROTO_TCP;
+		packet->flow.th = &ths[i];
+		packet->app.raw = payload;
+		packet->app_len = SEG_SIZE;
+
+		ths[i].th_seq = htonl(seg * SEG_SIZE);
+		ths[i].th_flags = TH_ACK;
+
+		TRACK_KEY(&key, packet);
+		refs[i] = peak_track_acquire(tracker, &key);
+		assert(refs[i]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; ++i) {
+		peak_reasm_add(reasm, refs[i], &packets[i]);
+		while (peak_reasm_next(reasm, &data)) {
+			bytes += data.len;
+		}
+	}
+	elapsed = bench_elapsed(&start);
+
+	pout("synthetic %s: %u flows, %.2f Mpps, %.1f MB/s\n",
+	    reorder ? "reordered" : "in order", flows,
+	    count / elapsed / 1e6, bytes / elapsed / 1e6);
+
+	peak_reasm_exit(reasm);
+	peak_track_exit(tracker);
+	free(payload);
+	free(packets);
+	free(refs);
+	free(ths);
+}
+
+static void
+bench(int argc, char **argv)
+{
+	int i;
+
+	for (i = 0; i < argc; ++i) {
+		bench_trace(argv[i], 2000);
+	}
+
+	bench_synthetic(64, 20000, 0);
+	bench_synthetic(64, 20000, 1);
+}
+
+int
+main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "b")) != -1) {
+		switch (c) {
+		case 'b':
+			bench(argc - optind, argv + optind);
+			return (0);
+		default:
+			return (1);
+		}
+	}
+
+	pout("peak reasm test suite... ");
+
+	test_inorder();
+	test_reorder();
+	test_policy(REASM_POLICY_FIRST, "0123456789XXXXEFYYIJ");
+	test_policy(REASM_POLICY_LAST, "0123456789ABCDEFGHIJ");
+	test_evict();
+	test_flush();
+	test_trace("../../sample/tcp.pcap");
+	test_trace("../../sample/tcp6.pcap");
+	test_trace("../../sample/test.pcap");
+
+	pout("ok\n");
+
+	return (0);
+}
@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <peak.h>
+#include <assert.h>
+#include <unistd.h>
+
+#define TRACE_MAX	100000
+#define FLOW_MAX	4096
+
+output_init();
+
+static const char *pcap_file = "../../sample/test.pcap";
+
+struct test_frame {
+	unsigned int seq;
+	uint8_t pad[60];
+};
+
+static void
+test_flow(struct peak_track *flow, const uint64_t id)
+{
+	memset(flow, 0, sizeof(*flow));
+	flow->id = id;
+}
+
+static void
+test_add(struct peak_records *record, const struct peak_track *flow,
+    const unsigned int seq, const long long sec)
+{
+	struct peak_timeval ts = {
+		.tv_usec = seq % 1000000,
+		.tv_sec = sec,
+	};
+	struct test_frame frame;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.seq = seq;
+
+	peak_record_add(record, flow, &frame, sizeof(frame), &ts);
+}
+
+static unsigned int
+test_check(const char *file, unsigned int *last)
+{
+	struct peak_load *load;
+	struct test_frame frame;
+	unsigned int count = 0;
+
+	load = peak_load_init(file);
+	assert(load);
+
+	while (peak_load_packet(load)) {
+		assert(load->len == sizeof(frame));
+		memcpy(&frame, load->buf, sizeof(frame));
+		/* contiguous history, oldest first */
+		assert(!count || frame.seq == *last + 1);
+		assert(load->ts.tv_usec == frame.seq % 1000000);
+		*last = frame.seq;
+		++count;
+	}
+
+	peak_load_exit(load);
+	unlink(file);
+
+	return (count);
+}
+
+static void
+test_record(void)
+{
+	static uint8_t big[32 * 1024];
+	struct peak_timeval ts = { 0, 0 };
+	char file[] = "/tmp/record.XXXXXX";
+	struct peak_records *record;
+	struct peak_track flow[3];
+	unsigned int i, last;
+
+	assert(!peak_record_init(0, 4096, 0));
+	assert(!peak_record_init(2, 100, 0));
+
+	record = peak_record_init(2, 64 * 1024, 0);
+	assert(record);
+	test_flow(&flow[0], 1);
+	test_flow(&flow[1], 2);
+	test_flow(&flow[2], 3);
+
+	mktemp(file);
+
+	/* nothing recorded yet */
+	assert(!peak_record_dump(record, &flow[0], file));
+
+	for (i = 0; i < 100; ++i) {
+		test_add(record, &flow[i % 2], i / 2, 0);
+	}
+
+	assert(peak_record_dump(record, &flow[0], file) == 50);
+	assert(!peak_record_wait(record));
+	assert(test_check(file, &last) == 50 && last == 49);
+
+	/* too big to be worth it */
+	peak_record_add(record, &flow[1], big, sizeof(big), &ts);
+	assert(peak_record_dump(record, &flow[1], file) == 50);
+	assert(!peak_record_wait(record));
+	assert(test_check(file, &last) == 50 && last == 49);
+
+	/* flow states are recycled */
+	test_add(record, &flow[2], 0, 0);
+	assert(!peak_record_dump(record, &flow[0], file));
+	assert(peak_record_dump(record, &flow[1], file) == 50);
+	assert(!peak_record_wait(record));
+	assert(test_check(file, &last) == 50);
+
+	peak_record_forget(record, &flow[2]);
+	assert(!peak_record_dump(record, &flow[2], file));
+
+	/* failures are only known after the fact */
+	assert(peak_record_dump(record, &flow[1], "/nonexistent/x.pcap"));
+	assert(peak_record_wait(record) == 1);
+	assert(!peak_record_wait(record));
+
+	peak_record_exit(record);
+}
+
+static void
+test_record_bounded(void)
+{
+	char file[] = "/tmp/record.XXXXXX";
+	struct peak_records *record;
+	struct peak_track flow;
+	unsigned int count, i, last;
+
+	record = peak_record_init(16, 16 * 1024, 0);
+	assert(record);
+	test_flow(&flow, 42);
+
+	mktemp(file);
+
+	/* old frames make room for new ones */
+	for (i = 0; i < 10000; ++i) {
+		test_add(record, &flow, i, i);
+	}
+
+	count = peak_record_dump(record, &flow, file);
+	assert(count > 1 && count < 16 * 1024 / sizeof(struct test_frame));
+	assert(!peak_record_wait(record));
+	assert(test_check(file, &last) == count && last == 9999);
+
+	peak_record_exit(record);
+
+	/* only the last seconds are of interest */
+	record = peak_record_init(16, 64 * 1024, 10);
+	assert(record);
+
+	for (i = 0; i < 100; ++i) {
+		test_add(record, &flow, i, i);
+	}
+
+	assert(peak_record_dump(record, &flow, file) == 11);
+
+	/* the writer works in the background */
+	peak_record_exit(record);
+	assert(test_check(file, &last) == 11 && last == 99);
+}
+
+static void
+test_record_trace(const char *file)
+{
+	static unsigned int seen[FLOW_MAX];
+	char template[] = "/tmp/record.XXXXXX";
+	struct peak_records *record;
+	struct peak_tracks *tracker;
+	struct peak_track *flow, key;
+	struct peak_track want;
+	struct peak_packet packet;
+	struct peak_load *load;
+	unsigned int count = 0;
+	unsigned int best = 0;
+	uint64_t base = 0;
+
+	load = peak_load_init(file);
+	tracker = peak_track_init(FLOW_MAX, 0);
+	record = peak_record_init(FLOW_MAX, 1024 * 1024, 0);
+	assert(load && tracker && record);
+
+	memset(seen, 0, sizeof(seen));
+	memset(&want, 0, sizeof(want));
+
+	while (peak_load_packet(load)) {
+		if (peak_packet_parse(&packet, load->buf, load->len,
+		    load->ll)) {
+			continue;
+		}
+
+		TRACK_KEY(&key, &packet);
+		flow = peak_track_acquire(tracker, &key);
+		assert(flow);
+		if (!count++) {
+			/* flow ids are global, make them relative */
+			base = flow->id;
+		}
+		assert(flow->id - base < FLOW_MAX);
+
+		peak_record_add(record, flow, load->buf, load->len,
+		    &load->ts);
+
+		if (++seen[flow->id - base] > seen[best]) {
+			best = flow->id - base;
+		}
+	}
+
+	peak_load_exit(load);
+
+	/* the busiest flow is dumped as is */
+	want.id = base + best;
+	mktemp(template);
+	count = peak_record_dump(record, &want, template);
+	assert(count && count == seen[best]);
+	assert(!peak_record_wait(record));
+
+	load = peak_load_init(template);
+	assert(load);
+
+	while (peak_load_packet(load)) {
+		assert(!peak_packet_parse(&packet, load->buf, load->len,
+		    load->ll));
+		TRACK_KEY(&key, &packet);
+		assert(peak_track_acquire(tracker, &key)->id == want.id);
+		--count;
+	}
+
+	assert(!count);
+
+	peak_load_exit(load);
+	unlink(template);
+
+	peak_record_exit(record);
+	peak_track_exit(tracker);
+}
+
+int
+main(void)
+{
+	pout("peak record test suite... ");
+
+	test_record();
+	test_record_bounded();
+	test_record_trace(pcap_file);
+
+	pout("ok\n");
+
+	return (0);
+}
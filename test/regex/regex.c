@@ -68,12 +68,106 @@ test_regex(void)
 	peak_regex_exit(root);
 }
 
+static void
+test_regex_vector(void)
+{
+	STASH_DECLARE(stash, unsigned int, 10);
+	struct peak_regexes *root;
+	struct iovec iov[3];
+	unsigned int *ret;
+
+	root = peak_regex_init();
+	assert(root);
+
+	assert(1 == peak_regex_add(root, 1, "get /index", 10, 0));
+	assert(2 == peak_regex_add(root, 2, "^host", 5, 0));
+
+	/* match spans all buffers */
+	iov[0].iov_base = "xx ge";
+	iov[0].iov_len = 5;
+	iov[1].iov_base = "t /in";
+	iov[1].iov_len = 5;
+	iov[2].iov_base = "dex xx";
+	iov[2].iov_len = 6;
+
+	peak_regex_findv(root, iov, 3, stash);
+	assert((ret = STASH_POP(stash)));
+	assert(*ret == 1);
+	assert(STASH_EMPTY(stash));
+	STASH_CLEAR(stash);
+
+	/* incomplete at the end */
+	peak_regex_findv(root, iov, 2, stash);
+	assert(STASH_EMPTY(stash));
+
+	/* new matches start in later buffers, too */
+	iov[0].iov_base = "xx ge";
+	iov[1].iov_base = "e get";
+	iov[2].iov_base = " /index";
+	iov[2].iov_len = 7;
+
+	peak_regex_findv(root, iov, 3, stash);
+	assert((ret = STASH_POP(stash)));
+	assert(*ret == 1);
+	assert(STASH_EMPTY(stash));
+	STASH_CLEAR(stash);
+
+	/* only the first buffer is the beginning of the subject */
+	iov[0].iov_base = "xx";
+	iov[0].iov_len = 2;
+	iov[1].iov_base = "host";
+	iov[1].iov_len = 4;
+
+	peak_regex_findv(root, iov, 2, stash);
+	assert(STASH_EMPTY(stash));
+
+	peak_regex_findv(root, &iov[1], 1, stash);
+	assert((ret = STASH_POP(stash)));
+	assert(*ret == 2);
+	assert(STASH_EMPTY(stash));
+	STASH_CLEAR(stash);
+
+	peak_regex_exit(root);
+
+	root = peak_regex_init();
+	assert(root);
+
+	assert(3 == peak_regex_add(root, 3, "a{5}b", 5, 0));
+	assert(4 == peak_regex_add(root, 4, "x.y", 3, 0));
+
+	/* the first partial match fails, a later one doesn't */
+	iov[0].iov_base = "aa";
+	iov[0].iov_len = 2;
+	iov[1].iov_base = "aa";
+	iov[1].iov_len = 2;
+	iov[2].iov_base = "aab";
+	iov[2].iov_len = 3;
+
+	peak_regex_findv(root, iov, 3, stash);
+	assert((ret = STASH_POP(stash)));
+	assert(*ret == 3);
+	assert(STASH_EMPTY(stash));
+	STASH_CLEAR(stash);
+
+	iov[0].iov_base = "xx";
+	iov[1].iov_base = "zy";
+
+	peak_regex_findv(root, iov, 2, stash);
+	assert((ret = STASH_POP(stash)));
+	assert(*ret == 4);
+	assert(STASH_EMPTY(stash));
+	STASH_CLEAR(stash);
+
+	peak_regex_exit(root);
+}
+
 int
 main(void)
 {
 	pout("peak regex test suite... ");
 
 	test_regex();
+	test_regex_vector();
 
 	pout("ok\n");
 
@@ -65,12 +65,67 @@ test_store(const char *file, const unsigned int *len, const size_t count)
 	unlink(template);
 }
 
+static void
+test_buffered(const char *file, const unsigned int *len, const size_t count,
+    const size_t size)
+{
+	char template[] = "/tmp/store.XXXXXX";
+	struct peak_store *store;
+	struct peak_load *trace;
+	struct peak_load *other;
+	size_t i;
+
+	trace = peak_load_init(file);
+	assert(trace);
+
+	store = peak_store_open(mktemp(template), size);
+	assert(store);
+
+	for (i = 0; i < count; ++i) {
+		assert(peak_load_packet(trace) == len[i]);
+		assert(peak_store_write(store, trace->buf, len[i],
+		    trace->ts.tv_sec, trace->ts.tv_usec));
+		if (i == count / 2) {
+			assert(peak_store_flush(store));
+			assert(peak_store_flush(store));
+		}
+	}
+
+	assert(peak_store_close(store));
+	peak_load_exit(trace);
+
+	trace = peak_load_init(file);
+	assert(trace);
+	other = peak_load_init(template);
+	assert(other);
+
+	for (i = 0; i < count; ++i) {
+		assert(peak_load_packet(trace) == len[i]);
+		assert(peak_load_packet(other) == len[i]);
+		assert(trace->ts.tv_sec == other->ts.tv_sec);
+		assert(trace->ts.tv_usec == other->ts.tv_usec);
+		assert(!memcmp(trace->buf, other->buf, len[i]));
+	}
+
+	assert(!peak_load_packet(other));
+
+	peak_load_exit(other);
+	peak_load_exit(trace);
+	unlink(template);
+
+	assert(!peak_store_open("/nonexistent/store", size));
+	assert(!peak_store_close(NULL));
+}
+
 int
 main(void)
 {
 	pout("peak store test suite... ");
 
 	test_store(pcap_file, pcap_len, lengthof(pcap_len));
+	test_buffered(pcap_file, pcap_len, lengthof(pcap_len), 0);
+	test_buffered(pcap_file, pcap_len, lengthof(pcap_len), 1);
+	test_buffered(pcap_file, pcap_len, lengthof(pcap_len), 1600);
 
 	pout("ok\n");
 
@@ -16,6 +16,7 @@
 
 #include <peak.h>
 #include <assert.h>
+#include <unistd.h>
 
 output_init();
 
@@ -350,9 +351,835 @@ test_stream_byte_complex(void)
 	peak_stream_exit(pool);
 }
 
+static void
+test_stream_runs(void)
+{
+	const size_t count = 64 * 64 * 3 + 17;
+	struct peak_stream *pin[100];
+	struct peak_stream *hole[100];
+	struct peak_stream *big = NULL;
+	struct peak_streams *pool;
+	size_t i;
+
+	/* spans three bitmap levels with a ragged end */
+	pool = peak_stream_init(count, DATA_SIZE);
+	assert(pool);
+
+	/* punch holes smaller than the next request */
+	for (i = 0; i < lengthof(pin); ++i) {
+		pin[i] = hole[i] = NULL;
+		assert(peak_stream_claim(pool, &hole[i], 99 * DATA_SIZE));
+		assert(peak_stream_claim(pool, &pin[i], DATA_SIZE));
+	}
+	for (i = 0; i < lengthof(hole); ++i) {
+		peak_stream_release(pool, &hole[i], 99 * DATA_SIZE);
+		assert(!hole[i]);
+	}
+
+	/* first hole is reused for small requests */
+	assert(peak_stream_claim(pool, &big, DATA_SIZE));
+	assert(big->buf < pin[0]->buf);
+	peak_stream_release(pool, &big, DATA_SIZE);
+
+	/* needs a long run past all the holes */
+	assert(peak_stream_claim(pool, &big, 150 * DATA_SIZE));
+	assert(big->buf > pin[lengthof(pin) - 1]->buf);
+
+	/* grows in place until the pool ends */
+	for (i = 150; i < count - 100 * lengthof(pin); ++i) {
+		assert(peak_stream_claim(pool, &big, DATA_SIZE));
+	}
+	assert(!peak_stream_claim(pool, &big, DATA_SIZE));
+	assert(big->len == DATA_SIZE * (count - 100 * lengthof(pin)));
+
+	for (i = 0; i < lengthof(pin); ++i) {
+		peak_stream_release(pool, &pin[i], DATA_SIZE);
+		assert(!pin[i]);
+	}
+
+	peak_stream_release(pool, &big, big->len);
+	assert(!big);
+
+	/* everything is back in one piece */
+	assert(peak_stream_claim(pool, &big, count * DATA_SIZE));
+	peak_stream_release(pool, &big, count * DATA_SIZE);
+	assert(!big);
+
+	peak_stream_exit(pool);
+}
+
+static void
+test_stream_chain(void)
+{
+	struct peak_stream *gap[4] = { NULL };
+	struct peak_stream_chain *chain = NULL;
+	struct peak_stream *block = NULL;
+	struct peak_streams *pool;
+	struct iovec iov[4];
+	void *first;
+	size_t i;
+
+	pool = peak_stream_init(8, DATA_SIZE);
+	assert(pool);
+
+	/* empty claim successfully does nothing */
+	assert(peak_stream_chain_claim(pool, &chain, 0));
+	assert(!chain);
+	assert(!peak_stream_chain_iov(chain, iov, lengthof(iov)));
+
+	/* too big for the pool */
+	assert(!peak_stream_chain_claim(pool, &chain, 9 * DATA_SIZE));
+	assert(!chain);
+
+	assert(peak_stream_chain_claim(pool, &chain, DATA_SIZE));
+	assert(chain && chain->len == DATA_SIZE && chain->count == 1);
+	assert(peak_stream_chain_iov(chain, iov, lengthof(iov)) == 1);
+	first = iov[0].iov_base;
+	memset(first, 'a', DATA_SIZE);
+
+	/* grows in place while it can */
+	assert(peak_stream_chain_claim(pool, &chain, DATA_SIZE / 2));
+	assert(chain->len == DATA_SIZE * 3 / 2 && chain->count == 1);
+	assert(peak_stream_chain_claim(pool, &chain, DATA_SIZE / 2));
+	assert(chain->len == 2 * DATA_SIZE && chain->count == 1);
+	memset((uint8_t *)first + DATA_SIZE, 'b', DATA_SIZE);
+
+	/* block the next page, the chain gets a new segment */
+	assert(peak_stream_claim(pool, &block, DATA_SIZE));
+	assert(peak_stream_chain_claim(pool, &chain, 2 * DATA_SIZE));
+	assert(chain->len == 4 * DATA_SIZE && chain->count == 2);
+	assert(peak_stream_chain_iov(chain, iov, lengthof(iov)) == 2);
+	memset(iov[1].iov_base, 'c', 2 * DATA_SIZE);
+
+	/* data was not moved */
+	assert(iov[0].iov_base == first);
+	assert(iov[0].iov_len == 2 * DATA_SIZE);
+	assert(iov[1].iov_len == 2 * DATA_SIZE);
+
+	/* the view may be cut short */
+	assert(peak_stream_chain_iov(chain, iov, 1) == 1);
+
+	/* not enough pages left, nothing changes */
+	assert(!peak_stream_chain_claim(pool, &chain, 4 * DATA_SIZE));
+	assert(chain->len == 4 * DATA_SIZE && chain->count == 2);
+
+	/* release across the segment boundary */
+	peak_stream_chain_release(pool, &chain, 3 * DATA_SIZE - 4);
+	assert(chain && chain->len == DATA_SIZE + 4 && chain->count == 1);
+	assert(peak_stream_chain_iov(chain, iov, lengthof(iov)) == 1);
+	assert(iov[0].iov_len == DATA_SIZE + 4);
+	for (i = 0; i < iov[0].iov_len; ++i) {
+		assert(((uint8_t *)iov[0].iov_base)[i] == 'c');
+	}
+
+	peak_stream_chain_release(pool, &chain, chain->len);
+	assert(!chain);
+	peak_stream_release(pool, &block, DATA_SIZE);
+	assert(!block);
+
+	/* fill the pool one page at a time with a gap in between */
+	for (i = 0; i < 4; ++i) {
+		assert(peak_stream_chain_claim(pool, &chain, DATA_SIZE));
+		assert(peak_stream_claim(pool, &gap[i], DATA_SIZE));
+	}
+	assert(chain->count == 4 && chain->len == 4 * DATA_SIZE);
+	assert(peak_stream_chain_iov(chain, iov, lengthof(iov)) == 4);
+	for (i = 1; i < 4; ++i) {
+		assert(iov[i].iov_base > iov[i - 1].iov_base);
+	}
+
+	for (i = 0; i < 4; ++i) {
+		peak_stream_chain_release(pool, &chain, DATA_SIZE);
+		assert(i == 3 ? !chain : chain->count == 3 - i);
+		peak_stream_release(pool, &gap[i], DATA_SIZE);
+		assert(!gap[i]);
+	}
+
+	peak_stream_exit(pool);
+}
+
+#define SPILL_PAGES	12
+#define SPILL_CHUNK	1024
+#define SPILL_FILE	"/tmp/peak_stream.XXXXXX"
+
+static void
+test_spill_check(const struct peak_stream_chain *chain, const size_t offset)
+{
+	struct iovec iov[64];
+	unsigned int count, i;
+	size_t j, len = 0;
+
+	count = peak_stream_chain_iov(chain, iov, lengthof(iov));
+	assert(count == chain->count);
+
+	for (i = 0; i < count; ++i) {
+		for (j = 0; j < iov[i].iov_len; ++j, ++len) {
+			assert(((uint8_t *)iov[i].iov_base)[j] ==
+			    (offset + len) % 251);
+		}
+	}
+
+	assert(len == chain->len);
+}
+
+static unsigned int
+test_spill_append(struct peak_streams *pool,
+    struct peak_stream_chain **chain, const size_t offset, const size_t size)
+{
+	struct iovec iov[512];
+	unsigned int count;
+	uint8_t *buf;
+	size_t i;
+
+	if (!peak_stream_chain_claim(pool, chain, size)) {
+		return (0);
+	}
+
+	/* appended data always ends up in the tail */
+	count = peak_stream_chain_iov(*chain, iov, lengthof(iov));
+	assert(count == (*chain)->count && iov[count - 1].iov_len >= size);
+	buf = (uint8_t *)iov[count - 1].iov_base +
+	    iov[count - 1].iov_len - size;
+
+	for (i = 0; i < size; ++i) {
+		buf[i] = ((*chain)->len - size + offset + i) % 251;
+	}
+
+	return (1);
+}
+
+static void
+test_stream_spill(void)
+{
+	struct peak_stream_chain *chain = NULL;
+	struct peak_stream *block = NULL;
+	char file[sizeof(SPILL_FILE)];
+	struct peak_streams *pool;
+	uint64_t spilled, writes;
+	size_t offset = 0;
+	unsigned int i;
+	int fd;
+
+	memcpy(file, SPILL_FILE, sizeof(file));
+	fd = mkstemp(file);
+	assert(fd >= 0);
+	close(fd);
+
+	pool = peak_stream_init(SPILL_PAGES, PAGE_SIZE);
+	assert(pool);
+
+	/* not even one block */
+	assert(!peak_stream_spill(pool, file, PAGE_SIZE - 1, 0));
+
+	assert(peak_stream_spill(pool, file, 32 * PAGE_SIZE,
+	    8 * PAGE_SIZE));
+
+	/* only once */
+	assert(!peak_stream_spill(pool, file, 32 * PAGE_SIZE, 0));
+
+	/* the file is mapped, its name is no longer needed */
+	unlink(file);
+
+	spilled = peak_audit_get(AUDIT_STREAM_SPILLED);
+	writes = peak_audit_get(AUDIT_STREAM_WRITES);
+
+	/* twice the pool goes through, segments are cut at 2 pages */
+	for (i = 0; i < 24 * PAGE_SIZE / SPILL_CHUNK; ++i) {
+		assert(test_spill_append(pool, &chain, 0, SPILL_CHUNK));
+	}
+
+	assert(chain->len == 24 * PAGE_SIZE && chain->count == 12);
+	test_spill_check(chain, 0);
+
+	/* two batches of four segments went out */
+	assert(peak_audit_get(AUDIT_STREAM_SPILLED) == spilled + 16);
+	assert(peak_audit_get(AUDIT_STREAM_WRITES) == writes + 2);
+
+	/* take the rest of the pool */
+	assert(peak_stream_claim(pool, &block, 4 * PAGE_SIZE));
+	assert(!peak_stream_claim(pool, &block, 1));
+
+	/* no memory left, so the chain makes room itself */
+	assert(test_spill_append(pool, &chain, 0, SPILL_CHUNK));
+	assert(peak_audit_get(AUDIT_STREAM_SPILLED) == spilled + 22);
+	assert(peak_audit_get(AUDIT_STREAM_WRITES) == writes + 3);
+	test_spill_check(chain, 0);
+
+	/* release from spilled data into data in memory */
+	peak_stream_chain_release(pool, &chain, 5 * PAGE_SIZE + 100);
+	offset += 5 * PAGE_SIZE + 100;
+	test_spill_check(chain, offset);
+	peak_stream_chain_release(pool, &chain, 17 * PAGE_SIZE);
+	offset += 17 * PAGE_SIZE;
+	test_spill_check(chain, offset);
+
+	/* appending still works */
+	for (i = 0; i < 8; ++i) {
+		assert(test_spill_append(pool, &chain, offset, SPILL_CHUNK));
+	}
+	test_spill_check(chain, offset);
+
+	peak_stream_chain_release(pool, &chain, chain->len);
+	assert(!chain);
+	peak_stream_release(pool, &block, block->len);
+	assert(!block);
+
+	/* everything is back */
+	assert(peak_stream_claim(pool, &block, SPILL_PAGES * PAGE_SIZE));
+	peak_stream_release(pool, &block, block->len);
+	assert(!block);
+
+	peak_stream_exit(pool);
+
+	/* a full spill file means a failed claim, nothing more */
+	memcpy(file, SPILL_FILE, sizeof(file));
+	fd = mkstemp(file);
+	assert(fd >= 0);
+	close(fd);
+
+	pool = peak_stream_init(4, PAGE_SIZE);
+	assert(pool);
+	assert(peak_stream_spill(pool, file, 4 * PAGE_SIZE,
+	    2 * PAGE_SIZE));
+	unlink(file);
+
+	for (i = 0; test_spill_append(pool, &chain, 0, PAGE_SIZE); ++i) {
+		assert(i < 8);
+	}
+
+	assert(chain->len == i * PAGE_SIZE && i >= 6);
+	test_spill_check(chain, 0);
+
+	peak_stream_chain_release(pool, &chain, chain->len);
+	assert(!chain);
+
+	peak_stream_exit(pool);
+}
+
+#define EVICT_PAGES	16
+
+struct test_evict {
+	struct peak_streams *pool;
+	struct peak_stream **seen[EVICT_PAGES];
+	unsigned int count;
+	unsigned int keep;
+};
+
+static void
+test_evict_fun(void *arg, struct peak_stream **ref)
+{
+	struct test_evict *ctx = arg;
+
+	assert(*ref);
+	assert(ctx->count < EVICT_PAGES);
+	ctx->seen[ctx->count++] = ref;
+
+	if (!ctx->keep) {
+		peak_stream_release(ctx->pool, ref, (*ref)->len);
+	}
+}
+
+struct test_holder {
+	struct peak_stream *ref;
+	struct test_holder **slot;
+};
+
+static void
+test_evict_free(void *arg, struct peak_stream **ref)
+{
+	struct test_holder *holder = (struct test_holder *)ref;
+	struct test_evict *ctx = arg;
+
+	ctx->seen[ctx->count++] = ref;
+
+	*holder->slot = NULL;
+	peak_stream_release(ctx->pool, ref, (*ref)->len);
+	free(holder);
+}
+
+static void
+test_stream_evict(void)
+{
+	struct test_holder *holder[EVICT_PAGES];
+	struct peak_stream *ref[EVICT_PAGES + 1];
+	struct peak_streams *pool;
+	struct peak_audit stats;
+	struct test_evict ctx;
+	unsigned int i;
+
+	memset(&stats, 0, sizeof(stats));
+	peak_audit_sync(&stats);
+	memset(&stats, 0, sizeof(stats));
+	memset(&ctx, 0, sizeof(ctx));
+	memset(ref, 0, sizeof(ref));
+
+	pool = peak_stream_init(EVICT_PAGES, DATA_SIZE);
+	assert(pool);
+	ctx.pool = pool;
+
+	assert(!peak_stream_watermark(pool, 9, 8, STREAM_EVICT_LRU,
+	    NULL, NULL));
+	assert(!peak_stream_watermark(pool, 8, EVICT_PAGES + 1,
+	    STREAM_EVICT_LRU, NULL, NULL));
+	assert(!peak_stream_watermark(pool, 8, 12, STREAM_EVICT_MAX,
+	    NULL, NULL));
+	assert(peak_stream_watermark(pool, 8, 12, STREAM_EVICT_LRU,
+	    test_evict_fun, &ctx));
+
+	for (i = 0; i < 12; ++i) {
+		assert(peak_stream_claim(pool, &ref[i], DATA_SIZE));
+	}
+	assert(!ctx.count);
+	assert(peak_audit_get(AUDIT_STREAM_USED) == 12);
+
+	/* touched streams are not old */
+	peak_stream_touch(pool, &ref[0]);
+
+	/* high watermark reached: shed down to the low one */
+	assert(peak_stream_claim(pool, &ref[12], DATA_SIZE));
+	assert(ctx.count == 4);
+	for (i = 0; i < 4; ++i) {
+		assert(ctx.seen[i] == &ref[i + 1]);
+		assert(!ref[i + 1]);
+	}
+	assert(ref[0] && ref[5] && ref[12]);
+	assert(peak_audit_get(AUDIT_STREAM_USED) == 9);
+	/* new stream took page 1, pages 2-4 are a lone hole */
+	assert(peak_audit_get(AUDIT_STREAM_FRAGMENTED) == 3);
+
+	for (i = 0; i <= 12; ++i) {
+		peak_stream_release(pool, &ref[i], ref[i] ? ref[i]->len : 0);
+	}
+
+	/* largest first, owner keeps the data */
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.pool = pool;
+	ctx.keep = 1;
+	assert(peak_stream_watermark(pool, EVICT_PAGES, EVICT_PAGES,
+	    STREAM_EVICT_LARGEST, test_evict_fun, &ctx));
+
+	assert(peak_stream_claim(pool, &ref[0], DATA_SIZE));
+	assert(peak_stream_claim(pool, &ref[1], 4 * DATA_SIZE));
+	assert(peak_stream_claim(pool, &ref[2], 2 * DATA_SIZE));
+	assert(peak_stream_claim(pool, &ref[3], 9 * DATA_SIZE));
+
+	/* pool is full, so the nine page stream has to go */
+	assert(peak_stream_claim(pool, &ref[4], 3 * DATA_SIZE));
+	assert(ctx.count == 1 && ctx.seen[0] == &ref[3] && !ref[3]);
+
+	/* growing streams don't evict themselves */
+	assert(peak_stream_claim(pool, &ref[1], 8 * DATA_SIZE));
+	assert(ref[1] && ref[1]->len == 12 * DATA_SIZE);
+	assert(ctx.count == 3 && !ref[2] && !ref[4] && ref[0]);
+
+	/* shed everything, but it's not enough */
+	assert(!peak_stream_claim(pool, &ref[2], (EVICT_PAGES + 1) *
+	    DATA_SIZE));
+	assert(ctx.count == 5 && !ref[0] && !ref[1] && !ref[2]);
+	assert(!peak_audit_get(AUDIT_STREAM_USED));
+
+	/* the callback frees the holder of the reference */
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.pool = pool;
+	assert(peak_stream_watermark(pool, EVICT_PAGES, EVICT_PAGES,
+	    STREAM_EVICT_LRU, test_evict_free, &ctx));
+
+	for (i = 0; i < EVICT_PAGES; ++i) {
+		holder[i] = calloc(1, sizeof(*holder[i]));
+		assert(holder[i]);
+		holder[i]->slot = &holder[i];
+		assert(peak_stream_claim(pool, &holder[i]->ref, DATA_SIZE));
+	}
+
+	assert(peak_stream_claim(pool, &ref[0], 2 * DATA_SIZE));
+	assert(ctx.count == 2 && !holder[0] && !holder[1]);
+	assert(peak_audit_get(AUDIT_STREAM_USED) == EVICT_PAGES);
+
+	peak_stream_release(pool, &ref[0], ref[0]->len);
+	for (i = 2; i < EVICT_PAGES; ++i) {
+		peak_stream_release(pool, &holder[i]->ref,
+		    holder[i]->ref->len);
+		free(holder[i]);
+	}
+	assert(!peak_audit_get(AUDIT_STREAM_USED));
+
+	assert(peak_stream_claim(pool, &ref[0], 3 * DATA_SIZE));
+	peak_audit_sync(&stats);
+	assert(stats.field[AUDIT_STREAM_USED] == 3);
+	peak_stream_release(pool, &ref[0], ref[0]->len);
+
+	peak_audit_sync(&stats);
+	assert(!stats.field[AUDIT_STREAM_USED]);
+	assert(stats.field[AUDIT_STREAM_PRESSURE] == 3);
+	assert(stats.field[AUDIT_STREAM_EVICTED] == 11);
+	assert(stats.field[AUDIT_STREAM_FAILED] == 1);
+
+	peak_stream_exit(pool);
+}
+
+#define CACHE_PAGES	1024
+#define CACHE_THREADS	4
+#define CACHE_SLOTS	256
+#define CACHE_ROUNDS	(100 * 1000)
+
+struct test_cache {
+	struct peak_streams *pool;
+	struct peak_stream **slot;
+	unsigned int locked;
+	unsigned int rounds;
+	unsigned int seed;
+	spinlock_t *lock;
+	pthread_t thread;
+};
+
+static void
+test_stream_cache(void)
+{
+	struct peak_stream_cache *cache1, *cache2;
+	struct peak_stream *ref[CACHE_PAGES];
+	struct peak_stream *all = NULL;
+	struct peak_streams *pool;
+	unsigned int i;
+
+	assert(!peak_stream_cache_init(NULL));
+
+	pool = peak_stream_init(CACHE_PAGES, DATA_SIZE);
+	cache1 = peak_stream_cache_init(pool);
+	cache2 = peak_stream_cache_init(pool);
+	assert(pool && cache1 && cache2);
+
+	/* drain the whole pool through one cache */
+	for (i = 0; i < CACHE_PAGES; ++i) {
+		ref[i] = NULL;
+		assert(peak_stream_cache_claim(cache1, &ref[i], DATA_SIZE));
+		memset(ref[i]->buf, i, DATA_SIZE);
+	}
+	assert(!peak_stream_claim(pool, &all, DATA_SIZE));
+
+	/* data stays where it is */
+	for (i = 0; i < CACHE_PAGES; ++i) {
+		assert(((uint8_t *)ref[i]->buf)[DATA_SIZE - 1] ==
+		    (uint8_t)i);
+	}
+
+	/* release all of it through the other */
+	for (i = 0; i < CACHE_PAGES; ++i) {
+		peak_stream_cache_release(cache2, &ref[i], DATA_SIZE);
+		assert(!ref[i]);
+	}
+
+	/* cached pages are stranded, but not for their owner */
+	assert(!peak_stream_cache_claim(cache1, &all,
+	    CACHE_PAGES * DATA_SIZE));
+	assert(peak_stream_cache_claim(cache2, &all,
+	    CACHE_PAGES * DATA_SIZE));
+	assert(!peak_stream_cache_claim(cache1, &ref[0], 1));
+	peak_stream_cache_release(cache1, &all, all->len);
+
+	/* small growth stays in place, large growth relocates */
+	assert(peak_stream_cache_claim(cache1, &ref[0], 8));
+	all = ref[0];
+	assert(peak_stream_cache_claim(cache1, &ref[0], 8));
+	assert(all == ref[0] && ref[0]->len == 16);
+	assert(peak_stream_cache_claim(cache1, &ref[1], 8));
+	assert(peak_stream_cache_claim(cache1, &ref[0], DATA_SIZE));
+	assert(ref[0]->len == DATA_SIZE + 16);
+	peak_stream_cache_release(cache2, &ref[0], ref[0]->len);
+	peak_stream_cache_release(cache2, &ref[1], ref[1]->len);
+
+	/* exit gives all pages back */
+	peak_stream_cache_exit(cache1);
+	peak_stream_cache_exit(cache2);
+
+	all = NULL;
+	assert(peak_stream_claim(pool, &all, CACHE_PAGES * DATA_SIZE));
+	peak_stream_release(pool, &all, all->len);
+
+	peak_stream_exit(pool);
+}
+
+static void *
+test_cache_thread(void *arg)
+{
+	struct test_cache *ctx = arg;
+	struct peak_stream_cache *cache = NULL;
+	struct peak_stream *ref;
+	unsigned int i, j;
+
+	if (!ctx->locked) {
+		cache = peak_stream_cache_init(ctx->pool);
+		assert(cache);
+	}
+
+	/*
+	 * Slots are shared by all threads, so streams are
+	 * released by whoever comes along next, which is
+	 * mostly not the thread that claimed them.
+	 */
+	for (i = 0; i < ctx->rounds; ++i) {
+		j = rand_r(&ctx->seed) % CACHE_SLOTS;
+		ref = __sync_lock_test_and_set(&ctx->slot[j], NULL);
+		if (ref) {
+			if (cache) {
+				peak_stream_cache_release(cache, &ref,
+				    ref->len);
+			} else {
+				spin_lock(ctx->lock);
+				peak_stream_release(ctx->pool, &ref,
+				    ref->len);
+				spin_unlock(ctx->lock);
+			}
+			continue;
+		}
+
+		if (cache) {
+			peak_stream_cache_claim(cache, &ref, DATA_SIZE);
+		} else {
+			spin_lock(ctx->lock);
+			peak_stream_claim(ctx->pool, &ref, DATA_SIZE);
+			spin_unlock(ctx->lock);
+		}
+
+		if (ref && !__sync_bool_compare_and_swap(&ctx->slot[j],
+		    NULL, ref)) {
+			/* someone else was faster */
+			if (cache) {
+				peak_stream_cache_release(cache, &ref,
+				    ref->len);
+			} else {
+				spin_lock(ctx->lock);
+				peak_stream_release(ctx->pool, &ref,
+				    ref->len);
+				spin_unlock(ctx->lock);
+			}
+		}
+	}
+
+	peak_stream_cache_exit(cache);
+
+	return (NULL);
+}
+
+static double
+test_cache_run(const unsigned int threads, const unsigned int rounds,
+    const unsigned int locked)
+{
+	struct test_cache ctx[threads];
+	struct peak_stream *slot[CACHE_SLOTS];
+	struct timespec start, stop;
+	struct peak_streams *pool;
+	spinlock_t lock;
+	unsigned int i;
+
+	pool = peak_stream_init(CACHE_PAGES * threads, DATA_SIZE);
+	assert(pool);
+
+	memset(slot, 0, sizeof(slot));
+	spin_init(&lock);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < threads; ++i) {
+		ctx[i].pool = pool;
+		ctx[i].slot = slot;
+		ctx[i].lock = &lock;
+		ctx[i].locked = locked;
+		ctx[i].rounds = rounds;
+		ctx[i].seed = i + 1;
+		assert(!pthread_create(&ctx[i].thread, NULL,
+		    test_cache_thread, &ctx[i]));
+	}
+
+	for (i = 0; i < threads; ++i) {
+		pthread_join(ctx[i].thread, NULL);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	for (i = 0; i < CACHE_SLOTS; ++i) {
+		peak_stream_release(pool, &slot[i], slot[i] ? slot[i]->len : 0);
+	}
+
+	/* nothing was leaked or stranded */
+	assert(peak_stream_claim(pool, &slot[0],
+	    CACHE_PAGES * threads * DATA_SIZE));
+	peak_stream_release(pool, &slot[0], slot[0]->len);
+
+	spin_exit(&lock);
+	peak_stream_exit(pool);
+
+	return ((stop.tv_sec - start.tv_sec) +
+	    (stop.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+static void
+test_stream_threads(void)
+{
+	test_cache_run(CACHE_THREADS, CACHE_ROUNDS / 10, 0);
+}
+
+static void
+bench_threads(void)
+{
+	double cached, locked;
+	unsigned int i;
+
+	for (i = 1; i <= 32; i *= 2) {
+		locked = test_cache_run(i, CACHE_ROUNDS * 10, 1);
+		cached = test_cache_run(i, CACHE_ROUNDS * 10, 0);
+		pout("%2u threads: locked pool %.1f Mops/s, "
+		    "cached pool %.1f Mops/s\n", i,
+		    i * CACHE_ROUNDS * 10 / locked / 1e6,
+		    i * CACHE_ROUNDS * 10 / cached / 1e6);
+	}
+}
+
+#define BENCH_PAGES	(256 * 1024)
+#define BENCH_SLOTS	(32 * 1024)
+#define BENCH_ROUNDS	(2 * 1000 * 1000)
+
+static void
+bench_fragment(const size_t page_size)
+{
+	struct peak_stream **slot;
+	struct timespec start, stop;
+	struct peak_streams *pool;
+	size_t claimed = 0, failed = 0;
+	unsigned int i, j;
+	double elapsed;
+
+	pool = peak_stream_init(BENCH_PAGES, page_size);
+	slot = calloc(BENCH_SLOTS, sizeof(*slot));
+	assert(pool && slot);
+
+	srandom(42);
+
+	/* fill up and free every other stream to fragment the pool */
+	for (i = 0; i < BENCH_SLOTS; ++i) {
+		peak_stream_claim(pool, &slot[i],
+		    (1 + random() % 8) * page_size);
+	}
+	for (i = 0; i < BENCH_SLOTS; i += 2) {
+		peak_stream_release(pool, &slot[i], slot[i] ? slot[i]->len : 0);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < BENCH_ROUNDS; ++i) {
+		j = random() % BENCH_SLOTS;
+
+		if (slot[j] && random() % 4) {
+			peak_stream_release(pool, &slot[j], slot[j]->len);
+		} else if (peak_stream_claim(pool, &slot[j],
+		    (1 + (random() % 32 ? random() % 8 : 200)) *
+		    page_size)) {
+			++claimed;
+		} else {
+			++failed;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	elapsed = (stop.tv_sec - start.tv_sec) +
+	    (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+	pout("%u pages of %zu bytes: %.1f ns/op, %zu claimed, "
+	    "%zu failed\n", BENCH_PAGES, page_size,
+	    elapsed * 1e9 / BENCH_ROUNDS, claimed, failed);
+
+	for (i = 0; i < BENCH_SLOTS; ++i) {
+		peak_stream_release(pool, &slot[i], slot[i] ? slot[i]->len : 0);
+	}
+
+	free(slot);
+	peak_stream_exit(pool);
+}
+
+#define BENCH_SPILL	(1024 * 1024 * 1024)
+#define BENCH_CHUNK	(64 * 1024)
+#define BENCH_LAG	(64 * 1024 * 1024)
+
+static void
+bench_spill(void)
+{
+	struct peak_stream_chain *chain = NULL;
+	uint64_t spilled, writes;
+	struct timespec start, stop;
+	char file[sizeof(SPILL_FILE)];
+	struct peak_streams *pool;
+	struct iovec iov[64];
+	size_t done, offset = 0, i;
+	double elapsed;
+	int fd;
+
+	memcpy(file, SPILL_FILE, sizeof(file));
+	fd = mkstemp(file);
+	assert(fd >= 0);
+	close(fd);
+
+	/* 4 MB of memory for a reader lagging 64 MB behind */
+	pool = peak_stream_init(1024, PAGE_SIZE);
+	assert(pool);
+	assert(peak_stream_spill(pool, file, 2 * BENCH_LAG,
+	    1024 * 1024));
+	unlink(file);
+
+	spilled = peak_audit_get(AUDIT_STREAM_SPILLED);
+	writes = peak_audit_get(AUDIT_STREAM_WRITES);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (done = 0; done < BENCH_SPILL; done += BENCH_CHUNK) {
+		assert(test_spill_append(pool, &chain, offset,
+		    BENCH_CHUNK));
+		if (chain->len < BENCH_LAG) {
+			continue;
+		}
+
+		/* page the oldest segment back in, then drop it */
+		peak_stream_chain_iov(chain, iov, 1);
+		for (i = 0; i < iov[0].iov_len; i += 512) {
+			assert(((uint8_t *)iov[0].iov_base)[i] ==
+			    (offset + i) % 251);
+		}
+		offset += iov[0].iov_len;
+		peak_stream_chain_release(pool, &chain, iov[0].iov_len);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	elapsed = (stop.tv_sec - start.tv_sec) +
+	    (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+	spilled = peak_audit_get(AUDIT_STREAM_SPILLED) - spilled;
+	writes = peak_audit_get(AUDIT_STREAM_WRITES) - writes;
+
+	pout("spill: %.1f MB/s through %u KB of memory, %llu pages "
+	    "in %llu writes\n", BENCH_SPILL / elapsed / 1e6,
+	    1024 * PAGE_SIZE / 1024, (unsigned long long)spilled,
+	    (unsigned long long)writes);
+
+	peak_stream_chain_release(pool, &chain, chain->len);
+	peak_stream_exit(pool);
+}
+
 int
-main(void)
+main(int argc, char **argv)
 {
+	int c;
+
+	while ((c = getopt(argc, argv, "b")) != -1) {
+		switch (c) {
+		case 'b':
+			bench_fragment(DATA_SIZE);
+			bench_fragment(PAGE_SIZE / 8);
+			bench_threads();
+			bench_spill();
+			return (0);
+		default:
+			return (1);
+		}
+	}
+
 	pout("peak stream test suite... ");
 
 	test_stream_basics();
@@ -361,6 +1188,12 @@ main(void)
 	test_stream_data();
 	test_stream_byte_simple();
 	test_stream_byte_complex();
+	test_stream_runs();
+	test_stream_chain();
+	test_stream_spill();
+	test_stream_cache();
+	test_stream_evict();
+	test_stream_threads();
 
 	pout("ok\n");
 
@@ -265,6 +265,62 @@ test_string_multiple(void)
 	peak_string_exit(root);
 }
 
+static void
+test_string_vector(void)
+{
+	STASH_DECLARE(stash, unsigned int, 10);
+	struct peak_strings *root;
+	struct iovec iov[4];
+	unsigned int *ret;
+
+	root = peak_string_init();
+	assert(root);
+
+	assert(1 == peak_string_add(root, 1, "test", 4, 0));
+	assert(2 == peak_string_add(root, 2, "ab", 2,
+	    STRING_LEFT|STRING_RIGHT));
+
+	/* match spans three buffers, including an empty one */
+	iov[0].iov_base = "xxte";
+	iov[0].iov_len = 4;
+	iov[1].iov_base = "";
+	iov[1].iov_len = 0;
+	iov[2].iov_base = "s";
+	iov[2].iov_len = 1;
+	iov[3].iov_base = "txx";
+	iov[3].iov_len = 3;
+
+	peak_string_findv(root, iov, 4, stash);
+	assert((ret = STASH_POP(stash)));
+	assert(*ret == 1);
+	assert(STASH_EMPTY(stash));
+	STASH_CLEAR(stash);
+
+	/* a match cut short by the end of the last buffer */
+	peak_string_findv(root, iov, 3, stash);
+	assert(STASH_EMPTY(stash));
+
+	/* anchors apply to the whole vector */
+	iov[0].iov_base = "a";
+	iov[0].iov_len = 1;
+	iov[1].iov_base = "b";
+	iov[1].iov_len = 1;
+
+	peak_string_findv(root, iov, 2, stash);
+	assert((ret = STASH_POP(stash)));
+	assert(*ret == 2);
+	assert(STASH_EMPTY(stash));
+	STASH_CLEAR(stash);
+
+	peak_string_findv(root, iov, 1, stash);
+	assert(STASH_EMPTY(stash));
+
+	peak_string_findv(root, iov, 0, stash);
+	assert(STASH_EMPTY(stash));
+
+	peak_string_exit(root);
+}
+
 int
 main(void)
 {
@@ -277,6 +333,7 @@ main(void)
 	test_string_left();
 	test_string_right();
 	test_string_exact();
+	test_string_vector();
 
 	pout("ok\n");
 
@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2014 Franco Fichtner <franco@packetwerk.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <peak.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif /* WITH_ZSTD */
+#ifdef WITH_LZ4
+#include <lz4frame.h>
+#endif /* WITH_LZ4 */
+
+#define TEST_SIZE	(3 * 1024 * 1024 + 123)
+#define TEST_CHUNK	(32 * 1024)
+
+output_init();
+
+static void
+test_data(uint8_t *buf, const size_t len)
+{
+	uint32_t seed = 42;
+	size_t i;
+
+	/* compressible, but not trivially */
+	for (i = 0; i < len; ++i) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (seed >> 16) % 16 ? 'a' + i % 23 : seed >> 24;
+	}
+}
+
+static size_t
+test_gzip_member(uint8_t *out, const uint8_t *in, const size_t len,
+    const unsigned int bgzf)
+{
+	const size_t head = bgzf ? 18 : 10;
+	z_stream z;
+	size_t ret;
+
+	memset(&z, 0, sizeof(z));
+	assert(deflateInit2(&z, 6, Z_DEFLATED, -15, 8,
+	    Z_DEFAULT_STRATEGY) == Z_OK);
+
+	z.next_in = (Bytef *)in;
+	z.avail_in = len;
+	z.next_out = out + head;
+	z.avail_out = deflateBound(&z, len);
+	assert(deflate(&z, Z_FINISH) == Z_STREAM_END);
+
+	ret = head + z.total_out + 8;
+	deflateEnd(&z);
+
+	memset(out, 0, head);
+	out[0] = 0x1F;
+	out[1] = 0x8B;
+	out[2] = 0x08;
+	out[9] = 0xFF;
+
+	if (bgzf) {
+		/* the member size goes into the header */
+		out[3] = 0x04;
+		le16enc(out + 10, 6);
+		out[12] = 'B';
+		out[13] = 'C';
+		le16enc(out + 14, 2);
+		le16enc(out + 16, ret - 1);
+	}
+
+	le32enc(out + ret - 8, crc32(crc32(0, NULL, 0), in, len));
+	le32enc(out + ret - 4, len);
+
+	return (ret);
+}
+
+static size_t
+test_gzip(uint8_t *out, const uint8_t *in, const size_t len,
+    const size_t chunk, const unsigned int bgzf)
+{
+	size_t i, ret = 0;
+
+	for (i = 0; i < len; i += chunk) {
+		ret += test_gzip_member(out + ret, in + i,
+		    MIN(chunk, len - i), bgzf);
+	}
+
+	if (bgzf) {
+		/* empty member, like the bgzip EOF marker */
+		ret += test_gzip_member(out + ret, in, 0, bgzf);
+	}
+
+	return (ret);
+}
+
+static ssize_t
+test_read(const unsigned int codec, const uint8_t *blob,
+    const size_t blob_len, const uint8_t *data, const size_t len,
+    const unsigned int threads, const unsigned int stream)
+{
+	char file[] = "/tmp/unpack.XXXXXX";
+	struct peak_unpack *unpack;
+	uint8_t magic[4], *buf;
+	size_t done = 0;
+	ssize_t ret;
+	int fd = -1;
+
+	if (stream) {
+		fd = mkstemp(file);
+		assert(fd >= 0);
+		unlink(file);
+		assert(write(fd, blob, blob_len) == (ssize_t)blob_len);
+		lseek(fd, 0, SEEK_SET);
+		/* the caller had a look already */
+		assert(read(fd, magic, sizeof(magic)) == sizeof(magic));
+		unpack = peak_unpack_init(codec, fd, magic, sizeof(magic),
+		    threads);
+	} else {
+		unpack = peak_unpack_init(codec, -1, blob, blob_len, threads);
+	}
+
+	assert(unpack);
+
+	buf = malloc(len + 4093);
+	assert(buf);
+
+	/* odd sizes to make reads straddle blocks */
+	while ((ret = peak_unpack_read(unpack, buf + done, 4093)) > 0) {
+		done += ret;
+		assert(done <= len);
+	}
+
+	if (!ret) {
+		assert(done == len);
+		assert(!memcmp(buf, data, len));
+		ret = done;
+	} else {
+		/* errors stick */
+		assert(peak_unpack_read(unpack, buf, 4093) < 0);
+	}
+
+	peak_unpack_exit(unpack);
+	free(buf);
+
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	return (ret);
+}
+
+static void
+test_codec(const unsigned int codec, uint8_t *blob, const size_t blob_len,
+    const uint8_t *data, const size_t len)
+{
+	unsigned int threads[] = { 1, 4 };
+	unsigned int i, stream;
+
+	assert(peak_unpack_detect(blob, blob_len) == codec);
+
+	for (stream = 0; stream < 2; ++stream) {
+		for (i = 0; i < lengthof(threads); ++i) {
+			assert(test_read(codec, blob, blob_len, data, len,
+			    threads[i], stream) == (ssize_t)len);
+			/* a truncated stream is an error */
+			assert(test_read(codec, blob, blob_len - 7, data,
+			    len, threads[i], stream) < 0);
+		}
+	}
+
+	/* damage in the middle is noticed */
+	blob[blob_len / 2] ^= 0x55;
+	blob[blob_len / 2 + 1] ^= 0x55;
+
+	for (stream = 0; stream < 2; ++stream) {
+		for (i = 0; i < lengthof(threads); ++i) {
+			assert(test_read(codec, blob, blob_len, data, len,
+			    threads[i], stream) < 0);
+		}
+	}
+
+	blob[blob_len / 2] ^= 0x55;
+	blob[blob_len / 2 + 1] ^= 0x55;
+}
+
+static void
+test_detect(void)
+{
+	const uint8_t pcap[] = { 0xD4, 0xC3, 0xB2, 0xA1 };
+	const uint8_t zstd[] = { 0x28, 0xB5, 0x2F, 0xFD };
+	const uint8_t gzip[] = { 0x1F, 0x8B, 0x08, 0x00 };
+	const uint8_t lz4[] = { 0x04, 0x22, 0x4D, 0x18 };
+
+	assert(peak_unpack_detect(pcap, sizeof(pcap)) == UNPACK_NONE);
+	assert(peak_unpack_detect(gzip, sizeof(gzip)) == UNPACK_GZIP);
+	assert(peak_unpack_detect(gzip, 3) == UNPACK_NONE);
+	assert(peak_unpack_detect(zstd, sizeof(zstd)) == UNPACK_ZSTD);
+	assert(peak_unpack_detect(lz4, sizeof(lz4)) == UNPACK_LZ4);
+}
+
+static void
+test_gzip_all(const uint8_t *data, uint8_t *blob)
+{
+	size_t len;
+
+	/* one big member can only be streamed */
+	len = test_gzip(blob, data, TEST_SIZE, TEST_SIZE, 0);
+	test_codec(UNPACK_GZIP, blob, len, data, TEST_SIZE);
+
+	/* plain members can't be split either */
+	len = test_gzip(blob, data, TEST_SIZE, TEST_CHUNK, 0);
+	test_codec(UNPACK_GZIP, blob, len, data, TEST_SIZE);
+
+	/* sized members go in parallel */
+	len = test_gzip(blob, data, TEST_SIZE, TEST_CHUNK, 1);
+	test_codec(UNPACK_GZIP, blob, len, data, TEST_SIZE);
+
+	/* sized members followed by a plain one */
+	len = test_gzip(blob, data, TEST_SIZE - 1000, TEST_CHUNK, 1);
+	len += test_gzip(blob + len, data + TEST_SIZE - 1000, 1000,
+	    1000, 0);
+	test_codec(UNPACK_GZIP, blob, len, data, TEST_SIZE);
+
+	/* padding after the last member is ignored */
+	len = test_gzip(blob, data, TEST_SIZE, TEST_CHUNK, 1);
+	memset(blob + len, 0, 512);
+	assert(test_read(UNPACK_GZIP, blob, len + 512, data, TEST_SIZE,
+	    4, 0) == TEST_SIZE);
+}
+
+#ifdef WITH_ZSTD
+static void
+test_zstd_all(const uint8_t *data, uint8_t *blob, const size_t size)
+{
+	size_t i, len = 0, ret;
+	ZSTD_CCtx *cctx;
+
+	cctx = ZSTD_createCCtx();
+	assert(cctx);
+
+	/* damage can only be detected with checksums */
+	ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+
+	for (i = 0; i < TEST_SIZE; i += 8 * TEST_CHUNK) {
+		ret = ZSTD_compress2(cctx, blob + len, size - len, data + i,
+		    MIN(8 * TEST_CHUNK, TEST_SIZE - i));
+		assert(!ZSTD_isError(ret));
+		len += ret;
+	}
+
+	test_codec(UNPACK_ZSTD, blob, len, data, TEST_SIZE);
+
+	/* frames without a size end the parallel part */
+	ZSTD_CCtx_setParameter(cctx, ZSTD_c_contentSizeFlag, 0);
+
+	len -= ret;
+	i -= 8 * TEST_CHUNK;
+
+	ret = ZSTD_compress2(cctx, blob + len, size - len, data + i,
+	    TEST_SIZE - i);
+	assert(!ZSTD_isError(ret));
+	len += ret;
+
+	ZSTD_freeCCtx(cctx);
+
+	test_codec(UNPACK_ZSTD, blob, len, data, TEST_SIZE);
+}
+#endif /* WITH_ZSTD */
+
+#ifdef WITH_LZ4
+static void
+test_lz4_all(const uint8_t *data, uint8_t *blob, const size_t size)
+{
+	LZ4F_preferences_t prefs;
+	size_t i, len = 0, ret;
+
+	memset(&prefs, 0, sizeof(prefs));
+	prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+
+	for (i = 0; i < TEST_SIZE; i += 8 * TEST_CHUNK) {
+		ret = LZ4F_compressFrame(blob + len, size - len, data + i,
+		    MIN(8 * TEST_CHUNK, TEST_SIZE - i), &prefs);
+		assert(!LZ4F_isError(ret));
+		len += ret;
+	}
+
+	test_codec(UNPACK_LZ4, blob, len, data, TEST_SIZE);
+}
+#endif /* WITH_LZ4 */
+
+#define BENCH_SIZE	(256 * 1024 * 1024)
+#define BENCH_CHUNK	(4 * 1024 * 1024)
+
+static void
+bench_unpack(void)
+{
+	unsigned int threads[] = { 1, 2, 4 };
+	struct timespec start, stop;
+	struct peak_unpack *unpack;
+	uint8_t *data, *blob, *buf;
+	size_t i, len;
+	double elapsed;
+	ssize_t ret;
+
+	data = malloc(BENCH_SIZE);
+	blob = malloc(BENCH_SIZE + BENCH_SIZE / 8);
+	buf = malloc(BENCH_CHUNK);
+	assert(data && blob && buf);
+
+	test_data(data, BENCH_SIZE);
+	len = test_gzip(blob, data, BENCH_SIZE, 60 * 1024, 1);
+
+	for (i = 0; i < lengthof(threads); ++i) {
+		unpack = peak_unpack_init(UNPACK_GZIP, -1, blob, len,
+		    threads[i]);
+		assert(unpack);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		do {
+			ret = peak_unpack_read(unpack, buf, BENCH_CHUNK);
+		} while (ret > 0);
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+
+		assert(!ret);
+
+		elapsed = (stop.tv_sec - start.tv_sec) +
+		    (stop.tv_nsec - start.tv_nsec) / 1e9;
+		pout("gzip, %u thread(s): %.0f MB/s\n", threads[i],
+		    BENCH_SIZE / elapsed / 1e6);
+
+		peak_unpack_exit(unpack);
+	}
+
+	free(data);
+	free(blob);
+	free(buf);
+}
+
+int
+main(int argc, char **argv)
+{
+	const size_t size = 2 * TEST_SIZE;
+	uint8_t *data, *blob;
+	int c;
+
+	while ((c = getopt(argc, argv, "b")) != -1) {
+		switch (c) {
+		case 'b':
+			bench_unpack();
+			return (0);
+		default:
+			return (1);
+		}
+	}
+
+	pout("peak unpack test suite... ");
+
+	data = malloc(TEST_SIZE);
+	blob = malloc(size);
+	assert(data && blob);
+
+	test_data(data, TEST_SIZE);
+
+	test_detect();
+	test_gzip_all(data, blob);
+#ifdef WITH_ZSTD
+	test_zstd_all(data, blob, size);
+#endif /* WITH_ZSTD */
+#ifdef WITH_LZ4
+	test_lz4_all(data, blob, size);
+#endif /* WITH_LZ4 */
+
+	free(data);
+	free(blob);
+
+	pout("ok\n");
+
+	return (0);
+}